@@ -10,6 +10,8 @@
 --  Software Foundation; either version 2 of the License, or any later version. --
 ----------------------------------------------------------------------------------
 
+local BANK_ACCOUNT = get_quest_var_id("BankAccount")
+
 function Banker(npc, ch)
     if ch:gender() == GENDER_MALE then
         say("Welcome to the bank, sir!")
@@ -18,14 +20,14 @@ function Banker(npc, ch)
     else
         say("Welcome to the bank... uhm... person of unspecified gender!")
     end
-    local account = tonumber(chr_get_quest(ch, "BankAccount"))
+    local account = tonumber(chr_get_quest(ch, BANK_ACCOUNT))
     local result = -1
 
     if (account == nil) then --Initial account creation, if needed
         say("Hello! Would you like to setup a bank account? There is a sign-on bonus right now!")
         result = ask("Yes", "No")
         if (result == 1) then
-            chr_set_quest(ch, "BankAccount", 5)
+            chr_set_quest(ch, BANK_ACCOUNT, 5)
             say("Your account has been made. Your sign-on bonus is 5GP.")
             account = 5
         end
@@ -36,7 +38,7 @@ function Banker(npc, ch)
         local input = 0
         result = 1
         while (result < 3) do --While they've choosen a valid option that isn't "Never mind"
-            account = tonumber(chr_get_quest(ch, "BankAccount")) --Why do I need to convert this?
+            account = tonumber(chr_get_quest(ch, BANK_ACCOUNT)) --Why do I need to convert this?
             say("Your balance: " .. account .. ".\nYour money: " .. ch:money() .. ".")
             result = ask("Deposit", "Withdraw", "Never mind")
             if (result == 1) then --Deposit
@@ -47,7 +49,7 @@ function Banker(npc, ch)
                     money = ch:money()
                     if (input > 0 and input <= money) then --Make sure something weird doesn't happen and they try to deposit more than they have
                         ch:change_money(-input)
-                        chr_set_quest(ch, "BankAccount", account + input)
+                        chr_set_quest(ch, BANK_ACCOUNT, account + input)
                         say(input .. " GP deposited.")
                     elseif (input > money) then --Chosen more than they have
                         say("You don't have that much money. But you just did....")
@@ -61,7 +63,7 @@ function Banker(npc, ch)
                     input = ask_number(0, account, 1)
                     if (input > 0 and input <= account) then --Make sure something weird doesn't happen and they try to withdraw more than they have
                         ch:change_money(input)
-                        chr_set_quest(ch, "BankAccount", account - input)
+                        chr_set_quest(ch, BANK_ACCOUNT, account - input)
                         say(input .. " GP withdrawn.")
                     elseif (input > account) then --Chosen more than they have
                         say("You don't have that much in your account. But you just did....")
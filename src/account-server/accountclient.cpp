@@ -23,6 +23,12 @@
 AccountClient::AccountClient(ENetPeer *peer):
     NetComputer(peer),
     status(CLIENT_LOGIN),
-    version(0)
+    version(0),
+    mHandle(std::make_shared<AccountClient *>(this))
 {
 }
+
+AccountClient::~AccountClient()
+{
+    *mHandle = nullptr;
+}
@@ -44,16 +44,26 @@ class AccountClient : public NetComputer
 {
     public:
         AccountClient(ENetPeer *peer);
+        ~AccountClient();
 
         void setAccount(Account *acc);
         void unsetAccount();
         Account *getAccount() const;
 
+        /**
+         * Returns a handle that points to this client until it is deleted.
+         * Used by asynchronous operations that complete after the client may
+         * have disconnected.
+         */
+        std::shared_ptr<AccountClient *> getHandle() const
+        { return mHandle; }
+
         AccountClientStatus status;
         int version;
 
     private:
         std::unique_ptr<Account> mAccount;
+        std::shared_ptr<AccountClient *> mHandle;
 };
 
 /**
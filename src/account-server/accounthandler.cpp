@@ -23,6 +23,7 @@
 #include "account-server/account.h"
 #include "account-server/accountclient.h"
 #include "account-server/character.h"
+#include "account-server/characterdirectory.h"
 #include "account-server/storage.h"
 #include "account-server/serverhandler.h"
 #include "chat-server/chathandler.h"
@@ -37,12 +38,18 @@
 #include "utils/logger.h"
 #include "utils/point.h"
 #include "utils/stringfilter.h"
+#include "utils/timer.h"
 #include "utils/tokencollector.h"
 #include "utils/tokendispenser.h"
 #include "utils/sha256.h"
 #include "utils/string.h"
 #include "utils/xml.h"
 
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
 using namespace ManaServ;
 
 class AccountHandler : public ConnectionHandler
@@ -67,6 +74,15 @@ public:
      */
     void deletePendingConnect(int) {}
 
+    /**
+     * Starts checking the passwords of the logins received since the last
+     * call. Once a second, also drops the logins that did not complete in
+     * time and sends the queued clients their new position.
+     */
+    void processLogins();
+
+    void dumpStatistics(std::ostream &os) const;
+
     /**
      * Token collector for connecting a client coming from a game server
      * without having to provide username and password a second time.
@@ -99,10 +115,10 @@ private:
 
     void addServerInfo(MessageOut *msg);
 
-    /** List of all accounts which requested a random seed, but are not logged
-     *  yet. This list will be regularly remove (after timeout) old accounts
-     */
-    std::list<Account*> mPendingAccounts;
+    void startLogin(AccountClient &client, const std::string &username);
+    void checkLogins();
+    void finishLogin(AccountClient &client, int result);
+    void admitQueuedLogins();
 
     /** List of attributes that the client can send at account creation. */
     std::vector<int> mModifiableAttributes;
@@ -130,6 +146,65 @@ private:
 
     typedef std::map<int, time_t> IPsToTime;
     IPsToTime mLastLoginAttemptForIP;
+
+    enum LoginStage
+    {
+        LOGIN_LOOKUP,       /**< The account is being loaded. */
+        LOGIN_SALT_SENT,    /**< Waiting for the client to send its login. */
+        LOGIN_VERIFYING     /**< The password is being checked. */
+    };
+
+    /**
+     * A client that was admitted to the login pipeline. The account is only
+     * set once it was loaded, and stays unset when the name is unknown.
+     */
+    struct PendingLogin
+    {
+        LoginStage stage;
+        unsigned serial;            /**< Identifies the attempt. */
+        std::string username;
+        std::unique_ptr<Account> account;
+        time_t expires;
+    };
+
+    /**
+     * A client waiting for a free slot in the login pipeline.
+     */
+    struct QueuedLogin
+    {
+        AccountClient *client;
+        std::string username;
+        unsigned lastPosition;      /**< The last position sent. */
+    };
+
+    typedef std::list<QueuedLogin> LoginQueue;
+
+    /** The clients in the login pipeline, at most mMaxConcurrentLogins. */
+    std::unordered_map<AccountClient *, PendingLogin> mPendingLogins;
+
+    /**
+     * A login waiting for its password to be checked.
+     */
+    struct LoginCheck
+    {
+        std::shared_ptr<AccountClient *> client;
+        unsigned serial;
+        std::unique_ptr<Account> account;
+        std::string password;
+        int result;
+    };
+
+    /** The logins received since the last checkLogins(). */
+    std::vector<LoginCheck> mLoginChecks;
+
+    /** Clients waiting to enter the login pipeline, in arrival order. */
+    LoginQueue mLoginQueue;
+    std::unordered_map<AccountClient *, LoginQueue::iterator> mQueuedClients;
+
+    unsigned mMaxConcurrentLogins;
+    int mLoginTimeout;
+    unsigned mLoginSerial;
+    utils::Timer mLoginTimer;
 };
 
 static AccountHandler *accountHandler;
@@ -147,8 +222,15 @@ AccountHandler::AccountHandler(const std::string &attributesFile):
     mMaxCharacters(Configuration::getValue("account_maxCharacters", 3)),
     mRegistrationAllowed(Configuration::getBoolValue("account_allowRegister", true)),
     mUpdateHost(Configuration::getValue("net_defaultUpdateHost", std::string())),
-    mDataUrl(Configuration::getValue("net_clientDataUrl", std::string()))
+    mDataUrl(Configuration::getValue("net_clientDataUrl", std::string())),
+    mMaxConcurrentLogins(std::max(1, Configuration::getValue(
+                                      "account_maxConcurrentLogins", 100))),
+    mLoginTimeout(Configuration::getValue("account_loginTimeout", 30)),
+    mLoginSerial(0),
+    mLoginTimer(1000)
 {
+    mLoginTimer.start();
+
     XML::Document doc(attributesFile);
     xmlNodePtr node = doc.rootNode();
 
@@ -224,9 +306,11 @@ AccountHandler::AccountHandler(const std::string &attributesFile):
 }
 
 bool AccountClientHandler::initialize(const std::string &attributesFile, int port,
-                                      const std::string &host)
+                                      const std::string &host,
+                                      HostPoller *poller)
 {
     accountHandler = new AccountHandler(attributesFile);
+    accountHandler->setPoller(poller);
     LOG_INFO("Account handler started:");
 
     return accountHandler->startListen(port, host);
@@ -241,7 +325,16 @@ void AccountClientHandler::deinitialize()
 
 void AccountClientHandler::process()
 {
-    accountHandler->process(50);
+    accountHandler->process();
+    accountHandler->processLogins();
+
+    // Send the replies of processLogins() right away
+    accountHandler->flush();
+}
+
+void AccountClientHandler::dumpStatistics(std::ostream &os)
+{
+    accountHandler->dumpStatistics(os);
 }
 
 void AccountClientHandler::prepareReconnect(const std::string &token, int id)
@@ -262,6 +355,16 @@ void AccountHandler::computerDisconnected(NetComputer *comp)
         // Delete it from the pendingClient list
         mTokenCollector.deletePendingClient(client);
 
+    auto queued = mQueuedClients.find(client);
+    if (queued != mQueuedClients.end())
+    {
+        mLoginQueue.erase(queued->second);
+        mQueuedClients.erase(queued);
+    }
+
+    if (mPendingLogins.erase(client))
+        admitQueuedLogins();
+
     delete client; // ~AccountClient unsets the account
 }
 
@@ -306,6 +409,14 @@ static void sendFullCharacterData(AccountClient *client,
     client->send(msg);
 }
 
+/** Makes the characters of a logged in account known to the directory. */
+static void addToDirectory(const Characters &chars)
+{
+    for (auto &charIt : chars)
+        characterDirectory->add(charIt.second->getDatabaseID(),
+                                charIt.second->getName());
+}
+
 static std::string getRandomString(int length)
 {
     char s[length];
@@ -319,19 +430,129 @@ static std::string getRandomString(int length)
 
 void AccountHandler::handleLoginRandTriggerMessage(AccountClient &client, MessageIn &msg)
 {
-    std::string salt = getRandomString(4);
     std::string username = msg.readString();
 
-    if (Account *acc = storage->getAccount(username))
+    // A client asking again restarts its login, keeping its slot
+    auto queued = mQueuedClients.find(&client);
+    if (queued != mQueuedClients.end())
+    {
+        queued->second->username = username;
+        return;
+    }
+
+    if (mPendingLogins.count(&client) ||
+        mPendingLogins.size() < mMaxConcurrentLogins)
     {
-        acc->setRandomSalt(salt);
-        mPendingAccounts.push_back(acc);
+        startLogin(client, username);
+        return;
     }
-    MessageOut reply(APMSG_LOGIN_RNDTRGR_RESPONSE);
-    reply.writeString(salt);
+
+    // Too many logins are in progress. The client waits for a slot, and is
+    // told its position in the queue in the meantime.
+    QueuedLogin login = { &client, username, (unsigned) mLoginQueue.size() + 1 };
+    mQueuedClients[&client] = mLoginQueue.insert(mLoginQueue.end(), login);
+
+    MessageOut reply(APMSG_LOGIN_QUEUE_POSITION);
+    reply.writeInt32(login.lastPosition);
     client.send(reply);
 }
 
+void AccountHandler::startLogin(AccountClient &client,
+                                const std::string &username)
+{
+    const unsigned serial = ++mLoginSerial;
+
+    PendingLogin &login = mPendingLogins[&client];
+    login.stage = LOGIN_LOOKUP;
+    login.serial = serial;
+    login.username = username;
+    login.account.reset();
+    login.expires = time(nullptr) + mLoginTimeout;
+
+    // The account is looked up on the database thread. The client may have
+    // disconnected or restarted its login by the time the lookup completes.
+    std::shared_ptr<Account *> result = std::make_shared<Account *>(nullptr);
+    std::shared_ptr<AccountClient *> handle = client.getHandle();
+
+    storage->async("getAccount", [result, username] {
+        *result = storage->getAccount(username);
+    }, [this, result, handle, serial] {
+        std::unique_ptr<Account> acc(*result);
+
+        AccountClient *client = *handle;
+        if (!client)
+            return;
+
+        auto it = mPendingLogins.find(client);
+        if (it == mPendingLogins.end() || it->second.serial != serial)
+            return;
+
+        // The salt is sent for unknown names as well, the login will fail
+        const std::string salt = getRandomString(4);
+        if (acc)
+            acc->setRandomSalt(salt);
+
+        it->second.stage = LOGIN_SALT_SENT;
+        it->second.account = std::move(acc);
+
+        MessageOut reply(APMSG_LOGIN_RNDTRGR_RESPONSE);
+        reply.writeString(salt);
+        client->send(reply);
+    }, Storage::AccountKey);
+}
+
+void AccountHandler::admitQueuedLogins()
+{
+    while (!mLoginQueue.empty() &&
+           mPendingLogins.size() < mMaxConcurrentLogins)
+    {
+        QueuedLogin login = mLoginQueue.front();
+        mLoginQueue.pop_front();
+        mQueuedClients.erase(login.client);
+
+        startLogin(*login.client, login.username);
+    }
+}
+
+void AccountHandler::processLogins()
+{
+    if (!mLoginChecks.empty())
+        checkLogins();
+
+    if (!mLoginTimer.poll())
+        return;
+
+    // Drop the logins of clients that never completed them. Logins that are
+    // waiting for the database are left alone.
+    const time_t now = time(nullptr);
+    for (auto it = mPendingLogins.begin(); it != mPendingLogins.end();)
+    {
+        if (it->second.stage == LOGIN_SALT_SENT && it->second.expires < now)
+            it = mPendingLogins.erase(it);
+        else
+            ++it;
+    }
+    admitQueuedLogins();
+
+    unsigned position = 0;
+    for (QueuedLogin &login : mLoginQueue)
+    {
+        if (++position == login.lastPosition)
+            continue;
+
+        login.lastPosition = position;
+        MessageOut msg(APMSG_LOGIN_QUEUE_POSITION);
+        msg.writeInt32(position);
+        login.client->send(msg);
+    }
+}
+
+void AccountHandler::dumpStatistics(std::ostream &os) const
+{
+    os << "<logins pending=\"" << mPendingLogins.size()
+       << "\" queued=\"" << mLoginQueue.size() << "\" />\n";
+}
+
 void AccountHandler::handleLoginMessage(AccountClient &client, MessageIn &msg)
 {
     MessageOut reply(APMSG_LOGIN_RESPONSE);
@@ -388,45 +609,124 @@ void AccountHandler::handleLoginMessage(AccountClient &client, MessageIn &msg)
         return;
     }
 
-    // Check if the account exists
-    Account *acc = nullptr;
-    for (Account *account : mPendingAccounts)
-        if (account->getName() == username)
-            acc = account;
-    mPendingAccounts.remove(acc);
-
-    if (!acc || sha256(acc->getPassword() + acc->getRandomSalt()) != password)
+    // The login has to continue the one started by the random seed request
+    auto pending = mPendingLogins.find(&client);
+    if (pending == mPendingLogins.end() ||
+        pending->second.stage != LOGIN_SALT_SENT ||
+        pending->second.username != username)
     {
         reply.writeInt8(ERRMSG_INVALID_ARGUMENT);
         client.send(reply);
-        delete acc;
         return;
     }
 
-    if (acc->getLevel() == AL_BANNED)
+    // The password check and the last login update are done on the database
+    // thread, the client keeps its slot until they are done.
+    PendingLogin &login = pending->second;
+    login.stage = LOGIN_VERIFYING;
+
+    LoginCheck check;
+    check.client = client.getHandle();
+    check.serial = login.serial;
+    check.account = std::move(login.account);
+    check.password = password;
+    check.result = ERRMSG_FAILURE;
+    mLoginChecks.push_back(std::move(check));
+}
+
+void AccountHandler::checkLogins()
+{
+    // The logins received since the last call are checked together, so that
+    // their passwords are hashed as one batch.
+    std::shared_ptr<std::vector<LoginCheck>> checks =
+            std::make_shared<std::vector<LoginCheck>>();
+    checks->swap(mLoginChecks);
+
+    storage->async("login", [checks] {
+        std::vector<std::string> salted;
+        for (LoginCheck &check : *checks)
+        {
+            if (Account *account = check.account.get())
+                salted.push_back(account->getPassword() +
+                                 account->getRandomSalt());
+        }
+        const std::vector<std::string> hashes = sha256(salted);
+
+        time_t now;
+        time(&now);
+
+        auto hash = hashes.begin();
+        for (LoginCheck &check : *checks)
+        {
+            Account *account = check.account.get();
+            if (!account)
+            {
+                check.result = ERRMSG_INVALID_ARGUMENT;
+                continue;
+            }
+
+            if (*hash++ != check.password)
+                check.result = ERRMSG_INVALID_ARGUMENT;
+            else if (account->getLevel() == AL_BANNED)
+                check.result = LOGIN_BANNED;
+            else
+            {
+                try
+                {
+                    // Set lastLogin date of the account.
+                    account->setLastLogin(now);
+                    storage->updateLastLogin(account);
+                    check.result = ERRMSG_OK;
+                }
+                catch (const std::string &)
+                {
+                    // Already logged, the login fails
+                }
+            }
+        }
+    }, [this, checks] {
+        for (LoginCheck &check : *checks)
+        {
+            AccountClient *client = *check.client;
+            if (!client)
+                continue;
+
+            auto it = mPendingLogins.find(client);
+            if (it == mPendingLogins.end() || it->second.serial != check.serial)
+                continue;
+
+            mPendingLogins.erase(it);
+
+            if (client->status != CLIENT_LOGIN)
+                check.result = ERRMSG_FAILURE;
+            else if (check.result == ERRMSG_OK)
+                client->setAccount(check.account.release());
+
+            finishLogin(*client, check.result);
+        }
+        admitQueuedLogins();
+    }, Storage::AccountKey);
+}
+
+void AccountHandler::finishLogin(AccountClient &client, int result)
+{
+    MessageOut reply(APMSG_LOGIN_RESPONSE);
+
+    if (result != ERRMSG_OK)
     {
-        reply.writeInt8(LOGIN_BANNED);
+        reply.writeInt8(result);
         client.send(reply);
-        delete acc;
         return;
     }
 
     // The client successfully logged in...
-
-    // Set lastLogin date of the account.
-    time_t login;
-    time(&login);
-    acc->setLastLogin(login);
-    storage->updateLastLogin(acc);
-
-    // Associate account with connection.
-    client.setAccount(acc);
     client.status = CLIENT_CONNECTED;
 
     reply.writeInt8(ERRMSG_OK);
     addServerInfo(&reply);
 
-    Characters &chars = acc->getCharacters();
+    Characters &chars = client.getAccount()->getCharacters();
+    addToDirectory(chars);
 
     if (client.version < 10) {
         client.send(reply);
@@ -515,42 +815,75 @@ void AccountHandler::handleRegisterMessage(AccountClient &client,
     {
         reply.writeInt8(ERRMSG_INVALID_ARGUMENT);
     }
-    else if (storage->doesUserNameExist(username))
-    {
-        reply.writeInt8(REGISTER_EXISTS_USERNAME);
-    }
-    else if (storage->doesEmailAddressExist(sha256(email)))
-    {
-        reply.writeInt8(REGISTER_EXISTS_EMAIL);
-    }
     else if (!checkCaptcha(client, captcha))
     {
         reply.writeInt8(REGISTER_CAPTCHA_WRONG);
     }
     else
     {
-        Account *acc = new Account;
-        acc->setName(username);
-        acc->setPassword(sha256(password));
-        // We hash email server-side for additional privacy
-        // we ask for it again when we need it and verify it
-        // through comparing it with the hash.
-        acc->setEmail(sha256(email));
-        acc->setLevel(AL_PLAYER);
-
-        // Set the date and time of the account registration, and the last login
-        time_t regdate;
-        time(&regdate);
-        acc->setRegistrationDate(regdate);
-        acc->setLastLogin(regdate);
-
-        storage->addAccount(acc);
-        reply.writeInt8(ERRMSG_OK);
-        addServerInfo(&reply);
+        // The checks for existing accounts, the hashing and the insert are
+        // done on the database thread. Since it handles one registration at
+        // a time, two clients can not register the same name.
+        std::shared_ptr<std::unique_ptr<Account>> acc =
+                std::make_shared<std::unique_ptr<Account>>();
+        std::shared_ptr<int> result = std::make_shared<int>(ERRMSG_FAILURE);
+        std::shared_ptr<AccountClient *> handle = client.getHandle();
+
+        storage->async("register", [=] {
+            if (storage->doesUserNameExist(username))
+            {
+                *result = REGISTER_EXISTS_USERNAME;
+                return;
+            }
+
+            // We hash email server-side for additional privacy
+            // we ask for it again when we need it and verify it
+            // through comparing it with the hash.
+            const std::string emailHash = sha256(email);
+            if (storage->doesEmailAddressExist(emailHash))
+            {
+                *result = REGISTER_EXISTS_EMAIL;
+                return;
+            }
 
-        // Associate account with connection
-        client.setAccount(acc);
-        client.status = CLIENT_CONNECTED;
+            Account *account = new Account;
+            acc->reset(account);
+            account->setName(username);
+            account->setPassword(sha256(password));
+            account->setEmail(emailHash);
+            account->setLevel(AL_PLAYER);
+
+            // Set the date and time of the account registration, and the
+            // last login
+            time_t regdate;
+            time(&regdate);
+            account->setRegistrationDate(regdate);
+            account->setLastLogin(regdate);
+
+            storage->addAccount(account);
+            *result = ERRMSG_OK;
+        }, [this, acc, result, handle] {
+            AccountClient *client = *handle;
+            if (!client)
+                return;
+
+            MessageOut reply(APMSG_REGISTER_RESPONSE);
+
+            if (*result == ERRMSG_OK && client->status != CLIENT_LOGIN)
+                *result = ERRMSG_FAILURE;
+
+            reply.writeInt8(*result);
+            if (*result == ERRMSG_OK)
+            {
+                addServerInfo(&reply);
+
+                // Associate account with connection
+                client->setAccount(acc->release());
+                client->status = CLIENT_CONNECTED;
+            }
+            client->send(reply);
+        }, Storage::AccountKey);
+        return;
     }
 
     client.send(reply);
@@ -823,6 +1156,7 @@ void AccountHandler::handleCharacterCreateMessage(AccountClient &client,
                      << acc->getName() << "'s account.");
 
             storage->flush(acc); // flush changes
+            characterDirectory->add(newCharacter->getDatabaseID(), name);
 
             // log transaction
             Transaction trans;
@@ -903,7 +1237,8 @@ void AccountHandler::handleCharacterSelectMessage(AccountClient &client,
                                              alternativePort));
 
     GameServerHandler::registerClient(magic_token, selectedChar);
-    registerChatClient(magic_token, selectedChar->getName(), acc->getLevel());
+    registerChatClient(magic_token, selectedChar->getDatabaseID(),
+                       selectedChar->getName(), acc->getLevel());
 
     client.send(reply);
 
@@ -949,6 +1284,10 @@ void AccountHandler::handleCharacterDeleteMessage(AccountClient &client,
     trans.mMessage.append(acc->getName());
     storage->addTransaction(trans);
 
+    // Deleted by its id first, which waits for the saves queued for it
+    const int charId = chars[slot]->getDatabaseID();
+    characterDirectory->remove(charId);
+    storage->delCharacter(charId);
     acc->delCharacter(slot);
     storage->flush(acc);
 
@@ -985,6 +1324,7 @@ void AccountHandler::tokenMatched(AccountClient *client, int accountID)
 
     // Return information about available characters
     Characters &chars = acc->getCharacters();
+    addToDirectory(chars);
 
     // Send characters list
     sendFullCharacterData(client, chars);
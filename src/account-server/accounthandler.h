@@ -21,15 +21,19 @@
 #ifndef ACCOUNTHANDLER_H
 #define ACCOUNTHANDLER_H
 
+#include <iosfwd>
 #include <string>
 
+class HostPoller;
+
 namespace AccountClientHandler
 {
     /**
      * Creates a connection handler and starts listening on given port.
+     * The packets of the clients are waited for by \a poller.
      */
     bool initialize(const std::string &configFile, int port,
-                    const std::string &host);
+                    const std::string &host, HostPoller *poller);
 
     /**
      * Stops listening to messages and destroys the connection handler.
@@ -42,9 +46,15 @@ namespace AccountClientHandler
     void prepareReconnect(const std::string &token, int accountID);
 
     /**
-     * Processes messages received by the connection handler.
+     * Processes messages received by the connection handler, and advances
+     * the queue of clients waiting to log in.
      */
     void process();
+
+    /**
+     * Dumps the number of logins in progress and waiting into given stream.
+     */
+    void dumpStatistics(std::ostream &);
 }
 
 #endif // ACCOUNTHANDLER_H
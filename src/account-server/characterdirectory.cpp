@@ -0,0 +1,108 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "account-server/characterdirectory.h"
+
+#include "account-server/storage.h"
+
+void CharacterDirectory::add(int charId, const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    insert(charId, name);
+}
+
+void CharacterDirectory::insert(int charId, const std::string &name)
+{
+    auto result = mById.insert(std::make_pair(charId, Entry()));
+    Entry &entry = result.first->second;
+    if (!result.second && entry.name == name)
+        return;
+
+    if (!result.second)
+        mByName.erase(entry.name);
+    else
+        entry.mapId = 0;
+
+    entry.name = name;
+    mByName[name] = charId;
+}
+
+void CharacterDirectory::setMapId(int charId, int mapId)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mById.find(charId);
+    if (it != mById.end())
+        it->second.mapId = mapId;
+}
+
+void CharacterDirectory::remove(int charId)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mById.find(charId);
+    if (it == mById.end())
+        return;
+
+    mByName.erase(it->second.name);
+    mById.erase(it);
+}
+
+int CharacterDirectory::getId(const std::string &name)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mByName.find(name);
+        if (it != mByName.end())
+            return it->second;
+    }
+
+    const int charId = storage->getCharacterId(name);
+    if (charId)
+        add(charId, name);
+    return charId;
+}
+
+std::string CharacterDirectory::getName(int charId)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mById.find(charId);
+        if (it != mById.end())
+            return it->second.name;
+    }
+
+    const std::string name = storage->getCharacterName(charId);
+    if (!name.empty())
+        add(charId, name);
+    return name;
+}
+
+int CharacterDirectory::getMapId(int charId) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mById.find(charId);
+    return it != mById.end() ? it->second.mapId : 0;
+}
+
+size_t CharacterDirectory::getCount() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mById.size();
+}
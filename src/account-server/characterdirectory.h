@@ -0,0 +1,98 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CHARACTERDIRECTORY_H
+#define CHARACTERDIRECTORY_H
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * Knows the names of the characters by id and the other way around, so that
+ * the chat, party and guild code does not need to load whole characters from
+ * the database to translate between the two.
+ *
+ * Characters are added when their account logs in, when they enter a game
+ * server and when they are created. Names of characters that are not known
+ * yet are looked up in the database once. Since names and ids do not change,
+ * characters are only removed when they are deleted.
+ *
+ * All methods are thread safe.
+ */
+class CharacterDirectory
+{
+    public:
+        /**
+         * Remembers the name of a character.
+         */
+        void add(int charId, const std::string &name);
+
+        /**
+         * Remembers the map a character is entering.
+         */
+        void setMapId(int charId, int mapId);
+
+        /**
+         * Forgets a deleted character.
+         */
+        void remove(int charId);
+
+        /**
+         * Returns the id of the character with the given name, or 0 when
+         * there is no such character.
+         */
+        int getId(const std::string &name);
+
+        /**
+         * Returns the name of a character, or an empty string when there is
+         * no such character.
+         */
+        std::string getName(int charId);
+
+        /**
+         * Returns the map a character last entered while the account server
+         * was running, or 0 when it is not known.
+         */
+        int getMapId(int charId) const;
+
+        /**
+         * Returns the number of characters known.
+         */
+        size_t getCount() const;
+
+    private:
+        struct Entry
+        {
+            std::string name;
+            int mapId;
+        };
+
+        void insert(int charId, const std::string &name);
+
+        mutable std::mutex mMutex;
+        std::unordered_map<int, Entry> mById;
+        std::unordered_map<std::string, int> mByName;
+};
+
+extern CharacterDirectory *characterDirectory;
+
+#endif // CHARACTERDIRECTORY_H
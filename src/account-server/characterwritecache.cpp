@@ -0,0 +1,475 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "account-server/characterwritecache.h"
+
+#include "account-server/character.h"
+#include "utils/logger.h"
+
+#include <cstdio>
+#include <limits>
+#include <sstream>
+
+/*
+ * The journal is a text file with one change per line:
+ *
+ *     P <char id> <character points> <correction points>
+ *     A <char id> <attribute id> <base> <modified>
+ *     Q <char id> <quest variable name> <value>
+ *     D <char id>
+ *     R <char id>
+ *
+ * Doubles are written with enough digits to be read back exactly. Quest
+ * variable names and values are escaped so that they are single words.
+ */
+
+static const char *WRITING_SUFFIX = ".writing";
+
+/** Escapes \a text so that it reads back as a single word. */
+static std::string escape(const std::string &text)
+{
+    if (text.empty())
+        return "\\e";
+
+    std::string result;
+    result.reserve(text.size());
+    for (char c : text)
+    {
+        switch (c)
+        {
+            case '\\': result += "\\\\"; break;
+            case ' ':  result += "\\s"; break;
+            case '\t': result += "\\t"; break;
+            case '\n': result += "\\n"; break;
+            case '\r': result += "\\r"; break;
+            default:   result += c; break;
+        }
+    }
+    return result;
+}
+
+static std::string unescape(const std::string &word)
+{
+    std::string result;
+    result.reserve(word.size());
+    for (size_t i = 0; i < word.size(); ++i)
+    {
+        if (word[i] != '\\' || i + 1 == word.size())
+        {
+            result += word[i];
+            continue;
+        }
+
+        switch (word[++i])
+        {
+            case 's': result += ' '; break;
+            case 't': result += '\t'; break;
+            case 'n': result += '\n'; break;
+            case 'r': result += '\r'; break;
+            case 'e': break;
+            default:  result += word[i]; break;
+        }
+    }
+    return result;
+}
+
+/** Writes the pending changes of \a batch in journal format. */
+static void writeBatch(std::ostream &os, const CharacterWriteCache::Batch &batch)
+{
+    for (auto &it : batch.points)
+    {
+        os << "P " << it.first << ' ' << it.second.charPoints
+           << ' ' << it.second.corrPoints << '\n';
+    }
+    for (auto &it : batch.attributes)
+    {
+        os << "A " << it.first.first << ' ' << it.first.second
+           << ' ' << it.second.base << ' ' << it.second.mod << '\n';
+    }
+    for (auto &it : batch.questVars)
+    {
+        os << "Q " << it.first.first << ' ' << escape(it.first.second)
+           << ' ' << escape(it.second) << '\n';
+    }
+}
+
+/** Removes the points and attribute changes of a character from \a batch. */
+static void eraseCharacter(CharacterWriteCache::Batch &batch, int charId)
+{
+    batch.points.erase(charId);
+    batch.attributes.erase(
+            batch.attributes.lower_bound(std::make_pair(charId, 0u)),
+            batch.attributes.lower_bound(std::make_pair(charId + 1, 0u)));
+}
+
+/** Removes the quest variable changes of a character from \a batch. */
+static void eraseQuestVars(CharacterWriteCache::Batch &batch, int charId)
+{
+    batch.questVars.erase(
+            batch.questVars.lower_bound(
+                    std::make_pair(charId, std::string())),
+            batch.questVars.lower_bound(
+                    std::make_pair(charId + 1, std::string())));
+}
+
+/** Applies the points and attribute changes in \a batch to \a character. */
+static void applyBatch(const CharacterWriteCache::Batch &batch,
+                       CharacterData *character)
+{
+    const int charId = character->getDatabaseID();
+
+    auto pointsIt = batch.points.find(charId);
+    if (pointsIt != batch.points.end())
+    {
+        character->setAttributePoints(pointsIt->second.charPoints);
+        character->setCorrectionPoints(pointsIt->second.corrPoints);
+    }
+
+    for (auto it = batch.attributes.lower_bound(std::make_pair(charId, 0u)),
+         it_end = batch.attributes.lower_bound(
+                std::make_pair(charId + 1, 0u)); it != it_end; ++it)
+    {
+        character->setAttribute(it->first.second, it->second.base);
+        character->setModAttribute(it->first.second, it->second.mod);
+    }
+}
+
+CharacterWriteCache::CharacterWriteCache():
+    mWriting(false),
+    mCoalesced(0)
+{
+}
+
+void CharacterWriteCache::open(const std::string &journalFile)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    mJournalFile = journalFile;
+    if (mJournalFile.empty())
+        return;
+
+    const std::string writingFile = mJournalFile + WRITING_SUFFIX;
+
+    // The rotated journal holds older changes than the current one
+    replay(writingFile);
+    replay(mJournalFile);
+
+    if (!mPending.empty())
+    {
+        LOG_INFO("Recovered " << mPending.size()
+                 << " unwritten character changes from " << mJournalFile);
+
+        // Consolidate the recovered changes into a single journal
+        const std::string tmpFile = mJournalFile + ".tmp";
+        {
+            std::ofstream file(tmpFile.c_str(), std::ios::trunc);
+            file.precision(std::numeric_limits<double>::digits10 + 2);
+            writeBatch(file, mPending);
+            file.flush();
+            if (!file)
+            {
+                // Leave the old journals around, nothing is lost
+                LOG_ERROR("Could not write the character journal "
+                          << tmpFile);
+            }
+        }
+        std::rename(tmpFile.c_str(), mJournalFile.c_str());
+    }
+    std::remove(writingFile.c_str());
+
+    openJournal();
+}
+
+void CharacterWriteCache::replay(const std::string &fileName)
+{
+    std::ifstream file(fileName.c_str());
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream is(line);
+        char type;
+        int charId;
+        if (!(is >> type >> charId))
+            continue;
+
+        switch (type)
+        {
+            case 'P':
+            {
+                Points &points = mPending.points[charId];
+                is >> points.charPoints >> points.corrPoints;
+            } break;
+
+            case 'A':
+            {
+                unsigned attrId;
+                Attribute attribute;
+                if (is >> attrId >> attribute.base >> attribute.mod)
+                    mPending.attributes[std::make_pair(charId, attrId)] =
+                            attribute;
+            } break;
+
+            case 'Q':
+            {
+                std::string name, value;
+                if (is >> name >> value)
+                    mPending.questVars[std::make_pair(charId, unescape(name))] =
+                            unescape(value);
+            } break;
+
+            case 'D':
+                eraseCharacter(mPending, charId);
+                break;
+
+            case 'R':
+                eraseQuestVars(mPending, charId);
+                break;
+        }
+    }
+}
+
+void CharacterWriteCache::openJournal()
+{
+    mJournal.close();
+    mJournal.clear();
+    mJournal.open(mJournalFile.c_str(), std::ios::app);
+    mJournal.precision(std::numeric_limits<double>::digits10 + 2);
+    if (!mJournal)
+    {
+        LOG_ERROR("Could not open the character journal " << mJournalFile
+                  << ", unwritten character changes may get lost.");
+    }
+}
+
+void CharacterWriteCache::setPoints(int charId, int charPoints, int corrPoints)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    auto result = mPending.points.insert(
+                std::make_pair(charId, Points()));
+    if (!result.second)
+        ++mCoalesced;
+    result.first->second.charPoints = charPoints;
+    result.first->second.corrPoints = corrPoints;
+
+    if (mJournal.is_open())
+    {
+        // Flushed right away, so that the change survives a crash
+        mJournal << "P " << charId << ' ' << charPoints
+                 << ' ' << corrPoints << std::endl;
+    }
+}
+
+void CharacterWriteCache::setAttribute(int charId, unsigned attrId,
+                                       double base, double mod)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    auto result = mPending.attributes.insert(
+                std::make_pair(std::make_pair(charId, attrId), Attribute()));
+    if (!result.second)
+        ++mCoalesced;
+    result.first->second.base = base;
+    result.first->second.mod = mod;
+
+    if (mJournal.is_open())
+    {
+        mJournal << "A " << charId << ' ' << attrId
+                 << ' ' << base << ' ' << mod << std::endl;
+    }
+}
+
+void CharacterWriteCache::setQuestVar(int charId, const std::string &name,
+                                      const std::string &value)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    auto result = mPending.questVars.insert(
+                std::make_pair(std::make_pair(charId, name), value));
+    if (!result.second)
+    {
+        ++mCoalesced;
+        result.first->second = value;
+    }
+
+    if (mJournal.is_open())
+    {
+        mJournal << "Q " << charId << ' ' << escape(name)
+                 << ' ' << escape(value) << std::endl;
+    }
+}
+
+bool CharacterWriteCache::getQuestVar(int charId, const std::string &name,
+                                      std::string &value) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    const auto key = std::make_pair(charId, name);
+
+    auto it = mPending.questVars.find(key);
+    if (it != mPending.questVars.end())
+    {
+        value = it->second;
+        return true;
+    }
+
+    // The batch being written may or may not be in the database yet
+    it = mWritingBatch.questVars.find(key);
+    if (it != mWritingBatch.questVars.end())
+    {
+        value = it->second;
+        return true;
+    }
+    return false;
+}
+
+void CharacterWriteCache::discard(int charId)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    eraseCharacter(mPending, charId);
+    eraseCharacter(mWritingBatch, charId);
+
+    if (mWriting)
+        mDiscarded.insert(charId);
+
+    if (mJournal.is_open())
+        mJournal << "D " << charId << std::endl;
+}
+
+void CharacterWriteCache::discardQuestVars(int charId)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    eraseQuestVars(mPending, charId);
+    eraseQuestVars(mWritingBatch, charId);
+
+    if (mWriting)
+        mDiscardedQuestVars.insert(charId);
+
+    if (mJournal.is_open())
+        mJournal << "R " << charId << std::endl;
+}
+
+void CharacterWriteCache::apply(CharacterData *character) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    // The batch being written may or may not be in the database yet
+    applyBatch(mWritingBatch, character);
+    applyBatch(mPending, character);
+}
+
+bool CharacterWriteCache::takeBatch(Batch &batch)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    if (mWriting || mPending.empty())
+        return false;
+
+    batch = Batch();
+    std::swap(batch, mPending);
+    mWritingBatch = batch;
+    mWriting = true;
+
+    if (mJournal.is_open())
+    {
+        mJournal.close();
+        const std::string writingFile = mJournalFile + WRITING_SUFFIX;
+        if (std::rename(mJournalFile.c_str(), writingFile.c_str()) != 0)
+        {
+            LOG_ERROR("Could not rotate the character journal "
+                      << mJournalFile);
+        }
+        openJournal();
+    }
+
+    return true;
+}
+
+void CharacterWriteCache::batchWritten()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    mWriting = false;
+    mWritingBatch = Batch();
+    mDiscarded.clear();
+    mDiscardedQuestVars.clear();
+    if (!mJournalFile.empty())
+        std::remove((mJournalFile + WRITING_SUFFIX).c_str());
+}
+
+void CharacterWriteCache::batchFailed(const Batch &batch)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    Batch requeued;
+    for (auto &it : batch.points)
+    {
+        if (!mDiscarded.count(it.first) &&
+            mPending.points.insert(it).second)
+            requeued.points.insert(it);
+    }
+    for (auto &it : batch.attributes)
+    {
+        if (!mDiscarded.count(it.first.first) &&
+            mPending.attributes.insert(it).second)
+            requeued.attributes.insert(it);
+    }
+    for (auto &it : batch.questVars)
+    {
+        if (!mDiscardedQuestVars.count(it.first.first) &&
+            mPending.questVars.insert(it).second)
+            requeued.questVars.insert(it);
+    }
+
+    // Move the changes to the current journal, so that the rotated one
+    // can be replaced by the next batch.
+    if (mJournal.is_open())
+    {
+        writeBatch(mJournal, requeued);
+        mJournal.flush();
+    }
+
+    mWriting = false;
+    mWritingBatch = Batch();
+    mDiscarded.clear();
+    mDiscardedQuestVars.clear();
+    if (!mJournalFile.empty())
+        std::remove((mJournalFile + WRITING_SUFFIX).c_str());
+}
+
+bool CharacterWriteCache::isWriting() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mWriting;
+}
+
+size_t CharacterWriteCache::getPendingCount() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mPending.size();
+}
+
+unsigned CharacterWriteCache::getCoalescedCount() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mCoalesced;
+}
@@ -0,0 +1,189 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CHARACTERWRITECACHE_H
+#define CHARACTERWRITECACHE_H
+
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+
+class CharacterData;
+
+/**
+ * Collects the character points, attribute and quest variable changes
+ * reported by the game servers, so that they can be written to the database
+ * in batches.
+ *
+ * Repeated changes to the same value only keep the latest one. Every change
+ * is also appended to a journal file, which is replayed when the server
+ * starts again. The journal is rotated when a batch is taken, and the
+ * rotated part is removed once the batch has been written. This way no
+ * change is lost when the server stops before a batch could be written.
+ *
+ * All methods are thread safe.
+ */
+class CharacterWriteCache
+{
+    public:
+        struct Points
+        {
+            int charPoints;
+            int corrPoints;
+        };
+
+        struct Attribute
+        {
+            double base;
+            double mod;
+        };
+
+        /** Attribute changes, by character id and attribute id. */
+        typedef std::map<std::pair<int, unsigned>, Attribute> Attributes;
+
+        /**
+         * Quest variable values, by character id and variable name. An empty
+         * value removes the variable.
+         */
+        typedef std::map<std::pair<int, std::string>, std::string> QuestVars;
+
+        /**
+         * A set of changes to be written to the database together.
+         */
+        struct Batch
+        {
+            std::map<int, Points> points;       /**< By character id. */
+            Attributes attributes;
+            QuestVars questVars;
+
+            bool empty() const
+            {
+                return points.empty() && attributes.empty() &&
+                        questVars.empty();
+            }
+
+            size_t size() const
+            { return points.size() + attributes.size() + questVars.size(); }
+        };
+
+        CharacterWriteCache();
+
+        /**
+         * Replays the journal left by a previous run into the pending
+         * changes and starts a new journal.
+         *
+         * @param journalFile the journal file, or an empty string to keep
+         *                    the changes in memory only.
+         */
+        void open(const std::string &journalFile);
+
+        void setPoints(int charId, int charPoints, int corrPoints);
+
+        void setAttribute(int charId, unsigned attrId, double base, double mod);
+
+        void setQuestVar(int charId, const std::string &name,
+                         const std::string &value);
+
+        /**
+         * Gets the pending value of a quest variable, including the changes
+         * of the batch being written.
+         * @return false if there is no pending change to the variable.
+         */
+        bool getQuestVar(int charId, const std::string &name,
+                         std::string &value) const;
+
+        /**
+         * Drops the pending changes of a character. Used when the complete
+         * character is written or when it gets deleted. The quest variables
+         * are not part of the character, so they are kept.
+         */
+        void discard(int charId);
+
+        /**
+         * Drops the pending quest variable changes of a character. Used when
+         * it gets deleted.
+         */
+        void discardQuestVars(int charId);
+
+        /**
+         * Applies the pending changes to a character that was just loaded
+         * from the database, including the changes of the batch being
+         * written. This way the character does not need to wait for the
+         * batch.
+         */
+        void apply(CharacterData *character) const;
+
+        /**
+         * Moves the pending changes into \a batch and rotates the journal.
+         * Fails when the previous batch has not been written yet.
+         */
+        bool takeBatch(Batch &batch);
+
+        /**
+         * Called once the batch obtained from takeBatch() has been written to
+         * the database. Removes the rotated journal.
+         */
+        void batchWritten();
+
+        /**
+         * Called when writing the batch obtained from takeBatch() failed.
+         * Its changes are queued again, unless they were replaced or
+         * discarded in the meantime.
+         */
+        void batchFailed(const Batch &batch);
+
+        /**
+         * Returns whether a batch has been taken but not written yet.
+         */
+        bool isWriting() const;
+
+        /**
+         * Returns the number of changes waiting to be written.
+         */
+        size_t getPendingCount() const;
+
+        /**
+         * Returns the number of changes that replaced a pending change to the
+         * same value.
+         */
+        unsigned getCoalescedCount() const;
+
+    private:
+        void replay(const std::string &fileName);
+        void openJournal();
+
+        mutable std::mutex mMutex;
+        Batch mPending;
+        Batch mWritingBatch;    /**< Copy of the batch being written. */
+        bool mWriting;
+        unsigned mCoalesced;
+
+        /** Characters discarded while a batch was being written. */
+        std::set<int> mDiscarded;
+        std::set<int> mDiscardedQuestVars;
+
+        std::string mJournalFile;
+        std::ofstream mJournal;
+};
+
+#endif // CHARACTERWRITECACHE_H
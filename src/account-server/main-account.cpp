@@ -28,6 +28,8 @@
 #endif
 
 #include "account-server/accounthandler.h"
+#include "account-server/characterdirectory.h"
+#include "account-server/onlineregistry.h"
 #include "account-server/serverhandler.h"
 #include "account-server/storage.h"
 #include "chat-server/chatchannelmanager.h"
@@ -40,13 +42,16 @@
 #include "common/resourcemanager.h"
 #include "net/bandwidth.h"
 #include "net/connectionhandler.h"
+#include "net/hostpoller.h"
 #include "net/messageout.h"
 #include "utils/logger.h"
 #include "utils/processorutils.h"
+#include "utils/sha256.h"
 #include "utils/stringfilter.h"
 #include "utils/time.h"
 #include "utils/timer.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <getopt.h>
 #include <signal.h>
@@ -71,6 +76,12 @@ static std::string statisticsFile = std::string();
 /** Database handler. */
 Storage *storage;
 
+/** The characters online on the game servers. */
+OnlineRegistry *onlineRegistry;
+
+/** The names of the characters, by id. */
+CharacterDirectory *characterDirectory;
+
 /** Communications (chat) message handler */
 ChatHandler *chatHandler;
 
@@ -79,6 +90,9 @@ GuildManager *guildManager;
 PostManager *postalManager;
 BandwidthMonitor *gBandwidth;
 
+/** Waits for the packets of all the network handlers of the main loop. */
+static HostPoller *hostPoller;
+
 /** Callback used when SIGQUIT signal is received. */
 static void closeGracefully(int)
 {
@@ -127,6 +141,8 @@ static void initialize()
 
     // --- Initialize the managers
     stringFilter = new utils::StringFilter;  // The slang's and double quotes filter.
+    onlineRegistry = new OnlineRegistry;
+    characterDirectory = new CharacterDirectory;
     chatChannelManager = new ChatChannelManager;
     guildManager = new GuildManager;
     postalManager = new PostManager;
@@ -144,8 +160,14 @@ static void initialize()
         exit(EXIT_NET_EXCEPTION);
     }
 
+    // The main loop also wakes up for finished database work
+    hostPoller = new HostPoller;
+    storage->setCompletionNotifier([] { hostPoller->wakeUp(); });
+
     // Initialize the processor utility functions
     utils::processor::init();
+    LOG_INFO("Using the " << sha256Implementation()
+             << " SHA-256 implementation.");
 
     // Seed the random number generator
     std::srand( time(nullptr) );
@@ -171,6 +193,8 @@ static void deinitializeServer()
 
     // Destroy Managers
     delete stringFilter;
+    delete onlineRegistry;
+    delete characterDirectory;
     delete chatChannelManager;
     delete guildManager;
     delete postalManager;
@@ -179,6 +203,8 @@ static void deinitializeServer()
     // Get rid of persistent data storage
     delete storage;
 
+    delete hostPoller;
+
     PHYSFS_deinit();
 }
 
@@ -198,7 +224,16 @@ static void dumpStatistics(std::string accountAddress, int accountClientPort,
     << accountClientPort << "\" gameport=\"" << accountGamePort
     << "\" chatclientport=\"" << chatClientPort << "\" />\n";
     // Add game servers information
+    AccountClientHandler::dumpStatistics(os);
     GameServerHandler::dumpStatistics(os);
+    // Add database latencies
+    storage->dumpStatistics(os);
+    os << "<online characters=\"" << onlineRegistry->getCharacters().size()
+       << "\" pending=\"" << onlineRegistry->getPendingCount()
+       << "\" coalesced=\"" << onlineRegistry->getCoalescedCount()
+       << "\" />\n";
+    os << "<characters known=\"" << characterDirectory->getCount()
+       << "\" />\n";
     os << "</statistics>\n";
 }
 
@@ -353,8 +388,10 @@ int main(int argc, char *argv[])
     MessageOut::setDebugModeEnabled(debugNetwork);
 
     if (!AccountClientHandler::initialize(DEFAULT_ATTRIBUTEDB_FILE,
-                                          options.port, accountHost) ||
-        !GameServerHandler::initialize(accountGamePort, accountHost) ||
+                                          options.port, accountHost,
+                                          hostPoller) ||
+        !GameServerHandler::initialize(accountGamePort, accountHost,
+                                       hostPoller) ||
         !chatHandler->startListen(chatClientPort, chatHost))
     {
         LOG_FATAL("Unable to create an ENet server host.");
@@ -363,11 +400,47 @@ int main(int argc, char *argv[])
 
     // Dump statistics every 10 seconds.
     utils::Timer statTimer(10000);
-    // Check for expired bans every 30 seconds
-    utils::Timer banTimer(30000);
+    // Lift the bans known to expire every second, and look for other
+    // expired bans in the database every 10 minutes
+    utils::Timer banTimer(1000);
+    utils::Timer banSweepTimer(600000);
+
+    // Write the queued character changes every 10 seconds by default
+    utils::Timer characterFlushTimer(
+            std::max(1, Configuration::getValue("sql_characterFlushInterval",
+                                                10)) * 1000);
+
+    // Write the online status changes every 5 seconds by default
+    utils::Timer onlineStatusTimer(
+            std::max(1, Configuration::getValue("sql_onlineStatusInterval",
+                                                5)) * 1000);
+
+    // Move the SQLite write-ahead log into the database every 30 seconds by
+    // default, instead of doing it as part of a commit
+    const int checkpointInterval =
+            Configuration::getValue("sqlite_checkpointInterval", 30);
+    utils::Timer checkpointTimer(std::max(1, checkpointInterval) * 1000);
+
+    // Look for changes to the slangs file every 5 seconds
+    utils::Timer slangsTimer(5000);
+
+    // Hand the online characters over to the chat server every second, it
+    // tells the who list subscribers about them
+    utils::Timer whoTimer(1000);
+
+    // Delete the expired letters every 10 minutes
+    utils::Timer postExpiryTimer(600000);
 
     statTimer.start();
     banTimer.start();
+    banSweepTimer.start();
+    characterFlushTimer.start();
+    onlineStatusTimer.start();
+    if (checkpointInterval > 0)
+        checkpointTimer.start();
+    slangsTimer.start();
+    whoTimer.start();
+    postExpiryTimer.start();
 
     // Write startup time to database as system world state variable
     std::stringstream timestamp;
@@ -375,11 +448,27 @@ int main(int argc, char *argv[])
     storage->setWorldStateVar("accountserver_startup", timestamp.str(),
                               Storage::SystemMap);
 
+    // A busy chat should not delay the logins and the game servers
+    const bool chatThread = Configuration::getBoolValue("chat_dedicatedThread",
+                                                        true);
+    if (chatThread)
+        chatHandler->startThread();
+    else
+        chatHandler->setPoller(hostPoller);
+
     while (running)
     {
+        // Only the handlers that have packets waiting do any work, the
+        // others just send their queued messages
+        hostPoller->wait(-1);
+
+        // Before the handlers, so that the replies go out with them
+        storage->processCompletions();
+
         AccountClientHandler::process();
         GameServerHandler::process();
-        chatHandler->process(50);
+        if (!chatThread)
+            chatHandler->process();
 
         if (statTimer.poll())
             dumpStatistics(accountHost, options.port, accountGamePort,
@@ -387,9 +476,35 @@ int main(int argc, char *argv[])
 
         if (banTimer.poll())
             storage->checkBannedAccounts();
+
+        if (banSweepTimer.poll())
+            storage->sweepBannedAccounts();
+
+        if (characterFlushTimer.poll())
+            storage->flushCharacterChanges();
+
+        if (onlineStatusTimer.poll())
+            onlineRegistry->flush();
+
+        if (checkpointTimer.poll())
+            storage->checkpoint();
+
+        if (slangsTimer.poll())
+            stringFilter->checkForChanges();
+
+        if (whoTimer.poll())
+        {
+            std::map<std::string, bool> changes;
+            onlineRegistry->takeNameChanges(changes);
+            forwardOnlineNameChanges(changes);
+        }
+
+        if (postExpiryTimer.poll())
+            postalManager->removeExpiredLetters();
     }
 
     LOG_INFO("Received: Quit signal, closing down...");
+    chatHandler->stopThread();
     chatHandler->stopListen();
     deinitializeServer();
 
@@ -0,0 +1,182 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "account-server/onlineregistry.h"
+
+#include "account-server/storage.h"
+
+#include <memory>
+
+/** Seconds to keep the name of a character that does not show up. */
+static const time_t NAME_EXPIRY = 60;
+
+OnlineRegistry::OnlineRegistry():
+    mWriting(false),
+    mCoalesced(0)
+{
+}
+
+void OnlineRegistry::setName(int charId, const std::string &name)
+{
+    auto it = mOnline.find(charId);
+    if (it != mOnline.end())
+    {
+        if (it->second.name != name)
+        {
+            setNameChanged(it->second.name, false);
+            setNameChanged(name, true);
+        }
+        it->second.name = name;
+    }
+    else
+        mNames[charId] = std::make_pair(name, time(nullptr));
+}
+
+void OnlineRegistry::setOnline(int charId)
+{
+    if (isOnline(charId))
+        return;
+
+    Character &character = mOnline[charId];
+    character.loginTime = time(nullptr);
+
+    auto name = mNames.find(charId);
+    if (name != mNames.end())
+    {
+        character.name = name->second.first;
+        mNames.erase(name);
+    }
+
+    setNameChanged(character.name, true);
+    setChanged(charId, true);
+}
+
+void OnlineRegistry::setOffline(int charId)
+{
+    auto it = mOnline.find(charId);
+    if (it == mOnline.end())
+        return;
+
+    // Kept for a while, the character is likely to come back online right
+    // away when it changes maps
+    mNames[charId] = std::make_pair(it->second.name, time(nullptr));
+    setNameChanged(it->second.name, false);
+    mOnline.erase(it);
+
+    setChanged(charId, false);
+}
+
+void OnlineRegistry::setChanged(int charId, bool online)
+{
+    if (mPersisted.count(charId) == (online ? 1u : 0u))
+    {
+        // Back to the status in the database
+        if (mChanges.erase(charId))
+            ++mCoalesced;
+        return;
+    }
+
+    mChanges[charId] = online;
+}
+
+void OnlineRegistry::setNameChanged(const std::string &name, bool online)
+{
+    // Characters without a known name are not listed
+    if (name.empty())
+        return;
+
+    // A change undoing an earlier one cancels it
+    auto result = mNameChanges.insert(std::make_pair(name, online));
+    if (!result.second && result.first->second != online)
+        mNameChanges.erase(result.first);
+}
+
+void OnlineRegistry::takeNameChanges(std::map<std::string, bool> &changes)
+{
+    changes.clear();
+    changes.swap(mNameChanges);
+}
+
+void OnlineRegistry::flush()
+{
+    const time_t now = time(nullptr);
+    for (auto it = mNames.begin(); it != mNames.end(); )
+    {
+        if (now - it->second.second > NAME_EXPIRY)
+            mNames.erase(it++);
+        else
+            ++it;
+    }
+
+    if (mWriting || mChanges.empty())
+        return;
+
+    std::map<int, bool> batch;
+    batch.swap(mChanges);
+
+    std::map<int, time_t> online;
+    std::vector<int> offline;
+    for (auto &it : batch)
+    {
+        if (it.second)
+        {
+            auto character = mOnline.find(it.first);
+            online[it.first] = character != mOnline.end()
+                    ? character->second.loginTime : now;
+            mPersisted.insert(it.first);
+        }
+        else
+        {
+            offline.push_back(it.first);
+            mPersisted.erase(it.first);
+        }
+    }
+
+    mWriting = true;
+
+    auto written = std::make_shared<bool>(false);
+    storage->async("writeOnlineStatus", [online, offline, written] {
+        storage->writeOnlineStatus(online, offline);
+        *written = true;
+    }, [this, batch, written] {
+        mWriting = false;
+        if (!*written)
+            batchFailed(batch);
+    }, Storage::BackgroundKey);
+}
+
+void OnlineRegistry::batchFailed(const std::map<int, bool> &batch)
+{
+    for (auto &it : batch)
+    {
+        // The database still has the opposite status
+        if (it.second)
+            mPersisted.erase(it.first);
+        else
+            mPersisted.insert(it.first);
+
+        // A newer change went back to that status, nothing to write
+        if (mChanges.erase(it.first))
+            continue;
+
+        mChanges[it.first] = it.second;
+    }
+}
@@ -0,0 +1,134 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef ONLINEREGISTRY_H
+#define ONLINEREGISTRY_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <time.h>
+
+/**
+ * Keeps track of the characters that are online on the game servers.
+ *
+ * The registry is the source of truth for the online status. The changes
+ * reported by the game servers are only written to the online list table of
+ * the database by flush(), in one batch. A character that goes offline and
+ * online again between two flushes, as happens on map changes, causes no
+ * database write at all.
+ *
+ * Only to be used from the main thread.
+ */
+class OnlineRegistry
+{
+    public:
+        struct Character
+        {
+            std::string name;       /**< Empty when not known. */
+            time_t loginTime;
+        };
+
+        typedef std::map<int, Character> Characters;
+
+        OnlineRegistry();
+
+        /**
+         * Remembers the name of a character that is about to enter a game
+         * server, since the game servers only report the character id.
+         */
+        void setName(int charId, const std::string &name);
+
+        void setOnline(int charId);
+
+        void setOffline(int charId);
+
+        bool isOnline(int charId) const
+        { return mOnline.find(charId) != mOnline.end(); }
+
+        /**
+         * Returns the online characters, by character id.
+         */
+        const Characters &getCharacters() const
+        { return mOnline; }
+
+        /**
+         * Moves the changes to the online names since the last call into
+         * \a changes, as name -> online. A character that went offline and
+         * came back online in the meantime is not included.
+         */
+        void takeNameChanges(std::map<std::string, bool> &changes);
+
+        /**
+         * Writes the changes since the last flush to the database, on the
+         * database thread. Changes that could not be written are kept for
+         * the next flush.
+         */
+        void flush();
+
+        /**
+         * Returns the number of status changes waiting to be written.
+         */
+        unsigned getPendingCount() const
+        { return mChanges.size(); }
+
+        /**
+         * Returns the number of status changes that did not need to be
+         * written, because they undid an earlier unwritten change.
+         */
+        unsigned getCoalescedCount() const
+        { return mCoalesced; }
+
+    private:
+        /**
+         * Records that the status of \a charId should become \a online in the
+         * database.
+         */
+        void setChanged(int charId, bool online);
+
+        /**
+         * Records that the character called \a name came online or went
+         * offline, for takeNameChanges().
+         */
+        void setNameChanged(const std::string &name, bool online);
+
+        /**
+         * Restores the changes of a batch that could not be written.
+         */
+        void batchFailed(const std::map<int, bool> &batch);
+
+        Characters mOnline;
+
+        /** Names of characters that are not online, with the time they
+            were given, until the characters show up. */
+        std::map<int, std::pair<std::string, time_t> > mNames;
+
+        std::map<int, bool> mChanges;   /**< Status changes to be written. */
+        std::set<int> mPersisted;       /**< Online in the database. */
+        bool mWriting;                  /**< Whether a batch is written. */
+        unsigned mCoalesced;
+
+        std::map<std::string, bool> mNameChanges;
+};
+
+extern OnlineRegistry *onlineRegistry;
+
+#endif // ONLINEREGISTRY_H
@@ -21,14 +21,18 @@
 #include <cassert>
 #include <sstream>
 #include <list>
+#include <memory>
+#include <vector>
 
 #include "account-server/serverhandler.h"
 
 #include "account-server/accountclient.h"
 #include "account-server/accounthandler.h"
 #include "account-server/character.h"
+#include "account-server/characterdirectory.h"
 #include "account-server/flooritem.h"
 #include "account-server/mapmanager.h"
+#include "account-server/onlineregistry.h"
 #include "account-server/storage.h"
 #include "chat-server/chathandler.h"
 #include "chat-server/post.h"
@@ -37,9 +41,11 @@
 #include "common/manaserv_protocol.h"
 #include "common/transaction.h"
 #include "net/connectionhandler.h"
+#include "net/hostpoller.h"
 #include "net/messageout.h"
 #include "net/netcomputer.h"
 #include "utils/logger.h"
+#include "utils/taskqueue.h"
 #include "utils/tokendispenser.h"
 
 using namespace ManaServ;
@@ -58,13 +64,42 @@ typedef std::map<unsigned short, MapStatistics> ServerStatistics;
  */
 struct GameServer: NetComputer
 {
-    GameServer(ENetPeer *peer): NetComputer(peer), server(0), port(0) {}
+    GameServer(ENetPeer *peer):
+        NetComputer(peer), server(0), port(0), capabilities(0),
+        handle(std::make_shared<GameServer *>(this)) {}
+
+    ~GameServer()
+    { *handle = nullptr; }
 
     std::string name;
     std::string address;
     NetComputer *server;
     ServerStatistics maps;
     short port;
+    int capabilities;   /**< Features supported by both servers. */
+
+    /**
+     * Points to this server until it is deleted. Used by the storage
+     * operations that complete after the server may have disconnected.
+     */
+    std::shared_ptr<GameServer *> handle;
+};
+
+/**
+ * The world state variables, map variables and floor items sent to a game
+ * server after it registered.
+ */
+struct ServerRegistrationData
+{
+    struct MapData
+    {
+        int id;
+        std::map<std::string, std::string> variables;
+        std::list<FloorItem> items;
+    };
+
+    std::map<std::string, std::string> worldVariables;
+    std::vector<MapData> maps;
 };
 
 static GameServer *getGameServerFromMap(int);
@@ -97,10 +132,16 @@ class ServerHandler: public ConnectionHandler
 
 static ServerHandler *serverHandler;
 
-bool GameServerHandler::initialize(int port, const std::string &host)
+/** Work handed over by the chat server. */
+static utils::TaskQueue *serverTasks;
+
+bool GameServerHandler::initialize(int port, const std::string &host,
+                                   HostPoller *poller)
 {
     MapManager::initialize(DEFAULT_MAPSDB_FILE);
     serverHandler = new ServerHandler;
+    serverHandler->setPoller(poller);
+    serverTasks = new utils::TaskQueue;
     LOG_INFO("Game server handler started:");
     return serverHandler->startListen(port, host);
 }
@@ -109,11 +150,14 @@ void GameServerHandler::deinitialize()
 {
     serverHandler->stopListen();
     delete serverHandler;
+    delete serverTasks;
 }
 
 void GameServerHandler::process()
 {
-    serverHandler->process(50);
+    // The messages sent by the tasks go out with the processing
+    serverTasks->process();
+    serverHandler->process();
 }
 
 NetComputer *ServerHandler::computerConnected(ENetPeer *peer)
@@ -161,6 +205,10 @@ static void registerGameClient(GameServer *s, const std::string &token,
     msg.writeString(token, MAGIC_TOKEN_LENGTH);
     msg.writeInt32(ptr->getDatabaseID());
     msg.writeString(ptr->getName());
+    onlineRegistry->setName(ptr->getDatabaseID(), ptr->getName());
+    characterDirectory->add(ptr->getDatabaseID(), ptr->getName());
+    characterDirectory->setMapId(ptr->getDatabaseID(), ptr->getMapId());
+    msg.setBinaryDoubles(s->capabilities & SERVER_CAPABILITY_BINARY_DOUBLE);
     ptr->serialize(msg);
     s->send(msg);
 }
@@ -192,37 +240,32 @@ void ServerHandler::processMessage(NetComputer *comp, MessageIn &msg)
             unsigned dbversion = msg.readInt32();
             LOG_INFO("Game server uses itemsdatabase with version " << dbversion);
 
-            LOG_DEBUG("AGMSG_REGISTER_RESPONSE");
-            MessageOut outMsg(AGMSG_REGISTER_RESPONSE);
+            // Older game servers do not announce their capabilities
+            const bool hasCapabilities = msg.getUnreadLength() > 0;
+            if (hasCapabilities)
+            {
+                server->capabilities = msg.readInt16() &
+                        (SERVER_CAPABILITY_BINARY_DOUBLE |
+                         SERVER_CAPABILITY_PAGED_POST);
+            }
+
+            int dataVersion;
             if (dbversion == storage->getItemDatabaseVersion())
             {
                 LOG_DEBUG("Item databases between account server and "
                     "gameserver are in sync");
-                outMsg.writeInt16(DATA_VERSION_OK);
+                dataVersion = DATA_VERSION_OK;
             }
             else
             {
                 LOG_DEBUG("Item database of game server has a wrong version");
-                outMsg.writeInt16(DATA_VERSION_OUTDATED);
-            }
-            if (password == Configuration::getValue("net_password", "changeMe"))
-            {
-                outMsg.writeInt16(PASSWORD_OK);
-
-                // transmit global world state variables
-                std::map<std::string, std::string> variables;
-                variables = storage->getAllWorldStateVars(Storage::WorldMap);
-
-                for (auto &variableIt : variables)
-                {
-                    outMsg.writeString(variableIt.first);
-                    outMsg.writeString(variableIt.second);
-                }
-
-                comp->send(outMsg);
+                dataVersion = DATA_VERSION_OUTDATED;
             }
-            else
+            if (password != Configuration::getValue("net_password", "changeMe"))
             {
+                LOG_DEBUG("AGMSG_REGISTER_RESPONSE");
+                MessageOut outMsg(AGMSG_REGISTER_RESPONSE);
+                outMsg.writeInt16(dataVersion);
                 LOG_INFO("The password given by " << server->address << ':'
                          << server->port << " was bad.");
                 outMsg.writeInt16(PASSWORD_BAD);
@@ -230,45 +273,83 @@ void ServerHandler::processMessage(NetComputer *comp, MessageIn &msg)
                 break;
             }
 
+            if (hasCapabilities)
+            {
+                MessageOut capabilitiesMsg(AGMSG_CAPABILITIES);
+                capabilitiesMsg.writeInt16(server->capabilities);
+                comp->send(capabilitiesMsg);
+            }
+
             LOG_INFO("Game server " << server->address << ':' << server->port
                      << " asks for maps to activate.");
 
+            auto data = std::make_shared<ServerRegistrationData>();
             const std::map<int, std::string> &maps = MapManager::getMaps();
             for (std::map<int, std::string>::const_iterator it = maps.begin(),
                  it_end = maps.end(); it != it_end; ++it)
             {
-                int id = it->first;
-                const std::string &reservedServer = it->second;
-                if (reservedServer == server->name)
+                if (it->second == server->name)
+                {
+                    ServerRegistrationData::MapData map;
+                    map.id = it->first;
+                    data->maps.push_back(map);
+                }
+            }
+
+            // The reply is sent once the variables and items are loaded
+            std::shared_ptr<GameServer *> handle = server->handle;
+            storage->async("registerGameServer", [data] {
+                data->worldVariables =
+                        storage->getAllWorldStateVars(Storage::WorldMap);
+                for (ServerRegistrationData::MapData &map : data->maps)
+                {
+                    map.variables = storage->getAllWorldStateVars(map.id);
+                    map.items = storage->getFloorItemsFromMap(map.id);
+                }
+            }, [data, dataVersion, handle] {
+                GameServer *server = *handle;
+                if (!server)
+                    return;
+
+                LOG_DEBUG("AGMSG_REGISTER_RESPONSE");
+                MessageOut outMsg(AGMSG_REGISTER_RESPONSE);
+                outMsg.writeInt16(dataVersion);
+                outMsg.writeInt16(PASSWORD_OK);
+
+                // transmit global world state variables
+                for (auto &variableIt : data->worldVariables)
+                {
+                    outMsg.writeString(variableIt.first);
+                    outMsg.writeString(variableIt.second);
+                }
+
+                server->send(outMsg);
+
+                for (const ServerRegistrationData::MapData &map : data->maps)
                 {
                     MessageOut outMsg(AGMSG_ACTIVE_MAP);
 
                     // Map variables
-                    outMsg.writeInt16(id);
+                    outMsg.writeInt16(map.id);
                     LOG_DEBUG("Issued server " << server->name << "("
                               << server->address << ":" << server->port << ") "
-                              << "to enable map " << id);
-                    std::map<std::string, std::string> variables;
-                    variables = storage->getAllWorldStateVars(id);
+                              << "to enable map " << map.id);
 
                      // Map vars number
-                    outMsg.writeInt16(variables.size());
+                    outMsg.writeInt16(map.variables.size());
 
-                    for (auto &variableIt : variables)
+                    for (auto &variableIt : map.variables)
                     {
                         outMsg.writeString(variableIt.first);
                         outMsg.writeString(variableIt.second);
                     }
 
                     // Persistent Floor Items
-                    std::list<FloorItem> items;
-                    items = storage->getFloorItemsFromMap(id);
-
-                    outMsg.writeInt16(items.size()); //number of floor items
+                    outMsg.writeInt16(map.items.size()); //number of floor items
 
                     // Send each map item: item_id, amount, pos_x, pos_y
-                    for (std::list<FloorItem>::iterator i = items.begin();
-                         i != items.end(); ++i)
+                    for (std::list<FloorItem>::const_iterator
+                         i = map.items.begin(); i != map.items.end(); ++i)
                     {
                         outMsg.writeInt32(i->getItemId());
                         outMsg.writeInt16(i->getItemAmount());
@@ -276,33 +357,42 @@ void ServerHandler::processMessage(NetComputer *comp, MessageIn &msg)
                         outMsg.writeInt16(i->getPosY());
                     }
 
-                    comp->send(outMsg);
-                    MapStatistics &m = server->maps[id];
+                    server->send(outMsg);
+                    MapStatistics &m = server->maps[map.id];
                     m.nbEntities = 0;
                     m.nbMonsters = 0;
                 }
-            }
+            });
         } break;
 
         case GAMSG_PLAYER_DATA:
         {
             LOG_DEBUG("GAMSG_PLAYER_DATA");
             int id = msg.readInt32();
-            if (CharacterData *ptr = storage->getCharacter(id, nullptr))
-            {
+
+            // The changes received so far are older than this data
+            storage->discardCharacterChanges(id);
+
+            auto data = std::make_shared<std::string>(msg.copyData());
+            storage->async("updateCharacter", [id, data] {
+                std::unique_ptr<CharacterData> ptr(
+                            storage->getCharacter(id, nullptr));
+                if (!ptr)
+                {
+                    LOG_ERROR("Received data for non-existing character "
+                              << id << '.');
+                    return;
+                }
+
+                MessageIn msg(data->data(), data->size());
+                msg.readInt32(); // Character id
                 ptr->deserialize(msg);
-                if (!storage->updateCharacter(ptr))
+                if (!storage->updateCharacter(ptr.get()))
                 {
                     LOG_ERROR("Failed to update character "
                               << id << '.');
                 }
-                delete ptr;
-            }
-            else
-            {
-                LOG_ERROR("Received data for non-existing character "
-                          << id << '.');
-            }
+            }, std::function<void()>(), id);
         } break;
 
         case GAMSG_PLAYER_SYNC:
@@ -315,32 +405,38 @@ void ServerHandler::processMessage(NetComputer *comp, MessageIn &msg)
         {
             LOG_DEBUG("GAMSG_REDIRECT");
             int id = msg.readInt32();
-            std::string magic_token(utils::getMagicToken());
-            if (CharacterData *ptr = storage->getCharacter(id, nullptr))
-            {
+            auto character = std::make_shared<std::unique_ptr<CharacterData> >();
+            std::shared_ptr<GameServer *> handle = server->handle;
+            storage->async("getCharacter", [id, character] {
+                character->reset(storage->getCharacter(id, nullptr));
+            }, [id, character, handle] {
+                CharacterData *ptr = character->get();
+                if (!ptr)
+                {
+                    LOG_ERROR("Received data for non-existing character "
+                              << id << '.');
+                    return;
+                }
+
                 int mapId = ptr->getMapId();
                 if (GameServer *s = getGameServerFromMap(mapId))
                 {
+                    std::string magic_token(utils::getMagicToken());
                     registerGameClient(s, magic_token, ptr);
                     MessageOut result(AGMSG_REDIRECT_RESPONSE);
                     result.writeInt32(id);
                     result.writeString(magic_token, MAGIC_TOKEN_LENGTH);
                     result.writeString(s->address);
                     result.writeInt16(s->port);
-                    comp->send(result);
+                    if (GameServer *server = *handle)
+                        server->send(result);
                 }
                 else
                 {
                     LOG_ERROR("Server Change: No game server for map " <<
                               mapId << '.');
                 }
-                delete ptr;
-            }
-            else
-            {
-                LOG_ERROR("Received data for non-existing character "
-                          << id << '.');
-            }
+            }, id);
         } break;
 
         case GAMSG_PLAYER_RECONNECT:
@@ -349,29 +445,45 @@ void ServerHandler::processMessage(NetComputer *comp, MessageIn &msg)
             int id = msg.readInt32();
             std::string magic_token = msg.readString(MAGIC_TOKEN_LENGTH);
 
-            if (CharacterData *ptr = storage->getCharacter(id, nullptr))
-            {
-                int accountID = ptr->getAccountID();
-                AccountClientHandler::prepareReconnect(magic_token, accountID);
-                delete ptr;
-            }
-            else
-            {
-                LOG_ERROR("Received data for non-existing character "
-                          << id << '.');
-            }
+            auto accountID = std::make_shared<int>(-1);
+            storage->async("getCharacter", [id, accountID] {
+                std::unique_ptr<CharacterData> ptr(
+                            storage->getCharacter(id, nullptr));
+                if (ptr)
+                    *accountID = ptr->getAccountID();
+            }, [id, magic_token, accountID] {
+                if (*accountID != -1)
+                {
+                    AccountClientHandler::prepareReconnect(magic_token,
+                                                           *accountID);
+                }
+                else
+                {
+                    LOG_ERROR("Received data for non-existing character "
+                              << id << '.');
+                }
+            }, id);
         } break;
 
         case GAMSG_GET_VAR_CHR:
         {
             int id = msg.readInt32();
             std::string name = msg.readString();
-            std::string value = storage->getQuestVar(id, name);
-            MessageOut result(AGMSG_GET_VAR_CHR_RESPONSE);
-            result.writeInt32(id);
-            result.writeString(name);
-            result.writeString(value);
-            comp->send(result);
+            auto value = std::make_shared<std::string>();
+            std::shared_ptr<GameServer *> handle = server->handle;
+            storage->async("getQuestVar", [id, name, value] {
+                *value = storage->getQuestVar(id, name);
+            }, [id, name, value, handle] {
+                GameServer *server = *handle;
+                if (!server)
+                    return;
+
+                MessageOut result(AGMSG_GET_VAR_CHR_RESPONSE);
+                result.writeInt32(id);
+                result.writeString(name);
+                result.writeString(*value);
+                server->send(result);
+            }, id);
         } break;
 
         case GAMSG_SET_VAR_CHR:
@@ -418,12 +530,15 @@ void ServerHandler::processMessage(NetComputer *comp, MessageIn &msg)
             int id = msg.readInt32();
             int level = msg.readInt16();
 
-            // get the character so we can get the account id
-            CharacterData *c = storage->getCharacter(id, nullptr);
-            if (c)
-            {
-                storage->setAccountLevel(c->getAccountID(), level);
-            }
+            storage->async("setAccountLevel", [id, level] {
+                // get the character so we can get the account id
+                std::unique_ptr<CharacterData> c(
+                            storage->getCharacter(id, nullptr));
+                if (c)
+                {
+                    storage->setAccountLevel(c->getAccountID(), level);
+                }
+            }, std::function<void()>(), id);
         } break;
 
         case GAMSG_STATISTICS:
@@ -456,99 +571,101 @@ void ServerHandler::processMessage(NetComputer *comp, MessageIn &msg)
         {
             // Retrieve the post for user
             LOG_DEBUG("GCMSG_REQUEST_POST");
-            MessageOut result(CGMSG_POST_RESPONSE);
-
-            // get the character id
-            int characterId = msg.readInt32();
-
-            // send the character id of sender
-            result.writeInt32(characterId);
-
-            // get the character based on the id
-            CharacterData *ptr = storage->getCharacter(characterId, nullptr);
-            if (!ptr)
-            {
-                // Invalid character
-                LOG_ERROR("Error finding character id for post");
-                break;
-            }
 
-            // get the post for that character
-            Post *post = postalManager->getPost(ptr);
+            // get the character id and the letters wanted. Servers without
+            // paged post take a single letter and are not told how many
+            // are left.
+            const int characterId = msg.readInt32();
+            const bool paged =
+                    server->capabilities & SERVER_CAPABILITY_PAGED_POST;
+            const unsigned maxLetters = paged ? msg.readInt16() : 1;
+
+            auto result = std::make_shared<MessageOut>(CGMSG_POST_RESPONSE);
+            std::shared_ptr<GameServer *> handle = server->handle;
+            storage->async("takePost",
+                           [characterId, maxLetters, paged, result] {
+                // send the character id of sender
+                result->writeInt32(characterId);
+
+                // take the oldest letters out of the mailbox, a page at most
+                std::unique_ptr<Post> post(
+                        postalManager->takePost(characterId, maxLetters));
+                if (paged)
+                {
+                    result->writeInt16(
+                            postalManager->getNumberOfLetters(characterId));
+                }
 
-            // send the post if valid
-            if (post)
-            {
                 for (unsigned i = 0; i < post->getNumberOfLetters(); ++i)
                 {
                     // get each letter, send the sender's name,
                     // the contents and any attachments
                     Letter *letter = post->getLetter(i);
-                    result.writeString(letter->getSender()->getName());
-                    result.writeString(letter->getContents());
-                    std::vector<InventoryItem> items = letter->getAttachments();
-                    for (unsigned j = 0; j < items.size(); ++j)
+                    result->writeString(characterDirectory->getName(
+                                                letter->getSenderId()));
+                    result->writeString(letter->getContents());
+                    const std::vector<InventoryItem> &items =
+                            letter->getAttachments();
+                    result->writeInt16(items.size());
+                    for (const InventoryItem &item : items)
                     {
-                        result.writeInt16(items[j].itemId);
-                        result.writeInt16(items[j].amount);
+                        result->writeInt16(item.itemId);
+                        result->writeInt16(item.amount);
                     }
                 }
-
-                // clean up
-                postalManager->clearPost(ptr);
-            }
-
-            comp->send(result);
+            }, [result, handle] {
+                if (GameServer *server = *handle)
+                    server->send(*result);
+            }, characterId);
         } break;
 
         case GCMSG_STORE_POST:
         {
             // Store the letter for the user
             LOG_DEBUG("GCMSG_STORE_POST");
-            MessageOut result(CGMSG_STORE_POST_RESPONSE);
 
             // get the sender and receiver
-            int senderId = msg.readInt32();
-            std::string receiverName = msg.readString();
+            const int senderId = msg.readInt32();
+            const std::string receiverName = msg.readString();
 
-            // for sending it back
-            result.writeInt32(senderId);
-
-            // get their characters
-            CharacterData *sender = storage->getCharacter(senderId, nullptr);
-            CharacterData *receiver = storage->getCharacter(receiverName);
-            if (!sender || !receiver)
-            {
-                // Invalid character
-                LOG_ERROR("Error finding character id for post");
-                result.writeInt8(ERRMSG_INVALID_ARGUMENT);
-                break;
-            }
-
-            // get the letter contents
-            std::string contents = msg.readString();
-
-            std::vector< std::pair<int, int> > items;
+            // get the letter contents, the receiver is filled in once known
+            auto letter = std::make_shared<Letter>(0, senderId, 0);
+            letter->addText(msg.readString());
             while (msg.getUnreadLength())
-            {
-                items.push_back(std::pair<int, int>(msg.readInt16(), msg.readInt16()));
-            }
-
-            // save the letter
-            LOG_DEBUG("Creating letter");
-            Letter *letter = new Letter(0, sender, receiver);
-            letter->addText(contents);
-            for (unsigned i = 0; i < items.size(); ++i)
             {
                 InventoryItem item;
-                item.itemId = items[i].first;
-                item.amount = items[i].second;
+                item.itemId = msg.readInt16();
+                item.amount = msg.readInt16();
                 letter->addAttachment(item);
             }
-            postalManager->addLetter(letter);
 
-            result.writeInt8(ERRMSG_OK);
-            comp->send(result);
+            auto error = std::make_shared<int>(ERRMSG_OK);
+            std::shared_ptr<GameServer *> handle = server->handle;
+            storage->async("storeLetter", [receiverName, letter, error] {
+                // get the id of the receiver
+                const int receiverId = characterDirectory->getId(receiverName);
+                if (!receiverId)
+                {
+                    // Invalid character
+                    LOG_DEBUG("Letter from " << letter->getSenderId()
+                              << " to unknown character " << receiverName);
+                    *error = ERRMSG_INVALID_ARGUMENT;
+                    return;
+                }
+
+                // save the letter
+                LOG_DEBUG("Creating letter");
+                letter->setReceiverId(receiverId);
+                if (!postalManager->addLetter(letter.get()))
+                    *error = ERRMSG_LIMIT_REACHED;
+            }, [senderId, error, handle] {
+                MessageOut result(CGMSG_STORE_POST_RESPONSE);
+                // for sending it back
+                result.writeInt32(senderId);
+                result.writeInt8(*error);
+                if (GameServer *server = *handle)
+                    server->send(result);
+            }, senderId);
         } break;
 
         case GAMSG_TRANSACTION:
@@ -566,8 +683,11 @@ void ServerHandler::processMessage(NetComputer *comp, MessageIn &msg)
         } break;
 
         case GCMSG_PARTY_INVITE:
-            chatHandler->handlePartyInvite(msg);
-            break;
+        {
+            const std::string inviterName = msg.readString();
+            const std::string inviteeName = msg.readString();
+            forwardPartyInvite(inviterName, inviteeName);
+        } break;
 
         case GAMSG_CREATE_ITEM_ON_MAP:
         {
@@ -602,7 +722,7 @@ void ServerHandler::processMessage(NetComputer *comp, MessageIn &msg)
             const std::string message = msg.readString();
             const int senderId = msg.readInt16();
             const std::string senderName = msg.readString();
-            chatHandler->handleAnnounce(message, senderId, senderName);
+            forwardAnnounce(message, senderId, senderName);
         } break;
 
         default:
@@ -644,22 +764,30 @@ void GameServerHandler::dumpStatistics(std::ostream &os)
     }
 }
 
-void GameServerHandler::sendPartyChange(CharacterData *ptr, int partyId)
+void GameServerHandler::sendPartyChange(int charId, int partyId)
 {
-    GameServer *s = ::getGameServerFromMap(ptr->getMapId());
-    if (s)
-    {
-        MessageOut msg(CGMSG_CHANGED_PARTY);
-        msg.writeInt32(ptr->getDatabaseID());
-        msg.writeInt32(partyId);
-        s->send(msg);
-    }
+    // Called by the chat server, which may run on another thread
+    serverTasks->post([charId, partyId] {
+        GameServer *s = ::getGameServerFromMap(
+                    characterDirectory->getMapId(charId));
+        if (s)
+        {
+            MessageOut msg(CGMSG_CHANGED_PARTY);
+            msg.writeInt32(charId);
+            msg.writeInt32(partyId);
+            s->send(msg);
+        }
+    });
+
+    if (HostPoller *poller = serverHandler->getPoller())
+        poller->wakeUp();
 }
 
 void GameServerHandler::syncDatabase(MessageIn &msg)
 {
-    // It is safe to perform the following updates in a transaction
-    dal::PerformTransaction transaction(storage->database());
+    // Character points, attributes and quest variables are queued and
+    // written in batches, the online status is kept by the online registry.
+    bool loggedOut = false;
 
     while (msg.getUnreadLength() > 0)
     {
@@ -685,15 +813,34 @@ void GameServerHandler::syncDatabase(MessageIn &msg)
                 storage->updateAttribute(charId, attrId, base, mod);
             } break;
 
+            case SYNC_QUEST_VAR:
+            {
+                LOG_DEBUG("received SYNC_QUEST_VAR");
+                int charId = msg.readInt32();
+                std::string name = msg.readString();
+                std::string value = msg.readString();
+                storage->setQuestVar(charId, name, value);
+            } break;
+
             case SYNC_ONLINE_STATUS:
             {
                 LOG_DEBUG("received SYNC_ONLINE_STATUS");
                 int charId = msg.readInt32();
                 bool online = (msg.readInt8() == 1);
-                storage->setOnlineStatus(charId, online);
+                if (online)
+                {
+                    onlineRegistry->setOnline(charId);
+                }
+                else
+                {
+                    onlineRegistry->setOffline(charId);
+                    loggedOut = true;
+                }
             } break;
         }
     }
 
-    transaction.commit();
+    // Do not keep the changes of characters that left around for long
+    if (loggedOut)
+        storage->flushCharacterChanges();
 }
@@ -27,13 +27,15 @@
 #include "net/messagein.h"
 
 class CharacterData;
+class HostPoller;
 
 namespace GameServerHandler
 {
     /**
      * Creates a connection handler and starts listening on given port.
+     * The packets of the game servers are waited for by \a poller.
      */
-    bool initialize(int port, const std::string &host);
+    bool initialize(int port, const std::string &host, HostPoller *poller);
 
     /**
      * Stops listening to messages and destroys the connection handler.
@@ -62,9 +64,10 @@ namespace GameServerHandler
     void process();
 
     /**
-     * Sends chat party information
+     * Sends chat party information. May be called from any thread, the
+     * message is sent by the next process(), which is woken up for it.
      */
-    void sendPartyChange(CharacterData *ptr, int partyId);
+    void sendPartyChange(int charId, int partyId);
 
     /**
      * Takes a GAMSG_PLAYER_SYNC from the gameserver and stores all changes in
@@ -26,6 +26,7 @@
 #include "account-server/account.h"
 #include "account-server/character.h"
 #include "account-server/flooritem.h"
+#include "account-server/storageexecutor.h"
 #include "chat-server/chatchannel.h"
 #include "chat-server/guild.h"
 #include "chat-server/post.h"
@@ -37,6 +38,7 @@
 #include "utils/point.h"
 #include "utils/string.h"
 #include "utils/throwerror.h"
+#include "utils/timer.h"
 #include "utils/xml.h"
 
 #include <stdint.h>
@@ -81,6 +83,7 @@ static const char *CHAR_ABILITIES_TBL_NAME      =   "mana_char_abilities";
 static const char *QUESTLOG_TBL_NAME            =   "mana_questlog";
 static const char *INVENTORIES_TBL_NAME         =   "mana_inventories";
 static const char *ITEMS_TBL_NAME               =   "mana_items";
+static const char *ITEM_INSTANCES_TBL_NAME      =   "mana_item_instances";
 static const char *GUILDS_TBL_NAME              =   "mana_guilds";
 static const char *GUILD_MEMBERS_TBL_NAME       =   "mana_guild_members";
 static const char *QUESTS_TBL_NAME              =   "mana_quests";
@@ -93,9 +96,85 @@ static const char *ONLINE_USERS_TBL_NAME        =   "mana_online_list";
 static const char *TRANSACTION_TBL_NAME         =   "mana_transactions";
 static const char *FLOOR_ITEMS_TBL_NAME         =   "mana_floor_items";
 
+// Number of rows written with a single statement
+static const size_t ROWS_PER_STATEMENT = 32;
+
+static const char *DEFAULT_CHARACTER_JOURNAL = "manaserv-characters.journal";
+
+/**
+ * Adds the attributes of \a character to a batch of changes.
+ */
+static void addAttributes(CharacterWriteCache::Batch &batch,
+                          const CharacterData *character)
+{
+    const int charId = character->getDatabaseID();
+    for (auto &it : character->getAttributes())
+    {
+        CharacterWriteCache::Attribute &attribute =
+                batch.attributes[std::make_pair(charId, it.first)];
+        attribute.base = it.second.base;
+        attribute.mod = it.second.modified;
+    }
+}
+
+/**
+ * The rows of a character in the tables written by updateCharacter(), keyed
+ * by the column identifying them for the character.
+ */
+struct Storage::CharacterRows
+{
+    struct Attribute
+    {
+        double base;
+        double mod;
+
+        bool operator==(const Attribute &other) const
+        { return base == other.base && mod == other.mod; }
+    };
+
+    struct Quest
+    {
+        int state;
+        std::string title;
+        std::string description;
+
+        bool operator==(const Quest &other) const
+        {
+            return state == other.state && title == other.title &&
+                   description == other.description;
+        }
+    };
+
+    struct Item
+    {
+        int itemId;
+        int amount;
+        int equipmentSlot;
+
+        bool operator==(const Item &other) const
+        {
+            return itemId == other.itemId && amount == other.amount &&
+                   equipmentSlot == other.equipmentSlot;
+        }
+    };
+
+    std::map<int, Attribute> attributes;
+    std::map<int, int> kills;
+    std::map<int, int> abilities;       /**< Values are unused. */
+    std::map<int, Quest> quests;
+    std::map<int, Item> inventory;
+    std::map<int, int> statusEffects;   /**< Time left, by status id. */
+};
+
 Storage::Storage()
         : mDb(dal::DataProviderFactory::createDataProvider()),
-          mItemDbVersion(0)
+          mItemDbVersion(0),
+          mWriteCache(new CharacterWriteCache),
+          mFlushRequested(false),
+          mDbOwner(std::thread::id()),
+          mCharacterSaves(0),
+          mCharacterSaveRows(0),
+          mCharacterSaveMaxRows(0)
 {
 }
 
@@ -149,6 +228,28 @@ void Storage::open()
             sql << "DELETE FROM " << FLOOR_ITEMS_TBL_NAME;
             mDb->execSql(sql.str());
         }
+
+        loadBans();
+
+        mExecutor.reset(new StorageExecutor);
+        mExecutor->setCompletionNotifier(mCompletionNotifier);
+
+        // Reports get connections of their own when there is a read
+        // replica, unless configured otherwise
+        const bool readReplica = DataProviderFactory::hasReadReplica();
+        const int readConnections =
+                Configuration::getValue("sql_readConnections",
+                                        readReplica ? 2 : 0);
+        if (readConnections > 0)
+        {
+            mReadPool.reset(new ConnectionPool(readConnections,
+                                               readReplica));
+        }
+
+        // Write the character changes left over by the last run
+        mWriteCache->open(Configuration::getValue("sql_characterJournal",
+                                                  DEFAULT_CHARACTER_JOURNAL));
+        flushCharacterChanges();
     }
     catch (const DbConnectionFailure& e)
     {
@@ -159,9 +260,210 @@ void Storage::open()
 
 void Storage::close()
 {
+    // Finishes the pending work before disconnecting
+    if (mExecutor)
+        mExecutor->stop();
+    mExecutor.reset();
+    mReadPool.reset();
+
+    // Without the database thread, this writes the remaining changes
+    // right away. When it fails, they remain in the journal.
+    try
+    {
+        flushCharacterChanges();
+    }
+    catch (const std::exception &e)
+    {
+        LOG_ERROR("Could not write the character changes: " << e.what());
+    }
+    catch (const std::string &)
+    {
+        // Already logged by utils::throwError
+    }
+
     mDb->disconnect();
 }
 
+void Storage::async(const char *name,
+                    std::function<void()> work,
+                    std::function<void()> done,
+                    int key)
+{
+    if (!mExecutor)
+    {
+        // Not connected, or being closed
+        Call call(this, name, key);
+        work();
+        if (done)
+            done();
+        return;
+    }
+
+    mExecutor->post(name, std::move(work), std::move(done), key);
+}
+
+void Storage::processCompletions()
+{
+    if (mExecutor)
+        mExecutor->process();
+}
+
+void Storage::setCompletionNotifier(std::function<void()> notifier)
+{
+    mCompletionNotifier = notifier;
+    if (mExecutor)
+        mExecutor->setCompletionNotifier(std::move(notifier));
+}
+
+bool Storage::deferToDatabaseThread(const char *name,
+                                    std::function<void()> work)
+{
+    if (!mExecutor || mExecutor->isWorkerThread())
+        return false;
+
+    mExecutor->post(name, std::move(work));
+    return true;
+}
+
+void Storage::dumpStatistics(std::ostream &os) const
+{
+    std::lock_guard<std::mutex> lock(mStatisticsMutex);
+
+    os << "<storage pending=\""
+       << (mExecutor ? mExecutor->getPendingCount() : 0) << "\">\n";
+
+    for (auto &it : mHistograms)
+    {
+        const Histogram &histogram = it.second;
+        os << "<method name=\"" << it.first
+           << "\" calls=\"" << histogram.count
+           << "\" avg_us=\"" << histogram.total / histogram.count
+           << "\" max_us=\"" << histogram.max << "\">\n";
+
+        for (int i = 0; i < Histogram::BucketCount; ++i)
+        {
+            if (histogram.buckets[i])
+            {
+                os << "<bucket lt_us=\"" << (1u << i)
+                   << "\" calls=\"" << histogram.buckets[i] << "\" />\n";
+            }
+        }
+        os << "</method>\n";
+    }
+
+    if (mReadPool)
+    {
+        os << "<readconnections size=\"" << mReadPool->getSize()
+           << "\" busy=\"" << mReadPool->getBusyCount()
+           << "\" replica=\"" << mReadPool->isReadReplica() << "\" />\n";
+    }
+
+    os << "<characterchanges pending=\"" << mWriteCache->getPendingCount()
+       << "\" coalesced=\"" << mWriteCache->getCoalescedCount() << "\" />\n";
+
+    os << "<charactersaves count=\"" << mCharacterSaves
+       << "\" rows=\"" << mCharacterSaveRows
+       << "\" avg_rows=\""
+       << (mCharacterSaves ? mCharacterSaveRows / mCharacterSaves : 0)
+       << "\" max_rows=\"" << mCharacterSaveMaxRows << "\" />\n";
+
+    os << "</storage>\n";
+}
+
+Storage::Call::Call(const Storage *storage, const char *name, int key):
+    mStorage(storage),
+    mName(name)
+{
+    enter(std::vector<int>(1, key));
+}
+
+Storage::Call::Call(const Storage *storage, const char *name,
+                    const std::vector<int> &keys):
+    mStorage(storage),
+    mName(name)
+{
+    enter(keys);
+}
+
+void Storage::Call::enter(const std::vector<int> &keys)
+{
+    // Only this thread sets the owner to itself, so it is only equal while
+    // this thread holds the mutex
+    mOutermost = mStorage->mDbOwner.load() != std::this_thread::get_id();
+
+    // Make sure the writes queued before this call are done
+    StorageExecutor *executor = mStorage->mExecutor.get();
+    if (mOutermost && executor && !executor->isWorkerThread())
+    {
+        for (int key : keys)
+            executor->waitUntilDone(key);
+    }
+
+    mStorage->mDbMutex.lock();
+    if (mOutermost)
+        mStorage->mDbOwner = std::this_thread::get_id();
+    mStart = utils::getTimeInMicroseconds();
+}
+
+Storage::Call::~Call()
+{
+    const uint64_t elapsed = utils::getTimeInMicroseconds() - mStart;
+    if (mOutermost)
+        mStorage->mDbOwner = std::thread::id();
+    mStorage->mDbMutex.unlock();
+    mStorage->recordLatency(mName, elapsed);
+}
+
+Storage::ReadCall::ReadCall(const Storage *storage, const char *name):
+    mStorage(storage),
+    mName(name),
+    mDb(nullptr)
+{
+    if (!storage->mReadPool)
+    {
+        mCall.reset(new Call(storage, name));
+        mDb = storage->mDb;
+        return;
+    }
+
+    try
+    {
+        mLease.reset(new dal::ConnectionPool::Lease(
+                         storage->mReadPool->acquire()));
+    }
+    catch (const dal::DbConnectionFailure &e)
+    {
+        utils::throwError("(DALStorage::ReadCall) "
+                          "Unable to connect to the database: ", e);
+    }
+    mDb = mLease->get();
+    mStart = utils::getTimeInMicroseconds();
+}
+
+Storage::ReadCall::~ReadCall()
+{
+    if (mLease)
+    {
+        const uint64_t elapsed = utils::getTimeInMicroseconds() - mStart;
+        mLease.reset();
+        mStorage->recordLatency(mName, elapsed);
+    }
+}
+
+void Storage::recordLatency(const char *name, uint64_t elapsed) const
+{
+    int bucket = 0;
+    while (bucket < Histogram::BucketCount - 1 && elapsed >= (1u << bucket))
+        ++bucket;
+
+    std::lock_guard<std::mutex> lock(mStatisticsMutex);
+    Histogram &histogram = mHistograms[name];
+    ++histogram.buckets[bucket];
+    ++histogram.count;
+    histogram.total += elapsed;
+    histogram.max = std::max(histogram.max, elapsed);
+}
+
 Account *Storage::getAccountBySQL()
 {
     try
@@ -202,37 +504,35 @@ Account *Storage::getAccountBySQL()
 
         // Load the characters associated with the account.
         std::ostringstream sql;
-        sql << "select id from " << CHARACTERS_TBL_NAME << " where user_id = '"
-            << id << "';";
-        const dal::RecordSet &charInfo = mDb->execSql(sql.str());
+        sql << "SELECT * FROM " << CHARACTERS_TBL_NAME << " WHERE user_id = ?";
+        if (!mDb->prepareSql(sql.str()))
+        {
+            utils::throwError("(DALStorage::getAccountBySQL) "
+                              "SQL query preparation failure.");
+        }
+        mDb->bindValue(1, (int) id);
 
-        if (!charInfo.isEmpty())
+        Characters characters;
+        std::map<int, CharacterData*> charactersById;
+        while (mDb->fetchRow())
         {
-            int size = charInfo.rows();
-            Characters characters;
+            CharacterData *character = readCharacter();
+            character->setAccount(account);
+            characters[character->getCharacterSlot()] = character;
+            charactersById[character->getDatabaseID()] = character;
+        }
 
-            LOG_DEBUG("Account "<< id << " has " << size
+        if (!charactersById.empty())
+        {
+            LOG_DEBUG("Account "<< id << " has " << charactersById.size()
                       << " character(s) in database.");
 
-            // Two steps: it seems like multiple requests cannot be alive
-            // at the same time.
-            std::vector< unsigned > characterIDs;
-            for (int k = 0; k < size; ++k)
-                characterIDs.push_back(toUint(charInfo(k, 0)));
-
-            for (int k = 0; k < size; ++k)
-            {
-                if (CharacterData *ptr =
-                        getCharacter(characterIDs[k], account))
-                {
-                    characters[ptr->getCharacterSlot()] = ptr;
-                }
-                else
-                {
-                    LOG_ERROR("Failed to get character " << characterIDs[k]
-                              << " for account " << id << '.');
-                }
-            }
+            // Load the data of all characters at once, a query per table
+            sql.clear();
+            sql.str("");
+            sql << "IN (SELECT id FROM " << CHARACTERS_TBL_NAME
+                << " WHERE user_id = ?)";
+            loadCharacterData(charactersById, sql.str(), id);
 
             account->setCharacters(characters);
         }
@@ -255,8 +555,14 @@ void Storage::fixCharactersSlot(int accountId)
         // Obtain all the characters slots from an account.
         std::ostringstream sql;
         sql << "SELECT id, slot FROM " << CHARACTERS_TBL_NAME
-            << " where user_id = " << accountId;
-        const dal::RecordSet &charInfo = mDb->execSql(sql.str());
+            << " WHERE user_id = ?";
+        if (!mDb->prepareSql(sql.str()))
+        {
+            utils::throwError("(DALStorage::fixCharactersSlot) "
+                              "SQL query preparation failure #1.");
+        }
+        mDb->bindValue(1, accountId);
+        const dal::RecordSet &charInfo = mDb->processSql();
 
         // If the account is not even in the database then
         // we can quit now.
@@ -291,18 +597,25 @@ void Storage::fixCharactersSlot(int accountId)
         {
             dal::PerformTransaction transaction(mDb);
 
+            sql.clear();
+            sql.str("");
+            sql << "UPDATE " << CHARACTERS_TBL_NAME
+                << " SET slot = ? WHERE id = ?";
+
             // Update the slots in database.
             for (std::map<unsigned, unsigned>::iterator i =
                                                           slotsToUpdate.begin(),
                 i_end = slotsToUpdate.end(); i != i_end; ++i)
             {
                 // Update the character slot.
-                sql.clear();
-                sql.str("");
-                sql << "UPDATE " << CHARACTERS_TBL_NAME
-                    << " SET slot = " << i->second
-                    << " where id = " << i->first;
-                mDb->execSql(sql.str());
+                if (!mDb->prepareSql(sql.str()))
+                {
+                    utils::throwError("(DALStorage::fixCharactersSlot) "
+                                      "SQL query preparation failure #2.");
+                }
+                mDb->bindValue(1, (int) i->second);
+                mDb->bindValue(2, (int) i->first);
+                mDb->processSql();
             }
 
             transaction.commit();
@@ -317,6 +630,8 @@ void Storage::fixCharactersSlot(int accountId)
 
 Account *Storage::getAccount(const std::string &userName)
 {
+    Call call(this, __func__);
+
     std::ostringstream sql;
     sql << "SELECT * FROM " << ACCOUNTS_TBL_NAME << " WHERE username = ?";
     if (mDb->prepareSql(sql.str()))
@@ -329,6 +644,8 @@ Account *Storage::getAccount(const std::string &userName)
 
 Account *Storage::getAccount(int accountID)
 {
+    Call call(this, __func__);
+
     std::ostringstream sql;
     sql << "SELECT * FROM " << ACCOUNTS_TBL_NAME << " WHERE id = ?";
     if (mDb->prepareSql(sql.str()))
@@ -339,198 +656,248 @@ Account *Storage::getAccount(int accountID)
     return 0;
 }
 
-CharacterData *Storage::getCharacterBySQL(Account *owner)
+CharacterData *Storage::readCharacter()
 {
-    CharacterData *character = 0;
-
-    string_to< unsigned > toUint;
-    string_to< int > toInt;
+    CharacterData *character = new CharacterData(mDb->getString(2),
+                                                  mDb->getInt(0));
+    character->setGender(mDb->getInt(3));
+    character->setHairStyle(mDb->getInt(4));
+    character->setHairColor(mDb->getInt(5));
+    character->setAttributePoints(mDb->getInt(6));
+    character->setCorrectionPoints(mDb->getInt(7));
+    Point pos(mDb->getInt(8), mDb->getInt(9));
+    character->setPosition(pos);
 
-    try
+    int mapId = mDb->getInt(10);
+    if (mapId > 0)
     {
-        const dal::RecordSet &charInfo = mDb->processSql();
-
-        // If the character is not even in the database then
-        // we have no choice but to return nothing.
-        if (charInfo.isEmpty())
-            return 0;
+        character->setMapId(mapId);
+    }
+    else
+    {
+        // Set character to default map and one of the default location
+        // Default map is to be 1, as not found return value will be 0.
+        character->setMapId(Configuration::getValue("char_defaultMap", 1));
+    }
 
-        string_to< unsigned short > toUshort;
-        string_to< double > toDouble;
+    character->setCharacterSlot(mDb->getInt(11));
+    character->setAccountID(mDb->getInt(1));
 
-        character = new CharacterData(charInfo(0, 2), toUint(charInfo(0, 0)));
-        character->setGender(toUshort(charInfo(0, 3)));
-        character->setHairStyle(toUshort(charInfo(0, 4)));
-        character->setHairColor(toUshort(charInfo(0, 5)));
-        character->setAttributePoints(toUshort(charInfo(0, 6)));
-        character->setCorrectionPoints(toUshort(charInfo(0, 7)));
-        Point pos(toInt(charInfo(0, 8)), toInt(charInfo(0, 9)));
-        character->setPosition(pos);
+    return character;
+}
 
-        int mapId = toUint(charInfo(0, 10));
-        if (mapId > 0)
-        {
-            character->setMapId(mapId);
-        }
-        else
-        {
-            // Set character to default map and one of the default location
-            // Default map is to be 1, as not found return value will be 0.
-            character->setMapId(Configuration::getValue("char_defaultMap", 1));
-        }
+void Storage::getCharacterRows(const CharacterData *character,
+                               CharacterRows &rows) const
+{
+    for (auto &it : character->getAttributes())
+    {
+        CharacterRows::Attribute &attribute = rows.attributes[it.first];
+        attribute.base = it.second.base;
+        attribute.mod = it.second.modified;
+    }
 
-        character->setCharacterSlot(toUint(charInfo(0, 11)));
+    for (auto it = character->getKillCountBegin(),
+         it_end = character->getKillCountEnd(); it != it_end; ++it)
+        rows.kills[it->first] = it->second;
 
-        // Fill the account-related fields. Last step, as it may require a new
-        // SQL query.
-        if (owner)
-        {
-            character->setAccount(owner);
-        }
-        else
-        {
-            int id = toUint(charInfo(0, 1));
-            character->setAccountID(id);
-            std::ostringstream s;
-            s << "select level from " << ACCOUNTS_TBL_NAME
-              << " where id = '" << id << "';";
-            const dal::RecordSet &levelInfo = mDb->execSql(s.str());
-            character->setAccountLevel(toUint(levelInfo(0, 0)), true);
-        }
+    for (int abilityId : character->getAbilities())
+        rows.abilities[abilityId] = 0;
 
-        std::ostringstream s;
+    for (const QuestInfo &questInfo : character->mQuests)
+    {
+        CharacterRows::Quest &quest = rows.quests[questInfo.id];
+        quest.state = questInfo.state;
+        quest.title = questInfo.title;
+        quest.description = questInfo.description;
+    }
 
-        // Load attributes.
-        {
-            s << "SELECT attr_id, attr_base, attr_mod "
-              << "FROM " << CHAR_ATTR_TBL_NAME << " "
-              << "WHERE char_id = " << character->getDatabaseID();
+    const InventoryData &inventory =
+            character->getPossessions().getInventory();
+    for (auto &it : inventory)
+    {
+        assert(it.second.itemId);
+        CharacterRows::Item &item = rows.inventory[it.first];
+        item.itemId = it.second.itemId;
+        item.amount = it.second.amount;
+        item.equipmentSlot = it.second.equipmentSlot;
+    }
 
-            const dal::RecordSet &attrInfo = mDb->execSql(s.str());
-            const unsigned nRows = attrInfo.rows();
-            for (unsigned row = 0; row < nRows; ++row)
-            {
-                unsigned id = toUint(attrInfo(row, 0));
-                character->setAttribute(id,    toDouble(attrInfo(row, 1)));
-                character->setModAttribute(id, toDouble(attrInfo(row, 2)));
-            }
-        }
+    for (auto it = character->getStatusEffectBegin(),
+         it_end = character->getStatusEffectEnd(); it != it_end; ++it)
+        rows.statusEffects[it->first] = it->second.time;
+}
 
-        // Load the status effects
-        {
-            s.clear();
-            s.str("");
-            s << "select status_id, status_time FROM "
-              << CHAR_STATUS_EFFECTS_TBL_NAME
-              << " WHERE char_id = " << character->getDatabaseID();
-            const dal::RecordSet &statusInfo = mDb->execSql(s.str());
-            const unsigned nRows = statusInfo.rows();
-            for (unsigned row = 0; row < nRows; row++)
-            {
-                character->applyStatusEffect(
-                    toUint(statusInfo(row, 0)), // Status Id
-                    toUint(statusInfo(row, 1))); // Time
-            }
-        }
+void Storage::loadCharacterData(const std::map<int, CharacterData*> &characters,
+                                const std::string &filter, int filterValue)
+{
+    typedef std::map<int, CharacterData*>::const_iterator CharacterIterator;
+
+    // Every query selects the character id first, to dispatch its rows.
+    const char *queries[] = {
+        "SELECT char_id, attr_id, attr_base, attr_mod FROM ",
+        "SELECT char_id, status_id, status_time FROM ",
+        "SELECT char_id, monster_id, kills FROM ",
+        "SELECT char_id, ability_id FROM ",
+        "SELECT char_id, quest_id, quest_state, quest_title, "
+            "quest_description FROM ",
+        "SELECT owner_id, slot, class_id, amount, equipped FROM "
+    };
+    const char *tables[] = {
+        CHAR_ATTR_TBL_NAME,
+        CHAR_STATUS_EFFECTS_TBL_NAME,
+        CHAR_KILL_COUNT_TBL_NAME,
+        CHAR_ABILITIES_TBL_NAME,
+        QUESTLOG_TBL_NAME,
+        INVENTORIES_TBL_NAME
+    };
+    const char *keys[] = {
+        "char_id", "char_id", "char_id", "char_id", "char_id", "owner_id"
+    };
+    enum { ATTRIBUTES, STATUS_EFFECTS, KILL_COUNTS, ABILITIES, QUESTS,
+           INVENTORY, QUERY_COUNT };
+
+    std::map<int, InventoryData> inventories;
+    std::map<int, EquipData> equipments;
 
-        // Load the kill stats
+    try
+    {
+        for (int query = 0; query < QUERY_COUNT; ++query)
         {
-            s.clear();
-            s.str("");
-            s << "select monster_id, kills FROM " << CHAR_KILL_COUNT_TBL_NAME
-              << " WHERE char_id = " << character->getDatabaseID();
-            const dal::RecordSet &killsInfo = mDb->execSql(s.str());
-            const unsigned nRows = killsInfo.rows();
-            for (unsigned row = 0; row < nRows; row++)
+            std::ostringstream sql;
+            sql << queries[query] << tables[query]
+                << " WHERE " << keys[query] << " " << filter;
+            if (!mDb->prepareSql(sql.str()))
             {
-                character->setKillCount(
-                    toUint(killsInfo(row, 0)), // MonsterID
-                    toUint(killsInfo(row, 1))); // Kills
+                utils::throwError("(DALStorage::loadCharacterData) "
+                                  "SQL query preparation failure.");
             }
-        }
+            mDb->bindValue(1, filterValue);
 
-        // Load the ability status
-        {
-            s.clear();
-            s.str("");
-            s << "SELECT ability_id FROM "
-              << CHAR_ABILITIES_TBL_NAME
-              << " WHERE char_id = " << character->getDatabaseID();
-            const dal::RecordSet &abilitiesInfo = mDb->execSql(s.str());
-            const unsigned nRows = abilitiesInfo.rows();
-            for (unsigned row = 0; row < nRows; row++)
+            while (mDb->fetchRow())
             {
-                character->giveAbility(toUint(abilitiesInfo(row, 0)));
-            }
-        }
+                const int charId = mDb->getInt(0);
+                CharacterIterator it = characters.find(charId);
+                if (it == characters.end())
+                    continue;
+                CharacterData *character = it->second;
 
-        // Load the questlog
-        {
-            s.clear();
-            s.str("");
-            s << "SELECT quest_id, quest_state, quest_title, quest_description "
-              << "FROM " << QUESTLOG_TBL_NAME
-              << " WHERE char_id = " << character->getDatabaseID();
-            const dal::RecordSet &quests = mDb->execSql(s.str());
-            const unsigned nRows = quests.rows();
-            for (unsigned row = 0; row < nRows; row++)
-            {
-                QuestInfo quest;
-                quest.id = toUint(quests(row, 0));
-                quest.state = toUint(quests(row, 1));
-                quest.title = quests(row, 2);
-                quest.description = quests(row, 3);
-                character->mQuests.push_back(quest);
+                switch (query)
+                {
+                case ATTRIBUTES:
+                {
+                    unsigned id = mDb->getInt(1);
+                    character->setAttribute(id,    mDb->getDouble(2));
+                    character->setModAttribute(id, mDb->getDouble(3));
+                    break;
+                }
+                case STATUS_EFFECTS:
+                    character->applyStatusEffect(
+                        mDb->getInt(1),  // Status Id
+                        mDb->getInt(2)); // Time
+                    break;
+                case KILL_COUNTS:
+                    character->setKillCount(
+                        mDb->getInt(1),  // MonsterID
+                        mDb->getInt(2)); // Kills
+                    break;
+                case ABILITIES:
+                    character->giveAbility(mDb->getInt(1));
+                    break;
+                case QUESTS:
+                {
+                    QuestInfo quest;
+                    quest.id = mDb->getInt(1);
+                    quest.state = mDb->getInt(2);
+                    quest.title = mDb->getString(3);
+                    quest.description = mDb->getString(4);
+                    character->mQuests.push_back(quest);
+                    break;
+                }
+                case INVENTORY:
+                {
+                    InventoryItem item;
+                    unsigned short slot = mDb->getInt(1);
+                    item.itemId   = mDb->getInt(2);
+                    item.amount   = mDb->getInt(3);
+                    item.equipmentSlot = mDb->getInt(4);
+                    inventories[charId][slot] = item;
+
+                    if (item.equipmentSlot != 0)
+                        equipments[charId].insert(slot);
+                    break;
+                }
+                }
             }
         }
     }
     catch (const dal::DbSqlQueryExecFailure &e)
     {
-        utils::throwError("DALStorage::getCharacter #1) SQL query failure: ",
-                          e);
+        utils::throwError("(DALStorage::loadCharacterData) "
+                          "SQL query failure: ", e);
     }
 
-    Possessions &poss = character->getPossessions();
+    for (CharacterIterator it = characters.begin(), it_end = characters.end();
+         it != it_end; ++it)
+    {
+        Possessions &poss = it->second->getPossessions();
+        poss.setInventory(inventories[it->first]);
+        poss.setEquipment(equipments[it->first]);
+
+        // Changes that were not written yet are more recent
+        mWriteCache->apply(it->second);
+    }
+}
+
+CharacterData *Storage::getCharacterBySQL(Account *owner)
+{
+    CharacterData *character = 0;
 
     try
     {
-        std::ostringstream sql;
-        sql << " select id, owner_id, slot, class_id, amount, equipped from "
-            << INVENTORIES_TBL_NAME << " where owner_id = '"
-            << character->getDatabaseID() << "' order by slot asc;";
+        // If the character is not even in the database then
+        // we have no choice but to return nothing.
+        if (!mDb->fetchRow())
+            return 0;
 
-        InventoryData inventoryData;
-        EquipData equipmentData;
-        const dal::RecordSet &itemInfo = mDb->execSql(sql.str());
-        if (!itemInfo.isEmpty())
+        character = readCharacter();
+
+        // Fill the account-related fields. Last step, as it may require a new
+        // SQL query.
+        if (owner)
         {
-            for (int k = 0, size = itemInfo.rows(); k < size; ++k)
+            character->setAccount(owner);
+        }
+        else
+        {
+            std::ostringstream s;
+            s << "SELECT level FROM " << ACCOUNTS_TBL_NAME << " WHERE id = ?";
+            if (!mDb->prepareSql(s.str()))
             {
-                InventoryItem item;
-                unsigned short slot = toUint(itemInfo(k, 2));
-                item.itemId   = toUint(itemInfo(k, 3));
-                item.amount   = toUint(itemInfo(k, 4));
-                item.equipmentSlot = toUint(itemInfo(k, 5));
-                inventoryData[slot] = item;
-
-                if (item.equipmentSlot != 0)
-                    equipmentData.insert(slot);
+                utils::throwError("(DALStorage::getCharacter) "
+                                  "SQL query preparation failure.");
             }
+            mDb->bindValue(1, character->getAccountID());
+            if (mDb->fetchRow())
+                character->setAccountLevel(mDb->getInt(0), true);
         }
-        poss.setInventory(inventoryData);
-        poss.setEquipment(equipmentData);
     }
     catch (const dal::DbSqlQueryExecFailure &e)
     {
-        utils::throwError("DALStorage::getCharacter #3) SQL query failure: ",
+        utils::throwError("DALStorage::getCharacter #1) SQL query failure: ",
                           e);
     }
 
+    std::map<int, CharacterData*> characters;
+    characters[character->getDatabaseID()] = character;
+    loadCharacterData(characters, "= ?", character->getDatabaseID());
+
     return character;
 }
 
 CharacterData *Storage::getCharacter(int id, Account *owner)
 {
+    Call call(this, __func__, id);
+
     std::ostringstream sql;
     sql << "SELECT * FROM " << CHARACTERS_TBL_NAME << " WHERE id = ?";
     if (mDb->prepareSql(sql.str()))
@@ -543,6 +910,8 @@ CharacterData *Storage::getCharacter(int id, Account *owner)
 
 CharacterData *Storage::getCharacter(const std::string &name)
 {
+    Call call(this, __func__);
+
     std::ostringstream sql;
     sql << "SELECT * FROM " << CHARACTERS_TBL_NAME << " WHERE name = ?";
     if (mDb->prepareSql(sql.str()))
@@ -555,6 +924,8 @@ CharacterData *Storage::getCharacter(const std::string &name)
 
 unsigned Storage::getCharacterId(const std::string &name)
 {
+    Call call(this, __func__);
+
     std::ostringstream sql;
     sql << "SELECT id FROM " << CHARACTERS_TBL_NAME << " WHERE name = ?";
     if (!mDb->prepareSql(sql.str()))
@@ -577,8 +948,35 @@ unsigned Storage::getCharacterId(const std::string &name)
     return 0;
 }
 
+std::string Storage::getCharacterName(int id)
+{
+    Call call(this, __func__);
+
+    std::ostringstream sql;
+    sql << "SELECT name FROM " << CHARACTERS_TBL_NAME << " WHERE id = ?";
+    if (!mDb->prepareSql(sql.str()))
+        return std::string();
+    try
+    {
+        mDb->bindValue(1, id);
+        const dal::RecordSet &charInfo = mDb->processSql();
+        if (charInfo.isEmpty())
+            return std::string();
+
+        return charInfo(0, 0);
+    }
+    catch (const dal::DbSqlQueryExecFailure &e)
+    {
+        utils::throwError("DALStorage::getCharacterName #1) SQL query "
+                          "failure: ", e);
+    }
+    return std::string();
+}
+
 bool Storage::doesUserNameExist(const std::string &name)
 {
+    Call call(this, __func__);
+
     try
     {
         std::ostringstream sql;
@@ -613,6 +1011,8 @@ bool Storage::doesUserNameExist(const std::string &name)
 
 bool Storage::doesEmailAddressExist(const std::string &email)
 {
+    Call call(this, __func__);
+
     try
     {
         std::ostringstream sql;
@@ -646,6 +1046,8 @@ bool Storage::doesEmailAddressExist(const std::string &email)
 
 bool Storage::doesCharacterNameExist(const std::string& name)
 {
+    Call call(this, __func__);
+
     try
     {
         std::ostringstream sql;
@@ -678,222 +1080,321 @@ bool Storage::doesCharacterNameExist(const std::string& name)
     return true;
 }
 
-bool Storage::updateCharacter(CharacterData *character)
+/**
+ * Writes the rows of a character that differ from what was written before.
+ * Rows that disappeared are deleted, rows that changed are updated and the
+ * rows that appeared are inserted, using multi-row statements where the
+ * databases allow it.
+ *
+ * @param valueColumns  the columns following the owner and key columns.
+ * @param oldRows       the rows written by the last save, or null when
+ *                      unknown. In that case all rows of the character are
+ *                      replaced.
+ * @param removeMissing whether to delete the rows missing in \a newRows.
+ * @param bindValues    binds the value columns of a row, starting at the
+ *                      given parameter index.
+ * @return the number of rows deleted, updated and inserted.
+ */
+template <typename T, typename BindValues>
+static unsigned writeRowChanges(dal::DataProvider *db,
+                                const char *table,
+                                const char *ownerColumn,
+                                const char *keyColumn,
+                                const std::vector<const char *> &valueColumns,
+                                int charId,
+                                const std::map<int, T> *oldRows,
+                                const std::map<int, T> &newRows,
+                                bool removeMissing,
+                                BindValues bindValues)
 {
-    dal::PerformTransaction transaction(mDb);
+    std::vector<int> deleted;
+    std::vector<typename std::map<int, T>::const_iterator> updated;
+    std::vector<typename std::map<int, T>::const_iterator> inserted;
+    unsigned rowsWritten = 0;
 
-    try
+    if (oldRows)
     {
-        // Update the database Character data (see CharacterData for details)
-        std::ostringstream sqlUpdateCharacterInfo;
-        sqlUpdateCharacterInfo
-            << "update "        << CHARACTERS_TBL_NAME << " "
-            << "set "
-            << "gender = '"     << character->getGender() << "', "
-            << "hair_style = '" << character->getHairStyle() << "', "
-            << "hair_color = '" << character->getHairColor() << "', "
-            << "char_pts = '"   << character->getAttributePoints() << "', "
-            << "correct_pts = '"<< character->getCorrectionPoints() << "', "
-            << "x = '"          << character->getPosition().x << "', "
-            << "y = '"          << character->getPosition().y << "', "
-            << "map_id = '"     << character->getMapId() << "', "
-            << "slot = '"     << character->getCharacterSlot() << "' "
-            << "where id = '"   << character->getDatabaseID() << "';";
-
-        mDb->execSql(sqlUpdateCharacterInfo.str());
+        for (auto it = newRows.begin(); it != newRows.end(); ++it)
+        {
+            auto oldIt = oldRows->find(it->first);
+            if (oldIt == oldRows->end())
+                inserted.push_back(it);
+            else if (!(oldIt->second == it->second))
+                updated.push_back(it);
+        }
+        if (removeMissing)
+        {
+            for (auto &it : *oldRows)
+                if (!newRows.count(it.first))
+                    deleted.push_back(it.first);
+        }
     }
-    catch (const dal::DbSqlQueryExecFailure& e)
+    else
     {
-        utils::throwError("(DALStorage::updateCharacter #1) "
-                          "SQL query failure: ", e);
+        for (auto it = newRows.begin(); it != newRows.end(); ++it)
+        {
+            if (!removeMissing)
+                deleted.push_back(it->first);
+            inserted.push_back(it);
+        }
     }
 
-    // Character attributes.
     try
     {
-        for (AttributeMap::const_iterator it = character->mAttributes.begin(),
-             it_end = character->mAttributes.end(); it != it_end; ++it)
-            updateAttribute(character->getDatabaseID(), it->first,
-                            it->second.base, it->second.modified);
-    }
-    catch (const dal::DbSqlQueryExecFailure &e)
-    {
-        utils::throwError("(DALStorage::updateCharacter #2) "
-                          "SQL query failure: ", e);
-    }
+        if (!oldRows && removeMissing)
+        {
+            std::ostringstream sql;
+            sql << "DELETE FROM " << table << " WHERE " << ownerColumn
+                << " = ?";
+            if (!db->prepareSql(sql.str()))
+            {
+                utils::throwError(std::string("(DALStorage::updateCharacter) "
+                                              "SQL query preparation failure "
+                                              "deleting from ") + table);
+            }
+            db->bindValue(1, charId);
+            db->processSql();
+            rowsWritten += db->getModifiedRows();
+        }
 
-    // Character's kill count
-    try
-    {
-        std::map<int, int>::const_iterator kill_it;
-        for (kill_it = character->getKillCountBegin();
-             kill_it != character->getKillCountEnd(); ++kill_it)
+        for (size_t first = 0; first < deleted.size();
+             first += ROWS_PER_STATEMENT)
         {
-            updateKillCount(character->getDatabaseID(),
-                            kill_it->first, kill_it->second);
+            const size_t rows = std::min(ROWS_PER_STATEMENT,
+                                         deleted.size() - first);
+
+            std::ostringstream sql;
+            sql << "DELETE FROM " << table << " WHERE " << ownerColumn
+                << " = ? AND " << keyColumn << " IN (";
+            for (size_t i = 0; i < rows; ++i)
+                sql << (i ? ", ?" : "?");
+            sql << ")";
+
+            if (!db->prepareSql(sql.str()))
+            {
+                utils::throwError(std::string("(DALStorage::updateCharacter) "
+                                              "SQL query preparation failure "
+                                              "deleting from ") + table);
+            }
+            db->bindValue(1, charId);
+            for (size_t i = 0; i < rows; ++i)
+                db->bindValue(i + 2, deleted[first + i]);
+            db->processSql();
+            rowsWritten += rows;
         }
-    }
-    catch (const dal::DbSqlQueryExecFailure& e)
-    {
-        utils::throwError("(DALStorage::updateCharacter #4) "
-                          "SQL query failure: ", e);
-    }
 
-    //  Character's abillities
-    try
-    {
-        // Out with the old
-        std::ostringstream deleteSql("");
-        std::ostringstream insertSql;
-        deleteSql   << "DELETE FROM " << CHAR_ABILITIES_TBL_NAME
-                    << " WHERE char_id='"
-                    << character->getDatabaseID() << "';";
-        mDb->execSql(deleteSql.str());
-        // In with the new
-        for (int abilityId : character->getAbilities())
-        {
-            insertSql.str("");
-            insertSql   << "INSERT INTO " << CHAR_ABILITIES_TBL_NAME
-                        << " (char_id, ability_id)"
-                        << " VALUES ("
-                        << " '" << character->getDatabaseID() << "',"
-                        << " '" << abilityId
-                        << "');";
-            mDb->execSql(insertSql.str());
+        // Not every database has a unique key on these tables, so the
+        // changed rows are updated one at a time
+        const unsigned valueCount = valueColumns.size();
+        if (!updated.empty() && valueCount)
+        {
+            std::ostringstream sql;
+            sql << "UPDATE " << table << " SET ";
+            for (unsigned column = 0; column < valueCount; ++column)
+                sql << (column ? ", " : "") << valueColumns[column] << " = ?";
+            sql << " WHERE " << ownerColumn << " = ? AND " << keyColumn
+                << " = ?";
+            const std::string updateSql = sql.str();
+
+            for (const auto &row : updated)
+            {
+                if (!db->prepareSql(updateSql))
+                {
+                    utils::throwError(std::string("(DALStorage::"
+                                                  "updateCharacter) SQL "
+                                                  "query preparation failure "
+                                                  "updating ") + table);
+                }
+                bindValues(1, row->second);
+                db->bindValue(valueCount + 1, charId);
+                db->bindValue(valueCount + 2, row->first);
+                db->processSql();
+                ++rowsWritten;
+            }
         }
-    }
-    catch (const dal::DbSqlQueryExecFailure& e)
-    {
-        utils::throwError("(DALStorage::updateCharacter #5) "
-                          "SQL query failure: ", e);;
-    }
 
-    //  Character's questlog
-    try
-    {
-        // Out with the old
-        std::ostringstream deleteSql("");
-        std::ostringstream insertSql;
-        deleteSql   << "DELETE FROM " << QUESTLOG_TBL_NAME
-                    << " WHERE char_id='"
-                    << character->getDatabaseID() << "';";
-        mDb->execSql(deleteSql.str());
-        // In with the new
-        for (QuestInfo &quest : character->mQuests)
-        {
-            insertSql.str("");
-            insertSql   << "INSERT INTO " << QUESTLOG_TBL_NAME
-                        << " (char_id, quest_id, quest_state, "
-                        << "quest_title, quest_description)"
-                        << " VALUES ("
-                        << character->getDatabaseID() << ","
-                        << " " << quest.id << ","
-                        << " " << quest.state << ","
-                        << " ?,"
-                        << " ?"
-                        << ")";
-            if (mDb->prepareSql(insertSql.str()))
+        const unsigned columns = 2 + valueCount;
+        for (size_t first = 0; first < inserted.size();
+             first += ROWS_PER_STATEMENT)
+        {
+            const size_t rows = std::min(ROWS_PER_STATEMENT,
+                                         inserted.size() - first);
+
+            std::ostringstream sql;
+            sql << "INSERT INTO " << table << " (" << ownerColumn << ", "
+                << keyColumn;
+            for (const char *column : valueColumns)
+                sql << ", " << column;
+            sql << ") VALUES ";
+            for (size_t i = 0; i < rows; ++i)
             {
-                mDb->bindValue(1, quest.title);
-                mDb->bindValue(2, quest.description);
+                sql << (i ? ", (?" : "(?");
+                for (unsigned column = 1; column < columns; ++column)
+                    sql << ", ?";
+                sql << ")";
+            }
 
-                mDb->processSql();
+            if (!db->prepareSql(sql.str()))
+            {
+                utils::throwError(std::string("(DALStorage::updateCharacter) "
+                                              "SQL query preparation failure "
+                                              "inserting into ") + table);
+            }
+            for (size_t i = 0; i < rows; ++i)
+            {
+                const unsigned index = i * columns + 1;
+                const auto &row = *inserted[first + i];
+                db->bindValue(index, charId);
+                db->bindValue(index + 1, row.first);
+                bindValues(index + 2, row.second);
             }
+            db->processSql();
+            rowsWritten += rows;
         }
     }
-    catch (const dal::DbSqlQueryExecFailure& e)
+    catch (const dal::DbSqlQueryExecFailure &e)
     {
-        utils::throwError("(DALStorage::updateCharacter #5) "
-                          "SQL query failure: ", e);;
+        utils::throwError(std::string("(DALStorage::updateCharacter) "
+                                      "SQL query failure writing ") + table
+                          + ": ", e);
     }
 
-    // Character's inventory
-    // Delete the old inventory and equipment table first
-    try
-    {
-        std::ostringstream sqlDeleteCharacterInventory;
-        sqlDeleteCharacterInventory
-            << "delete from " << INVENTORIES_TBL_NAME
-            << " where owner_id = '" << character->getDatabaseID() << "';";
-        mDb->execSql(sqlDeleteCharacterInventory.str());
-    }
-    catch (const dal::DbSqlQueryExecFailure& e)
-    {
-        utils::throwError("(DALStorage::updateCharacter #6) "
-                          "SQL query failure: ", e);
-    }
+    return rowsWritten;
+}
 
-    // Insert the new inventory data
-    try
-    {
-        std::ostringstream sql;
+bool Storage::updateCharacter(CharacterData *character)
+{
+    Call call(this, __func__, character->getDatabaseID());
+    return writeCharacter(character, true);
+}
 
-        sql << "insert into " << INVENTORIES_TBL_NAME
-            << " (owner_id, slot, class_id, amount, equipped) values ("
-            << character->getDatabaseID() << ", ";
-        std::string base = sql.str();
+bool Storage::writeCharacter(CharacterData *character, bool remember)
+{
+    const int charId = character->getDatabaseID();
 
-        const Possessions &poss = character->getPossessions();
-        const InventoryData &inventoryData = poss.getInventory();
-        for (InventoryData::const_iterator itemIt = inventoryData.begin(),
-             j_end = inventoryData.end(); itemIt != j_end; ++itemIt)
-        {
-            sql.str("");
-            unsigned short slot = itemIt->first;
-            unsigned itemId = itemIt->second.itemId;
-            unsigned amount = itemIt->second.amount;
-            assert(itemId);
-            sql << base << slot << ", " << itemId << ", " << amount << ", "
-                << itemIt->second.equipmentSlot << ");";
-            mDb->execSql(sql.str());
-        }
+    std::unique_ptr<CharacterRows> rows(new CharacterRows);
+    getCharacterRows(character, *rows);
 
-    }
-    catch (const dal::DbSqlQueryExecFailure& e)
+    // The rows written by the last save, to only write the changes. They are
+    // forgotten until this save is committed, a failed save writes
+    // everything again.
+    auto savedIt = mSavedCharacters.find(charId);
+    std::unique_ptr<CharacterRows> saved;
+    if (savedIt != mSavedCharacters.end())
     {
-        utils::throwError("(DALStorage::updateCharacter #7) "
-                          "SQL query failure: ", e);
+        saved = std::move(savedIt->second);
+        mSavedCharacters.erase(savedIt);
+        remember = true;
     }
+    const CharacterRows *old = saved.get();
 
+    unsigned rowsWritten = 1;
 
-    // Update char status effects
-    try
-    {
-        // Delete the old status effects first
-        std::ostringstream sql;
-
-        sql << "delete from " << CHAR_STATUS_EFFECTS_TBL_NAME
-            << " where char_id = '" << character->getDatabaseID() << "';";
+    dal::PerformTransaction transaction(mDb);
 
-         mDb->execSql(sql.str());
-    }
-    catch (const dal::DbSqlQueryExecFailure& e)
-    {
-        utils::throwError("(DALStorage::updateCharacter #8) "
-                          "SQL query failure: ", e);
-    }
     try
     {
-        std::map<int, Status>::const_iterator status_it;
-        for (status_it = character->getStatusEffectBegin();
-             status_it != character->getStatusEffectEnd(); ++status_it)
+        // Update the database Character data (see CharacterData for details)
+        std::ostringstream sqlUpdateCharacterInfo;
+        sqlUpdateCharacterInfo
+            << "UPDATE " << CHARACTERS_TBL_NAME
+            << " SET gender = ?, hair_style = ?, hair_color = ?,"
+            << " char_pts = ?, correct_pts = ?, x = ?, y = ?, map_id = ?,"
+            << " slot = ? WHERE id = ?";
+
+        if (!mDb->prepareSql(sqlUpdateCharacterInfo.str()))
         {
-            insertStatusEffect(character->getDatabaseID(),
-                               status_it->first, status_it->second.time);
+            utils::throwError("(DALStorage::updateCharacter) "
+                              "SQL query preparation failure #1.");
         }
+        mDb->bindValue(1, character->getGender());
+        mDb->bindValue(2, character->getHairStyle());
+        mDb->bindValue(3, character->getHairColor());
+        mDb->bindValue(4, character->getAttributePoints());
+        mDb->bindValue(5, character->getCorrectionPoints());
+        mDb->bindValue(6, character->getPosition().x);
+        mDb->bindValue(7, character->getPosition().y);
+        mDb->bindValue(8, character->getMapId());
+        mDb->bindValue(9, (int) character->getCharacterSlot());
+        mDb->bindValue(10, charId);
+        mDb->processSql();
     }
     catch (const dal::DbSqlQueryExecFailure& e)
     {
-        utils::throwError("(DALStorage::updateCharacter #9) "
+        utils::throwError("(DALStorage::updateCharacter #1) "
                           "SQL query failure: ", e);
     }
 
+    // Attributes and kill counts are never removed from a character
+    rowsWritten += writeRowChanges(
+                mDb, CHAR_ATTR_TBL_NAME, "char_id", "attr_id",
+                { "attr_base", "attr_mod" }, charId,
+                old ? &old->attributes : nullptr, rows->attributes, false,
+                [this](unsigned index, const CharacterRows::Attribute &attr) {
+        mDb->bindValue(index, attr.base);
+        mDb->bindValue(index + 1, attr.mod);
+    });
+
+    rowsWritten += writeRowChanges(
+                mDb, CHAR_KILL_COUNT_TBL_NAME, "char_id", "monster_id",
+                { "kills" }, charId,
+                old ? &old->kills : nullptr, rows->kills, false,
+                [this](unsigned index, int kills) {
+        mDb->bindValue(index, kills);
+    });
+
+    rowsWritten += writeRowChanges(
+                mDb, CHAR_ABILITIES_TBL_NAME, "char_id", "ability_id",
+                {}, charId,
+                old ? &old->abilities : nullptr, rows->abilities, true,
+                [](unsigned, int) {});
+
+    rowsWritten += writeRowChanges(
+                mDb, QUESTLOG_TBL_NAME, "char_id", "quest_id",
+                { "quest_state", "quest_title", "quest_description" },
+                charId,
+                old ? &old->quests : nullptr, rows->quests, true,
+                [this](unsigned index, const CharacterRows::Quest &quest) {
+        mDb->bindValue(index, quest.state);
+        mDb->bindValue(index + 1, quest.title);
+        mDb->bindValue(index + 2, quest.description);
+    });
+
+    rowsWritten += writeRowChanges(
+                mDb, INVENTORIES_TBL_NAME, "owner_id", "slot",
+                { "class_id", "amount", "equipped" }, charId,
+                old ? &old->inventory : nullptr, rows->inventory, true,
+                [this](unsigned index, const CharacterRows::Item &item) {
+        mDb->bindValue(index, item.itemId);
+        mDb->bindValue(index + 1, item.amount);
+        mDb->bindValue(index + 2, item.equipmentSlot);
+    });
+
+    rowsWritten += writeRowChanges(
+                mDb, CHAR_STATUS_EFFECTS_TBL_NAME, "char_id", "status_id",
+                { "status_time" }, charId,
+                old ? &old->statusEffects : nullptr, rows->statusEffects, true,
+                [this](unsigned index, int time) {
+        mDb->bindValue(index, time);
+    });
+
     transaction.commit();
+
+    if (remember)
+        mSavedCharacters[charId] = std::move(rows);
+
+    std::lock_guard<std::mutex> lock(mStatisticsMutex);
+    ++mCharacterSaves;
+    mCharacterSaveRows += rowsWritten;
+    mCharacterSaveMaxRows = std::max(mCharacterSaveMaxRows, rowsWritten);
+
     return true;
 }
 
 void Storage::addAccount(Account *account)
 {
+    Call call(this, __func__);
+
     assert(account->getCharacters().size() == 0);
 
     using namespace dal;
@@ -905,16 +1406,16 @@ void Storage::addAccount(Account *account)
         sql << "insert into " << ACCOUNTS_TBL_NAME
              << " (username, password, email, level, "
              << "banned, registration, lastlogin)"
-             << " VALUES (?, ?, ?, "
-             << account->getLevel() << ", 0, "
-             << account->getRegistrationDate() << ", "
-             << account->getLastLogin() << ");";
+             << " VALUES (?, ?, ?, ?, 0, ?, ?)";
 
         if (mDb->prepareSql(sql.str()))
         {
             mDb->bindValue(1, account->getName());
             mDb->bindValue(2, account->getPassword());
             mDb->bindValue(3, account->getEmail());
+            mDb->bindValue(4, account->getLevel());
+            mDb->bindValue(5, (int64_t) account->getRegistrationDate());
+            mDb->bindValue(6, (int64_t) account->getLastLogin());
 
             mDb->processSql();
             account->setID(mDb->getLastId());
@@ -931,8 +1432,22 @@ void Storage::addAccount(Account *account)
     }
 }
 
+/**
+ * Returns the ordering keys to wait for before writing or deleting the
+ * characters of \a account.
+ */
+static std::vector<int> accountKeys(const Account *account)
+{
+    std::vector<int> keys(1, Storage::SharedKey);
+    for (const auto &character : account->getCharacters())
+        keys.push_back(character.second->getDatabaseID());
+    return keys;
+}
+
 void Storage::flush(Account *account)
 {
+    Call call(this, __func__, accountKeys(account));
+
     assert(account->getID() >= 0);
 
     using namespace dal;
@@ -946,7 +1461,7 @@ void Storage::flush(Account *account)
         sqlUpdateAccountTable
              << "update " << ACCOUNTS_TBL_NAME
              << " set username = ?, password = ?, email = ?, "
-             << "level = ?, lastlogin = ? where id = ?;";
+             << "level = ?, lastlogin = ? where id = ?";
 
         if (mDb->prepareSql(sqlUpdateAccountTable.str()))
         {
@@ -954,7 +1469,7 @@ void Storage::flush(Account *account)
             mDb->bindValue(2, account->getPassword());
             mDb->bindValue(3, account->getEmail());
             mDb->bindValue(4, account->getLevel());
-            mDb->bindValue(5, account->getLastLogin());
+            mDb->bindValue(5, (int64_t) account->getLastLogin());
             mDb->bindValue(6, account->getID());
 
             mDb->processSql();
@@ -975,7 +1490,7 @@ void Storage::flush(Account *account)
             CharacterData *character = (*it).second;
             if (character->getDatabaseID() >= 0)
             {
-                updateCharacter(character);
+                writeCharacter(character, false);
             }
             else
             {
@@ -987,36 +1502,34 @@ void Storage::flush(Account *account)
                      << "insert into " << CHARACTERS_TBL_NAME
                      << " (user_id, name, gender, hair_style, hair_color,"
                      << " char_pts, correct_pts,"
-                     << " x, y, map_id, slot) values ("
-                     << account->getID() << ", ?, "
-                     << character->getGender() << ", "
-                     << (int)character->getHairStyle() << ", "
-                     << (int)character->getHairColor() << ", "
-                     << (int)character->getAttributePoints() << ", "
-                     << (int)character->getCorrectionPoints() << ", "
-                     << character->getPosition().x << ", "
-                     << character->getPosition().y << ", "
-                     << character->getMapId() << ", "
-                     << character->getCharacterSlot()
-                     << ");";
-
-                mDb->prepareSql(sqlInsertCharactersTable.str());
-                mDb->bindValue(1, character->getName());
+                     << " x, y, map_id, slot)"
+                     << " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+
+                if (!mDb->prepareSql(sqlInsertCharactersTable.str()))
+                {
+                    utils::throwError("(DALStorage::flush) "
+                                      "SQL preparation query failure #2.");
+                }
+                mDb->bindValue(1, account->getID());
+                mDb->bindValue(2, character->getName());
+                mDb->bindValue(3, character->getGender());
+                mDb->bindValue(4, character->getHairStyle());
+                mDb->bindValue(5, character->getHairColor());
+                mDb->bindValue(6, character->getAttributePoints());
+                mDb->bindValue(7, character->getCorrectionPoints());
+                mDb->bindValue(8, character->getPosition().x);
+                mDb->bindValue(9, character->getPosition().y);
+                mDb->bindValue(10, character->getMapId());
+                mDb->bindValue(11, (int) character->getCharacterSlot());
                 mDb->processSql();
 
                 // Update the character ID.
                 character->setDatabaseID(mDb->getLastId());
 
-                // Update all attributes.
-                AttributeMap::const_iterator attr_it, attr_end;
-                for (attr_it =  character->mAttributes.begin(),
-                     attr_end = character->mAttributes.end();
-                     attr_it != attr_end; ++attr_it)
-                {
-                    updateAttribute(character->getDatabaseID(), attr_it->first,
-                                    attr_it->second.base,
-                                    attr_it->second.modified);
-                }
+                // Insert all attributes.
+                CharacterWriteCache::Batch attributes;
+                addAttributes(attributes, character);
+                writeCharacterChanges(attributes);
             }
         }
 
@@ -1024,18 +1537,25 @@ void Storage::flush(Account *account)
         // or updated in database.
         // Now, let's remove those who are no more in memory from database.
 
-        string_to<unsigned short> toUint;
+        string_to<unsigned> toUint;
 
         std::ostringstream sqlSelectNameIdCharactersTable;
         sqlSelectNameIdCharactersTable
-            << "select name, id from " << CHARACTERS_TBL_NAME
-            << " where user_id = '" << account->getID() << "';";
+            << "SELECT name, id FROM " << CHARACTERS_TBL_NAME
+            << " WHERE user_id = ?";
+
+        if (!mDb->prepareSql(sqlSelectNameIdCharactersTable.str()))
+        {
+            utils::throwError("(DALStorage::flush) "
+                              "SQL preparation query failure #3.");
+        }
+        mDb->bindValue(1, account->getID());
 
-        const RecordSet& charInMemInfo =
-            mDb->execSql(sqlSelectNameIdCharactersTable.str());
+        const RecordSet& charInMemInfo = mDb->processSql();
 
         // We compare chars from memory and those existing in db,
         // and delete those not in mem but existing in db.
+        std::vector<unsigned> charsToDelete;
         bool charFound;
         for (unsigned i = 0; i < charInMemInfo.rows(); ++i) // In database
         {
@@ -1056,11 +1576,13 @@ void Storage::flush(Account *account)
                 // We store the id of the char to delete,
                 // because as deleted, the RecordSet is also emptied,
                 // and that creates an error.
-                unsigned charId = toUint(charInMemInfo(i, 1));
-                delCharacter(charId);
+                charsToDelete.push_back(toUint(charInMemInfo(i, 1)));
             }
         }
 
+        for (unsigned i = 0; i < charsToDelete.size(); ++i)
+            delCharacter(charsToDelete[i]);
+
         transaction.commit();
     }
     catch (const std::exception &e)
@@ -1071,6 +1593,8 @@ void Storage::flush(Account *account)
 
 void Storage::delAccount(Account *account)
 {
+    Call call(this, __func__, accountKeys(account));
+
     // Sync the account info into the database.
     flush(account);
 
@@ -1078,9 +1602,14 @@ void Storage::delAccount(Account *account)
     {
         // Delete the account.
         std::ostringstream sql;
-        sql << "delete from " << ACCOUNTS_TBL_NAME
-            << " where id = '" << account->getID() << "';";
-        mDb->execSql(sql.str());
+        sql << "DELETE FROM " << ACCOUNTS_TBL_NAME << " WHERE id = ?";
+        if (!mDb->prepareSql(sql.str()))
+        {
+            utils::throwError("(DALStorage::delAccount) "
+                              "SQL query preparation failure.");
+        }
+        mDb->bindValue(1, account->getID());
+        mDb->processSql();
 
         // Remove the account's characters.
         account->setCharacters(Characters());
@@ -1093,13 +1622,22 @@ void Storage::delAccount(Account *account)
 
 void Storage::updateLastLogin(const Account *account)
 {
+    Call call(this, __func__);
+
     try
     {
         std::ostringstream sql;
         sql << "UPDATE " << ACCOUNTS_TBL_NAME
-            << "   SET lastlogin = '" << account->getLastLogin() << "'"
-            << " WHERE id = '" << account->getID() << "';";
-        mDb->execSql(sql.str());
+            << "   SET lastlogin = ?"
+            << " WHERE id = ?";
+        if (!mDb->prepareSql(sql.str()))
+        {
+            utils::throwError("(DALStorage::updateLastLogin) "
+                              "SQL query preparation failure.");
+        }
+        mDb->bindValue(1, (int64_t) account->getLastLogin());
+        mDb->bindValue(2, account->getID());
+        mDb->processSql();
     }
     catch (const dal::DbSqlQueryExecFailure &e)
     {
@@ -1111,68 +1649,233 @@ void Storage::updateLastLogin(const Account *account)
 void Storage::updateCharacterPoints(int charId,
                                     int charPoints, int corrPoints)
 {
-    try
-    {
-        std::ostringstream sql;
-        sql << "UPDATE " << CHARACTERS_TBL_NAME
-            << " SET char_pts = " << charPoints << ", "
-            << " correct_pts = " << corrPoints
-            << " WHERE id = " << charId;
+    mWriteCache->setPoints(charId, charPoints, corrPoints);
+}
 
-        mDb->execSql(sql.str());
-    }
-    catch (dal::DbSqlQueryExecFailure &e)
+void Storage::updateAttribute(int charId, unsigned attrId,
+                              double base, double mod)
+{
+    mWriteCache->setAttribute(charId, attrId, base, mod);
+}
+
+void Storage::discardCharacterChanges(int charId)
+{
+    mWriteCache->discard(charId);
+}
+
+void Storage::flushCharacterChanges()
+{
+    auto batch = std::make_shared<CharacterWriteCache::Batch>();
+    if (!mWriteCache->takeBatch(*batch))
     {
-        utils::throwError("(DALStorage::updateCharacterPoints) "
-                          "SQL query failure: ", e);
+        // Write the new changes once the current batch is done
+        if (mWriteCache->isWriting())
+            mFlushRequested = true;
+        return;
     }
+
+    mFlushRequested = false;
+
+    async("flushCharacterChanges", [this, batch] {
+        try
+        {
+            Call call(this, "flushCharacterChanges");
+            dal::PerformTransaction transaction(mDb);
+            writeCharacterChanges(*batch);
+            transaction.commit();
+            mWriteCache->batchWritten();
+        }
+        catch (...)
+        {
+            mWriteCache->batchFailed(*batch);
+            throw;
+        }
+    }, [this] {
+        if (mFlushRequested)
+            flushCharacterChanges();
+    }, BackgroundKey);
 }
 
-void Storage::updateAttribute(int charId, unsigned attrId,
-                              double base, double mod)
+void Storage::writeCharacterChanges(const CharacterWriteCache::Batch &batch)
 {
     try
     {
         std::ostringstream sql;
-        sql << "UPDATE " << CHAR_ATTR_TBL_NAME
-            << " SET attr_base = '" << base << "', "
-            << "attr_mod = '" << mod << "' "
-            << "WHERE char_id = '" << charId << "' "
-            << "AND attr_id = '" << attrId << "';";
-        mDb->execSql(sql.str());
+        sql << "UPDATE " << CHARACTERS_TBL_NAME
+            << " SET char_pts = ?, correct_pts = ? WHERE id = ?";
+        const std::string updatePoints = sql.str();
 
-        // If this has modified a row, we're done, it updated sucessfully.
-        if (mDb->getModifiedRows() > 0)
-            return;
+        for (auto &it : batch.points)
+        {
+            if (!mDb->prepareSql(updatePoints))
+            {
+                utils::throwError("(DALStorage::writeCharacterChanges) "
+                                  "SQL query preparation failure #1.");
+            }
+            mDb->bindValue(1, it.second.charPoints);
+            mDb->bindValue(2, it.second.corrPoints);
+            mDb->bindValue(3, it.first);
+            mDb->processSql();
+        }
+
+        // The attributes are replaced by deleting and inserting them in
+        // chunks, since not every database has a unique key on them.
+        auto it = batch.attributes.begin();
+        const auto it_end = batch.attributes.end();
+        while (it != it_end)
+        {
+            const size_t rows = std::min<size_t>(
+                        ROWS_PER_STATEMENT,
+                        std::distance(it, it_end));
+
+            std::ostringstream deleteSql;
+            std::ostringstream insertSql;
+            deleteSql << "DELETE FROM " << CHAR_ATTR_TBL_NAME << " WHERE ";
+            insertSql << "INSERT INTO " << CHAR_ATTR_TBL_NAME
+                      << " (char_id, attr_id, attr_base, attr_mod) VALUES ";
+            for (size_t i = 0; i < rows; ++i)
+            {
+                deleteSql << (i ? " OR " : "")
+                          << "(char_id = ? AND attr_id = ?)";
+                insertSql << (i ? ", " : "") << "(?, ?, ?, ?)";
+            }
+
+            if (!mDb->prepareSql(deleteSql.str()))
+            {
+                utils::throwError("(DALStorage::writeCharacterChanges) "
+                                  "SQL query preparation failure #2.");
+            }
+            auto rowIt = it;
+            for (size_t i = 0; i < rows; ++i, ++rowIt)
+            {
+                mDb->bindValue(i * 2 + 1, rowIt->first.first);
+                mDb->bindValue(i * 2 + 2, (int) rowIt->first.second);
+            }
+            mDb->processSql();
+
+            if (!mDb->prepareSql(insertSql.str()))
+            {
+                utils::throwError("(DALStorage::writeCharacterChanges) "
+                                  "SQL query preparation failure #3.");
+            }
+            for (size_t i = 0; i < rows; ++i, ++it)
+            {
+                mDb->bindValue(i * 4 + 1, it->first.first);
+                mDb->bindValue(i * 4 + 2, (int) it->first.second);
+                mDb->bindValue(i * 4 + 3, it->second.base);
+                mDb->bindValue(i * 4 + 4, it->second.mod);
+            }
+            mDb->processSql();
+        }
+
+        // Keep the rows known for updateCharacter in sync
+        for (auto &it : batch.attributes)
+        {
+            auto savedIt = mSavedCharacters.find(it.first.first);
+            if (savedIt != mSavedCharacters.end())
+            {
+                CharacterRows::Attribute &attribute =
+                        savedIt->second->attributes[it.first.second];
+                attribute.base = it.second.base;
+                attribute.mod = it.second.mod;
+            }
+        }
+
+        // Same for the quest variables, an empty value only removes one
+        auto varIt = batch.questVars.begin();
+        const auto varIt_end = batch.questVars.end();
+        while (varIt != varIt_end)
+        {
+            const size_t rows = std::min<size_t>(
+                        ROWS_PER_STATEMENT,
+                        std::distance(varIt, varIt_end));
+
+            std::ostringstream deleteSql;
+            deleteSql << "DELETE FROM " << QUESTS_TBL_NAME << " WHERE ";
+            for (size_t i = 0; i < rows; ++i)
+            {
+                deleteSql << (i ? " OR " : "")
+                          << "(owner_id = ? AND name = ?)";
+            }
+
+            if (!mDb->prepareSql(deleteSql.str()))
+            {
+                utils::throwError("(DALStorage::writeCharacterChanges) "
+                                  "SQL query preparation failure #4.");
+            }
+            auto rowIt = varIt;
+            size_t values = 0;
+            for (size_t i = 0; i < rows; ++i, ++rowIt)
+            {
+                mDb->bindValue(i * 2 + 1, rowIt->first.first);
+                mDb->bindValue(i * 2 + 2, rowIt->first.second);
+                if (!rowIt->second.empty())
+                    ++values;
+            }
+            mDb->processSql();
+
+            if (values == 0)
+            {
+                varIt = rowIt;
+                continue;
+            }
+
+            std::ostringstream insertSql;
+            insertSql << "INSERT INTO " << QUESTS_TBL_NAME
+                      << " (owner_id, name, value) VALUES ";
+            for (size_t i = 0; i < values; ++i)
+                insertSql << (i ? ", " : "") << "(?, ?, ?)";
+
+            if (!mDb->prepareSql(insertSql.str()))
+            {
+                utils::throwError("(DALStorage::writeCharacterChanges) "
+                                  "SQL query preparation failure #5.");
+            }
+            size_t i = 0;
+            for (; varIt != rowIt; ++varIt)
+            {
+                if (varIt->second.empty())
+                    continue;
+                mDb->bindValue(i * 3 + 1, varIt->first.first);
+                mDb->bindValue(i * 3 + 2, varIt->first.second);
+                mDb->bindValue(i * 3 + 3, varIt->second);
+                ++i;
+            }
+            mDb->processSql();
+        }
 
-        // If it did not change anything,
-        // then the record didn't previously exist. Create it.
-        sql.clear();
-        sql.str("");
-        sql << "INSERT INTO " << CHAR_ATTR_TBL_NAME
-            << " (char_id, attr_id, attr_base, attr_mod) VALUES ( "
-            << charId << ", " << attrId << ", " << base << ", "
-            << mod << ")";
-        mDb->execSql(sql.str());
     }
     catch (const dal::DbSqlQueryExecFailure &e)
     {
-        utils::throwError("(DALStorage::updateAttribute) SQL query failure: ",
-                          e);
+        utils::throwError("(DALStorage::writeCharacterChanges) "
+                          "SQL query failure: ", e);
     }
 }
 
 void Storage::updateKillCount(int charId, int monsterId, int kills)
 {
+    Call call(this, __func__);
+
+    // Written behind the back of updateCharacter
+    mSavedCharacters.erase(charId);
+
     try
     {
         // Try to update the kill count
         std::ostringstream sql;
         sql << "UPDATE " << CHAR_KILL_COUNT_TBL_NAME
-            << " SET kills = " << kills
-            << " WHERE char_id = " << charId
-            << " AND monster_id = " << monsterId;
-        mDb->execSql(sql.str());
+            << " SET kills = ?"
+            << " WHERE char_id = ?"
+            << " AND monster_id = ?";
+        if (!mDb->prepareSql(sql.str()))
+        {
+            utils::throwError("(DALStorage::updateKillCount) "
+                              "SQL query preparation failure #1.");
+        }
+        mDb->bindValue(1, kills);
+        mDb->bindValue(2, charId);
+        mDb->bindValue(3, monsterId);
+        mDb->processSql();
 
         // Check if the update has modified a row
         if (mDb->getModifiedRows() > 0)
@@ -1181,11 +1884,16 @@ void Storage::updateKillCount(int charId, int monsterId, int kills)
         sql.clear();
         sql.str("");
         sql << "INSERT INTO " << CHAR_KILL_COUNT_TBL_NAME << " "
-            << "(char_id, monster_id, kills) VALUES ( "
-            << charId << ", "
-            << monsterId << ", "
-            << kills << ")";
-        mDb->execSql(sql.str());
+            << "(char_id, monster_id, kills) VALUES (?, ?, ?)";
+        if (!mDb->prepareSql(sql.str()))
+        {
+            utils::throwError("(DALStorage::updateKillCount) "
+                              "SQL query preparation failure #2.");
+        }
+        mDb->bindValue(1, charId);
+        mDb->bindValue(2, monsterId);
+        mDb->bindValue(3, kills);
+        mDb->processSql();
     }
     catch (const dal::DbSqlQueryExecFailure &e)
     {
@@ -1196,16 +1904,26 @@ void Storage::updateKillCount(int charId, int monsterId, int kills)
 
 void Storage::insertStatusEffect(int charId, int statusId, int time)
 {
+    Call call(this, __func__);
+
+    // Written behind the back of updateCharacter
+    mSavedCharacters.erase(charId);
+
     try
     {
         std::ostringstream sql;
 
-        sql << "insert into " << CHAR_STATUS_EFFECTS_TBL_NAME
-            << " (char_id, status_id, status_time) VALUES ( "
-            << charId << ", "
-            << statusId << ", "
-            << time << ")";
-        mDb->execSql(sql.str());
+        sql << "INSERT INTO " << CHAR_STATUS_EFFECTS_TBL_NAME
+            << " (char_id, status_id, status_time) VALUES (?, ?, ?)";
+        if (!mDb->prepareSql(sql.str()))
+        {
+            utils::throwError("(DALStorage::insertStatusEffect) "
+                              "SQL query preparation failure.");
+        }
+        mDb->bindValue(1, charId);
+        mDb->bindValue(2, statusId);
+        mDb->bindValue(3, time);
+        mDb->processSql();
     }
     catch (const dal::DbSqlQueryExecFailure &e)
     {
@@ -1216,6 +1934,8 @@ void Storage::insertStatusEffect(int charId, int statusId, int time)
 
 void Storage::addGuild(Guild *guild)
 {
+    Call call(this, __func__);
+
     try
     {
         std::ostringstream sqlQuery;
@@ -1260,13 +1980,19 @@ void Storage::addGuild(Guild *guild)
 
 void Storage::removeGuild(Guild *guild)
 {
+    Call call(this, __func__);
+
     try
     {
         std::ostringstream sql;
-        sql << "delete from " << GUILDS_TBL_NAME
-            << " where id = '"
-            << guild->getId() << "';";
-        mDb->execSql(sql.str());
+        sql << "DELETE FROM " << GUILDS_TBL_NAME << " WHERE id = ?";
+        if (!mDb->prepareSql(sql.str()))
+        {
+            utils::throwError("(DALStorage::removeGuild) "
+                              "SQL query preparation failure.");
+        }
+        mDb->bindValue(1, guild->getId());
+        mDb->processSql();
     }
     catch (const dal::DbSqlQueryExecFailure &e)
     {
@@ -1276,16 +2002,22 @@ void Storage::removeGuild(Guild *guild)
 
 void Storage::addGuildMember(int guildId, int memberId)
 {
+    Call call(this, __func__);
+
     try
     {
         std::ostringstream sql;
-        sql << "insert into " << GUILD_MEMBERS_TBL_NAME
+        sql << "INSERT INTO " << GUILD_MEMBERS_TBL_NAME
         << " (guild_id, member_id, rights)"
-        << " values ("
-        << guildId << ", \""
-        << memberId << "\", "
-        << 0 << ");";
-        mDb->execSql(sql.str());
+        << " VALUES (?, ?, 0)";
+        if (!mDb->prepareSql(sql.str()))
+        {
+            utils::throwError("(DALStorage::addGuildMember) "
+                              "SQL query preparation failure.");
+        }
+        mDb->bindValue(1, guildId);
+        mDb->bindValue(2, memberId);
+        mDb->processSql();
     }
     catch (const dal::DbSqlQueryExecFailure& e)
     {
@@ -1296,14 +2028,21 @@ void Storage::addGuildMember(int guildId, int memberId)
 
 void Storage::removeGuildMember(int guildId, int memberId)
 {
+    Call call(this, __func__);
+
     try
     {
         std::ostringstream sql;
-        sql << "delete from " << GUILD_MEMBERS_TBL_NAME
-        << " where member_id = \""
-        << memberId << "\" and guild_id = '"
-        << guildId << "';";
-        mDb->execSql(sql.str());
+        sql << "DELETE FROM " << GUILD_MEMBERS_TBL_NAME
+        << " WHERE member_id = ? AND guild_id = ?";
+        if (!mDb->prepareSql(sql.str()))
+        {
+            utils::throwError("(DALStorage::removeGuildMember) "
+                              "SQL query preparation failure.");
+        }
+        mDb->bindValue(1, memberId);
+        mDb->bindValue(2, guildId);
+        mDb->processSql();
     }
     catch (const dal::DbSqlQueryExecFailure& e)
     {
@@ -1315,18 +2054,25 @@ void Storage::removeGuildMember(int guildId, int memberId)
 void Storage::addFloorItem(int mapId, int itemId, int amount,
                            int posX, int posY)
 {
+    Call call(this, __func__);
+
     try
     {
         std::ostringstream sql;
         sql << "INSERT INTO " << FLOOR_ITEMS_TBL_NAME
         << " (map_id, item_id, amount, pos_x, pos_y)"
-        << " VALUES ("
-        << mapId << ", "
-        << itemId << ", "
-        << amount << ", "
-        << posX << ", "
-        << posY << ");";
-        mDb->execSql(sql.str());
+        << " VALUES (?, ?, ?, ?, ?)";
+        if (!mDb->prepareSql(sql.str()))
+        {
+            utils::throwError("(DALStorage::addFloorItem) "
+                              "SQL query preparation failure.");
+        }
+        mDb->bindValue(1, mapId);
+        mDb->bindValue(2, itemId);
+        mDb->bindValue(3, amount);
+        mDb->bindValue(4, posX);
+        mDb->bindValue(5, posY);
+        mDb->processSql();
     }
     catch (const dal::DbSqlQueryExecFailure& e)
     {
@@ -1337,17 +2083,25 @@ void Storage::addFloorItem(int mapId, int itemId, int amount,
 void Storage::removeFloorItem(int mapId, int itemId, int amount,
                                 int posX, int posY)
 {
+    Call call(this, __func__);
+
     try
     {
         std::ostringstream sql;
         sql << "DELETE FROM " << FLOOR_ITEMS_TBL_NAME
-        << " WHERE map_id = "
-        << mapId << " AND item_id = "
-        << itemId << " AND amount = "
-        << amount << " AND pos_x = "
-        << posX << " AND pos_y = "
-        << posY << ";";
-        mDb->execSql(sql.str());
+        << " WHERE map_id = ? AND item_id = ? AND amount = ?"
+        << " AND pos_x = ? AND pos_y = ?";
+        if (!mDb->prepareSql(sql.str()))
+        {
+            utils::throwError("(DALStorage::removeFloorItem) "
+                              "SQL query preparation failure.");
+        }
+        mDb->bindValue(1, mapId);
+        mDb->bindValue(2, itemId);
+        mDb->bindValue(3, amount);
+        mDb->bindValue(4, posX);
+        mDb->bindValue(5, posY);
+        mDb->processSql();
     }
     catch (const dal::DbSqlQueryExecFailure& e)
     {
@@ -1358,16 +2112,24 @@ void Storage::removeFloorItem(int mapId, int itemId, int amount,
 
 std::list<FloorItem> Storage::getFloorItemsFromMap(int mapId)
 {
+    Call call(this, __func__);
+
     std::list<FloorItem> floorItems;
 
     try
     {
         std::ostringstream sql;
         sql << "SELECT * FROM " << FLOOR_ITEMS_TBL_NAME
-        << " WHERE map_id = " << mapId;
+        << " WHERE map_id = ?";
+        if (!mDb->prepareSql(sql.str()))
+        {
+            utils::throwError("(DALStorage::getFloorItemsFromMap) "
+                              "SQL query preparation failure.");
+        }
+        mDb->bindValue(1, mapId);
 
         string_to< unsigned > toUint;
-        const dal::RecordSet &itemInfo = mDb->execSql(sql.str());
+        const dal::RecordSet &itemInfo = mDb->processSql();
         if (!itemInfo.isEmpty())
         {
             for (int k = 0, size = itemInfo.rows(); k < size; ++k)
@@ -1390,14 +2152,24 @@ std::list<FloorItem> Storage::getFloorItemsFromMap(int mapId)
 
 void Storage::setMemberRights(int guildId, int memberId, int rights)
 {
+    Call call(this, __func__);
+
     try
     {
         std::ostringstream sql;
         sql << "UPDATE " << GUILD_MEMBERS_TBL_NAME
-            << " SET rights = " << rights
-            << " WHERE member_id = " << memberId
-            << "  AND guild_id = " << guildId << ";";
-        mDb->execSql(sql.str());
+            << " SET rights = ?"
+            << " WHERE member_id = ?"
+            << "  AND guild_id = ?";
+        if (!mDb->prepareSql(sql.str()))
+        {
+            utils::throwError("(DALStorage::setMemberRights) "
+                              "SQL query preparation failure.");
+        }
+        mDb->bindValue(1, rights);
+        mDb->bindValue(2, memberId);
+        mDb->bindValue(3, guildId);
+        mDb->processSql();
     }
     catch (const dal::DbSqlQueryExecFailure& e)
     {
@@ -1408,6 +2180,8 @@ void Storage::setMemberRights(int guildId, int memberId, int rights)
 
 std::map<int, Guild*> Storage::getGuildList()
 {
+    Call call(this, __func__);
+
     std::map<int, Guild*> guilds;
     std::stringstream sql;
     string_to<short> toShort;
@@ -1437,10 +2211,16 @@ std::map<int, Guild*> Storage::getGuildList()
              it != guilds.end(); ++it)
         {
             std::ostringstream memberSql;
-            memberSql << "select member_id, rights from "
+            memberSql << "SELECT member_id, rights FROM "
                       << GUILD_MEMBERS_TBL_NAME
-                      << " where guild_id = '" << it->second->getId() << "';";
-            const dal::RecordSet& memberInfo = mDb->execSql(memberSql.str());
+                      << " WHERE guild_id = ?";
+            if (!mDb->prepareSql(memberSql.str()))
+            {
+                utils::throwError("(DALStorage::getGuildList) "
+                                  "SQL query preparation failure.");
+            }
+            mDb->bindValue(1, it->second->getId());
+            const dal::RecordSet& memberInfo = mDb->processSql();
 
             std::list<std::pair<int, int> > members;
             for (unsigned j = 0; j < memberInfo.rows(); ++j)
@@ -1471,6 +2251,12 @@ std::map<int, Guild*> Storage::getGuildList()
 
 std::string Storage::getQuestVar(int id, const std::string &name)
 {
+    std::string value;
+    if (mWriteCache->getQuestVar(id, name, value))
+        return value;
+
+    Call call(this, __func__, id);
+
     try
     {
         std::ostringstream query;
@@ -1502,6 +2288,8 @@ std::string Storage::getQuestVar(int id, const std::string &name)
 
 std::string Storage::getWorldStateVar(const std::string &name, int mapId)
 {
+    Call call(this, __func__);
+
     try
     {
         std::ostringstream query;
@@ -1542,6 +2330,8 @@ std::string Storage::getWorldStateVar(const std::string &name, int mapId)
 
 std::map<std::string, std::string> Storage::getAllWorldStateVars(int mapId)
 {
+    Call call(this, __func__);
+
     std::map<std::string, std::string> variables;
 
     // Avoid a crash because prepared statements must have at least one binding.
@@ -1594,6 +2384,13 @@ void Storage::setWorldStateVar(const std::string &name,
                                const std::string &value,
                                int mapId)
 {
+    if (deferToDatabaseThread(__func__, [=] {
+        setWorldStateVar(name, value, mapId);
+    }))
+        return;
+
+    Call call(this, __func__);
+
     try
     {
         // Set the value to empty means: delete the variable
@@ -1601,20 +2398,36 @@ void Storage::setWorldStateVar(const std::string &name,
         {
             std::ostringstream deleteStateVar;
             deleteStateVar << "DELETE FROM " << WORLD_STATES_TBL_NAME
-                           << " WHERE state_name = '" << name << "'"
-                           << " AND map_id = '" << mapId << "';";
-            mDb->execSql(deleteStateVar.str());
+                           << " WHERE state_name = ?"
+                           << " AND map_id = ?";
+            if (!mDb->prepareSql(deleteStateVar.str()))
+            {
+                utils::throwError("(DALStorage::setWorldStateVar) "
+                                  "SQL query preparation failure #1.");
+            }
+            mDb->bindValue(1, name);
+            mDb->bindValue(2, mapId);
+            mDb->processSql();
             return;
         }
 
         // Try to update the variable in the database
         std::ostringstream updateStateVar;
         updateStateVar << "UPDATE " << WORLD_STATES_TBL_NAME
-                       << "   SET value = '" << value << "', "
-                       << "       moddate = '" << time(0) << "' "
-                       << " WHERE state_name = '" << name << "'"
-                       << " AND map_id = '" << mapId << "';";
-        mDb->execSql(updateStateVar.str());
+                       << "   SET value = ?, "
+                       << "       moddate = ? "
+                       << " WHERE state_name = ?"
+                       << " AND map_id = ?";
+        if (!mDb->prepareSql(updateStateVar.str()))
+        {
+            utils::throwError("(DALStorage::setWorldStateVar) "
+                              "SQL query preparation failure #2.");
+        }
+        mDb->bindValue(1, value);
+        mDb->bindValue(2, (int64_t) time(0));
+        mDb->bindValue(3, name);
+        mDb->bindValue(4, mapId);
+        mDb->processSql();
 
         // If we updated a row, were finished here
         if (mDb->getModifiedRows() > 0)
@@ -1623,12 +2436,18 @@ void Storage::setWorldStateVar(const std::string &name,
         // Otherwise we have to add the new variable
         std::ostringstream insertStateVar;
         insertStateVar << "INSERT INTO " << WORLD_STATES_TBL_NAME
-                       << " (state_name, map_id, value , moddate) VALUES ("
-                       << "'" << name << "', "
-                       << "'" << mapId << "', "
-                       << "'" << value << "', "
-                       << "'" << time(0) << "');";
-        mDb->execSql(insertStateVar.str());
+                       << " (state_name, map_id, value , moddate)"
+                       << " VALUES (?, ?, ?, ?)";
+        if (!mDb->prepareSql(insertStateVar.str()))
+        {
+            utils::throwError("(DALStorage::setWorldStateVar) "
+                              "SQL query preparation failure #3.");
+        }
+        mDb->bindValue(1, name);
+        mDb->bindValue(2, mapId);
+        mDb->bindValue(3, value);
+        mDb->bindValue(4, (int64_t) time(0));
+        mDb->processSql();
     }
     catch (const dal::DbSqlQueryExecFailure &e)
     {
@@ -1640,147 +2459,285 @@ void Storage::setWorldStateVar(const std::string &name,
 void Storage::setQuestVar(int id, const std::string &name,
                           const std::string &value)
 {
+    mWriteCache->setQuestVar(id, name, value);
+}
+
+void Storage::banCharacter(int id, int duration)
+{
+    if (deferToDatabaseThread(__func__, [=] { banCharacter(id, duration); }))
+        return;
+
+    Call call(this, __func__);
+
     try
     {
-        std::ostringstream query1;
-        query1 << "delete from " << QUESTS_TBL_NAME
-               << " where owner_id = '" << id << "' and name = '"
-               << name << "';";
-        mDb->execSql(query1.str());
-
-        if (value.empty())
+        // check the account of the character
+        std::ostringstream query;
+        query << "SELECT user_id FROM " << CHARACTERS_TBL_NAME
+              << " WHERE id = ?";
+        if (!mDb->prepareSql(query.str()))
+        {
+            utils::throwError("(DALStorage::banCharacter) "
+                              "SQL query preparation failure #1.");
+        }
+        mDb->bindValue(1, id);
+        const dal::RecordSet &info = mDb->processSql();
+        if (info.isEmpty())
+        {
+            LOG_ERROR("Tried to ban an unknown user.");
             return;
+        }
+        const std::string accountId = info(0, 0);
+
+        uint64_t bantime = (uint64_t)time(0) + (uint64_t)duration * 60u;
+        // ban the character
+        std::ostringstream sql;
+        sql << "UPDATE " << ACCOUNTS_TBL_NAME
+            << " SET level = ?, banned = ? WHERE id = ?";
+        if (!mDb->prepareSql(sql.str()))
+        {
+            utils::throwError("(DALStorage::banCharacter) "
+                              "SQL query preparation failure #2.");
+        }
+        mDb->bindValue(1, AL_BANNED);
+        mDb->bindValue(2, (int64_t) bantime);
+        mDb->bindValue(3, utils::stringToInt(accountId));
+        mDb->processSql();
 
-        std::ostringstream query2;
-        query2 << "insert into " << QUESTS_TBL_NAME
-               << " (owner_id, name, value) values ('"
-               << id << "', '" << name << "', '" << value << "');";
-        mDb->execSql(query2.str());
+        scheduleUnban(utils::stringToInt(accountId), bantime);
     }
     catch (const dal::DbSqlQueryExecFailure &e)
     {
-        utils::throwError("(DALStorage::setQuestVar) SQL query failure: ", e);
+        utils::throwError("(DALStorage::banAccount) SQL query failure: ", e);
     }
 }
 
-void Storage::banCharacter(int id, int duration)
+void Storage::delCharacter(int charId) const
 {
+    Call call(this, __func__, std::vector<int> { SharedKey, charId });
+
+    mWriteCache->discard(charId);
+    mWriteCache->discardQuestVars(charId);
+    mSavedCharacters.erase(charId);
+
+    // Tables referencing the character, and the character itself last
+    static const struct {
+        const char *table;
+        const char *column;
+    } references[] = {
+        { INVENTORIES_TBL_NAME,     "owner_id" },  // The inventory
+        { QUESTS_TBL_NAME,          "owner_id" },  // The quests
+        { GUILD_MEMBERS_TBL_NAME,   "member_id" }, // Guild memberships
+        { AUCTION_TBL_NAME,         "char_id" },   // Auctions of the character
+        { AUCTION_BIDS_TBL_NAME,    "char_id" },   // Bids made by the character
+        { CHARACTERS_TBL_NAME,      "id" }         // The character itself
+    };
+
     try
     {
-        // check the account of the character
-        std::ostringstream query;
-        query << "select user_id from " << CHARACTERS_TBL_NAME
-              << " where id = '" << id << "';";
-        const dal::RecordSet &info = mDb->execSql(query.str());
-        if (info.isEmpty())
+        dal::PerformTransaction transaction(mDb);
+
+        for (unsigned i = 0; i < sizeof(references) / sizeof(references[0]);
+             ++i)
         {
-            LOG_ERROR("Tried to ban an unknown user.");
-            return;
+            std::ostringstream sql;
+            sql << "DELETE FROM " << references[i].table
+                << " WHERE " << references[i].column << " = ?";
+            if (!mDb->prepareSql(sql.str()))
+            {
+                utils::throwError("(DALStorage::delCharacter) "
+                                  "SQL query preparation failure.");
+            }
+            mDb->bindValue(1, charId);
+            mDb->processSql();
+        }
+
+        transaction.commit();
+    }
+    catch (const dal::DbSqlQueryExecFailure &e)
+    {
+        utils::throwError("(DALStorage::delCharacter) SQL query failure: ", e);
+    }
+}
+
+void Storage::delCharacter(CharacterData *character) const
+{
+    Call call(this, __func__,
+              std::vector<int> { SharedKey, character->getDatabaseID() });
+
+    delCharacter(character->getDatabaseID());
+}
+
+void Storage::loadBans()
+{
+    Call call(this, __func__);
+
+    try
+    {
+        std::ostringstream sql;
+        sql << "SELECT id, banned FROM " << ACCOUNTS_TBL_NAME
+            << " WHERE level = ?";
+        if (!mDb->prepareSql(sql.str()))
+        {
+            utils::throwError("(DALStorage::loadBans) "
+                              "SQL query preparation failure.");
         }
+        mDb->bindValue(1, AL_BANNED);
 
-        uint64_t bantime = (uint64_t)time(0) + (uint64_t)duration * 60u;
-        // ban the character
-        std::ostringstream sql;
-        sql << "update " << ACCOUNTS_TBL_NAME
-            << " set level = '" << AL_BANNED << "', banned = '"
-            << bantime
-            << "' where id = '" << info(0, 0) << "';";
-        mDb->execSql(sql.str());
+        while (mDb->fetchRow())
+            scheduleUnban(mDb->getInt(0), mDb->getInt(1));
     }
     catch (const dal::DbSqlQueryExecFailure &e)
     {
-        utils::throwError("(DALStorage::banAccount) SQL query failure: ", e);
+        utils::throwError("(DALStorage::loadBans) SQL query failure: ", e);
     }
+
+    LOG_INFO(mBanExpiryByAccount.size() << " accounts are banned.");
 }
 
-void Storage::delCharacter(int charId) const
+void Storage::scheduleUnban(int accountId, time_t expiry)
 {
-    try
-    {
-        dal::PerformTransaction transaction(mDb);
-        std::ostringstream sql;
+    std::lock_guard<std::mutex> lock(mBanMutex);
+    mBanExpiryByAccount[accountId] = expiry;
+    mBanExpiries.push(BanExpiry(expiry, accountId));
+}
 
-        // Delete the inventory of the character
-        sql << "DELETE FROM " << INVENTORIES_TBL_NAME
-            << " WHERE owner_id = '" << charId << "';";
-        mDb->execSql(sql.str());
+void Storage::checkBannedAccounts()
+{
+    std::vector<int> expired;
+    {
+        std::lock_guard<std::mutex> lock(mBanMutex);
+        const time_t now = time(0);
 
-        // Delete from the quests table
-        sql.clear();
-        sql.str("");
-        sql << "DELETE FROM " << QUESTS_TBL_NAME
-            << " WHERE owner_id = '" << charId << "';";
-        mDb->execSql(sql.str());
+        while (!mBanExpiries.empty() && mBanExpiries.top().first <= now)
+        {
+            const BanExpiry ban = mBanExpiries.top();
+            mBanExpiries.pop();
 
-        // Delete from the guilds table
-        sql.clear();
-        sql.str("");
-        sql << "DELETE FROM " << GUILD_MEMBERS_TBL_NAME
-            << " WHERE member_id = '" << charId << "';";
-        mDb->execSql(sql.str());
+            auto it = mBanExpiryByAccount.find(ban.second);
+            if (it != mBanExpiryByAccount.end() && it->second == ban.first)
+            {
+                expired.push_back(ban.second);
+                mBanExpiryByAccount.erase(it);
+            }
+        }
+    }
 
-        // Delete auctions of the character
-        sql.clear();
-        sql.str("");
-        sql << "DELETE FROM " << AUCTION_TBL_NAME
-            << " WHERE char_id = '" << charId << "';";
-        mDb->execSql(sql.str());
+    if (!expired.empty())
+        unbanAccounts(expired);
+}
 
-        // Delete bids made on auctions made by the character
-        sql.clear();
-        sql.str("");
-        sql << "DELETE FROM " << AUCTION_BIDS_TBL_NAME
-            << " WHERE char_id = '" << charId << "';";
-        mDb->execSql(sql.str());
+void Storage::unbanAccounts(const std::vector<int> &accountIds)
+{
+    if (deferToDatabaseThread(__func__, [=] { unbanAccounts(accountIds); }))
+        return;
 
-        // Now delete the character itself.
-        sql.clear();
-        sql.str("");
-        sql << "DELETE FROM " << CHARACTERS_TBL_NAME
-            << " WHERE id = '" << charId << "';";
-        mDb->execSql(sql.str());
+    Call call(this, __func__);
 
-        transaction.commit();
+    try
+    {
+        // The conditions on the ban leave alone the accounts that were
+        // banned again or got another level in the meantime
+        for (size_t start = 0; start < accountIds.size();
+             start += ROWS_PER_STATEMENT)
+        {
+            const size_t count = std::min(ROWS_PER_STATEMENT,
+                                          accountIds.size() - start);
+            std::ostringstream sql;
+            sql << "UPDATE " << ACCOUNTS_TBL_NAME
+                << " SET level = ?, banned = 0"
+                << " WHERE level = ? AND banned <= ? AND id IN (";
+            for (size_t i = 0; i < count; ++i)
+                sql << (i ? ", ?" : "?");
+            sql << ")";
+
+            if (!mDb->prepareSql(sql.str()))
+            {
+                utils::throwError("(DALStorage::unbanAccounts) "
+                                  "SQL query preparation failure.");
+            }
+            mDb->bindValue(1, AL_PLAYER);
+            mDb->bindValue(2, AL_BANNED);
+            mDb->bindValue(3, (int64_t) time(0));
+            for (size_t i = 0; i < count; ++i)
+                mDb->bindValue(i + 4, accountIds[start + i]);
+            mDb->processSql();
+        }
     }
     catch (const dal::DbSqlQueryExecFailure &e)
     {
-        utils::throwError("(DALStorage::delCharacter) SQL query failure: ", e);
+        utils::throwError("(DALStorage::unbanAccounts) "
+                          "SQL query failure: ", e);
     }
 }
 
-void Storage::delCharacter(CharacterData *character) const
+void Storage::sweepBannedAccounts()
 {
-    delCharacter(character->getDatabaseID());
-}
+    if (deferToDatabaseThread(__func__, [this] { sweepBannedAccounts(); }))
+        return;
+
+    Call call(this, __func__);
 
-void Storage::checkBannedAccounts()
-{
     try
     {
-        // Update expired bans
+        // Update expired bans, uses the index on level and banned
         std::ostringstream sql;
-        sql << "update " << ACCOUNTS_TBL_NAME
-        << " set level = " << AL_PLAYER << ", banned = 0"
-        << " where level = " << AL_BANNED
-        << " AND banned <= " << time(0) << ";";
-        mDb->execSql(sql.str());
+        sql << "UPDATE " << ACCOUNTS_TBL_NAME
+        << " SET level = ?, banned = 0"
+        << " WHERE level = ?"
+        << " AND banned <= ?";
+        if (!mDb->prepareSql(sql.str()))
+        {
+            utils::throwError("(DALStorage::sweepBannedAccounts) "
+                              "SQL query preparation failure.");
+        }
+        mDb->bindValue(1, AL_PLAYER);
+        mDb->bindValue(2, AL_BANNED);
+        mDb->bindValue(3, (int64_t) time(0));
+        mDb->processSql();
     }
     catch (const dal::DbSqlQueryExecFailure &e)
     {
-        utils::throwError("(DALStorage::checkBannedAccounts) "
+        utils::throwError("(DALStorage::sweepBannedAccounts) "
                           "SQL query failure: ", e);
     }
 }
 
+void Storage::checkpoint()
+{
+    if (deferToDatabaseThread(__func__, [this] { checkpoint(); }))
+        return;
+
+    Call call(this, __func__);
+
+    mDb->checkpoint();
+}
+
 void Storage::setAccountLevel(int id, int level)
 {
+    Call call(this, __func__);
+
     try
     {
         std::ostringstream sql;
-        sql << "update " << ACCOUNTS_TBL_NAME
-        << " set level = " << level
-        << " where id = " << id << ";";
-        mDb->execSql(sql.str());
+        sql << "UPDATE " << ACCOUNTS_TBL_NAME
+        << " SET level = ?"
+        << " WHERE id = ?";
+        if (!mDb->prepareSql(sql.str()))
+        {
+            utils::throwError("(DALStorage::setAccountLevel) "
+                              "SQL query preparation failure.");
+        }
+        mDb->bindValue(1, level);
+        mDb->bindValue(2, id);
+        mDb->processSql();
+
+        // A ban lifted early does not need to be lifted again
+        if (level != AL_BANNED)
+        {
+            std::lock_guard<std::mutex> lock(mBanMutex);
+            mBanExpiryByAccount.erase(id);
+        }
     }
     catch (const dal::DbSqlQueryExecFailure &e)
     {
@@ -1791,53 +2748,91 @@ void Storage::setAccountLevel(int id, int level)
 
 void Storage::storeLetter(Letter *letter)
 {
+    Call call(this, __func__);
+
     try
     {
         std::ostringstream sql;
         if (letter->getId() == 0)
         {
             // The letter was never saved before
-            sql << "INSERT INTO " << POST_TBL_NAME << " VALUES ( "
-                << "NULL, "
-                << letter->getSender()->getDatabaseID() << ", "
-                << letter->getReceiver()->getDatabaseID() << ", "
-                << letter->getExpiry() << ", "
-                << time(0) << ", "
-                << "?)";
-            if (mDb->prepareSql(sql.str()))
-            {
-                mDb->bindValue(1, letter->getContents());
-                mDb->processSql();
-
-                letter->setId(mDb->getLastId());
-
-                // TODO: Store attachments in the database
+            dal::PerformTransaction transaction(mDb);
 
-                return;
-            }
-            else
+            sql << "INSERT INTO " << POST_TBL_NAME
+                << " (sender_id, receiver_id, letter_type, expiration_date,"
+                << "  sending_date, letter_text)"
+                << " VALUES (?, ?, ?, ?, ?, ?)";
+            if (!mDb->prepareSql(sql.str()))
             {
                 utils::throwError("(DALStorage::storeLetter) "
                                   "SQL query preparation failure #1.");
             }
+            mDb->bindValue(1, letter->getSenderId());
+            mDb->bindValue(2, letter->getReceiverId());
+            mDb->bindValue(3, (int) letter->getType());
+            mDb->bindValue(4, (int64_t) letter->getExpiry());
+            mDb->bindValue(5, (int64_t) time(0));
+            mDb->bindValue(6, letter->getContents());
+            mDb->processSql();
+
+            const unsigned letterId = mDb->getLastId();
+
+            // Each attachment is kept as an item instance
+            for (const InventoryItem &item : letter->getAttachments())
+            {
+                sql.clear();
+                sql.str("");
+                sql << "INSERT INTO " << ITEM_INSTANCES_TBL_NAME
+                    << " (itemclass_id, amount) VALUES (?, ?)";
+                if (!mDb->prepareSql(sql.str()))
+                {
+                    utils::throwError("(DALStorage::storeLetter) "
+                                      "SQL query preparation failure #2.");
+                }
+                mDb->bindValue(1, (int) item.itemId);
+                mDb->bindValue(2, (int) item.amount);
+                mDb->processSql();
+
+                const unsigned itemId = mDb->getLastId();
+
+                sql.clear();
+                sql.str("");
+                sql << "INSERT INTO " << POST_ATTACHMENTS_TBL_NAME
+                    << " (letter_id, item_id) VALUES (?, ?)";
+                if (!mDb->prepareSql(sql.str()))
+                {
+                    utils::throwError("(DALStorage::storeLetter) "
+                                      "SQL query preparation failure #3.");
+                }
+                mDb->bindValue(1, (int64_t) letterId);
+                mDb->bindValue(2, (int64_t) itemId);
+                mDb->processSql();
+            }
+
+            transaction.commit();
+            letter->setId(letterId);
         }
         else
         {
             // The letter has a unique id, update the record in the db
             sql << "UPDATE " << POST_TBL_NAME
-                << "   SET sender_id       = '"
-                << letter->getSender()->getDatabaseID() << "', "
-                << "       receiver_id     = '"
-                << letter->getReceiver()->getDatabaseID() << "', "
-                << "       letter_type     = '" << letter->getType() << "', "
-                << "       expiration_date = '" << letter->getExpiry() << "', "
-                << "       sending_date    = '" << time(0) << "', "
-                << "       letter_text = ? "
-                << " WHERE letter_id       = '" << letter->getId() << "'";
+                << "   SET sender_id       = ?, "
+                << "       receiver_id     = ?, "
+                << "       letter_type     = ?, "
+                << "       expiration_date = ?, "
+                << "       sending_date    = ?, "
+                << "       letter_text     = ? "
+                << " WHERE letter_id       = ?";
 
             if (mDb->prepareSql(sql.str()))
             {
-                mDb->bindValue(1, letter->getContents());
+                mDb->bindValue(1, letter->getSenderId());
+                mDb->bindValue(2, letter->getReceiverId());
+                mDb->bindValue(3, (int) letter->getType());
+                mDb->bindValue(4, (int64_t) letter->getExpiry());
+                mDb->bindValue(5, (int64_t) time(0));
+                mDb->bindValue(6, letter->getContents());
+                mDb->bindValue(7, (int64_t) letter->getId());
 
                 mDb->processSql();
 
@@ -1848,12 +2843,12 @@ void Storage::storeLetter(Letter *letter)
                                       "trying to update nonexistant letter.");
                 }
 
-                // TODO: Update attachments in the database
+                // Attachments are not changed after the letter was sent
             }
             else
             {
                 utils::throwError("(DALStorage::storeLetter) "
-                                  "SQL query preparation failure #2.");
+                                  "SQL query preparation failure #4.");
             }
         }
     }
@@ -1863,79 +2858,283 @@ void Storage::storeLetter(Letter *letter)
     }
 }
 
-Post *Storage::getStoredPost(int playerId)
+Post *Storage::getStoredPost(int playerId, unsigned maxLetters)
 {
+    Call call(this, __func__);
+
     Post *p = new Post();
+    if (maxLetters == 0)
+        return p;
 
     string_to< unsigned > toUint;
+    string_to< int64_t > toInt64;
 
     try
     {
+        // Uses the index on the receiver, which also orders by letter id
         std::ostringstream sql;
-        sql << "SELECT * FROM " << POST_TBL_NAME
-            << " WHERE receiver_id = " << playerId;
-
-        const dal::RecordSet &post = mDb->execSql(sql.str());
-
-        if (post.isEmpty())
+        sql << "SELECT letter_id, sender_id, letter_type, expiration_date,"
+            << "       letter_text"
+            << "  FROM " << POST_TBL_NAME
+            << " WHERE receiver_id = ?"
+            << "   AND (expiration_date = 0 OR expiration_date > ?)"
+            << " ORDER BY letter_id"
+            << " LIMIT " << maxLetters;
+        if (!mDb->prepareSql(sql.str()))
         {
-            // There is no post waiting for the character
-            return p;
+            utils::throwError("(DALStorage::getStoredPost) "
+                              "SQL query preparation failure.");
         }
+        mDb->bindValue(1, playerId);
+        mDb->bindValue(2, (int64_t) time(0));
+
+        const dal::RecordSet &post = mDb->processSql();
 
         for (unsigned i = 0; i < post.rows(); i++ )
         {
-            // Load sender and receiver
-            CharacterData *sender = getCharacter(toUint(post(i, 1)), 0);
-            CharacterData *receiver = getCharacter(toUint(post(i, 2)), 0);
-
-            Letter *letter = new Letter(toUint( post(0,3) ), sender, receiver);
+            Letter *letter = new Letter(toUint(post(i, 2)),
+                                        toUint(post(i, 1)), playerId);
 
-            letter->setId( toUint(post(0, 0)) );
-            letter->setExpiry( toUint(post(0, 4)) );
-            letter->addText( post(0, 6) );
-
-            // TODO: Load attachments per letter from POST_ATTACHMENTS_TBL_NAME
-            // needs redesign of struct ItemInventroy
+            letter->setId( toUint(post(i, 0)) );
+            letter->setExpiry( toInt64(post(i, 3)) );
+            letter->addText( post(i, 4) );
 
             p->addLetter(letter);
         }
     }
     catch (const std::exception &e)
     {
+        delete p;
         utils::throwError("(DALStorage::getStoredPost) Exception failure: ", e);
     }
 
     return p;
 }
 
-void Storage::deletePost(Letter *letter)
+void Storage::loadAttachments(Post *post)
 {
+    Call call(this, __func__);
+
+    std::map<unsigned, Letter *> letters;
+    for (unsigned i = 0; i < post->getNumberOfLetters(); ++i)
+    {
+        Letter *letter = post->getLetter(i);
+        letters[letter->getId()] = letter;
+    }
+
+    string_to< unsigned > toUint;
+
+    try
+    {
+        auto it = letters.begin();
+        while (it != letters.end())
+        {
+            const size_t count = std::min<size_t>(
+                        ROWS_PER_STATEMENT, std::distance(it, letters.end()));
+            std::ostringstream sql;
+            sql << "SELECT a.letter_id, i.itemclass_id, i.amount"
+                << "  FROM " << POST_ATTACHMENTS_TBL_NAME << " a"
+                << "  JOIN " << ITEM_INSTANCES_TBL_NAME << " i"
+                << "    ON i.item_id = a.item_id"
+                << " WHERE a.letter_id IN (";
+            for (size_t i = 0; i < count; ++i)
+                sql << (i ? ", ?" : "?");
+            sql << ") ORDER BY a.attachment_id";
+
+            if (!mDb->prepareSql(sql.str()))
+            {
+                utils::throwError("(DALStorage::loadAttachments) "
+                                  "SQL query preparation failure.");
+            }
+            for (size_t i = 0; i < count; ++i, ++it)
+                mDb->bindValue(i + 1, (int64_t) it->first);
+
+            const dal::RecordSet &attachments = mDb->processSql();
+            for (unsigned i = 0; i < attachments.rows(); ++i)
+            {
+                auto letter = letters.find(toUint(attachments(i, 0)));
+                if (letter == letters.end())
+                    continue;
+
+                InventoryItem item;
+                item.itemId = toUint(attachments(i, 1));
+                item.amount = toUint(attachments(i, 2));
+                letter->second->addAttachment(item);
+            }
+        }
+    }
+    catch (const dal::DbSqlQueryExecFailure &e)
+    {
+        utils::throwError("(DALStorage::loadAttachments) SQL query failure: ",
+                          e);
+    }
+}
+
+unsigned Storage::getLetterCount(int playerId)
+{
+    Call call(this, __func__);
+
     try
     {
-        dal::PerformTransaction transaction(mDb);
         std::ostringstream sql;
+        sql << "SELECT COUNT(*) FROM " << POST_TBL_NAME
+            << " WHERE receiver_id = ?";
+        if (!mDb->prepareSql(sql.str()))
+        {
+            utils::throwError("(DALStorage::getLetterCount) "
+                              "SQL query preparation failure.");
+        }
+        mDb->bindValue(1, playerId);
 
-        // First delete all attachments of the letter
-        // This could leave "dead" items in the item_instances table
-        sql << "DELETE FROM " << POST_ATTACHMENTS_TBL_NAME
-            << " WHERE letter_id = " << letter->getId();
-        mDb->execSql(sql.str());
+        const dal::RecordSet &count = mDb->processSql();
+        if (count.isEmpty())
+            return 0;
 
-        // Delete the letter itself
-        sql.clear();
-        sql.str("");
-        sql << "DELETE FROM " << POST_TBL_NAME
-            << " WHERE letter_id = " << letter->getId();
-        mDb->execSql(sql.str());
+        string_to< unsigned > toUint;
+        return toUint(count(0, 0));
+    }
+    catch (const dal::DbSqlQueryExecFailure &e)
+    {
+        utils::throwError("(DALStorage::getLetterCount) SQL query failure: ",
+                          e);
+    }
+    return 0;
+}
+
+void Storage::deleteLetters(const std::vector<unsigned> &letterIds)
+{
+    if (deferToDatabaseThread(__func__, [=] { deleteLetters(letterIds); }))
+        return;
+
+    Call call(this, __func__);
+
+    string_to< unsigned > toUint;
+
+    try
+    {
+        dal::PerformTransaction transaction(mDb);
+
+        for (size_t start = 0; start < letterIds.size();
+             start += ROWS_PER_STATEMENT)
+        {
+            const size_t count = std::min(ROWS_PER_STATEMENT,
+                                          letterIds.size() - start);
+            std::ostringstream in;
+            in << " IN (";
+            for (size_t i = 0; i < count; ++i)
+                in << (i ? ", ?" : "?");
+            in << ")";
+
+            // The item instances of the attachments go along with them
+            std::ostringstream sql;
+            sql << "SELECT item_id FROM " << POST_ATTACHMENTS_TBL_NAME
+                << " WHERE letter_id" << in.str();
+            if (!mDb->prepareSql(sql.str()))
+            {
+                utils::throwError("(DALStorage::deleteLetters) "
+                                  "SQL query preparation failure #1.");
+            }
+            for (size_t i = 0; i < count; ++i)
+                mDb->bindValue(i + 1, (int64_t) letterIds[start + i]);
+
+            std::vector<unsigned> itemIds;
+            const dal::RecordSet &items = mDb->processSql();
+            for (unsigned i = 0; i < items.rows(); ++i)
+                itemIds.push_back(toUint(items(i, 0)));
+
+            const char *tables[] = {
+                POST_ATTACHMENTS_TBL_NAME,
+                POST_TBL_NAME
+            };
+            for (const char *table : tables)
+            {
+                sql.clear();
+                sql.str("");
+                sql << "DELETE FROM " << table
+                    << " WHERE letter_id" << in.str();
+                if (!mDb->prepareSql(sql.str()))
+                {
+                    utils::throwError("(DALStorage::deleteLetters) "
+                                      "SQL query preparation failure #2.");
+                }
+                for (size_t i = 0; i < count; ++i)
+                    mDb->bindValue(i + 1, (int64_t) letterIds[start + i]);
+                mDb->processSql();
+            }
+
+            for (size_t itemStart = 0; itemStart < itemIds.size();
+                 itemStart += ROWS_PER_STATEMENT)
+            {
+                const size_t itemCount = std::min(ROWS_PER_STATEMENT,
+                                                  itemIds.size() - itemStart);
+                sql.clear();
+                sql.str("");
+                sql << "DELETE FROM " << ITEM_INSTANCES_TBL_NAME
+                    << " WHERE item_id IN (";
+                for (size_t i = 0; i < itemCount; ++i)
+                    sql << (i ? ", ?" : "?");
+                sql << ")";
+                if (!mDb->prepareSql(sql.str()))
+                {
+                    utils::throwError("(DALStorage::deleteLetters) "
+                                      "SQL query preparation failure #3.");
+                }
+                for (size_t i = 0; i < itemCount; ++i)
+                    mDb->bindValue(i + 1, (int64_t) itemIds[itemStart + i]);
+                mDb->processSql();
+            }
+        }
 
         transaction.commit();
-        letter->setId(0);
     }
     catch (const dal::DbSqlQueryExecFailure &e)
     {
-        utils::throwError("(DALStorage::deletePost) SQL query failure: ", e);
+        utils::throwError("(DALStorage::deleteLetters) SQL query failure: ",
+                          e);
+    }
+}
+
+std::set<int> Storage::deleteExpiredLetters()
+{
+    Call call(this, __func__);
+
+    std::vector<unsigned> letterIds;
+    std::set<int> receivers;
+
+    try
+    {
+        // Uses the index on the expiration date
+        std::ostringstream sql;
+        sql << "SELECT letter_id, receiver_id FROM " << POST_TBL_NAME
+            << " WHERE expiration_date > 0 AND expiration_date <= ?";
+        if (!mDb->prepareSql(sql.str()))
+        {
+            utils::throwError("(DALStorage::deleteExpiredLetters) "
+                              "SQL query preparation failure.");
+        }
+        mDb->bindValue(1, (int64_t) time(0));
+
+        string_to< unsigned > toUint;
+        const dal::RecordSet &expired = mDb->processSql();
+        for (unsigned i = 0; i < expired.rows(); ++i)
+        {
+            letterIds.push_back(toUint(expired(i, 0)));
+            receivers.insert(toUint(expired(i, 1)));
+        }
+    }
+    catch (const dal::DbSqlQueryExecFailure &e)
+    {
+        utils::throwError("(DALStorage::deleteExpiredLetters) "
+                          "SQL query failure: ", e);
+    }
+
+    if (!letterIds.empty())
+    {
+        LOG_INFO("Deleting " << letterIds.size() << " expired letters.");
+        deleteLetters(letterIds);
     }
+
+    return receivers;
 }
 
 void Storage::syncDatabase()
@@ -1996,18 +3195,23 @@ void Storage::syncDatabase()
             sql << "UPDATE " << ITEMS_TBL_NAME
                 << " SET name = ?, "
                 << "     description = ?, "
-                << "     image = '" << image << "', "
-                << "     weight = " << weight << ", "
-                << "     itemtype = '" << type << "', "
+                << "     image = ?, "
+                << "     weight = ?, "
+                << "     itemtype = ?, "
                 << "     effect = ?, "
-                << "     dyestring = '" << dye << "' "
-                << " WHERE id = " << id;
+                << "     dyestring = ? "
+                << " WHERE id = ?";
 
             if (mDb->prepareSql(sql.str()))
             {
                 mDb->bindValue(1, name);
                 mDb->bindValue(2, desc);
-                mDb->bindValue(3, eff);
+                mDb->bindValue(3, image);
+                mDb->bindValue(4, weight);
+                mDb->bindValue(5, type);
+                mDb->bindValue(6, eff);
+                mDb->bindValue(7, dye);
+                mDb->bindValue(8, id);
 
                 mDb->processSql();
                 if (mDb->getModifiedRows() == 0)
@@ -2015,14 +3219,17 @@ void Storage::syncDatabase()
                     sql.clear();
                     sql.str("");
                     sql << "INSERT INTO " << ITEMS_TBL_NAME
-                        << "  VALUES ( " << id << ", ?, ?, '"
-                        << image << "', " << weight << ", '"
-                        << type << "', ?, '" << dye << "' )";
+                        << "  VALUES (?, ?, ?, ?, ?, ?, ?, ?)";
                     if (mDb->prepareSql(sql.str()))
                     {
-                        mDb->bindValue(1, name);
-                        mDb->bindValue(2, desc);
-                        mDb->bindValue(3, eff);
+                        mDb->bindValue(1, id);
+                        mDb->bindValue(2, name);
+                        mDb->bindValue(3, desc);
+                        mDb->bindValue(4, image);
+                        mDb->bindValue(5, weight);
+                        mDb->bindValue(6, type);
+                        mDb->bindValue(7, eff);
+                        mDb->bindValue(8, dye);
                         mDb->processSql();
                     }
                     else
@@ -2049,57 +3256,98 @@ void Storage::syncDatabase()
     transaction.commit();
 }
 
-void Storage::setOnlineStatus(int charId, bool online)
+void Storage::writeOnlineStatus(const std::map<int, time_t> &online,
+                                const std::vector<int> &offline)
 {
+    Call call(this, __func__);
+
+    // Do not keep the rows of characters that left around
+    for (int charId : offline)
+        mSavedCharacters.erase(charId);
+
+    // The rows of the characters that came online are replaced as well, in
+    // case the list still has them
+    std::vector<int> changed(offline);
+    for (auto &it : online)
+        changed.push_back(it.first);
+
     try
     {
-        std::ostringstream sql;
-        if (online)
-        {
-            // First we try to update the online status. this prevents errors
-            // in case we get the online status twice
-            sql << "SELECT COUNT(*) FROM " << ONLINE_USERS_TBL_NAME
-                << " WHERE char_id = " << charId;
-            const std::string res = mDb->execSql(sql.str())(0, 0);
-
-            if (res != "0")
-                return;
+        dal::PerformTransaction transaction(mDb);
 
-            sql.clear();
-            sql.str("");
-            sql << "INSERT INTO " << ONLINE_USERS_TBL_NAME
-                << " VALUES (" << charId << ", " << time(0) << ")";
-            mDb->execSql(sql.str());
-        }
-        else
+        for (size_t start = 0; start < changed.size();
+             start += ROWS_PER_STATEMENT)
         {
+            const size_t count = std::min(ROWS_PER_STATEMENT,
+                                          changed.size() - start);
+            std::ostringstream sql;
             sql << "DELETE FROM " << ONLINE_USERS_TBL_NAME
-                << " WHERE char_id = " << charId;
-            mDb->execSql(sql.str());
+                << " WHERE char_id IN (";
+            for (size_t i = 0; i < count; ++i)
+                sql << (i ? ", ?" : "?");
+            sql << ")";
+
+            if (!mDb->prepareSql(sql.str()))
+            {
+                utils::throwError("(DALStorage::writeOnlineStatus) "
+                                  "SQL query preparation failure #1.");
+            }
+            for (size_t i = 0; i < count; ++i)
+                mDb->bindValue(i + 1, changed[start + i]);
+            mDb->processSql();
         }
 
+        auto it = online.begin();
+        while (it != online.end())
+        {
+            const size_t count = std::min<size_t>(
+                        ROWS_PER_STATEMENT, std::distance(it, online.end()));
+            std::ostringstream sql;
+            sql << "INSERT INTO " << ONLINE_USERS_TBL_NAME
+                << " (char_id, login_date) VALUES ";
+            for (size_t i = 0; i < count; ++i)
+                sql << (i ? ", (?, ?)" : "(?, ?)");
+
+            if (!mDb->prepareSql(sql.str()))
+            {
+                utils::throwError("(DALStorage::writeOnlineStatus) "
+                                  "SQL query preparation failure #2.");
+            }
+            for (size_t i = 0; i < count; ++i, ++it)
+            {
+                mDb->bindValue(i * 2 + 1, it->first);
+                mDb->bindValue(i * 2 + 2, (int64_t) it->second);
+            }
+            mDb->processSql();
+        }
 
+        transaction.commit();
     }
     catch (const dal::DbSqlQueryExecFailure &e)
     {
-        utils::throwError("(DALStorage::setOnlineStatus) SQL query failure: ",
+        utils::throwError("(DALStorage::writeOnlineStatus) SQL query failure: ",
                           e);
     }
 }
 
 void Storage::addTransaction(const Transaction &trans)
 {
+    if (deferToDatabaseThread(__func__, [=] { addTransaction(trans); }))
+        return;
+
+    Call call(this, __func__);
+
     try
     {
         std::stringstream sql;
         sql << "INSERT INTO " << TRANSACTION_TBL_NAME
-            << " VALUES (NULL, " << trans.mCharacterId << ", "
-            << trans.mAction << ", "
-            << "?, "
-            << time(0) << ")";
+            << " VALUES (NULL, ?, ?, ?, ?)";
         if (mDb->prepareSql(sql.str()))
         {
-            mDb->bindValue(1, trans.mMessage);
+            mDb->bindValue(1, (int) trans.mCharacterId);
+            mDb->bindValue(2, (int) trans.mAction);
+            mDb->bindValue(3, trans.mMessage);
+            mDb->bindValue(4, (int64_t) time(0));
             mDb->processSql();
         }
         else
@@ -2117,6 +3365,9 @@ void Storage::addTransaction(const Transaction &trans)
 
 std::vector<Transaction> Storage::getTransactions(unsigned num)
 {
+    ReadCall call(this, __func__);
+    dal::DataProvider *db = call.database();
+
     std::vector<Transaction> transactions;
     string_to<unsigned> toUint;
 
@@ -2124,7 +3375,7 @@ std::vector<Transaction> Storage::getTransactions(unsigned num)
     {
         std::stringstream sql;
         sql << "SELECT * FROM " << TRANSACTION_TBL_NAME;
-        const dal::RecordSet &rec = mDb->execSql(sql.str());
+        const dal::RecordSet &rec = db->execSql(sql.str());
 
         int size = rec.rows();
         int start = size - num;
@@ -2149,15 +3400,23 @@ std::vector<Transaction> Storage::getTransactions(unsigned num)
 
 std::vector<Transaction> Storage::getTransactions(time_t date)
 {
+    ReadCall call(this, __func__);
+    dal::DataProvider *db = call.database();
+
     std::vector<Transaction> transactions;
     string_to<unsigned> toUint;
 
     try
     {
         std::stringstream sql;
-        sql << "SELECT * FROM " << TRANSACTION_TBL_NAME << " WHERE time > "
-            << date;
-        const dal::RecordSet &rec = mDb->execSql(sql.str());
+        sql << "SELECT * FROM " << TRANSACTION_TBL_NAME << " WHERE time > ?";
+        if (!db->prepareSql(sql.str()))
+        {
+            utils::throwError("(DALStorage::getTransactions) "
+                              "SQL query preparation failure.");
+        }
+        db->bindValue(1, (int64_t) date);
+        const dal::RecordSet &rec = db->processSql();
 
         for (unsigned i = 0; i < rec.rows(); ++i)
         {
@@ -21,10 +21,21 @@
 #ifndef STORAGE_H
 #define STORAGE_H
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iosfwd>
 #include <list>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <thread>
 #include <vector>
 
+#include "account-server/characterwritecache.h"
+#include "dal/connectionpool.h"
 #include "dal/dataprovider.h"
 
 #include "common/transaction.h"
@@ -36,10 +47,23 @@ class FloorItem;
 class Guild;
 class Letter;
 class Post;
+class StorageExecutor;
 
 /**
  * The high level interface to the database. Through the storage you can access
  * all accounts, characters, guilds, worlds states, transactions, etc.
+ *
+ * While the storage is open, a database thread is running. Work can be moved
+ * to it with async(), and writes that nobody waits for (transactions, quest
+ * and world variables, bans) are always executed there.
+ *
+ * Every asynchronous operation has an ordering key. Operations on a single
+ * character use the character id as their key. A call made from the
+ * main thread only waits for the queued operations with its own key, so that
+ * it sees the results of the writes that were queued before it without
+ * waiting for the unrelated ones. Calls that delete characters also wait
+ * for the keys of these characters, so that a queued save cannot write a
+ * deleted character back.
  */
 class Storage
 {
@@ -47,6 +71,17 @@ class Storage
         Storage();
         ~Storage();
 
+        /**
+         * Ordering keys of the asynchronous operations that do not concern a
+         * single character.
+         */
+        enum OrderingKey
+        {
+            SharedKey = 0,      /**< Operations without a narrower key. */
+            AccountKey = -1,    /**< Logins and registrations. */
+            BackgroundKey = -2  /**< Batched writes nobody waits for. */
+        };
+
         /**
          * Connect to the database and initialize it if necessary.
          */
@@ -57,6 +92,39 @@ class Storage
          */
         void close();
 
+        /**
+         * Runs \a work on the database thread. Once it is done, \a done is
+         * called from processCompletions(). The work should only access the
+         * database through the storage methods.
+         *
+         * @param name name of the operation, used when logging errors.
+         * @param key  ordering key, the id of the character the operation
+         *             is about, or one of OrderingKey.
+         */
+        void async(const char *name,
+                   std::function<void()> work,
+                   std::function<void()> done = std::function<void()>(),
+                   int key = SharedKey);
+
+        /**
+         * Calls the completion callbacks of the finished asynchronous
+         * operations. Should be called regularly from the main loop.
+         */
+        void processCompletions();
+
+        /**
+         * Sets a function that is called on the database thread whenever an
+         * asynchronous operation finished, so that the main loop can wake up
+         * to call processCompletions().
+         */
+        void setCompletionNotifier(std::function<void()> notifier);
+
+        /**
+         * Writes the number of calls and the latency histogram of each
+         * storage method to the statistics file.
+         */
+        void dumpStatistics(std::ostream &os) const;
+
         /**
          * Get an account by user name.
          *
@@ -103,6 +171,16 @@ class Storage
          */
         unsigned getCharacterId(const std::string &name);
 
+        /**
+         * Gets the name of a character by its id.
+         *
+         * @param id the id of the character.
+         *
+         * @return the name of the character, or an empty string if there is
+         *         no such character.
+         */
+        std::string getCharacterName(int id);
+
         /**
          * Add an account to the database.
          *
@@ -125,7 +203,8 @@ class Storage
         void updateLastLogin(const Account *account);
 
         /**
-         * Write a modification message about Character points to the database.
+         * Queues a modification of the character points. It is written to
+         * the database by the next flushCharacterChanges().
          *
          * @param CharId      ID of the character
          * @param CharPoints  Number of character points left for the character
@@ -135,8 +214,8 @@ class Storage
                                    int charPoints, int corrPoints);
 
         /**
-         * Write a modification message about character attributes
-         * to the database.
+         * Queues a modification of a character attribute. It is written to
+         * the database by the next flushCharacterChanges().
          *
          * @param charId    The Id of the character
          * @param attrId    The Id of the attribute
@@ -146,6 +225,12 @@ class Storage
         void updateAttribute(int charId, unsigned attrId,
                              double base, double mod);
 
+        /**
+         * Writes the queued character points, attribute and quest variable
+         * changes on the database thread, in a single transaction.
+         */
+        void flushCharacterChanges();
+
         /**
          * Write a modification message about kill counts to the database.
          *
@@ -188,10 +273,24 @@ class Storage
         void delCharacter(CharacterData *character) const;
 
         /**
-         * Removes expired bans from accounts
+         * Lifts the bans that expired since the last call. Only the bans
+         * known to be due are written, which makes this cheap enough to be
+         * called every second.
          */
         void checkBannedAccounts();
 
+        /**
+         * Lifts all expired bans in the database, including the ones that
+         * were not set through this storage.
+         */
+        void sweepBannedAccounts();
+
+        /**
+         * Moves the changes from the write-ahead log of the database into
+         * the database, on the database thread.
+         */
+        void checkpoint();
+
         /**
          * Tells if the user name already exists.
          *
@@ -225,12 +324,25 @@ class Storage
          * Primary usage should be storing characterdata
          * received from a game server.
          *
+         * Only the rows that changed since the last save of the character
+         * are written. The first save after it came online replaces all its
+         * rows.
+         *
+         * The pending changes of the character are older than the complete
+         * character, and should be dropped with discardCharacterChanges()
+         * when the character is received.
+         *
          * @param ptr Character to store values in the database.
          *
          * @return true on success
          */
         bool updateCharacter(CharacterData *ptr);
 
+        /**
+         * Drops the pending points and attribute changes of a character.
+         */
+        void discardCharacterChanges(int charId);
+
         /**
          * Add a new guild.
          *
@@ -317,7 +429,8 @@ class Storage
         void flush(Account *);
 
         /**
-         * Gets the value of a quest variable.
+         * Gets the value of a quest variable, including the changes that were
+         * not written yet.
          *
          * @param id character id.
          * @param name quest var name to get.
@@ -325,11 +438,12 @@ class Storage
         std::string getQuestVar(int id, const std::string &);
 
         /**
-         * Sets the value of a quest variable.
+         * Queues a modification of a quest variable. It is written to the
+         * database by the next flushCharacterChanges().
          *
          * @param id character id.
          * @param name quest var name to set.
-         * @param value value to set.
+         * @param value value to set, an empty value removes the variable.
          */
         void setQuestVar(int id, const std::string &, const std::string &);
 
@@ -375,24 +489,44 @@ class Storage
         void setAccountLevel(int id, int level);
 
         /**
-         * Store letter.
+         * Store letter, along with its attachments when it was never stored
+         * before.
          *
          * @param letter The letter to store
          */
         void storeLetter(Letter *letter);
 
         /**
-         * Retrieve post
+         * Retrieve the oldest letters of a character, without their
+         * attachments.
          *
          * @param playerId The id of the character requesting his post
+         * @param maxLetters The most letters to retrieve
          */
-        Post *getStoredPost(int playerId);
+        Post *getStoredPost(int playerId, unsigned maxLetters);
 
         /**
-         * Delete a letter from the database.
-         * @param letter The letter to delete.
+         * Loads the attachments of the letters of \a post.
          */
-        void deletePost(Letter *letter);
+        void loadAttachments(Post *post);
+
+        /**
+         * Returns the number of letters waiting for a character.
+         */
+        unsigned getLetterCount(int playerId);
+
+        /**
+         * Delete letters and their attachments from the database.
+         * @param letterIds The ids of the letters to delete.
+         */
+        void deleteLetters(const std::vector<unsigned> &letterIds);
+
+        /**
+         * Deletes the expired letters from the database.
+         *
+         * @return the ids of the characters that had letters deleted.
+         */
+        std::set<int> deleteExpiredLetters();
 
         /**
          * Returns the version of the local item database.
@@ -403,15 +537,18 @@ class Storage
         { return mItemDbVersion; }
 
         /**
-         * Sets the status of a character to online (true) or offline (false).
+         * Writes a batch of online status changes to the online list, see
+         * OnlineRegistry.
          *
-         * @param charId Id of the character.
-         * @param online True to mark the character as being online.
+         * @param online  the characters that came online, with their login
+         *                time.
+         * @param offline the characters that went offline.
          */
-        void setOnlineStatus(int charId, bool online);
+        void writeOnlineStatus(const std::map<int, time_t> &online,
+                               const std::vector<int> &offline);
 
         /**
-         * Store a transaction.
+         * Store a transaction. This is done on the database thread.
          *
          * @param trans The transaction to add in the logs.
          */
@@ -443,6 +580,89 @@ class Storage
         Storage(const Storage &rhs) = delete;
         Storage &operator=(const Storage &rhs) = delete;
 
+        /**
+         * Latency statistics of a storage method. Bucket \a i counts the
+         * calls that took less than 2^i microseconds.
+         */
+        struct Histogram
+        {
+            Histogram() : count(0), total(0), max(0)
+            { std::fill(buckets, buckets + BucketCount, 0); }
+
+            static const int BucketCount = 24;
+
+            unsigned buckets[BucketCount];
+            unsigned count;
+            uint64_t total;             /**< Sum of latencies in us. */
+            uint64_t max;               /**< Largest latency in us. */
+        };
+
+        /**
+         * Guards a call to a public storage method. Waits for the queued
+         * operations with the given ordering keys, serializes access to the
+         * data provider and records the latency of the call.
+         *
+         * Only the outermost call of a thread waits. A nested call already
+         * holds the data provider, and the database thread may be blocked
+         * on it, so waiting there could deadlock.
+         */
+        class Call
+        {
+            public:
+                Call(const Storage *storage, const char *name,
+                     int key = SharedKey);
+                Call(const Storage *storage, const char *name,
+                     const std::vector<int> &keys);
+                ~Call();
+
+            private:
+                void enter(const std::vector<int> &keys);
+
+                const Storage *mStorage;
+                const char *mName;
+                bool mOutermost;
+                uint64_t mStart;
+        };
+        friend class Call;
+
+        /**
+         * Guards a read-only query that may run on a pooled connection to
+         * the read replica, so that it neither waits for nor blocks the
+         * database thread. Behaves like Call when there is no read pool.
+         */
+        class ReadCall
+        {
+            public:
+                ReadCall(const Storage *storage, const char *name);
+                ~ReadCall();
+
+                dal::DataProvider *database() const
+                { return mDb; }
+
+            private:
+                const Storage *mStorage;
+                const char *mName;
+                std::unique_ptr<Call> mCall;
+                std::unique_ptr<dal::ConnectionPool::Lease> mLease;
+                dal::DataProvider *mDb;
+                uint64_t mStart;
+        };
+        friend class ReadCall;
+
+        /**
+         * Adds a call taking \a elapsed microseconds to the latency
+         * histogram of the method \a name.
+         */
+        void recordLatency(const char *name, uint64_t elapsed) const;
+
+        /**
+         * Queues \a work on the database thread when called from another
+         * thread. Returns whether it was queued, in which case the caller
+         * should return immediately.
+         */
+        bool deferToDatabaseThread(const char *name,
+                                   std::function<void()> work);
+
         /**
          * Gets an account from a prepared SQL statement
          *
@@ -459,6 +679,63 @@ class Storage
          */
         CharacterData *getCharacterBySQL(Account *owner);
 
+        /**
+         * Creates a character from the current row of a query selecting all
+         * columns of the characters table, fetched with fetchRow().
+         */
+        CharacterData *readCharacter();
+
+        /**
+         * Loads the attributes, status effects, kill counts, abilities,
+         * quests and inventories of the given characters. Each table is read
+         * with a single query, for the characters matching \a filter.
+         * @param characters the characters to fill, by database id.
+         * @param filter condition on the character id, taking one parameter.
+         * @param filterValue value bound to the filter parameter.
+         */
+        void loadCharacterData(const std::map<int, CharacterData*> &characters,
+                               const std::string &filter, int filterValue);
+
+        struct CharacterRows;
+
+        /**
+         * Collects the rows \a character has in the tables written by
+         * updateCharacter().
+         */
+        void getCharacterRows(const CharacterData *character,
+                              CharacterRows &rows) const;
+
+        /**
+         * Does the work of updateCharacter(), within the call that is
+         * already guarding the data provider.
+         *
+         * @param remember whether to remember the rows written for the next
+         *                 save, they are always updated when already known.
+         */
+        bool writeCharacter(CharacterData *character, bool remember);
+
+        /**
+         * Writes the given character changes, using multi-row statements for
+         * the attributes.
+         */
+        void writeCharacterChanges(const CharacterWriteCache::Batch &batch);
+
+        /**
+         * Loads the expiry times of the banned accounts.
+         */
+        void loadBans();
+
+        /**
+         * Remembers to lift the ban on \a accountId at \a expiry. Replaces
+         * an earlier expiry of the account.
+         */
+        void scheduleUnban(int accountId, time_t expiry);
+
+        /**
+         * Lifts the bans of the given accounts, unless they were extended.
+         */
+        void unbanAccounts(const std::vector<int> &accountIds);
+
         /**
          * Fix improper character slots
          *
@@ -480,6 +757,42 @@ class Storage
 
         dal::DataProvider *mDb;         /**< the data provider */
         unsigned mItemDbVersion;        /**< Version of the item database. */
+
+        std::unique_ptr<StorageExecutor> mExecutor;
+        std::function<void()> mCompletionNotifier;
+
+        /** Connections for read-only reports, see ReadCall. */
+        std::unique_ptr<dal::ConnectionPool> mReadPool;
+
+        /**
+         * The rows written by the last save of the characters, by character
+         * id. Only kept while the characters are online.
+         */
+        mutable std::map<int, std::unique_ptr<CharacterRows> > mSavedCharacters;
+
+        /** Character changes waiting to be written. */
+        std::unique_ptr<CharacterWriteCache> mWriteCache;
+        bool mFlushRequested;
+
+        /** Ban expiry times with the account id, soonest first. Entries
+            that do not match mBanExpiryByAccount are outdated. */
+        typedef std::pair<time_t, int> BanExpiry;
+        std::priority_queue<BanExpiry, std::vector<BanExpiry>,
+                            std::greater<BanExpiry> > mBanExpiries;
+        std::map<int, time_t> mBanExpiryByAccount;
+        std::mutex mBanMutex;
+
+        /** Serializes the access to the data provider. */
+        mutable std::recursive_mutex mDbMutex;
+
+        /** The thread holding mDbMutex, set by the outermost Call. */
+        mutable std::atomic<std::thread::id> mDbOwner;
+
+        mutable std::mutex mStatisticsMutex;
+        mutable std::map<std::string, Histogram> mHistograms;
+        unsigned mCharacterSaves;           /**< Calls to updateCharacter. */
+        uint64_t mCharacterSaveRows;        /**< Rows written by these. */
+        unsigned mCharacterSaveMaxRows;     /**< Most rows in one save. */
 };
 
 extern Storage *storage;
@@ -0,0 +1,151 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "account-server/storageexecutor.h"
+
+#include "utils/logger.h"
+
+#include <exception>
+
+StorageExecutor::StorageExecutor():
+    mBusy(false),
+    mStopping(false)
+{
+    mThread = std::thread(&StorageExecutor::run, this);
+}
+
+StorageExecutor::~StorageExecutor()
+{
+    stop();
+}
+
+void StorageExecutor::stop()
+{
+    if (!mThread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mWorkAvailable.notify_one();
+    mThread.join();
+
+    mDone.clear();
+}
+
+void StorageExecutor::post(const char *name, Callback work, Callback done,
+                           int key)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        Job job = { name, std::move(work), std::move(done), key };
+        mJobs.push_back(std::move(job));
+        ++mPendingByKey[key];
+    }
+    mWorkAvailable.notify_one();
+}
+
+void StorageExecutor::process()
+{
+    std::deque<Callback> done;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        done.swap(mDone);
+    }
+
+    for (Callback &callback : done)
+        callback();
+}
+
+void StorageExecutor::setCompletionNotifier(Callback notifier)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mCompletionNotifier = std::move(notifier);
+}
+
+void StorageExecutor::waitUntilDone(int key)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mKeyDone.wait(lock, [this, key] {
+        return mPendingByKey.find(key) == mPendingByKey.end();
+    });
+}
+
+bool StorageExecutor::isWorkerThread() const
+{
+    return std::this_thread::get_id() == mThread.get_id();
+}
+
+size_t StorageExecutor::getPendingCount() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mJobs.size() + (mBusy ? 1 : 0);
+}
+
+void StorageExecutor::run()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    for (;;)
+    {
+        mWorkAvailable.wait(lock, [this] {
+            return mStopping || !mJobs.empty();
+        });
+
+        if (mJobs.empty())
+            break; // Only stop once all jobs have been executed
+
+        Job job = std::move(mJobs.front());
+        mJobs.pop_front();
+        mBusy = true;
+        lock.unlock();
+
+        try
+        {
+            job.work();
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR("Storage job " << job.name << " failed: " << e.what());
+        }
+        catch (const std::string &error)
+        {
+            // Already logged by utils::throwError
+            LOG_ERROR("Storage job " << job.name << " failed: " << error);
+        }
+
+        lock.lock();
+        mBusy = false;
+        if (job.done)
+        {
+            mDone.push_back(std::move(job.done));
+            if (mCompletionNotifier)
+                mCompletionNotifier();
+        }
+
+        auto pending = mPendingByKey.find(job.key);
+        if (--pending->second == 0)
+        {
+            mPendingByKey.erase(pending);
+            mKeyDone.notify_all();
+        }
+    }
+}
@@ -0,0 +1,126 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STORAGEEXECUTOR_H
+#define STORAGEEXECUTOR_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * Runs database work on a dedicated thread, so that slow queries do not
+ * stall the network loop.
+ *
+ * Jobs are executed one at a time in the order they were posted. Once a job
+ * is done, its completion callback is queued and later called from
+ * process(), which is meant to be called from the main loop. This way the
+ * completion callbacks can safely touch the network handlers.
+ *
+ * Every job has an ordering key, and other threads can wait for the jobs
+ * of a single key with waitUntilDone(), without waiting for the rest.
+ */
+class StorageExecutor
+{
+    public:
+        typedef std::function<void()> Callback;
+
+        StorageExecutor();
+
+        /**
+         * Stops the worker thread.
+         */
+        ~StorageExecutor();
+
+        /**
+         * Stops the worker thread after executing the pending jobs. Their
+         * completion callbacks are dropped. No jobs should be posted anymore
+         * after this call.
+         */
+        void stop();
+
+        /**
+         * Queues \a work for execution on the worker thread. When it is
+         * done, \a done gets called from process(). The completion is
+         * delivered even when the work threw an exception.
+         *
+         * @param name name of the job, used when logging errors.
+         * @param key  ordering key of the job, see waitUntilDone().
+         */
+        void post(const char *name, Callback work, Callback done = Callback(),
+                  int key = 0);
+
+        /**
+         * Calls the completion callbacks of the jobs that finished since the
+         * last call.
+         */
+        void process();
+
+        /**
+         * Sets a function that is called on the worker thread whenever a
+         * completion callback got queued, so that the thread calling
+         * process() can wake up.
+         */
+        void setCompletionNotifier(Callback notifier);
+
+        /**
+         * Blocks until the jobs posted with the given \a key have been
+         * executed.
+         */
+        void waitUntilDone(int key);
+
+        /**
+         * Returns whether the calling thread is the worker thread.
+         */
+        bool isWorkerThread() const;
+
+        /**
+         * Returns the number of jobs waiting to be executed.
+         */
+        size_t getPendingCount() const;
+
+    private:
+        struct Job
+        {
+            const char *name;
+            Callback work;
+            Callback done;
+            int key;
+        };
+
+        void run();
+
+        std::thread mThread;
+        mutable std::mutex mMutex;
+        std::condition_variable mWorkAvailable;
+        std::condition_variable mKeyDone;
+        std::deque<Job> mJobs;          /**< Jobs waiting to be executed. */
+        std::map<int, unsigned> mPendingByKey; /**< Jobs not done, by key. */
+        std::deque<Callback> mDone;     /**< Pending completion callbacks. */
+        Callback mCompletionNotifier;
+        bool mBusy;                     /**< Whether a job is executing. */
+        bool mStopping;
+};
+
+#endif // STORAGEEXECUTOR_H
@@ -18,6 +18,7 @@
  *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <list>
 
 #include "chat-server/chatchannelmanager.h"
@@ -32,7 +33,9 @@
 
 using namespace ManaServ;
 
-ChatChannelManager::ChatChannelManager() : mNextChannelId(1)
+ChatChannelManager::ChatChannelManager() :
+    mNextChannelId(1),
+    mPublicChannelsValid(false)
 {
 }
 
@@ -55,6 +58,7 @@ int ChatChannelManager::createNewChannel(const std::string &channelName,
                                                     channelAnnouncement,
                                                     channelPassword,
                                                     joinable)));
+    mPublicChannelsValid = false;
     return channelId;
 }
 
@@ -95,24 +99,33 @@ bool ChatChannelManager::removeChannel(int channelId)
     i->second.removeAllUsers();
     mChatChannels.erase(i);
     mChannelsNoLongerUsed.push_back(channelId);
+    mPublicChannelsValid = false;
     return true;
 }
 
-std::list<const ChatChannel*> ChatChannelManager::getPublicChannels() const
+const std::vector<const ChatChannel*> &ChatChannelManager::getPublicChannels()
 {
-    std::list<const ChatChannel*> channels;
+    if (mPublicChannelsValid)
+        return mPublicChannels;
 
+    mPublicChannels.clear();
     for (ChatChannels::const_iterator i = mChatChannels.begin(),
             i_end = mChatChannels.end();
          i != i_end; ++i)
     {
         if (i->second.canJoin())
         {
-            channels.push_back(&i->second);
+            mPublicChannels.push_back(&i->second);
         }
     }
 
-    return channels;
+    std::sort(mPublicChannels.begin(), mPublicChannels.end(),
+              [](const ChatChannel *a, const ChatChannel *b) {
+        return a->getName() < b->getName();
+    });
+    mPublicChannelsValid = true;
+
+    return mPublicChannels;
 }
 
 int ChatChannelManager::getChannelId(const std::string &channelName) const
@@ -24,6 +24,7 @@
 #include <list>
 #include <map>
 #include <deque>
+#include <vector>
 
 #include "chat-server/chatchannel.h"
 
@@ -60,11 +61,12 @@ class ChatChannelManager
         bool removeChannel(int channelId);
 
         /**
-         * Returns a list containing all public channels.
+         * Returns a list containing all public channels, sorted by name. The
+         * list is only rebuilt after channels were created or removed.
          *
          * @return a list of all public channels
          */
-        std::list<const ChatChannel*> getPublicChannels() const;
+        const std::vector<const ChatChannel*> &getPublicChannels();
 
         /**
          * Get the id of a channel from its name.
@@ -124,6 +126,9 @@ class ChatChannelManager
         ChatChannels mChatChannels;
         int mNextChannelId;
         std::deque<int> mChannelsNoLongerUsed;
+
+        std::vector<const ChatChannel*> mPublicChannels;
+        bool mPublicChannelsValid;
 };
 
 extern ChatChannelManager *chatChannelManager;
@@ -23,12 +23,12 @@
 #include <string>
 #include <sstream>
 
-#include "account-server/character.h"
 #include "account-server/storage.h"
 #include "chat-server/guildmanager.h"
 #include "chat-server/chatchannelmanager.h"
 #include "chat-server/chatclient.h"
 #include "chat-server/chathandler.h"
+#include "common/configuration.h"
 #include "common/manaserv_protocol.h"
 #include "common/transaction.h"
 #include "net/connectionhandler.h"
@@ -41,27 +41,142 @@
 
 using namespace ManaServ;
 
+/**
+ * Returns the part of the sorted range [begin, end) of which the names start
+ * with \a prefix.
+ */
+template <class Iterator, class GetName>
+static std::pair<Iterator, Iterator> findPrefixed(Iterator begin,
+                                                  Iterator end,
+                                                  const std::string &prefix,
+                                                  GetName getName)
+{
+    typedef typename std::iterator_traits<Iterator>::reference Item;
+
+    begin = std::partition_point(begin, end, [&](Item item) {
+        return getName(item) < prefix;
+    });
+    end = std::partition_point(begin, end, [&](Item item) {
+        return getName(item).compare(0, prefix.length(), prefix) == 0;
+    });
+    return std::make_pair(begin, end);
+}
+
+/**
+ * Narrows \a range down to at most \a count items, starting at \a offset.
+ */
+template <class Iterator>
+static void selectPage(std::pair<Iterator, Iterator> &range,
+                       unsigned offset, unsigned count)
+{
+    range.first += std::min<size_t>(offset, range.second - range.first);
+    range.second = range.first + std::min<size_t>(count, range.second -
+                                                         range.first);
+}
+
 void registerChatClient(const std::string &token,
+                        int characterId,
                         const std::string &name,
                         int level)
 {
     ChatHandler::Pending *p = new ChatHandler::Pending;
+    p->characterId = characterId;
     p->character = name;
     p->level = level;
-    chatHandler->mTokenCollector.addPendingConnect(token, p);
+    chatHandler->post([token, p] {
+        chatHandler->mTokenCollector.addPendingConnect(token, p);
+    });
+}
+
+void forwardPartyInvite(const std::string &inviterName,
+                        const std::string &inviteeName)
+{
+    chatHandler->post([inviterName, inviteeName] {
+        chatHandler->handlePartyInvite(inviterName, inviteeName);
+    });
+}
+
+void forwardAnnounce(const std::string &message, int senderId,
+                     const std::string &senderName)
+{
+    chatHandler->post([message, senderId, senderName] {
+        chatHandler->handleAnnounce(message, senderId, senderName);
+    });
+}
+
+void forwardOnlineNameChanges(const std::map<std::string, bool> &changes)
+{
+    if (changes.empty())
+        return;
+
+    chatHandler->post([changes] {
+        chatHandler->updateOnlineNames(changes);
+    });
 }
 
 ChatHandler::ChatHandler():
+    mMaxListPageSize(Configuration::getValue("chat_maxListPageSize", 100)),
+    mThreadRunning(false),
     mTokenCollector(this)
 {
 }
 
+ChatHandler::~ChatHandler()
+{
+    stopThread();
+}
+
 bool ChatHandler::startListen(enet_uint16 port, const std::string &host)
 {
     LOG_INFO("Chat handler started:");
     return ConnectionHandler::startListen(port, host);
 }
 
+void ChatHandler::process(enet_uint32 timeout)
+{
+    // The messages sent by the tasks go out with the processing
+    mTasks.process();
+    ConnectionHandler::process(timeout);
+}
+
+void ChatHandler::startThread()
+{
+    if (mThread.joinable())
+        return;
+
+    LOG_INFO("Serving the chat clients on a separate thread.");
+    setPoller(&mThreadPoller);
+    mThreadRunning = true;
+    mThread = std::thread(&ChatHandler::run, this);
+}
+
+void ChatHandler::stopThread()
+{
+    if (!mThread.joinable())
+        return;
+
+    mThreadRunning = false;
+    mThreadPoller.wakeUp();
+    mThread.join();
+    setPoller(nullptr);
+}
+
+void ChatHandler::post(utils::TaskQueue::Task task)
+{
+    mTasks.post(std::move(task));
+    if (HostPoller *poller = getPoller())
+        poller->wakeUp();
+}
+
+void ChatHandler::run()
+{
+    while (mThreadRunning)
+    {
+        mThreadPoller.wait(-1);
+        process();
+    }
+}
+
 void ChatHandler::deletePendingClient(ChatClient *c)
 {
     MessageOut msg(CPMSG_CONNECT_RESPONSE);
@@ -80,29 +195,20 @@ void ChatHandler::tokenMatched(ChatClient *client, Pending *p)
 {
     MessageOut msg(CPMSG_CONNECT_RESPONSE);
 
+    // The account server registered the character along with the token,
+    // so there is no need to look it up in the database.
+    client->characterId = p->characterId;
     client->characterName = p->character;
     client->accountLevel = p->level;
+    delete p;
 
-    CharacterData *c = storage->getCharacter(p->character);
-
-    if (!c)
-    {
-        // character wasnt found
-        msg.writeInt8(ERRMSG_FAILURE);
-    }
-    else
-    {
-        client->characterId = c->getDatabaseID();
-        delete p;
-
-        msg.writeInt8(ERRMSG_OK);
+    msg.writeInt8(ERRMSG_OK);
 
-        // Add chat client to player map
-        mPlayerMap.insert(std::pair<std::string, ChatClient*>(client->characterName, client));
-    }
+    // Add chat client to player map
+    mPlayerMap.insert(std::pair<std::string, ChatClient*>(client->characterName, client));
+    mPlayersById[client->characterId] = client;
 
     client->send(msg);
-
 }
 
 NetComputer *ChatHandler::computerConnected(ENetPeer *peer)
@@ -130,10 +236,13 @@ void ChatHandler::computerDisconnected(NetComputer *comp)
         // Notify guilds about him leaving
         guildManager->disconnectPlayer(computer);
 
+        mWhoSubscribers.erase(computer);
+
         // Remove the character from the player map
         // need to do this after removing them from party
         // as that uses the player map
         mPlayerMap.erase(computer->characterName);
+        mPlayersById.erase(computer->characterId);
     }
 
     delete computer;
@@ -164,7 +273,11 @@ void ChatHandler::processMessage(NetComputer *comp, MessageIn &message)
             break;
 
         case PCMSG_WHO:
-            handleWhoMessage(computer);
+            handleWhoMessage(computer, message);
+            break;
+
+        case PCMSG_WHO_SUBSCRIBE:
+            handleWhoSubscribeMessage(computer, message);
             break;
 
         case PCMSG_ENTER_CHANNEL:
@@ -260,12 +373,27 @@ void ChatHandler::warnPlayerAboutBadWords(ChatClient &computer)
     LOG_INFO(computer.characterName << " says bad words.");
 }
 
+/**
+ * Passes a message through the slang filter. Depending on the configuration,
+ * the slangs are masked or the message is rejected.
+ *
+ * @return false when the message was rejected.
+ */
+static bool filterSlangs(std::string &text)
+{
+    if (stringFilter->isMaskingEnabled())
+    {
+        stringFilter->maskContent(text);
+        return true;
+    }
+    return stringFilter->filterContent(text);
+}
+
 void ChatHandler::handleChatMessage(ChatClient &client, MessageIn &msg)
 {
     std::string text = msg.readString();
 
-    // Pass it through the slang filter (false when it contains bad words)
-    if (!stringFilter->filterContent(text))
+    if (!filterSlangs(text))
     {
         warnPlayerAboutBadWords(client);
         return;
@@ -311,7 +439,7 @@ void ChatHandler::handlePrivMsgMessage(ChatClient &client, MessageIn &msg)
     std::string user = msg.readString();
     std::string text = msg.readString();
 
-    if (!stringFilter->filterContent(text))
+    if (!filterSlangs(text))
     {
         warnPlayerAboutBadWords(client);
         return;
@@ -321,23 +449,83 @@ void ChatHandler::handlePrivMsgMessage(ChatClient &client, MessageIn &msg)
     sayToPlayer(client, user, text);
 }
 
-void ChatHandler::handleWhoMessage(ChatClient &client)
+void ChatHandler::handleWhoMessage(ChatClient &client, MessageIn &msg)
 {
-    MessageOut reply(CPMSG_WHO_RESPONSE);
-
-    std::map<std::string, ChatClient*>::iterator itr, itr_end;
-    itr = mPlayerMap.begin();
-    itr_end = mPlayerMap.end();
+    // Lists the characters in the game, they do not need to be connected to
+    // the chat server
+    const std::vector<std::string> &names = mOnlineNames;
 
-    while (itr != itr_end)
+    if (msg.getUnreadLength() == 0)
     {
-        reply.writeString(itr->first);
-        ++itr;
+        // The complete list is only built again after it changed
+        if (!mWhoReply)
+        {
+            mWhoReply.reset(new MessageOut(CPMSG_WHO_RESPONSE));
+            for (const std::string &name : names)
+                mWhoReply->writeString(name);
+        }
+
+        client.send(*mWhoReply);
+        return;
     }
 
+    const unsigned offset = msg.readInt32();
+    const unsigned count = std::min<unsigned>(msg.readInt16(),
+                                              mMaxListPageSize);
+    const std::string prefix = msg.readString();
+
+    auto range = findPrefixed(names.begin(), names.end(), prefix,
+                              [](const std::string &name) -> const std::string &
+                              { return name; });
+
+    MessageOut reply(CPMSG_WHO_PAGE);
+    reply.writeInt32(range.second - range.first);
+    reply.writeInt32(offset);
+
+    selectPage(range, offset, count);
+    for (auto it = range.first; it != range.second; ++it)
+        reply.writeString(*it);
+
     client.send(reply);
 }
 
+void ChatHandler::handleWhoSubscribeMessage(ChatClient &client,
+                                            MessageIn &msg)
+{
+    if (msg.readInt8())
+        mWhoSubscribers.insert(&client);
+    else
+        mWhoSubscribers.erase(&client);
+}
+
+void ChatHandler::updateOnlineNames(const std::map<std::string, bool> &changes)
+{
+    for (auto &change : changes)
+    {
+        auto it = std::lower_bound(mOnlineNames.begin(), mOnlineNames.end(),
+                                   change.first);
+        const bool listed = it != mOnlineNames.end() && *it == change.first;
+        if (change.second && !listed)
+            mOnlineNames.insert(it, change.first);
+        else if (!change.second && listed)
+            mOnlineNames.erase(it);
+    }
+    mWhoReply.reset();
+
+    if (mWhoSubscribers.empty())
+        return;
+
+    MessageOut msg(CPMSG_WHO_CHANGES);
+    for (auto &change : changes)
+    {
+        msg.writeInt8(change.second);
+        msg.writeString(change.first);
+    }
+
+    NetComputer::broadcast(mWhoSubscribers.begin(), mWhoSubscribers.end(),
+                           msg);
+}
+
 void ChatHandler::handleEnterChannelMessage(ChatClient &client, MessageIn &msg)
 {
     MessageOut reply(CPMSG_ENTER_CHANNEL_RESPONSE);
@@ -526,22 +714,44 @@ void ChatHandler::handleQuitChannelMessage(ChatClient &client, MessageIn &msg)
     client.send(reply);
 }
 
-void ChatHandler::handleListChannelsMessage(ChatClient &client, MessageIn &)
+void ChatHandler::handleListChannelsMessage(ChatClient &client, MessageIn &msg)
 {
-    MessageOut reply(CPMSG_LIST_CHANNELS_RESPONSE);
-
-    std::list<const ChatChannel*> channels =
+    const std::vector<const ChatChannel*> &channels =
         chatChannelManager->getPublicChannels();
 
-    for (std::list<const ChatChannel*>::iterator i = channels.begin(),
-            i_end = channels.end();
-            i != i_end; ++i)
+    auto range = std::make_pair(channels.begin(), channels.end());
+
+    std::unique_ptr<MessageOut> reply;
+    if (msg.getUnreadLength() == 0)
     {
-        reply.writeString((*i)->getName());
-        reply.writeInt16((*i)->getUserList().size());
+        reply.reset(new MessageOut(CPMSG_LIST_CHANNELS_RESPONSE));
     }
+    else
+    {
+        const unsigned offset = msg.readInt32();
+        const unsigned count = std::min<unsigned>(msg.readInt16(),
+                                                  mMaxListPageSize);
+        const std::string prefix = msg.readString();
 
-    client.send(reply);
+        range = findPrefixed(channels.begin(), channels.end(), prefix,
+                             [](const ChatChannel *channel)
+                             -> const std::string &
+                             { return channel->getName(); });
+
+        reply.reset(new MessageOut(CPMSG_LIST_CHANNELS_PAGE));
+        reply->writeInt32(range.second - range.first);
+        reply->writeInt32(offset);
+
+        selectPage(range, offset, count);
+    }
+
+    for (auto i = range.first; i != range.second; ++i)
+    {
+        reply->writeString((*i)->getName());
+        reply->writeInt16((*i)->getUserList().size());
+    }
+
+    client.send(*reply);
 
     // log transaction
     Transaction trans;
@@ -553,25 +763,41 @@ void ChatHandler::handleListChannelsMessage(ChatClient &client, MessageIn &)
 void ChatHandler::handleListChannelUsersMessage(ChatClient &client,
                                                 MessageIn &msg)
 {
-    MessageOut reply(CPMSG_LIST_CHANNELUSERS_RESPONSE);
-
     std::string channelName = msg.readString();
     ChatChannel *channel = chatChannelManager->getChannel(channelName);
 
     if (channel)
     {
-        reply.writeString(channel->getName());
-
         const ChatChannel::ChannelUsers &users = channel->getUserList();
+        auto range = std::make_pair(users.begin(), users.end());
 
-        for (ChatChannel::ChannelUsers::const_iterator
-             i = users.begin(), i_end = users.end(); i != i_end; ++i)
+        std::unique_ptr<MessageOut> reply;
+        if (msg.getUnreadLength() == 0)
         {
-            reply.writeString((*i)->characterName);
-            reply.writeString(channel->getUserMode((*i)));
+            reply.reset(new MessageOut(CPMSG_LIST_CHANNELUSERS_RESPONSE));
+            reply->writeString(channel->getName());
+        }
+        else
+        {
+            const unsigned offset = msg.readInt32();
+            const unsigned count = std::min<unsigned>(msg.readInt16(),
+                                                      mMaxListPageSize);
+
+            reply.reset(new MessageOut(CPMSG_LIST_CHANNELUSERS_PAGE));
+            reply->writeString(channel->getName());
+            reply->writeInt32(users.size());
+            reply->writeInt32(offset);
+
+            selectPage(range, offset, count);
+        }
+
+        for (auto i = range.first; i != range.second; ++i)
+        {
+            reply->writeString((*i)->characterName);
+            reply->writeString(channel->getUserMode((*i)));
         }
 
-        client.send(reply);
+        client.send(*reply);
     }
 
     // log transaction
@@ -646,12 +872,7 @@ void ChatHandler::warnUsersAboutPlayerEventInChat(ChatChannel *channel,
 void ChatHandler::sendInChannel(ChatChannel *channel, MessageOut &msg)
 {
     const ChatChannel::ChannelUsers &users = channel->getUserList();
-
-    for (ChatChannel::ChannelUsers::const_iterator
-         i = users.begin(), i_end = users.end(); i != i_end; ++i)
-    {
-        (*i)->send(msg);
-    }
+    NetComputer::broadcast(users.begin(), users.end(), msg);
 }
 
 ChatClient *ChatHandler::getClient(const std::string &name) const
@@ -664,3 +885,9 @@ ChatClient *ChatHandler::getClient(const std::string &name) const
     else
         return 0;
 }
+
+ChatClient *ChatHandler::getClientById(unsigned characterId) const
+{
+    auto it = mPlayersById.find(characterId);
+    return it != mPlayersById.end() ? it->second : nullptr;
+}
@@ -21,14 +21,23 @@
 #ifndef CHATHANDLER_H
 #define CHATHANDLER_H
 
+#include <atomic>
 #include <deque>
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "chat-server/guild.h"
 
 #include "net/connectionhandler.h"
+#include "net/hostpoller.h"
+#include "net/messageout.h"
 
+#include "utils/taskqueue.h"
 #include "utils/tokencollector.h"
 
 class ChatChannel;
@@ -50,6 +59,7 @@ class ChatHandler : public ConnectionHandler
          */
         struct Pending
         {
+            int characterId;
             std::string character;
             unsigned char level;
         };
@@ -70,17 +80,64 @@ class ChatHandler : public ConnectionHandler
         };
 
         std::map<std::string, ChatClient*> mPlayerMap;
+        std::unordered_map<unsigned, ChatClient*> mPlayersById;
         std::deque<PartyInvite> mInvitations;
         std::map<std::string, int> mNumInvites;
 
+        /** The names of the characters online on the game servers, sorted. */
+        std::vector<std::string> mOnlineNames;
+
+        /** The complete who list, rebuilt when the online names changed. */
+        std::unique_ptr<MessageOut> mWhoReply;
+
+        /** Clients that get told about characters coming online. */
+        std::set<ChatClient*> mWhoSubscribers;
+
+        unsigned mMaxListPageSize;
+
+        /** Work handed over by the account server. */
+        utils::TaskQueue mTasks;
+
+        std::thread mThread;
+        std::atomic<bool> mThreadRunning;
+        HostPoller mThreadPoller;
+
     public:
         ChatHandler();
 
+        /**
+         * Stops the chat server thread, when it was started.
+         */
+        ~ChatHandler();
+
         /**
          * Start the handler.
          */
         bool startListen(enet_uint16 port, const std::string &host);
 
+        /**
+         * Runs the tasks posted in the meantime and serves the chat clients.
+         * Not to be called while the chat server runs on its own thread.
+         */
+        void process(enet_uint32 timeout = 0);
+
+        /**
+         * Serves the chat clients on a thread of their own, so that chat
+         * traffic does not delay the logins and the game servers.
+         */
+        void startThread();
+
+        /**
+         * Stops the thread started by startThread().
+         */
+        void stopThread();
+
+        /**
+         * Queues \a task to be run by the chat server. May be called from
+         * any thread.
+         */
+        void post(utils::TaskQueue::Task task);
+
         /**
          * Tell a list of users about an event in a chatchannel.
          *
@@ -113,7 +170,8 @@ class ChatHandler : public ConnectionHandler
                                  const std::string &characterName,
                                  char eventId);
 
-        void handlePartyInvite(MessageIn &msg);
+        void handlePartyInvite(const std::string &inviterName,
+                               const std::string &inviteeName);
 
         /**
          * Sends an announce to all connected clients.
@@ -128,6 +186,19 @@ class ChatHandler : public ConnectionHandler
          */
         ChatClient *getClient(const std::string &name) const;
 
+        /**
+         * Returns the ChatClient of a character by its id, or nullptr when
+         * the character is not connected to the chat server.
+         */
+        ChatClient *getClientById(unsigned characterId) const;
+
+        /**
+         * Updates the who list with the characters that came online or went
+         * offline, as name -> online, and tells the clients that subscribed
+         * to it.
+         */
+        void updateOnlineNames(const std::map<std::string, bool> &changes);
+
     protected:
         /**
          * Process chat related messages.
@@ -161,12 +232,15 @@ class ChatHandler : public ConnectionHandler
                              const std::string &guildName);
 
     private:
+        void run();
+
         // TODO: Unused
         void handleCommand(ChatClient &client, const std::string &command);
 
         void handleChatMessage(ChatClient &client, MessageIn &msg);
         void handlePrivMsgMessage(ChatClient &client, MessageIn &msg);
-        void handleWhoMessage(ChatClient &client);
+        void handleWhoMessage(ChatClient &client, MessageIn &msg);
+        void handleWhoSubscribeMessage(ChatClient &client, MessageIn &msg);
 
         void handleEnterChannelMessage(ChatClient &client, MessageIn &msg);
         void handleModeChangeMessage(ChatClient &client, MessageIn &msg);
@@ -244,13 +318,39 @@ class ChatHandler : public ConnectionHandler
          * Container for pending clients and pending connections.
          */
         TokenCollector<ChatHandler, ChatClient *, Pending *> mTokenCollector;
-        friend void registerChatClient(const std::string &, const std::string &, int);
+        friend void registerChatClient(const std::string &, int,
+                                       const std::string &, int);
 };
 
+/*
+ * The account server talks to the chat server only through the following
+ * functions. They may be called from any thread, the work is done on the
+ * thread serving the chat clients.
+ */
+
 /**
  * Register future client attempt. Temporary until physical server split.
  */
-void registerChatClient(const std::string &, const std::string &, int);
+void registerChatClient(const std::string &token, int characterId,
+                        const std::string &name, int level);
+
+/**
+ * Forwards a party invite made on a game server.
+ */
+void forwardPartyInvite(const std::string &inviterName,
+                        const std::string &inviteeName);
+
+/**
+ * Forwards an announce made on a game server to all the chat clients.
+ */
+void forwardAnnounce(const std::string &message, int senderId,
+                     const std::string &senderName);
+
+/**
+ * Forwards the changes to the names of the online characters, as returned by
+ * OnlineRegistry::takeNameChanges().
+ */
+void forwardOnlineNameChanges(const std::map<std::string, bool> &changes);
 
 extern ChatHandler *chatHandler;
 
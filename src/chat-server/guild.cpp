@@ -24,8 +24,6 @@
 
 #include "common/defines.h"
 
-#include <algorithm>
-
 Guild::Guild(const std::string &name)
     : mId(0)
     , mName(name)
@@ -34,10 +32,20 @@ Guild::Guild(const std::string &name)
 
 Guild::~Guild()
 {
+    for (GuildMember *member : mMembers)
+        delete member;
 }
 
 void Guild::addMember(int playerId, int permissions)
 {
+    mInvited.erase(playerId);
+
+    if (GuildMember *member = getMember(playerId))
+    {
+        member->mPermissions = permissions;
+        return;
+    }
+
     // create new guild member
     GuildMember *member = new GuildMember;
     member->mId = playerId;
@@ -45,8 +53,7 @@ void Guild::addMember(int playerId, int permissions)
 
     // add new guild member to guild
     mMembers.push_back(member);
-
-    mInvited.remove(playerId);
+    mMembersById[playerId] = member;
 }
 
 void Guild::removeMember(int playerId)
@@ -65,9 +72,13 @@ void Guild::removeMember(int playerId)
             }
         }
     }
-    GuildMember *member = getMember(playerId);
-    if (member)
-        mMembers.remove(member);
+    auto it = mMembersById.find(playerId);
+    if (it != mMembersById.end())
+    {
+        mMembers.remove(it->second);
+        delete it->second;
+        mMembersById.erase(it);
+    }
 }
 
 int Guild::getOwner() const
@@ -92,17 +103,17 @@ void Guild::setOwner(int playerId)
 
 bool Guild::checkInvited(int playerId) const
 {
-    return std::find(mInvited.begin(), mInvited.end(), playerId) != mInvited.end();
+    return mInvited.count(playerId) != 0;
 }
 
 void Guild::addInvited(int playerId)
 {
-    mInvited.push_back(playerId);
+    mInvited.insert(playerId);
 }
 
 void Guild::removeInvited(int playerId)
 {
-    mInvited.remove(playerId);
+    mInvited.erase(playerId);
 }
 
 bool Guild::checkInGuild(int playerId) const
@@ -112,16 +123,8 @@ bool Guild::checkInGuild(int playerId) const
 
 GuildMember *Guild::getMember(int playerId) const
 {
-    std::list<GuildMember*>::const_iterator itr = mMembers.begin(),
-                                            itr_end = mMembers.end();
-    while (itr != itr_end)
-    {
-        if ((*itr)->mId == playerId)
-            return (*itr);
-        ++itr;
-    }
-
-    return 0;
+    auto it = mMembersById.find(playerId);
+    return it != mMembersById.end() ? it->second : 0;
 }
 
 bool Guild::canInvite(int playerId) const
@@ -23,6 +23,8 @@
 
 #include <string>
 #include <list>
+#include <unordered_map>
+#include <unordered_set>
 
 /**
  * Guild members
@@ -102,7 +104,7 @@ class Guild
         /**
          * Returns a list of the members in this guild.
          */
-        std::list<GuildMember*> getMembers() const
+        const std::list<GuildMember*> &getMembers() const
         { return mMembers; }
 
         /**
@@ -140,8 +142,9 @@ class Guild
     private:
         short mId;
         std::string mName;
-        std::list<GuildMember*> mMembers;
-        std::list<int> mInvited;
+        std::list<GuildMember*> mMembers;   /**< In the order they joined */
+        std::unordered_map<int, GuildMember*> mMembersById;
+        std::unordered_set<int> mInvited;
 };
 
 #endif
@@ -25,13 +25,13 @@
 #include "guild.h"
 #include "guildmanager.h"
 
-#include "account-server/character.h"
-#include "account-server/storage.h"
+#include "account-server/characterdirectory.h"
 
 #include "net/messagein.h"
 #include "net/messageout.h"
 
 #include "common/configuration.h"
+#include "common/defines.h"
 #include "common/manaserv_protocol.h"
 
 using namespace ManaServ;
@@ -121,19 +121,19 @@ void ChatHandler::sendGuildListUpdate(Guild *guild,
     msg.writeInt16(guild->getId());
     msg.writeString(characterName);
     msg.writeInt8(eventId);
-    std::map<std::string, ChatClient*>::const_iterator chr;
-    std::list<GuildMember*> members = guild->getMembers();
+    const std::list<GuildMember*> &members = guild->getMembers();
+    std::vector<ChatClient*> recipients;
 
     for (std::list<GuildMember*>::const_iterator itr = members.begin();
          itr != members.end(); ++itr)
     {
-        CharacterData *c = storage->getCharacter((*itr)->mId, nullptr);
-        chr = mPlayerMap.find(c->getName());
-        if (chr != mPlayerMap.end())
+        if (ChatClient *member = getClientById((*itr)->mId))
         {
-            chr->second->send(msg);
+            recipients.push_back(member);
         }
     }
+
+    NetComputer::broadcast(recipients.begin(), recipients.end(), msg);
 }
 
 void ChatHandler::handleGuildCreate(ChatClient &client, MessageIn &msg)
@@ -288,15 +288,16 @@ void ChatHandler::handleGuildGetMembers(ChatClient &client, MessageIn &msg)
         {
             reply.writeInt8(ERRMSG_OK);
             reply.writeInt16(guildId);
-            std::list<GuildMember*> memberList = guild->getMembers();
+            const std::list<GuildMember*> &memberList = guild->getMembers();
             std::list<GuildMember*>::const_iterator itr_end = memberList.end();
-            for (std::list<GuildMember*>::iterator itr = memberList.begin();
+            for (std::list<GuildMember*>::const_iterator itr = memberList.begin();
                  itr != itr_end; ++itr)
             {
-                CharacterData *c = storage->getCharacter((*itr)->mId, nullptr);
-                std::string memberName = c->getName();
-                reply.writeString(memberName);
-                reply.writeInt8(mPlayerMap.find(memberName) != mPlayerMap.end());
+                ChatClient *member = getClientById((*itr)->mId);
+                reply.writeString(member ?
+                        member->characterName :
+                        characterDirectory->getName((*itr)->mId));
+                reply.writeInt8(member != nullptr);
             }
         }
     }
@@ -318,12 +319,12 @@ void ChatHandler::handleGuildMemberLevelChange(ChatClient &client,
     std::string user = msg.readString();
     short level = msg.readInt8();
     Guild *guild = guildManager->findById(guildId);
-    CharacterData *c = storage->getCharacter(user);
+    int charId = characterDirectory->getId(user);
 
-    if (guild && c)
+    if (guild && charId)
     {
-        int rights = guild->getUserPermissions(c->getDatabaseID()) | level;
-        if (guildManager->changeMemberLevel(&client, guild, c->getDatabaseID(),
+        int rights = guild->getUserPermissions(charId) | level;
+        if (guildManager->changeMemberLevel(&client, guild, charId,
                                             rights) == 0)
         {
             reply.writeInt8(ERRMSG_OK);
@@ -354,7 +355,7 @@ void ChatHandler::handleGuildKickMember(ChatClient &client, MessageIn &msg)
     if (otherClient)
         otherCharId = otherClient->characterId;
     else
-        otherCharId = storage->getCharacterId(otherCharName);
+        otherCharId = characterDirectory->getId(otherCharName);
 
     if (otherCharId == 0)
     {
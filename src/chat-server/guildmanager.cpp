@@ -27,11 +27,20 @@
 #include "chat-server/chatchannelmanager.h"
 #include "chat-server/chathandler.h"
 
+#include <algorithm>
+
 using namespace ManaServ;
 
 GuildManager::GuildManager():
         mGuilds(storage->getGuildList())
 {
+    for (auto &it : mGuilds)
+    {
+        Guild *guild = it.second;
+        mGuildsByName[guild->getName()] = guild;
+        for (GuildMember *member : guild->getMembers())
+            addToIndex(guild, member->mId);
+    }
 }
 
 GuildManager::~GuildManager()
@@ -51,6 +60,7 @@ Guild* GuildManager::createGuild(const std::string &name, int playerId)
 
     // Add guild
     mGuilds[guild->getId()] = guild;
+    mGuildsByName[guild->getName()] = guild;
 
     // put the owner in the guild
     addGuildMember(guild, playerId);
@@ -67,6 +77,9 @@ void GuildManager::removeGuild(Guild *guild)
 {
     storage->removeGuild(guild);
     mGuilds.erase(guild->getId());
+    mGuildsByName.erase(guild->getName());
+    for (GuildMember *member : guild->getMembers())
+        removeFromIndex(guild, member->mId);
     delete guild;
 }
 
@@ -74,6 +87,7 @@ void GuildManager::addGuildMember(Guild *guild, int playerId)
 {
     storage->addGuildMember(guild->getId(), playerId);
     guild->addMember(playerId);
+    addToIndex(guild, playerId);
 }
 
 void GuildManager::removeGuildMember(Guild *guild, int playerId,
@@ -83,6 +97,7 @@ void GuildManager::removeGuildMember(Guild *guild, int playerId,
     // remove the user from the guild
     storage->removeGuildMember(guild->getId(), playerId);
     guild->removeMember(playerId);
+    removeFromIndex(guild, playerId);
 
     chatHandler->sendGuildListUpdate(guild, characterName,
                                      GUILD_EVENT_LEAVING_PLAYER);
@@ -117,15 +132,8 @@ Guild *GuildManager::findById(short id) const
 
 Guild *GuildManager::findByName(const std::string &name) const
 {
-    for (std::map<int, Guild*>::const_iterator it = mGuilds.begin(),
-            it_end = mGuilds.end();
-            it != it_end; ++it)
-    {
-        Guild *guild = it->second;
-        if (guild->getName() == name)
-            return guild;
-    }
-    return 0;
+    auto it = mGuildsByName.find(name);
+    return it == mGuildsByName.end() ? 0 : it->second;
 }
 
 bool GuildManager::doesExist(const std::string &name) const
@@ -133,18 +141,32 @@ bool GuildManager::doesExist(const std::string &name) const
     return findByName(name) != 0;
 }
 
-std::vector<Guild *> GuildManager::getGuildsForPlayer(int playerId) const
+const std::vector<Guild *> &GuildManager::getGuildsForPlayer(int playerId) const
 {
-    std::vector<Guild *> guilds;
-    for (std::map<int, Guild*>::const_iterator it = mGuilds.begin();
-         it != mGuilds.end(); ++it)
-    {
-        if (it->second->checkInGuild(playerId))
-        {
-            guilds.push_back(it->second);
-        }
-    }
-    return guilds;
+    static const std::vector<Guild *> noGuilds;
+
+    auto it = mGuildsByPlayer.find(playerId);
+    return it == mGuildsByPlayer.end() ? noGuilds : it->second;
+}
+
+void GuildManager::addToIndex(Guild *guild, int playerId)
+{
+    std::vector<Guild*> &guilds = mGuildsByPlayer[playerId];
+    if (std::find(guilds.begin(), guilds.end(), guild) == guilds.end())
+        guilds.push_back(guild);
+}
+
+void GuildManager::removeFromIndex(Guild *guild, int playerId)
+{
+    auto it = mGuildsByPlayer.find(playerId);
+    if (it == mGuildsByPlayer.end())
+        return;
+
+    std::vector<Guild*> &guilds = it->second;
+    guilds.erase(std::remove(guilds.begin(), guilds.end(), guild),
+                 guilds.end());
+    if (guilds.empty())
+        mGuildsByPlayer.erase(it);
 }
 
 void GuildManager::disconnectPlayer(ChatClient *player)
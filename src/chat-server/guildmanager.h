@@ -25,6 +25,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 
 class Guild;
 class ChatClient;
@@ -68,7 +69,7 @@ class GuildManager
         Guild *findById(short id) const;
 
         /**
-         * Returns the guild with the given name. O(n)
+         * Returns the guild with the given name.
          *
          * @return the guild with the given name, or nullptr if it doesn't exist
          */
@@ -82,7 +83,7 @@ class GuildManager
         /**
          * Return the guilds a character is in
          */
-        std::vector<Guild *> getGuildsForPlayer(int playerId) const;
+        const std::vector<Guild *> &getGuildsForPlayer(int playerId) const;
 
         /**
          * Inform guild members that a player has disconnected.
@@ -104,7 +105,14 @@ class GuildManager
         void setUserRights(Guild *guild, int playerId, int rights);
 
     private:
+        void addToIndex(Guild *guild, int playerId);
+        void removeFromIndex(Guild *guild, int playerId);
+
         std::map<int, Guild*> mGuilds;
+        std::unordered_map<std::string, Guild*> mGuildsByName;
+
+        /** The guilds of each character that is in a guild. */
+        std::unordered_map<int, std::vector<Guild*> > mGuildsByPlayer;
 };
 
 extern GuildManager *guildManager;
@@ -36,22 +36,27 @@ Party::Party()
     mId = id;
 }
 
-void Party::addUser(const std::string &name, const std::string &inviter)
+void Party::addUser(ChatClient *client, const std::string &inviter)
 {
-    mUsers.push_back(name);
+    mUsers.push_back(client->characterId);
 
+    std::vector<ChatClient*> members;
     for (size_t i = 0; i < userCount(); ++i)
     {
-        MessageOut out(ManaServ::CPMSG_PARTY_NEW_MEMBER);
-        out.writeString(name);
-        out.writeString(inviter);
-        chatHandler->getClient(mUsers[i])->send(out);
+        if (ChatClient *member = chatHandler->getClientById(mUsers[i]))
+            members.push_back(member);
     }
+
+    MessageOut out(ManaServ::CPMSG_PARTY_NEW_MEMBER);
+    out.writeString(client->characterName);
+    out.writeString(inviter);
+    NetComputer::broadcast(members.begin(), members.end(), out);
 }
 
-void Party::removeUser(const std::string &name)
+void Party::removeUser(unsigned characterId)
 {
-    PartyUsers::iterator itr = std::find(mUsers.begin(), mUsers.end(), name);
+    PartyUsers::iterator itr = std::find(mUsers.begin(), mUsers.end(),
+                                         characterId);
     if (itr != mUsers.end())
     {
         mUsers.erase(itr);
@@ -24,26 +24,29 @@
 #include <string>
 #include <vector>
 
+class ChatClient;
+
 /**
  * A party that contains 1 or more characters to play together
  */
 class Party
 {
 public:
-    typedef std::vector<std::string> PartyUsers;
+    /** The character ids of the members. */
+    typedef std::vector<unsigned> PartyUsers;
 
     Party();
 
     /**
-     * Add user to party
+     * Add user to party and tell all the members about it
      */
-    void addUser(const std::string &name,
+    void addUser(ChatClient *client,
                  const std::string &inviter = std::string());
 
     /**
      * Remove user from party
      */
-    void removeUser(const std::string &name);
+    void removeUser(unsigned characterId);
 
     /**
      * Return number of users in party
@@ -22,7 +22,6 @@
 #include "chatclient.h"
 #include "party.h"
 
-#include "account-server/storage.h"
 #include "account-server/serverhandler.h"
 
 #include "common/manaserv_protocol.h"
@@ -34,8 +33,7 @@ using namespace ManaServ;
 
 void updateInfo(ChatClient *client, int partyId)
 {
-    CharacterData *character = storage->getCharacter(client->characterName);
-    GameServerHandler::sendPartyChange(character, partyId);
+    GameServerHandler::sendPartyChange(client->characterId, partyId);
 }
 
 void ChatHandler::removeExpiredPartyInvites()
@@ -51,10 +49,9 @@ void ChatHandler::removeExpiredPartyInvites()
     }
 }
 
-void ChatHandler::handlePartyInvite(MessageIn &msg)
+void ChatHandler::handlePartyInvite(const std::string &inviterName,
+                                    const std::string &inviteeName)
 {
-    std::string inviterName = msg.readString();
-    std::string inviteeName = msg.readString();
     ChatClient *inviter = getClient(inviterName);
     ChatClient *invitee = getClient(inviteeName);
 
@@ -151,21 +148,24 @@ void ChatHandler::handlePartyInviteAnswer(ChatClient &client, MessageIn &msg)
     if (!c1->party)
     {
         c1->party = new Party();
-        c1->party->addUser(inviter);
+        c1->party->addUser(c1);
         // tell game server to update info
         updateInfo(c1, c1->party->getId());
     }
 
     outInvitee.writeInt8(ERRMSG_OK);
-    Party::PartyUsers users = c1->party->getUsers();
+    const Party::PartyUsers &users = c1->party->getUsers();
     const unsigned usersSize = users.size();
     for (unsigned i = 0; i < usersSize; i++)
-        outInvitee.writeString(users[i]);
+    {
+        if (ChatClient *member = getClientById(users[i]))
+            outInvitee.writeString(member->characterName);
+    }
 
     client.send(outInvitee);
 
     // add invitee to the party
-    c1->party->addUser(client.characterName, inviter);
+    c1->party->addUser(&client, inviter);
     client.party = c1->party;
 
     // tell game server to update info
@@ -187,30 +187,31 @@ void ChatHandler::removeUserFromParty(ChatClient &client)
 {
     if (client.party)
     {
-        client.party->removeUser(client.characterName);
+        client.party->removeUser(client.characterId);
         informPartyMemberQuit(client);
 
         // if theres less than 1 member left, remove the party
         if (client.party->userCount() < 1)
-        {
             delete client.party;
-            client.party = 0;
-        }
+
+        client.party = 0;
     }
 }
 
 void ChatHandler::informPartyMemberQuit(ChatClient &client)
 {
-    std::map<std::string, ChatClient*>::iterator itr;
-    std::map<std::string, ChatClient*>::const_iterator itr_end = mPlayerMap.end();
+    // The member that left is told as well
+    std::vector<ChatClient*> members(1, &client);
 
-    for (itr = mPlayerMap.begin(); itr != itr_end; ++itr)
+    const Party::PartyUsers &users = client.party->getUsers();
+    for (Party::PartyUsers::const_iterator it = users.begin(),
+         it_end = users.end(); it != it_end; ++it)
     {
-        if (itr->second->party == client.party)
-        {
-            MessageOut out(CPMSG_PARTY_MEMBER_LEFT);
-            out.writeInt32(client.characterId);
-            itr->second->send(out);
-        }
+        if (ChatClient *member = getClientById(*it))
+            members.push_back(member);
     }
+
+    MessageOut out(CPMSG_PARTY_MEMBER_LEFT);
+    out.writeInt32(client.characterId);
+    NetComputer::broadcast(members.begin(), members.end(), out);
 }
@@ -20,47 +20,22 @@
 
 #include "post.h"
 
-#include "../account-server/character.h"
+#include "../account-server/storage.h"
 #include "../common/configuration.h"
 
-Letter::Letter(unsigned type, CharacterData *sender, CharacterData *receiver)
- : mId(0), mType(type), mExpiry(0), mSender(sender), mReceiver(receiver)
-{
-}
+#include <algorithm>
+#include <memory>
 
-Letter::~Letter()
+Letter::Letter(unsigned type, int senderId, int receiverId)
+ : mId(0), mType(type), mExpiry(0), mSenderId(senderId),
+   mReceiverId(receiverId)
 {
-    if (mSender)
-        delete mSender;
-
-    if (mReceiver)
-        delete mReceiver;
 }
 
-void Letter::setExpiry(unsigned long expiry)
-{
-    mExpiry = expiry;
-}
-
-unsigned long Letter::getExpiry() const
-{
-    return mExpiry;
-}
-
-void Letter::addText(const std::string &text)
-{
-    mContents = text;
-}
-
-std::string Letter::getContents() const
-{
-    return mContents;
-}
-
-bool Letter::addAttachment(InventoryItem item)
+bool Letter::addAttachment(const InventoryItem &item)
 {
     unsigned max = Configuration::getValue("mail_maxAttachments", 3);
-    if (mAttachments.size() > max)
+    if (mAttachments.size() >= max)
     {
         return false;
     }
@@ -70,92 +45,92 @@ bool Letter::addAttachment(InventoryItem item)
     return true;
 }
 
-CharacterData *Letter::getReceiver() const
+Post::~Post()
 {
-    return mReceiver;
+    for (Letter *letter : mLetters)
+        delete letter;
 }
 
-CharacterData *Letter::getSender() const
+void Post::addLetter(Letter *letter)
 {
-    return mSender;
+    mLetters.push_back(letter);
 }
 
-std::vector<InventoryItem> Letter::getAttachments() const
+Letter *Post::getLetter(int letter) const
 {
-    return mAttachments;
+    if (letter < 0 || (size_t) letter >= mLetters.size())
+    {
+        return nullptr;
+    }
+    return mLetters[letter];
 }
 
-Post::~Post()
+unsigned Post::getNumberOfLetters() const
 {
-    std::vector<Letter*>::iterator itr_end = mLetters.end();
-    for (std::vector<Letter*>::iterator itr = mLetters.begin();
-         itr != itr_end;
-         ++itr)
-    {
-        delete (*itr);
-    }
+    return mLetters.size();
+}
 
-    mLetters.clear();
+PostManager::PostManager():
+    mMaxLetters(Configuration::getValue("mail_maxLetters", 10)),
+    mPageSize(std::max(1, Configuration::getValue("mail_pageSize", 10))),
+    mExpiryTime(Configuration::getValue("mail_expiryDays", 30) * 24 * 60 * 60)
+{
 }
 
-bool Post::addLetter(Letter *letter)
+bool PostManager::addLetter(Letter *letter)
 {
-    unsigned max = Configuration::getValue("mail_maxLetters", 10);
-    if (mLetters.size() > max)
-    {
+    const int receiverId = letter->getReceiverId();
+    const unsigned count = getNumberOfLetters(receiverId);
+    if (count >= mMaxLetters)
         return false;
-    }
 
-    mLetters.push_back(letter);
+    if (mExpiryTime > 0)
+        letter->setExpiry(time(nullptr) + mExpiryTime);
 
+    storage->storeLetter(letter);
+    mLetterCounts[receiverId] = count + 1;
     return true;
 }
 
-Letter* Post::getLetter(int letter) const
+Post *PostManager::takePost(int charId, unsigned maxLetters)
 {
-    if (letter < 0 || (size_t) letter > mLetters.size())
-    {
-        return nullptr;
-    }
-    return mLetters[letter];
-}
+    Post *post = storage->getStoredPost(charId,
+                                        std::min(maxLetters, mPageSize));
+    const unsigned taken = post->getNumberOfLetters();
+    if (taken == 0)
+        return post;
 
-unsigned Post::getNumberOfLetters() const
-{
-    return mLetters.size();
-}
+    // Only the attachments of the delivered letters are ever loaded
+    storage->loadAttachments(post);
 
-void PostManager::addLetter(Letter *letter)
-{
-    std::map<CharacterData*, Post*>::iterator itr =
-        mPostBox.find(letter->getReceiver());
-    if (itr != mPostBox.end())
-    {
-        itr->second->addLetter(letter);
-    }
-    else
-    {
-        Post *post = new Post();
-        post->addLetter(letter);
-        mPostBox.insert(
-            std::pair<CharacterData*, Post*>(letter->getReceiver(), post)
-            );
-    }
+    std::vector<unsigned> letterIds;
+    for (unsigned i = 0; i < taken; ++i)
+        letterIds.push_back(post->getLetter(i)->getId());
+    storage->deleteLetters(letterIds);
+
+    auto it = mLetterCounts.find(charId);
+    if (it != mLetterCounts.end())
+        it->second -= std::min(it->second, taken);
+
+    return post;
 }
 
-Post *PostManager::getPost(CharacterData *player) const
+unsigned PostManager::getNumberOfLetters(int charId)
 {
-    std::map<CharacterData*, Post*>::const_iterator itr = mPostBox.find(player);
-    return (itr == mPostBox.end()) ? nullptr : itr->second;
+    auto it = mLetterCounts.find(charId);
+    if (it != mLetterCounts.end())
+        return it->second;
+
+    const unsigned count = storage->getLetterCount(charId);
+    mLetterCounts[charId] = count;
+    return count;
 }
 
-void PostManager::clearPost(CharacterData *player)
+void PostManager::removeExpiredLetters()
 {
-    std::map<CharacterData*, Post*>::iterator itr =
-        mPostBox.find(player);
-    if (itr != mPostBox.end())
-    {
-        delete itr->second;
-        mPostBox.erase(itr);
-    }
+    storage->async("deleteExpiredLetters", [this] {
+        // Their letters are counted again when needed
+        for (int charId : storage->deleteExpiredLetters())
+            mLetterCounts.erase(charId);
+    });
 }
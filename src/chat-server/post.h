@@ -21,14 +21,13 @@
 #ifndef POST_H
 #define POST_H
 
-#include <map>
+#include <ctime>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "../common/inventorydata.h"
 
-class CharacterData;
-
 class Letter
 {
 public:
@@ -38,24 +37,22 @@ public:
      * Before the letter is stored in the database, the unique Id of the letter
      * is 0.
      * @param type Type of Letter - unused
-     * @param sender Pointer to character that sent the letter
-     * @param receiver Pointer to character that will receive the letter
+     * @param senderId Id of the character that sent the letter
+     * @param receiverId Id of the character that will receive the letter
      */
-    Letter(unsigned type, CharacterData *sender, CharacterData *receiver);
-
-    ~Letter();
+    Letter(unsigned type, int senderId, int receiverId);
 
     /**
      * Gets the unique Id of the letter.
      */
-    unsigned long getId() const
+    unsigned getId() const
     { return mId; }
 
     /**
      * Sets the unique Id of the letter used as primary key in the database.
      * @param Id Unique id of the letter.
      */
-    void setId(unsigned long Id)
+    void setId(unsigned Id)
     { mId = Id; }
 
     /**
@@ -65,78 +62,93 @@ public:
     { return mType; }
 
     /**
-     * Set the expiry
+     * Set the expiry, 0 for a letter that never expires
      */
-    void setExpiry(unsigned long expiry);
+    void setExpiry(time_t expiry)
+    { mExpiry = expiry; }
 
     /**
      * Get the expiry
      */
-    unsigned long getExpiry() const;
+    time_t getExpiry() const
+    { return mExpiry; }
 
     /**
      * Add text contents of letter
      * This overwrites whatever was there previously
      * @param text The content of the letter to add
      */
-    void addText(const std::string &text);
+    void addText(const std::string &text)
+    { mContents = text; }
 
     /**
      * Get the text contents of letter
      * @return String containing the text
      */
-    std::string getContents() const;
+    const std::string &getContents() const
+    { return mContents; }
 
     /**
      * Add an attachment
      * @param item The attachment to add to the letter
      * @return Returns true if the letter doesnt have too many attachments
      */
-    bool addAttachment(InventoryItem item);
+    bool addAttachment(const InventoryItem &item);
+
+    /**
+     * Get the id of the character receiving the letter
+     */
+    int getReceiverId() const
+    { return mReceiverId; }
 
     /**
-     * Get the character receiving the letter
-     * @return Returns the Character who will receive the letter
+     * Set the id of the character who receives the letter
      */
-    CharacterData *getReceiver() const;
+    void setReceiverId(int receiverId)
+    { mReceiverId = receiverId; }
 
     /**
-     * Get the character who sent the letter
-     * @return Returns the Character who sent the letter
+     * Get the id of the character who sent the letter
      */
-    CharacterData *getSender() const;
+    int getSenderId() const
+    { return mSenderId; }
 
     /**
-     * Get the attachments
+     * Get the attachments. Letters loaded from the database only have their
+     * attachments once they are about to be delivered, see
+     * Storage::loadAttachments().
      */
-    std::vector<InventoryItem> getAttachments() const;
+    const std::vector<InventoryItem> &getAttachments() const
+    { return mAttachments; }
 
 private:
     unsigned mId;
     unsigned mType;
-    unsigned long mExpiry;
+    time_t mExpiry;
     std::string mContents;
     std::vector<InventoryItem> mAttachments;
-    CharacterData *mSender;
-    CharacterData *mReceiver;
+    int mSenderId;
+    int mReceiverId;
 };
 
+/**
+ * A page of letters taken out of a mailbox.
+ */
 class Post
 {
 public:
     ~Post();
 
     /**
-     * Add letter to post
+     * Add letter to post, the post takes ownership of it
      * @param letter Letter to add
-     * @return Returns true if post isnt full
      */
-    bool addLetter(Letter *letter);
+    void addLetter(Letter *letter);
 
     /**
-     * Return next letter
+     * Return the letter at the given index
      */
-    Letter* getLetter(int letter) const;
+    Letter *getLetter(int letter) const;
 
     /**
      * Return number of letters in post
@@ -148,29 +160,56 @@ private:
     std::vector<Letter*> mLetters;
 };
 
+/**
+ * Keeps the mailboxes of the characters in the database, indexed by the id
+ * of the receiver. Only the number of letters in each mailbox that was used
+ * is kept in memory, the letters are loaded a page at a time when they are
+ * delivered.
+ *
+ * Apart from removeExpiredLetters(), the functions access the database and
+ * are meant to be called from the storage operations queued with
+ * Storage::async(). The letter counts are only touched by these operations,
+ * which run one at a time.
+ */
 class PostManager
 {
 public:
+    PostManager();
+
     /**
-     * Add letter to post box
-     * @param letter Letter to add
+     * Stores a letter in the mailbox of its receiver.
+     * @param letter Letter to add, stays owned by the caller
+     * @return Returns false when the mailbox is full
      */
-    void addLetter(Letter *letter);
+    bool addLetter(Letter *letter);
 
     /**
-     * Get post for character
-     * @param player Character that is getting post
-     * @return Returns the post for that character
+     * Takes the oldest letters out of the mailbox of a character, along with
+     * their attachments. At most mail_pageSize letters are taken at once.
+     * @param charId Character that is getting post
+     * @param maxLetters The most letters to take
+     * @return Returns the letters, owned by the caller
      */
-    Post *getPost(CharacterData *player) const;
+    Post *takePost(int charId, unsigned maxLetters);
 
     /**
-     * Remove the post for character
+     * Returns the number of letters in the mailbox of a character.
      */
-    void clearPost(CharacterData *player);
+    unsigned getNumberOfLetters(int charId);
+
+    /**
+     * Deletes the expired letters from the database. The letters are deleted
+     * on the database thread, and can be called from the main thread.
+     */
+    void removeExpiredLetters();
 
 private:
-    std::map<CharacterData*, Post*> mPostBox;
+    unsigned mMaxLetters;       /**< Letters a mailbox can hold. */
+    unsigned mPageSize;         /**< Letters delivered at once. */
+    time_t mExpiryTime;         /**< Seconds until a letter expires. */
+
+    /** The number of letters in the mailboxes, by character id. */
+    std::unordered_map<int, unsigned> mLetterCounts;
 };
 
 extern PostManager *postalManager;
@@ -31,7 +31,7 @@ namespace ManaServ {
 enum {
     PROTOCOL_VERSION = 10,
     MIN_PROTOCOL_VERSION = 9,
-    SUPPORTED_DB_VERSION = 26
+    SUPPORTED_DB_VERSION = 29
 };
 
 /**
@@ -79,6 +79,7 @@ enum {
     APMSG_LOGOUT_RESPONSE          = 0x0014, // B error
     PAMSG_LOGIN_RNDTRGR            = 0x0015, // S username
     APMSG_LOGIN_RNDTRGR_RESPONSE   = 0x0016, // S random seed
+    APMSG_LOGIN_QUEUE_POSITION     = 0x0017, // D position, sent instead of the random seed while too many logins are in progress
     PAMSG_CHAR_CREATE              = 0x0020, // S name, B hair style, B hair color, B gender, B slot, {W stats}*
     APMSG_CHAR_CREATE_RESPONSE     = 0x0021, // B error, on success: B slot, S name, B gender, B hair style, B hair color,
                                              // W character points, W correction points, B amount of items equipped,
@@ -238,8 +239,11 @@ enum {
     CPMSG_PUBMSG                   = 0x0404, // W channel, S user, S text
     PCMSG_CHAT                     = 0x0410, // S text, W channel
     PCMSG_PRIVMSG                  = 0x0412, // S user, S text
-    PCMSG_WHO                      = 0x0415, // -
+    PCMSG_WHO                      = 0x0415, // [D offset, W count, S name prefix]
     CPMSG_WHO_RESPONSE             = 0x0416, // { S user }
+    CPMSG_WHO_PAGE                 = 0x0417, // D total, D offset, { S user }
+    PCMSG_WHO_SUBSCRIBE            = 0x0418, // B subscribe
+    CPMSG_WHO_CHANGES              = 0x0419, // { B online, S user }
 
     // -- Channeling
     CPMSG_CHANNEL_EVENT               = 0x0430, // W channel, B event, S info
@@ -247,11 +251,13 @@ enum {
     CPMSG_ENTER_CHANNEL_RESPONSE      = 0x0441, // B error, W id, S name, S topic, S userlist
     PCMSG_QUIT_CHANNEL                = 0x0443, // W channel id
     CPMSG_QUIT_CHANNEL_RESPONSE       = 0x0444, // B error, W channel id
-    PCMSG_LIST_CHANNELS               = 0x0445, // -
+    PCMSG_LIST_CHANNELS               = 0x0445, // [D offset, W count, S name prefix]
     CPMSG_LIST_CHANNELS_RESPONSE      = 0x0446, // S names, W number of users
-    PCMSG_LIST_CHANNELUSERS           = 0x0460, // S channel
+    CPMSG_LIST_CHANNELS_PAGE          = 0x0447, // D total, D offset, { S name, W number of users }
+    PCMSG_LIST_CHANNELUSERS           = 0x0460, // S channel, [D offset, W count]
     CPMSG_LIST_CHANNELUSERS_RESPONSE  = 0x0461, // S channel, { S user, B mode }
     PCMSG_TOPIC_CHANGE                = 0x0462, // W channel id, S topic
+    CPMSG_LIST_CHANNELUSERS_PAGE      = 0x0463, // S channel, D total, D offset, { S user, B mode }
     // -- User modes
     PCMSG_USER_MODE                   = 0x0465, // W channel id, S name, B mode
     PCMSG_KICK_USER                   = 0x0466, // W channel id, S name
@@ -260,9 +266,10 @@ enum {
     GPMSG_QUESTLOG_STATUS       = 0x0470, // {W quest id, B flags, [B status], [S questname], [S questdescription]}*
 
     // Inter-server
-    GAMSG_REGISTER              = 0x0500, // S address, W port, S password, D items db revision
+    GAMSG_REGISTER              = 0x0500, // S name, S address, W port, S password, D items db revision, W capabilities
     AGMSG_REGISTER_RESPONSE     = 0x0501, // W item version, W password response, { S globalvar_key, S globalvar_value }
     AGMSG_ACTIVE_MAP            = 0x0502, // W map id, W Number of mapvar_key mapvar_value sent, { S mapvar_key, S mapvar_value }, W Number of map items, { D item Id, W amount, W posX, W posY }
+    AGMSG_CAPABILITIES          = 0x0503, // W capabilities supported by both servers
     AGMSG_PLAYER_ENTER          = 0x0510, // B*32 token, D id, S name, serialised character data
     GAMSG_PLAYER_DATA           = 0x0520, // D id, serialised character data
     GAMSG_REDIRECT              = 0x0530, // D id
@@ -282,8 +289,8 @@ enum {
     GAMSG_CHANGE_ACCOUNT_LEVEL  = 0x0556, // D id, W level
     GAMSG_STATISTICS            = 0x0560, // { W map id, W entity nb, W monster nb, W player nb, { D character id }* }*
     CGMSG_CHANGED_PARTY         = 0x0590, // D character id, D party id
-    GCMSG_REQUEST_POST          = 0x05A0, // D character id
-    CGMSG_POST_RESPONSE         = 0x05A1, // D receiver id, { S sender name, S letter, W num attachments { W attachment item id, W quantity } }
+    GCMSG_REQUEST_POST          = 0x05A0, // D character id, W max letters (paged post only)
+    CGMSG_POST_RESPONSE         = 0x05A1, // D receiver id, W letters left (paged post only), { S sender name, S letter, W num attachments { W attachment item id, W quantity } }
     GCMSG_STORE_POST            = 0x05A5, // D sender id, S receiver name, S letter, { W attachment item id, W quantity }
     CGMSG_STORE_POST_RESPONSE   = 0x05A6, // D id, B error
     GAMSG_TRANSACTION           = 0x0600, // D character id, D action, S message
@@ -326,11 +333,30 @@ enum {
     PASSWORD_BAD = 0x01
 };
 
+// used in GAMSG_REGISTER to announce the optional features understood by the
+// game server. The account server answers with AGMSG_CAPABILITIES, holding the
+// ones it supports as well. Older servers do not send these.
+enum {
+    SERVER_CAPABILITY_BINARY_DOUBLE = 0x01,
+    SERVER_CAPABILITY_PAGED_POST    = 0x02  // max letters and letters left
+};
+
+// markers written instead of the length of a double sent as text, when the
+// double is sent in binary. Followed by the big-endian value.
+enum {
+    DOUBLE_DECIMAL = 0xFB,  // B decimals, D value multiplied by 10^decimals
+    DOUBLE_FLOAT  = 0xFC,   // value exact in IEEE-754 single precision
+    DOUBLE_INT16  = 0xFD,   // integral value, as a 16-bit integer
+    DOUBLE_INT32  = 0xFE,   // integral value, as a 32-bit integer
+    DOUBLE_BINARY = 0xFF    // IEEE-754 double precision value
+};
+
 // used to identify part of sync message
 enum {
     SYNC_CHARACTER_POINTS    = 0x01,       // D charId, D charPoints, D corrPoints
     SYNC_CHARACTER_ATTRIBUTE = 0x02,       // D charId, D attrId, DF base, DF mod
-    SYNC_ONLINE_STATUS       = 0x04        // D charId, B 0 = offline, 1 = online
+    SYNC_ONLINE_STATUS       = 0x04,       // D charId, B 0 = offline, 1 = online
+    SYNC_QUEST_VAR           = 0x08        // D charId, S name, S value
 };
 
 // Login specific return values
@@ -0,0 +1,112 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "connectionpool.h"
+
+#include "dataprovider.h"
+#include "dataproviderfactory.h"
+
+#include "utils/logger.h"
+
+namespace dal
+{
+
+ConnectionPool::Lease::Lease(ConnectionPool *pool, DataProvider *provider):
+    mPool(pool),
+    mProvider(provider)
+{
+}
+
+ConnectionPool::Lease::Lease(Lease &&other):
+    mPool(other.mPool),
+    mProvider(other.mProvider)
+{
+    other.mProvider = nullptr;
+}
+
+ConnectionPool::Lease::~Lease()
+{
+    if (mProvider)
+        mPool->release(mProvider);
+}
+
+ConnectionPool::ConnectionPool(unsigned size, bool readReplica):
+    mReadReplica(readReplica)
+{
+    for (unsigned i = 0; i < size; ++i)
+    {
+        DataProvider *provider =
+                DataProviderFactory::createDataProvider(readReplica);
+        mProviders.push_back(std::unique_ptr<DataProvider>(provider));
+        mIdle.push_back(provider);
+    }
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    for (auto &provider : mProviders)
+    {
+        try
+        {
+            provider->disconnect();
+        }
+        catch (const std::exception &e)
+        {
+            LOG_WARN("Could not close a pooled database connection: "
+                     << e.what());
+        }
+    }
+}
+
+ConnectionPool::Lease ConnectionPool::acquire()
+{
+    DataProvider *provider;
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mReleased.wait(lock, [this] { return !mIdle.empty(); });
+        provider = mIdle.back();
+        mIdle.pop_back();
+    }
+
+    // Returned to the pool in case connecting fails
+    Lease lease(this, provider);
+    if (!provider->isConnected())
+        provider->connect();
+
+    return lease;
+}
+
+unsigned ConnectionPool::getBusyCount() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mProviders.size() - mIdle.size();
+}
+
+void ConnectionPool::release(DataProvider *provider)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mIdle.push_back(provider);
+    }
+    mReleased.notify_one();
+}
+
+} // namespace dal
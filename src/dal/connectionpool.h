@@ -0,0 +1,113 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CONNECTION_POOL_H
+#define CONNECTION_POOL_H
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace dal
+{
+
+class DataProvider;
+
+/**
+ * A fixed number of database connections that can be used from several
+ * threads. A connection is leased with acquire() and returned when the lease
+ * goes out of scope. Connections are opened when they are first leased.
+ */
+class ConnectionPool
+{
+    public:
+        /**
+         * A leased connection. Returns the connection to the pool when
+         * destroyed.
+         */
+        class Lease
+        {
+            public:
+                Lease(Lease &&other);
+                ~Lease();
+
+                DataProvider *get() const
+                { return mProvider; }
+
+                DataProvider *operator->() const
+                { return mProvider; }
+
+            private:
+                friend class ConnectionPool;
+
+                Lease(ConnectionPool *pool, DataProvider *provider);
+                Lease(const Lease &) = delete;
+                Lease &operator=(const Lease &) = delete;
+
+                ConnectionPool *mPool;
+                DataProvider *mProvider;
+        };
+
+        /**
+         * @param size        the number of connections.
+         * @param readReplica whether to connect to the read replica.
+         */
+        ConnectionPool(unsigned size, bool readReplica);
+
+        /**
+         * Closes the connections. No lease may be left.
+         */
+        ~ConnectionPool();
+
+        /**
+         * Leases a connection, waiting until one is free.
+         *
+         * @exception DbConnectionFailure if the connection could not be
+         *            opened.
+         */
+        Lease acquire();
+
+        unsigned getSize() const
+        { return mProviders.size(); }
+
+        /**
+         * Returns the number of connections currently leased.
+         */
+        unsigned getBusyCount() const;
+
+        bool isReadReplica() const
+        { return mReadReplica; }
+
+    private:
+        void release(DataProvider *provider);
+
+        std::vector<std::unique_ptr<DataProvider> > mProviders;
+        std::vector<DataProvider*> mIdle;   /**< Connections not leased. */
+        bool mReadReplica;
+
+        mutable std::mutex mMutex;
+        std::condition_variable mReleased;
+};
+
+} // namespace dal
+
+#endif // CONNECTION_POOL_H
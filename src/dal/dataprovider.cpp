@@ -20,6 +20,7 @@
 
 #include "dataprovider.h"
 
+#include "common/configuration.h"
 #include "utils/logger.h"
 
 namespace dal
@@ -57,8 +58,12 @@ void PerformTransaction::commit()
 DataProvider::DataProvider()
     throw()
         : mIsConnected(false),
-          mRecordSet()
+          mRecordSet(),
+          mStatementCacheSize(64)
 {
+    // Keep at least one statement, the one being processed
+    int size = Configuration::getValue("sql_statementCacheSize", 64);
+    mStatementCacheSize = size > 0 ? size : 1;
 }
 
 DataProvider::~DataProvider()
@@ -88,4 +93,42 @@ std::string DataProvider::getDbName() const
     return mDbName;
 }
 
+void *DataProvider::findCachedStatement(const std::string &sql)
+{
+    std::map<std::string, CachedStatements::iterator>::iterator it =
+            mStatementIndex.find(sql);
+    if (it == mStatementIndex.end())
+        return nullptr;
+
+    // Move the statement to the front of the LRU list
+    mStatements.splice(mStatements.begin(), mStatements, it->second);
+    return it->second->second;
+}
+
+void DataProvider::cacheStatement(const std::string &sql, void *statement)
+{
+    while (mStatements.size() >= mStatementCacheSize)
+    {
+        const CachedStatement &oldest = mStatements.back();
+        LOG_DEBUG("Dropping prepared statement from cache: " << oldest.first);
+        freeStatement(oldest.second);
+        mStatementIndex.erase(oldest.first);
+        mStatements.pop_back();
+    }
+
+    mStatements.push_front(CachedStatement(sql, statement));
+    mStatementIndex[sql] = mStatements.begin();
+}
+
+void DataProvider::clearStatementCache()
+{
+    for (CachedStatements::iterator it = mStatements.begin(),
+         it_end = mStatements.end(); it != it_end; ++it)
+    {
+        freeStatement(it->second);
+    }
+    mStatements.clear();
+    mStatementIndex.clear();
+}
+
 } // namespace dal
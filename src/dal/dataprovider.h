@@ -22,9 +22,13 @@
 #define DATA_PROVIDER_H
 
 
+#include <list>
+#include <map>
 #include <string>
 #include <stdexcept>
 
+#include <stdint.h>
+
 #include "recordset.h"
 
 namespace dal
@@ -179,6 +183,11 @@ class DataProvider
 
         /**
          * Prepare SQL statement
+         *
+         * Prepared statements are cached by their SQL text, so preparing the
+         * same query again only resets the cached statement and clears its
+         * bindings. Queries should therefore bind their parameters instead of
+         * embedding the values in the SQL.
          */
         virtual bool prepareSql(const std::string &sql) = 0;
 
@@ -203,11 +212,107 @@ class DataProvider
          */
         virtual void bindValue(int place, int value) = 0;
 
+        /**
+         * Bind Value (64-bit Integer)
+         * @param place - which parameter to bind to
+         * @param value - the integer to bind
+         */
+        virtual void bindValue(int place, int64_t value) = 0;
+
+        /**
+         * Bind Value (Double)
+         * @param place - which parameter to bind to
+         * @param value - the floating point number to bind
+         */
+        virtual void bindValue(int place, double value) = 0;
+
+        /**
+         * Steps the prepared statement to its next result row, executing it
+         * on the first call. Unlike processSql(), rows are not copied into a
+         * RecordSet, the current row is read with the typed getters below.
+         *
+         * Preparing another statement abandons the remaining rows.
+         *
+         * @return false when there are no more rows.
+         *
+         * @exception DbSqlQueryExecFailure if unsuccessful execution.
+         */
+        virtual bool fetchRow() = 0;
+
+        /**
+         * Returns whether a column of the current row is NULL.
+         * @param col - the column index, starting at 0
+         */
+        virtual bool isNull(unsigned col) const = 0;
+
+        /**
+         * Returns a column of the current row as an integer.
+         * @param col - the column index, starting at 0
+         */
+        virtual int64_t getInt(unsigned col) const = 0;
+
+        /**
+         * Returns a column of the current row as a floating point number.
+         * @param col - the column index, starting at 0
+         */
+        virtual double getDouble(unsigned col) const = 0;
+
+        /**
+         * Returns a column of the current row as a string.
+         * @param col - the column index, starting at 0
+         */
+        virtual std::string getString(unsigned col) const = 0;
+
+        /**
+         * Moves the changes kept in the write-ahead log of the database into
+         * the database itself. Called regularly from the database thread.
+         * Does nothing for backends that manage this on their own.
+         */
+        virtual void checkpoint() {}
+
     protected:
+        /**
+         * Looks up the prepared statement for the given SQL and marks it as
+         * the most recently used one.
+         *
+         * @return the backend statement handle, or nullptr when the statement
+         *         is not in the cache.
+         */
+        void *findCachedStatement(const std::string &sql);
+
+        /**
+         * Adds a newly prepared statement to the cache. When the cache is
+         * full, the least recently used statement is released through
+         * freeStatement().
+         */
+        void cacheStatement(const std::string &sql, void *statement);
+
+        /**
+         * Releases all cached statements. Has to be called by the backends
+         * before closing the connection.
+         */
+        void clearStatementCache();
+
+        /**
+         * Releases a backend statement handle that is dropped from the cache.
+         */
+        virtual void freeStatement(void *statement) = 0;
+
         std::string mDbName;  /**< the database name */
         bool mIsConnected;    /**< the connection status */
         std::string mSql;     /**< cache the last SQL query */
         RecordSet mRecordSet; /**< cache the result of the last SQL query */
+
+    private:
+        typedef std::pair<std::string, void *> CachedStatement;
+        typedef std::list<CachedStatement> CachedStatements;
+
+        /** Prepared statements, the most recently used one first */
+        CachedStatements mStatements;
+        /** Index into mStatements by SQL text */
+        std::map<std::string, CachedStatements::iterator> mStatementIndex;
+        /** Maximum number of cached prepared statements */
+        unsigned mStatementCacheSize;
 };
 
 
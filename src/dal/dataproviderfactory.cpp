@@ -20,6 +20,8 @@
 
 #include "dataproviderfactory.h"
 
+#include "common/configuration.h"
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
@@ -50,18 +52,30 @@ DataProviderFactory::~DataProviderFactory()
 /**
  * Create a data provider.
  */
-DataProvider *DataProviderFactory::createDataProvider()
+DataProvider *DataProviderFactory::createDataProvider(bool readReplica)
 {
 #if defined (MYSQL_SUPPORT)
-    MySqlDataProvider* provider = new MySqlDataProvider;
+    MySqlDataProvider* provider = new MySqlDataProvider(readReplica);
     return provider;
 #elif defined (POSTGRESQL_SUPPORT)
+    (void) readReplica;     // Only MySQL supports a read replica
     PqDataProvider *provider = new PqDataProvider;
     return provider;
 #else // SQLITE_SUPPORT
+    (void) readReplica;
     SqLiteDataProvider* provider = new SqLiteDataProvider;
     return provider;
 #endif
 }
 
+bool DataProviderFactory::hasReadReplica()
+{
+#if defined (MYSQL_SUPPORT)
+    return !Configuration::getValue("mysql_replica_hostname",
+                                    std::string()).empty();
+#else
+    return false;
+#endif
+}
+
 } // namespace dal
@@ -39,8 +39,17 @@ class DataProviderFactory
     public:
         /**
          * Create a new data provider.
+         *
+         * @param readReplica whether the provider should connect to the
+         *                    read replica, see hasReadReplica().
          */
-        static DataProvider *createDataProvider();
+        static DataProvider *createDataProvider(bool readReplica = false);
+
+        /**
+         * Returns whether a read replica is configured. Only supported by the
+         * MySQL backend.
+         */
+        static bool hasReadReplica();
 
     private:
         /**
@@ -22,6 +22,17 @@
 
 #include "dalexcept.h"
 
+#include <mysql/errmsg.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
 namespace dal
 {
 
@@ -37,12 +48,80 @@ const std::string  MySqlDataProvider::CFGPARAM_MYSQL_DB_DEF   = "mana";
 const std::string  MySqlDataProvider::CFGPARAM_MYSQL_USER_DEF = "mana";
 const std::string  MySqlDataProvider::CFGPARAM_MYSQL_PWD_DEF  = "mana";
 
-MySqlDataProvider::MySqlDataProvider()
+/** Prefix of the options overriding the settings for the read replica. */
+static const std::string REPLICA_PREFIX = "mysql_replica_";
+
+/**
+ * Reads a connection setting. The read replica uses the setting of the
+ * primary server for the options it does not override.
+ */
+static std::string getSetting(bool replica, const std::string &key,
+                              const std::string &def)
+{
+    const std::string value = Configuration::getValue(key, def);
+    if (!replica)
+        return value;
+
+    // mysql_hostname becomes mysql_replica_hostname
+    const std::string name = key.substr(key.find('_') + 1);
+    return Configuration::getValue(REPLICA_PREFIX + name, value);
+}
+
+static int getSetting(bool replica, const std::string &key, int def)
+{
+    const int value = Configuration::getValue(key, def);
+    if (!replica)
+        return value;
+
+    const std::string name = key.substr(key.find('_') + 1);
+    return Configuration::getValue(REPLICA_PREFIX + name, value);
+}
+
+/**
+ * Errors telling that the connection to the server is gone, as opposed to
+ * errors in the query itself.
+ */
+static bool isConnectionError(unsigned error)
+{
+    switch (error)
+    {
+    case CR_CONNECTION_ERROR:
+    case CR_CONN_HOST_ERROR:
+    case CR_SERVER_GONE_ERROR:
+    case CR_SERVER_LOST:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * Tells whether running \a sql a second time does no harm, because it does
+ * not change any data.
+ */
+static bool isReadOnly(const std::string &sql)
+{
+    static const char select[] = "select";
+    const size_t start = sql.find_first_not_of(" \t\r\n(");
+    if (start == std::string::npos ||
+        sql.length() - start < sizeof(select) - 1)
+        return false;
+
+    for (unsigned i = 0; i < sizeof(select) - 1; ++i)
+        if (std::tolower((unsigned char) sql[start + i]) != select[i])
+            return false;
+    return true;
+}
+
+MySqlDataProvider::MySqlDataProvider(bool readReplica)
     throw()
         : mDb(0),
           mStmt(0),
-          mBind(0),
-          mInTransaction(false)
+          mInTransaction(false),
+          mReadReplica(readReplica),
+          mPort(0),
+          mConnectionLost(false),
+          mGeneration(0)
 {
 }
 
@@ -76,55 +155,135 @@ void MySqlDataProvider::connect()
         return;
 
     // retrieve configuration from config file
-    const std::string hostname
-        = Configuration::getValue(CFGPARAM_MYSQL_HOST, CFGPARAM_MYSQL_HOST_DEF);
-    const std::string dbName
-        = Configuration::getValue(CFGPARAM_MYSQL_DB, CFGPARAM_MYSQL_DB_DEF);
-    const std::string username
-        = Configuration::getValue(CFGPARAM_MYSQL_USER, CFGPARAM_MYSQL_USER_DEF);
-    const std::string password
-        = Configuration::getValue(CFGPARAM_MYSQL_PWD, CFGPARAM_MYSQL_PWD_DEF);
-    const unsigned tcpPort
-        = Configuration::getValue(CFGPARAM_MYSQL_PORT, CFGPARAM_MYSQL_PORT_DEF);
+    mHostname = getSetting(mReadReplica, CFGPARAM_MYSQL_HOST,
+                           CFGPARAM_MYSQL_HOST_DEF);
+    mUsername = getSetting(mReadReplica, CFGPARAM_MYSQL_USER,
+                           CFGPARAM_MYSQL_USER_DEF);
+    mPassword = getSetting(mReadReplica, CFGPARAM_MYSQL_PWD,
+                           CFGPARAM_MYSQL_PWD_DEF);
+    mPort = getSetting(mReadReplica, CFGPARAM_MYSQL_PORT,
+                       (int) CFGPARAM_MYSQL_PORT_DEF);
+    const std::string dbName = getSetting(mReadReplica, CFGPARAM_MYSQL_DB,
+                                          CFGPARAM_MYSQL_DB_DEF);
 
+    // Save the Db Name.
+    mDbName = dbName;
+
+    // mysql_init() would initialize the library on first use, but that is
+    // not thread safe when several connections are opened concurrently.
+    static std::once_flag libraryInitialized;
+    std::call_once(libraryInitialized, [] {
+        mysql_library_init(0, nullptr, nullptr);
+    });
+
+    LOG_INFO("Trying to connect with mySQL "
+        << (mReadReplica ? "read replica" : "database server") << " '"
+        << mHostname << ":" << mPort << "' using '" << mUsername
+        << "' as user, and '" << dbName << "' as database.");
+
+    const std::string error = openConnection();
+    if (!error.empty())
+        throw DbConnectionFailure(error);
+
+    mIsConnected = true;
+    mConnectionLost = false;
+    LOG_INFO("Connection to mySQL was sucessfull.");
+}
+
+std::string MySqlDataProvider::openConnection()
+{
     // allocate and initialize a new MySQL object suitable
     // for mysql_real_connect().
     mDb = mysql_init(nullptr);
 
     if (!mDb)
-    {
-        throw DbConnectionFailure(
-            "unable to initialize the MySQL library: no memory");
-    }
-
-    LOG_INFO("Trying to connect with mySQL database server '"
-        << hostname << ":" << tcpPort << "' using '" << username
-        << "' as user, and '" << dbName << "' as database.");
+        return "unable to initialize the MySQL library: no memory";
 
     // actually establish the connection.
     if (!mysql_real_connect(mDb,                // handle to the connection
-                            hostname.c_str(),   // hostname
-                            username.c_str(),   // username
-                            password.c_str(),   // password
-                            dbName.c_str(),     // database name
-                            tcpPort,            // tcp port
-                            nullptr,               // socket, currently not used
+                            mHostname.c_str(),  // hostname
+                            mUsername.c_str(),  // username
+                            mPassword.c_str(),  // password
+                            mDbName.c_str(),    // database name
+                            mPort,              // tcp port
+                            nullptr,            // socket, currently not used
                             CLIENT_FOUND_ROWS)) // client flags
     {
         std::string msg(mysql_error(mDb));
         mysql_close(mDb);
+        mDb = 0;
+        return msg;
+    }
+
+    return std::string();
+}
+
+bool MySqlDataProvider::reconnect()
+{
+    const int attempts =
+        std::max(1, Configuration::getValue("mysql_reconnectAttempts", 5));
+    int delay = Configuration::getValue("mysql_reconnectDelay", 100);
+
+    // Closing detaches the prepared statements, they are released when
+    // they get prepared again.
+    if (mStmt)
+        mStmt->fetching = false;
+    if (mDb)
+        mysql_close(mDb);
+    mDb = 0;
 
-        throw DbConnectionFailure(msg);
+    for (int attempt = 1; attempt <= attempts; ++attempt)
+    {
+        const std::string error = openConnection();
+        if (error.empty())
+        {
+            LOG_INFO("Reconnected to mySQL server '" << mHostname << "'.");
+            mConnectionLost = false;
+            ++mGeneration;
+            return true;
+        }
+
+        LOG_WARN("Reconnecting to mySQL server '" << mHostname
+                 << "' failed (attempt " << attempt << " of " << attempts
+                 << "): " << error);
+
+        if (attempt < attempts)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+            delay = std::min(delay * 2, 5000);
+        }
     }
 
-    // Save the Db Name.
-    mDbName = dbName;
+    mConnectionLost = true;
+    return false;
+}
 
-    // Initialize statement structure
-    mStmt = mysql_stmt_init(mDb);
+bool MySqlDataProvider::retryAfterConnectionLoss(unsigned error,
+                                                 bool replaySafe)
+{
+    if (!isConnectionError(error))
+        return false;
 
-    mIsConnected = true;
-    LOG_INFO("Connection to mySQL was sucessfull.");
+    LOG_WARN("Lost the connection to mySQL server '" << mHostname << "'.");
+
+    if (mInTransaction)
+    {
+        // The server rolled the transaction back, the caller will find out
+        // through the error. A new connection is opened on the next query.
+        mConnectionLost = true;
+        return false;
+    }
+
+    if (error == CR_SERVER_LOST && !replaySafe)
+    {
+        // The query was sent, and may have been done before the connection
+        // broke. Running it again could for example insert a row twice.
+        LOG_WARN("Not running the query again, it may have been done.");
+        mConnectionLost = true;
+        return false;
+    }
+
+    return reconnect();
 }
 
 /**
@@ -145,9 +304,21 @@ const RecordSet &MySqlDataProvider::execSql(const std::string& sql,
     {
         mRecordSet.clear();
 
+        if (mConnectionLost && !reconnect())
+            throw DbSqlQueryExecFailure("lost connection to the database");
+
         // actually execute the query.
         if (mysql_query(mDb, sql.c_str()) != 0)
-            throw DbSqlQueryExecFailure(mysql_error(mDb));
+        {
+            // Read before the handle is closed by a failed reconnect
+            const unsigned error = mysql_errno(mDb);
+            const std::string message = mysql_error(mDb);
+
+            if (!retryAfterConnectionLoss(error, isReadOnly(sql)))
+                throw DbSqlQueryExecFailure(message);
+            if (mysql_query(mDb, sql.c_str()) != 0)
+                throw DbSqlQueryExecFailure(mysql_error(mDb));
+        }
 
         if (mysql_field_count(mDb) > 0)
         {
@@ -194,21 +365,21 @@ void MySqlDataProvider::disconnect()
     if (!mIsConnected)
         return;
 
+    // Close the prepared statements while the connection is still open.
+    clearStatementCache();
+    mStmt = 0;
+
     // mysql_close() closes the connection and deallocates the connection
     // handle allocated by mysql_init().
-    mysql_close(mDb);
-
-    // Clean possible statement.
-    mysql_stmt_close(mStmt);
-
-    // deinitialize the MySQL client library.
-    mysql_library_end();
+    if (mDb)
+        mysql_close(mDb);
 
-    // Clean potential active binds
-    cleanBinds();
+    // The client library is not deinitialized here, other connections may
+    // still be using it.
 
     mDb = 0;
     mIsConnected = false;
+    mInTransaction = false;
 }
 
 void MySqlDataProvider::beginTransaction()
@@ -230,7 +401,13 @@ void MySqlDataProvider::beginTransaction()
         throw std::runtime_error(error);
     }
 
-    if (mysql_autocommit(mDb, AUTOCOMMIT_OFF))
+    if (mConnectionLost && !reconnect())
+        throw std::runtime_error("lost connection to the database");
+
+    // Setting the autocommit mode twice does no harm
+    if (mysql_autocommit(mDb, AUTOCOMMIT_OFF) &&
+        (!retryAfterConnectionLoss(mysql_errno(mDb), true) ||
+         mysql_autocommit(mDb, AUTOCOMMIT_OFF)))
     {
         const std::string error = "Error while trying to disable autocommit";
         LOG_ERROR(error);
@@ -261,10 +438,15 @@ void MySqlDataProvider::commitTransaction()
         throw std::runtime_error(error);
     }
 
-    if (mysql_commit(mDb) != 0)
+    if (mConnectionLost || mysql_commit(mDb) != 0)
     {
-        LOG_ERROR("MySqlDataProvider::commitTransaction: " << mysql_error(mDb));
-        throw DbSqlQueryExecFailure(mysql_error(mDb));
+        const std::string error = mConnectionLost
+                ? "lost connection to the database" : mysql_error(mDb);
+        if (!mConnectionLost)
+            retryAfterConnectionLoss(mysql_errno(mDb), false);
+
+        LOG_ERROR("MySqlDataProvider::commitTransaction: " << error);
+        throw DbSqlQueryExecFailure(error);
     }
 
     if (mysql_autocommit(mDb, AUTOCOMMIT_ON))
@@ -297,6 +479,14 @@ void MySqlDataProvider::rollbackTransaction()
         throw std::runtime_error(error);
     }
 
+    if (mConnectionLost)
+    {
+        // The server already rolled back when the connection was lost
+        mInTransaction = false;
+        LOG_DEBUG("SQL: transaction lost with the connection");
+        return;
+    }
+
     if (mysql_rollback(mDb) != 0)
     {
         LOG_ERROR("MySqlDataProvider::rollbackTransaction: "
@@ -316,7 +506,7 @@ bool MySqlDataProvider::inTransaction() const
 
 unsigned MySqlDataProvider::getModifiedRows() const
 {
-    if (!mIsConnected)
+    if (!mIsConnected || !mDb)
     {
         const std::string error = "Trying to getModifiedRows while not "
                                   "connected to the database!";
@@ -341,7 +531,7 @@ unsigned MySqlDataProvider::getModifiedRows() const
 
 unsigned MySqlDataProvider::getLastId() const
 {
-    if (!mIsConnected)
+    if (!mIsConnected || !mDb)
     {
         const std::string error = "not connected to the database!";
         LOG_ERROR(error);
@@ -363,17 +553,123 @@ bool MySqlDataProvider::prepareSql(const std::string &sql)
 
     LOG_DEBUG("MySqlDataProvider::prepareSql Preparing SQL statement: " << sql);
 
-    cleanBinds();
+    mRecordSet.clear();
+
+    // Release a statement of which not all rows were fetched
+    if (mStmt)
+        stopFetching();
+
+    if (mConnectionLost && !reconnect())
+        return false;
+
+    mStmt = static_cast<Statement*>(findCachedStatement(sql));
+    if (mStmt && mStmt->stmt && mStmt->generation == mGeneration)
+    {
+        // Reuse the compiled statement, only the bindings need to be reset
+        mysql_stmt_reset(mStmt->stmt);
+    }
+    else if (mStmt)
+    {
+        // Compiled on a connection that was lost since, or its compilation
+        // failed
+        if (!prepareStatement(mStmt))
+        {
+            mStmt = 0;
+            return false;
+        }
+    }
+    else
+    {
+        Statement *statement = new Statement;
+        statement->stmt = 0;
+        statement->sql = sql;
+        statement->fetching = false;
+        if (!prepareStatement(statement))
+        {
+            delete statement;
+            return false;
+        }
+
+        mStmt = statement;
+        mStmt->binds.resize(mysql_stmt_param_count(mStmt->stmt));
+        mStmt->params.resize(mStmt->binds.size());
+        cacheStatement(sql, mStmt);
+    }
+
+    // Unbound parameters are passed as NULL
+    for (unsigned i = 0; i < mStmt->binds.size(); ++i)
+    {
+        memset(&mStmt->binds[i], 0, sizeof(MYSQL_BIND));
+        mStmt->binds[i].buffer_type = MYSQL_TYPE_NULL;
+    }
 
-    if (mysql_stmt_prepare(mStmt, sql.c_str(), sql.size()) != 0)
+    return true;
+}
+
+bool MySqlDataProvider::prepareStatement(Statement *statement, bool retry)
+{
+    if (statement->stmt)
+        mysql_stmt_close(statement->stmt);
+
+    statement->fetching = false;
+    statement->stmt = mysql_stmt_init(mDb);
+    if (!statement->stmt)
         return false;
 
-    // Allocate bind memory now that the prepared state is done.
-    mBind = new MYSQL_BIND[(int)mysql_stmt_param_count(mStmt)];
+    const std::string &sql = statement->sql;
+    if (mysql_stmt_prepare(statement->stmt, sql.c_str(), sql.size()) != 0)
+    {
+        const unsigned error = mysql_stmt_errno(statement->stmt);
+        LOG_ERROR("MySqlDataProvider::prepareSql Prepare failed: "
+                  << mysql_stmt_error(statement->stmt));
+        mysql_stmt_close(statement->stmt);
+        statement->stmt = 0;
+
+        // Nothing was executed yet
+        if (retry && retryAfterConnectionLoss(error, true))
+            return prepareStatement(statement, false);
+        return false;
+    }
 
+    statement->generation = mGeneration;
     return true;
 }
 
+bool MySqlDataProvider::executeStatement()
+{
+    for (bool retry = true; ; retry = false)
+    {
+        MYSQL_STMT *stmt = mStmt->stmt;
+
+        if (!mStmt->binds.empty() &&
+            mysql_stmt_bind_param(stmt, &mStmt->binds[0]))
+        {
+            mExecuteError = mysql_stmt_error(stmt);
+            LOG_ERROR("MySqlDataProvider: Bind params failed: "
+                      << mExecuteError);
+            return false;
+        }
+
+        if (mysql_stmt_execute(stmt) == 0)
+            return true;
+
+        // Read before the connection is replaced
+        const unsigned error = mysql_stmt_errno(stmt);
+        mExecuteError = mysql_stmt_error(stmt);
+
+        if (!retry || !retryAfterConnectionLoss(error,
+                                                isReadOnly(mStmt->sql)))
+        {
+            return false;
+        }
+        if (!prepareStatement(mStmt, false))
+        {
+            mExecuteError = "could not prepare the statement again";
+            return false;
+        }
+    }
+}
+
 const RecordSet &MySqlDataProvider::processSql()
 {
     if (!mIsConnected)
@@ -383,137 +679,353 @@ const RecordSet &MySqlDataProvider::processSql()
     // we clear the result member first.
     mRecordSet.clear();
 
-    if (!mBind)
+    if (!mStmt)
     {
         LOG_ERROR("MySqlDataProvider::processSql: "
-                  "No bind done before processing.");
+                  "No statement prepared before processing.");
         return mRecordSet;
     }
 
-    if (mysql_stmt_bind_param(mStmt, mBind))
+    const bool executed = executeStatement();
+
+    // The statement handle changes when it had to be prepared again
+    MYSQL_STMT *stmt = mStmt->stmt;
+    if (!executed)
     {
-        LOG_ERROR("MySqlDataProvider::processSql Bind params failed: "
-                  << mysql_stmt_error(mStmt));
+        LOG_ERROR("MySqlDataProvider::processSql Execute failed: "
+                  << mExecuteError);
         return mRecordSet;
     }
 
-    if (mysql_stmt_field_count(mStmt) > 0)
+    if (mysql_stmt_field_count(stmt) > 0)
     {
-        MYSQL_BIND* resultBind;
-        MYSQL_RES* res;
-
-        if (mysql_stmt_execute(mStmt))
-        {
-            LOG_ERROR("MySqlDataProvider::processSql Execute failed: "
-                      << mysql_stmt_error(mStmt));
-        }
+        static const unsigned long fieldLength = 255;
 
-        res = mysql_stmt_result_metadata(mStmt);
+        MYSQL_RES *res = mysql_stmt_result_metadata(stmt);
 
         // set the field names.
         unsigned nFields = mysql_num_fields(res);
         MYSQL_FIELD* fields = mysql_fetch_fields(res);
         Row fieldNames;
 
-        resultBind = new MYSQL_BIND[mysql_num_fields(res)];
+        std::vector<MYSQL_BIND> resultBind(nFields);
+        std::vector<char> buffers(nFields * fieldLength);
+        std::vector<unsigned long> lengths(nFields);
+        std::vector<my_bool> isNull(nFields);
 
         unsigned i = 0;
-        for (i = 0; i < mysql_num_fields(res); ++i)
+        for (i = 0; i < nFields; ++i)
         {
+            memset(&resultBind[i], 0, sizeof(MYSQL_BIND));
             resultBind[i].buffer_type = MYSQL_TYPE_STRING;
-            resultBind[i].buffer = (void*) new char[255];
-            resultBind[i].buffer_length = 255;
-            resultBind[i].is_null = new my_bool;
-            resultBind[i].length = new unsigned long;
-            resultBind[i].error = new my_bool;
+            resultBind[i].buffer = &buffers[i * fieldLength];
+            resultBind[i].buffer_length = fieldLength;
+            resultBind[i].is_null = &isNull[i];
+            resultBind[i].length = &lengths[i];
         }
 
-        if (mysql_stmt_bind_result(mStmt, resultBind))
+        if (nFields > 0 && mysql_stmt_bind_result(stmt, &resultBind[0]))
         {
             LOG_ERROR("MySqlDataProvider::processSql Bind result failed: "
-                      << mysql_stmt_error(mStmt));
+                      << mysql_stmt_error(stmt));
         }
 
         for (i = 0; i < nFields; ++i)
             fieldNames.push_back(fields[i].name);
 
+        mysql_free_result(res);
+
         mRecordSet.setColumnHeaders(fieldNames);
 
         // store the result of the query.
-        if (mysql_stmt_store_result(mStmt))
-            throw DbSqlQueryExecFailure(mysql_stmt_error(mStmt));
+        if (mysql_stmt_store_result(stmt))
+            throw DbSqlQueryExecFailure(mysql_stmt_error(stmt));
 
         // populate the RecordSet.
-        while (!mysql_stmt_fetch(mStmt))
+        int status;
+        while ((status = mysql_stmt_fetch(stmt)) == 0 ||
+               status == MYSQL_DATA_TRUNCATED)
         {
             Row r;
 
             for (i = 0; i < nFields; ++i)
-                r.push_back(static_cast<char *>(resultBind[i].buffer));
+            {
+                if (isNull[i])
+                    r.push_back(std::string());
+                else
+                    r.push_back(std::string(&buffers[i * fieldLength],
+                                            std::min(lengths[i],
+                                                     fieldLength)));
+            }
 
             mRecordSet.add(r);
         }
+    }
+
+    // Free memory
+    mysql_stmt_free_result(stmt);
 
-        delete[] resultBind;
+    return mRecordSet;
+}
+
+MYSQL_BIND *MySqlDataProvider::getBind(int place)
+{
+    if (!mStmt)
+    {
+        LOG_ERROR("MySqlDataProvider::bindValue: "
+                  "Attempted to use an unprepared bind!");
+        return nullptr;
     }
-    else
+    if (place <= 0 || place > (int)mStmt->binds.size())
     {
-        if (mysql_stmt_execute(mStmt))
+        LOG_ERROR("MySqlDataProvider::bindValue: "
+                  "Attempted bind index out of range");
+        return nullptr;
+    }
+    return &mStmt->binds[place - 1];
+}
+
+void MySqlDataProvider::bindValue(int place, const std::string &value)
+{
+    MYSQL_BIND *bind = getBind(place);
+    if (!bind)
+        return;
+
+    Parameter &param = mStmt->params[place - 1];
+    param.text = value;
+    param.length = param.text.size();
+    bind->buffer_type = MYSQL_TYPE_STRING;
+    bind->buffer = (void*) param.text.c_str();
+    bind->buffer_length = param.length;
+    bind->length = &param.length;
+}
+
+void MySqlDataProvider::bindValue(int place, int value)
+{
+    bindValue(place, (int64_t) value);
+}
+
+void MySqlDataProvider::bindValue(int place, int64_t value)
+{
+    MYSQL_BIND *bind = getBind(place);
+    if (!bind)
+        return;
+
+    Parameter &param = mStmt->params[place - 1];
+    param.integer = value;
+    bind->buffer_type = MYSQL_TYPE_LONGLONG;
+    bind->buffer = &param.integer;
+}
+
+void MySqlDataProvider::bindValue(int place, double value)
+{
+    MYSQL_BIND *bind = getBind(place);
+    if (!bind)
+        return;
+
+    Parameter &param = mStmt->params[place - 1];
+    param.real = value;
+    bind->buffer_type = MYSQL_TYPE_DOUBLE;
+    bind->buffer = &param.real;
+}
+
+void MySqlDataProvider::startFetching()
+{
+    if (!executeStatement())
+        throw DbSqlQueryExecFailure(mExecuteError);
+
+    MYSQL_STMT *stmt = mStmt->stmt;
+
+    MYSQL_RES *res = mysql_stmt_result_metadata(stmt);
+    if (!res)
+    {
+        // Not a query returning rows
+        mStmt->resultBinds.clear();
+        mStmt->columns.clear();
+        mStmt->fetching = true;
+        return;
+    }
+
+    const unsigned nFields = mysql_num_fields(res);
+    MYSQL_FIELD *fields = mysql_fetch_fields(res);
+
+    mStmt->resultBinds.resize(nFields);
+    mStmt->columns.resize(nFields);
+
+    for (unsigned i = 0; i < nFields; ++i)
+    {
+        MYSQL_BIND &bind = mStmt->resultBinds[i];
+        Column &column = mStmt->columns[i];
+        memset(&bind, 0, sizeof(MYSQL_BIND));
+        bind.is_null = &column.isNull;
+        bind.length = &column.length;
+
+        switch (fields[i].type)
         {
-            LOG_ERROR("MySqlDataProvider::processSql Execute failed: "
-                      << mysql_stmt_error(mStmt));
+        case MYSQL_TYPE_TINY:
+        case MYSQL_TYPE_SHORT:
+        case MYSQL_TYPE_LONG:
+        case MYSQL_TYPE_INT24:
+        case MYSQL_TYPE_LONGLONG:
+            bind.buffer_type = MYSQL_TYPE_LONGLONG;
+            bind.buffer = &column.integer;
+            break;
+        case MYSQL_TYPE_FLOAT:
+        case MYSQL_TYPE_DOUBLE:
+            bind.buffer_type = MYSQL_TYPE_DOUBLE;
+            bind.buffer = &column.real;
+            break;
+        default:
+            // Grown on demand when a value does not fit
+            column.text.resize(64);
+            bind.buffer_type = MYSQL_TYPE_STRING;
+            bind.buffer = &column.text[0];
+            bind.buffer_length = column.text.size();
+            break;
         }
     }
 
-    // Free memory
-    mysql_stmt_free_result(mStmt);
+    mysql_free_result(res);
 
-    return mRecordSet;
+    if (nFields > 0 && mysql_stmt_bind_result(stmt, &mStmt->resultBinds[0]))
+        throw DbSqlQueryExecFailure(mysql_stmt_error(stmt));
+
+    mStmt->fetching = true;
 }
 
-void MySqlDataProvider::bindValue(int place, const std::string &value)
+void MySqlDataProvider::stopFetching()
 {
-    unsigned long* size = new unsigned long;
-    *size = value.size();
-    MYSQL_BIND* bind = new MYSQL_BIND;
-    bind->buffer_type= MYSQL_TYPE_STRING;
-    bind->buffer= (void*) value.c_str();
-    bind->buffer_length= value.size();
-    bind->length = size;
-    bind->is_null = 0;
+    if (!mStmt->fetching)
+        return;
 
-    bindValue(place, bind);
+    mysql_stmt_free_result(mStmt->stmt);
+    mStmt->fetching = false;
 }
 
-void MySqlDataProvider::bindValue(int place, int value)
+bool MySqlDataProvider::fetchRow()
+{
+    if (!mIsConnected)
+        throw std::runtime_error("not connected to database");
+
+    if (!mStmt)
+    {
+        LOG_ERROR("MySqlDataProvider::fetchRow: "
+                  "No statement prepared before fetching.");
+        return false;
+    }
+
+    if (!mStmt->fetching)
+        startFetching();
+
+    MYSQL_STMT *stmt = mStmt->stmt;
+    if (mStmt->columns.empty())
+    {
+        stopFetching();
+        return false;
+    }
+
+    const int status = mysql_stmt_fetch(stmt);
+    if (status == MYSQL_NO_DATA)
+    {
+        stopFetching();
+        return false;
+    }
+    if (status == 1)
+    {
+        const std::string error = mysql_stmt_error(stmt);
+        stopFetching();
+        throw DbSqlQueryExecFailure(error);
+    }
+
+    if (status == MYSQL_DATA_TRUNCATED)
+    {
+        // Fetch the text columns that did not fit again in a larger buffer
+        for (unsigned i = 0; i < mStmt->columns.size(); ++i)
+        {
+            MYSQL_BIND &bind = mStmt->resultBinds[i];
+            Column &column = mStmt->columns[i];
+            if (bind.buffer_type != MYSQL_TYPE_STRING ||
+                column.length <= column.text.size())
+                continue;
+
+            column.text.resize(column.length);
+            bind.buffer = &column.text[0];
+            bind.buffer_length = column.text.size();
+            mysql_stmt_fetch_column(stmt, &bind, i, 0);
+        }
+        mysql_stmt_bind_result(stmt, &mStmt->resultBinds[0]);
+    }
+
+    return true;
+}
+
+bool MySqlDataProvider::isNull(unsigned col) const
+{
+    return mStmt->columns.at(col).isNull;
+}
+
+int64_t MySqlDataProvider::getInt(unsigned col) const
 {
-    MYSQL_BIND* bind = new MYSQL_BIND;
-    bind->buffer_type= MYSQL_TYPE_LONG;
-    bind->buffer= &value;
-    bind->is_null = 0;
+    const Column &column = mStmt->columns.at(col);
+    if (column.isNull)
+        return 0;
 
-    bindValue(place, bind);
+    switch (mStmt->resultBinds[col].buffer_type)
+    {
+    case MYSQL_TYPE_LONGLONG:
+        return column.integer;
+    case MYSQL_TYPE_DOUBLE:
+        return (int64_t) column.real;
+    default:
+        return strtoll(getString(col).c_str(), 0, 10);
+    }
 }
 
-void MySqlDataProvider::bindValue(int place, MYSQL_BIND* bind)
+double MySqlDataProvider::getDouble(unsigned col) const
 {
-    if (!mBind)
-        LOG_ERROR("MySqlDataProvider::bindValue: "
-                  "Attempted to use an unprepared bind!");
-    else if (place > 0 && place <= (int)mysql_stmt_param_count(mStmt))
-        mBind[place - 1] = *bind;
-    else
-        LOG_ERROR("MySqlDataProvider::bindValue: "
-                  "Attempted bind index out of range");
+    const Column &column = mStmt->columns.at(col);
+    if (column.isNull)
+        return 0.0;
+
+    switch (mStmt->resultBinds[col].buffer_type)
+    {
+    case MYSQL_TYPE_LONGLONG:
+        return column.integer;
+    case MYSQL_TYPE_DOUBLE:
+        return column.real;
+    default:
+        return strtod(getString(col).c_str(), 0);
+    }
 }
 
-void MySqlDataProvider::cleanBinds()
+std::string MySqlDataProvider::getString(unsigned col) const
 {
-    if (mBind)
+    const Column &column = mStmt->columns.at(col);
+    if (column.isNull)
+        return std::string();
+
+    std::ostringstream value;
+    switch (mStmt->resultBinds[col].buffer_type)
     {
-        delete[] mBind;
-        mBind = 0;
+    case MYSQL_TYPE_LONGLONG:
+        value << column.integer;
+        return value.str();
+    case MYSQL_TYPE_DOUBLE:
+        value << column.real;
+        return value.str();
+    default:
+        return std::string(&column.text[0],
+                           std::min<size_t>(column.length,
+                                            column.text.size()));
     }
 }
 
+void MySqlDataProvider::freeStatement(void *statement)
+{
+    Statement *s = static_cast<Statement*>(statement);
+    if (s->stmt)
+        mysql_stmt_close(s->stmt);
+    delete s;
+}
+
 } // namespace dal
@@ -29,6 +29,7 @@
 #endif
 #include <mysql/mysql.h>
 #include <climits>
+#include <vector>
 
 #include "dataprovider.h"
 #include "common/configuration.h"
@@ -53,7 +54,12 @@ class MySqlDataProvider: public DataProvider
             AUTOCOMMIT_ON = 1
         };
 
-        MySqlDataProvider()
+        /**
+         * @param readReplica whether to connect to the read replica
+         *                    configured with the mysql_replica_* options
+         *                    instead of the primary server.
+         */
+        explicit MySqlDataProvider(bool readReplica = false)
             throw();
 
         ~MySqlDataProvider()
@@ -167,16 +173,146 @@ class MySqlDataProvider: public DataProvider
          */
         void bindValue(int place, int value);
 
-    private:
         /**
-         * Bind Value (MYSQL_BIND*)
+         * Bind Value (64-bit Integer)
+         * @param place - which parameter to bind to
+         * @param value - the integer to bind
+         */
+        void bindValue(int place, int64_t value);
+
+        /**
+         * Bind Value (Double)
          * @param place - which parameter to bind to
-         * @param value - the MySQL bind structure itself
+         * @param value - the floating point number to bind
+         */
+        void bindValue(int place, double value);
+
+        /**
+         * Steps the prepared statement to its next result row.
+         *
+         * @return false when there are no more rows.
+         */
+        bool fetchRow();
+
+        /** Typed access to the current row, see DataProvider. */
+        bool isNull(unsigned col) const;
+        int64_t getInt(unsigned col) const;
+        double getDouble(unsigned col) const;
+        std::string getString(unsigned col) const;
+
+    protected:
+        /**
+         * Closes a prepared statement dropped from the statement cache.
+         */
+        void freeStatement(void *statement);
+
+    private:
+        /**
+         * Storage for a bound parameter. The MySQL bind structures point into
+         * it, so the bound values stay valid until the statement is executed.
+         */
+        struct Parameter
+        {
+            std::string text;
+            long long integer;
+            double real;
+            unsigned long length;
+        };
+
+        /**
+         * Storage for a column of the row being fetched by fetchRow(). Numeric
+         * columns are fetched in their native type.
+         */
+        struct Column
+        {
+            long long integer;
+            double real;
+            std::vector<char> text;
+            unsigned long length;
+            my_bool isNull;
+        };
+
+        /**
+         * A prepared statement along with its parameter bindings.
          */
-        void bindValue(int place, MYSQL_BIND* bind);
+        struct Statement
+        {
+            MYSQL_STMT *stmt;
+            std::string sql;
+            unsigned generation;    /**< see mGeneration */
+            std::vector<MYSQL_BIND> binds;
+            std::vector<Parameter> params;
+
+            /** Result bindings while rows are being fetched */
+            std::vector<MYSQL_BIND> resultBinds;
+            std::vector<Column> columns;
+            bool fetching;
+        };
+
+        /**
+         * Executes the current statement and binds its result columns for
+         * fetchRow().
+         */
+        void startFetching();
+
+        /**
+         * Releases the remaining rows of the current statement.
+         */
+        void stopFetching();
+
+        /**
+         * Returns the bind structure of the given parameter of the current
+         * statement, or nullptr when out of range.
+         */
+        MYSQL_BIND *getBind(int place);
+
+        /**
+         * Compiles the SQL of \a statement on the current connection,
+         * replacing the handle of an earlier connection.
+         *
+         * @param retry whether to reconnect and try again when the
+         *              connection turns out to be lost.
+         */
+        bool prepareStatement(Statement *statement, bool retry = true);
 
-        /** Clean potential binds */
-        void cleanBinds();
+        /**
+         * Binds the parameters of the current statement and executes it. When
+         * the connection was lost outside of a transaction, and running the
+         * statement twice would do no harm, it is executed again on a new
+         * connection. On failure the error is left in mExecuteError.
+         */
+        bool executeStatement();
+
+        /**
+         * Opens the connection with the settings read by connect().
+         *
+         * @return an error message, empty on success.
+         */
+        std::string openConnection();
+
+        /**
+         * Replaces a lost connection, waiting longer after each failed
+         * attempt. The prepared statements are compiled again when they are
+         * used next.
+         */
+        bool reconnect();
+
+        /**
+         * Called when a query failed with the given error. Returns whether
+         * the connection was lost and could be opened again, in which case
+         * the query should be retried.
+         *
+         * Within a transaction the query is never retried, since the
+         * transaction is lost with the connection. When the connection was
+         * lost after the query was sent, the server may have run it already,
+         * so it is only retried when \a replaySafe tells that running it
+         * twice does no harm. Otherwise the new connection is opened on the
+         * next query.
+         *
+         * The connection handle is closed when no new connection could be
+         * opened, so the error has to be read before calling this.
+         */
+        bool retryAfterConnectionLoss(unsigned error, bool replaySafe);
 
         /** defines the name of the hostname config parameter */
         static const std::string CFGPARAM_MYSQL_HOST;
@@ -203,12 +339,24 @@ class MySqlDataProvider: public DataProvider
 
         /** The handle to the database connection */
         MYSQL *mDb;
-        /** The prepared statement to process */
-        MYSQL_STMT *mStmt;
-        /** The Bind structure used in prepared statement */
-        MYSQL_BIND* mBind;
+        /** The prepared statement to process, owned by the statement cache */
+        Statement *mStmt;
         /** Tells whether we're in the middle of a transaction */
         bool mInTransaction;
+
+        bool mReadReplica;
+        std::string mHostname;
+        std::string mUsername;
+        std::string mPassword;
+        unsigned mPort;
+
+        /** Set when the connection was lost and could not be reopened yet */
+        bool mConnectionLost;
+        /** Incremented with each new connection, statements prepared on an
+            earlier one need to be prepared again */
+        unsigned mGeneration;
+        /** Why the last executeStatement() failed */
+        std::string mExecuteError;
 };
 
 
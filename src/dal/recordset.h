@@ -40,6 +40,9 @@ typedef std::vector<std::string> Row;
  *     - the field values are stored and returned as string,
  *     - no information about the field data types are stored.
  *     - not thread-safe.
+ *
+ * Results can also be read row by row with their native types through
+ * DataProvider::fetchRow(), without building a RecordSet.
  */
 class RecordSet
 {
@@ -25,6 +25,8 @@
 #include "common/configuration.h"
 #include "utils/logger.h"
 
+#include <algorithm>
+#include <cctype>
 #include <stdexcept>
 #include <limits.h>
 
@@ -40,10 +42,44 @@ namespace dal
 const std::string SqLiteDataProvider::CFGPARAM_SQLITE_DB     = "sqlite_database";
 const std::string SqLiteDataProvider::CFGPARAM_SQLITE_DB_DEF = "mana.db";
 
+/**
+ * Reads a configuration value that is passed to a pragma as a keyword.
+ * Returns the default when the configured value is not one of the allowed
+ * keywords, so that the configuration cannot inject arbitrary SQL.
+ */
+static std::string getKeyword(const std::string &key, const char *def,
+                              const char *const *allowed)
+{
+    std::string value = Configuration::getValue(key, std::string(def));
+    std::transform(value.begin(), value.end(), value.begin(), ::toupper);
+
+    for (; *allowed; ++allowed)
+        if (value == *allowed)
+            return value;
+
+    LOG_WARN("Invalid value '" << value << "' for " << key
+             << ", using " << def << ".");
+    return def;
+}
+
+/**
+ * Copies the current row of \a stmt into \a row. NULL values are returned
+ * as empty strings.
+ */
+static void readRow(sqlite3_stmt *stmt, int nCols, Row &row)
+{
+    for (int col = 0; col < nCols; ++col)
+    {
+        const unsigned char *txt = sqlite3_column_text(stmt, col);
+        row.push_back(txt ? (const char*) txt : std::string());
+    }
+}
+
 SqLiteDataProvider::SqLiteDataProvider()
     throw()
         : mDb(0)
         , mStmt(0)
+        , mScheduledCheckpoints(false)
 {
 }
 
@@ -112,9 +148,99 @@ void SqLiteDataProvider::connect()
     mDbName = dbName;
 
     mIsConnected = true;
+
+    try
+    {
+        configure();
+    }
+    catch (const DbSqlQueryExecFailure &e)
+    {
+        disconnect();
+        throw DbConnectionFailure(e.what());
+    }
+
     LOG_INFO("Connection to database successful.");
 }
 
+void SqLiteDataProvider::configure()
+{
+    static const char *const journalModes[] =
+        { "DELETE", "TRUNCATE", "PERSIST", "WAL", 0 };
+    static const char *const synchronousModes[] =
+        { "OFF", "NORMAL", "FULL", "EXTRA", 0 };
+    static const char *const tempStores[] =
+        { "DEFAULT", "FILE", "MEMORY", 0 };
+
+    // With a write-ahead log, a commit only appends to the log and readers
+    // don't block the writer. Combined with synchronous=NORMAL the log is
+    // only synced at checkpoints, a crash may lose the last transactions
+    // but does not corrupt the database.
+    const std::string journalMode =
+        getKeyword("sqlite_journalMode", "WAL", journalModes);
+    const std::string synchronous =
+        getKeyword("sqlite_synchronous", "NORMAL", synchronousModes);
+    const std::string tempStore =
+        getKeyword("sqlite_tempStore", "MEMORY", tempStores);
+
+    // Negative cache sizes are in KiB, positive ones in pages
+    const int cacheSize = Configuration::getValue("sqlite_cacheSize", -16384);
+    const int mmapSize = Configuration::getValue("sqlite_mmapSize", 67108864);
+    const int checkpointInterval =
+        Configuration::getValue("sqlite_checkpointInterval", 30);
+
+    // Returns the mode actually in effect, which stays the old one when
+    // the file system does not support it
+    const RecordSet &mode = execSql("PRAGMA journal_mode=" + journalMode);
+    std::string activeMode = mode.isEmpty() ? std::string() : mode(0, 0);
+    std::transform(activeMode.begin(), activeMode.end(), activeMode.begin(),
+                   ::toupper);
+    if (activeMode != journalMode)
+    {
+        LOG_WARN("Could not set the SQLite journal mode to " << journalMode
+                 << ", using " << activeMode << ".");
+    }
+
+    std::ostringstream pragmas;
+    pragmas << "PRAGMA synchronous=" << synchronous << ";"
+            << "PRAGMA temp_store=" << tempStore << ";"
+            << "PRAGMA cache_size=" << cacheSize << ";"
+            << "PRAGMA mmap_size=" << mmapSize << ";";
+
+    // Checkpoints are taken off the commits and done from the database
+    // thread instead, see checkpoint().
+    mScheduledCheckpoints = activeMode == "WAL" && checkpointInterval > 0;
+    if (mScheduledCheckpoints)
+        pragmas << "PRAGMA wal_autocheckpoint=0;";
+
+    execSql(pragmas.str(), true);
+
+    LOG_INFO("SQLite journal mode " << activeMode
+             << ", synchronous " << synchronous
+             << ", cache size " << cacheSize
+             << ", mmap size " << mmapSize);
+}
+
+void SqLiteDataProvider::checkpoint()
+{
+    if (!mIsConnected || !mScheduledCheckpoints)
+        return;
+
+    int logFrames = 0;
+    int checkpointedFrames = 0;
+    const int result = sqlite3_wal_checkpoint_v2(mDb, 0,
+                                                 SQLITE_CHECKPOINT_PASSIVE,
+                                                 &logFrames,
+                                                 &checkpointedFrames);
+    if (result != SQLITE_OK)
+    {
+        LOG_WARN("SQLite checkpoint failed: " << sqlite3_errmsg(mDb));
+        return;
+    }
+
+    LOG_DEBUG("SQLite checkpoint: " << checkpointedFrames << " of "
+              << logFrames << " frames written to the database.");
+}
+
 /**
  * Execute a SQL query.
  */
@@ -131,56 +257,71 @@ const RecordSet &SqLiteDataProvider::execSql(const std::string& sql,
     // otherwise just return the recordset from cache.
     if (refresh || (sql != mSql))
     {
-        char** result;
-        int nRows;
-        int nCols;
-        char* errMsg;
-
         mRecordSet.clear();
 
-        int errCode = sqlite3_get_table(
-                          mDb,          // an open database
-                          sql.c_str(),  // SQL to be executed
-                          &result,      // result of the query
-                          &nRows,       // number of result rows
-                          &nCols,       // number of result columns
-                          &errMsg       // error msg
-                      );
-
-        if (errCode != SQLITE_OK)
-        {
-            std::string msg(sqlite3_errmsg(mDb));
-
-            LOG_ERROR("Error in SQL: " << sql << "\n" << msg);
-
-            // free memory
-            sqlite3_free_table(result);
-            sqlite3_free(errMsg);
+        // The query may consist of several statements. They are prepared
+        // and executed one after the other, the rows they return end up in
+        // the same record set.
+        const char *tail = sql.c_str();
+        const char *const end = tail + sql.size();
+        int nCols = -1;
 
-            throw DbSqlQueryExecFailure(msg);
-        }
-
-        // the first row of result[] contains the field names.
-        Row fieldNames;
-        for (int col = 0; col < nCols; ++col)
-            fieldNames.push_back(result[col]);
-
-        mRecordSet.setColumnHeaders(fieldNames);
-
-        // populate the RecordSet
-        for (int row = 0; row < nRows; ++row)
+        while (tail < end)
         {
-            Row r;
-
-            for (int col = 0; col < nCols; ++col)
-                r.push_back(result[nCols + (row * nCols) + col]);
-
-            mRecordSet.add(r);
+            sqlite3_stmt *stmt = 0;
+            if (sqlite3_prepare_v2(mDb, tail, end - tail,
+                                   &stmt, &tail) != SQLITE_OK)
+            {
+                std::string msg(sqlite3_errmsg(mDb));
+                LOG_ERROR("Error in SQL: " << sql << "\n" << msg);
+                throw DbSqlQueryExecFailure(msg);
+            }
+
+            // Only white space or a comment was left
+            if (!stmt)
+                break;
+
+            const int stmtCols = sqlite3_column_count(stmt);
+            if (stmtCols > 0)
+            {
+                if (nCols == -1)
+                {
+                    Row fieldNames;
+                    for (int col = 0; col < stmtCols; ++col)
+                        fieldNames.push_back(sqlite3_column_name(stmt, col));
+
+                    mRecordSet.setColumnHeaders(fieldNames);
+                    nCols = stmtCols;
+                }
+                else if (stmtCols != nCols)
+                {
+                    sqlite3_finalize(stmt);
+                    LOG_ERROR("Error in SQL: " << sql << "\n"
+                              "Statements return different columns.");
+                    throw DbSqlQueryExecFailure(
+                            "statements return different columns");
+                }
+            }
+
+            int result;
+            while ((result = sqlite3_step(stmt)) == SQLITE_ROW)
+            {
+                Row r;
+                readRow(stmt, stmtCols, r);
+                mRecordSet.add(r);
+            }
+
+            if (result != SQLITE_DONE)
+            {
+                std::string msg(sqlite3_errmsg(mDb));
+                sqlite3_finalize(stmt);
+
+                LOG_ERROR("Error in SQL: " << sql << "\n" << msg);
+                throw DbSqlQueryExecFailure(msg);
+            }
+
+            sqlite3_finalize(stmt);
         }
-
-        // free memory
-        sqlite3_free_table(result);
-        sqlite3_free(errMsg);
     }
 
     return mRecordSet;
@@ -194,6 +335,10 @@ void SqLiteDataProvider::disconnect()
     if (!isConnected())
         return;
 
+    // Statements left unfinalized would keep the connection open
+    clearStatementCache();
+    mStmt = 0;
+
     // sqlite3_close() closes the connection and deallocates the connection
     // handle.
     if (sqlite3_close(mDb) != SQLITE_OK)
@@ -361,10 +506,29 @@ bool SqLiteDataProvider::prepareSql(const std::string &sql)
 
     mRecordSet.clear();
 
+    // Release a statement of which not all rows were fetched
+    if (mStmt)
+        sqlite3_reset(mStmt);
+
+    mStmt = static_cast<sqlite3_stmt*>(findCachedStatement(sql));
+    if (mStmt)
+    {
+        // Reuse the compiled statement, only the bindings need to be reset
+        sqlite3_reset(mStmt);
+        sqlite3_clear_bindings(mStmt);
+        return true;
+    }
+
     if (sqlite3_prepare_v2(mDb, sql.c_str(), sql.size(),
             &mStmt, nullptr) != SQLITE_OK)
+    {
+        LOG_ERROR("Error preparing SQL: " << sql << "\n"
+                  << sqlite3_errmsg(mDb));
+        mStmt = 0;
         return false;
+    }
 
+    cacheStatement(sql, mStmt);
     return true;
 }
 
@@ -383,26 +547,32 @@ const RecordSet &SqLiteDataProvider::processSql()
     }
     mRecordSet.setColumnHeaders(fieldNames);
 
-    while (sqlite3_step(mStmt) == SQLITE_ROW)
+    int result;
+    while ((result = sqlite3_step(mStmt)) == SQLITE_ROW)
     {
         Row r;
-        for (int col = 0; col < totalCols; ++col)
-        {
-            const unsigned char *txt = sqlite3_column_text(mStmt, col);
-            r.push_back(txt ? (char*)txt : std::string());
-
-        }
+        readRow(mStmt, totalCols, r);
         mRecordSet.add(r);
     }
 
-    sqlite3_finalize(mStmt);
+    if (result != SQLITE_DONE)
+    {
+        LOG_ERROR("Error in SQL: " << sqlite3_sql(mStmt) << "\n"
+                  << sqlite3_errmsg(mDb));
+    }
+
+    // Resetting releases the locks held by the statement, it stays compiled
+    // in the statement cache.
+    sqlite3_reset(mStmt);
 
     return mRecordSet;
 }
 
 void SqLiteDataProvider::bindValue(int place, const std::string &value)
 {
-    sqlite3_bind_text(mStmt, place, value.c_str(), value.size(), SQLITE_STATIC);
+    // The value may be a temporary, so SQLite has to take its own copy
+    sqlite3_bind_text(mStmt, place, value.c_str(), value.size(),
+                      SQLITE_TRANSIENT);
 }
 
 void SqLiteDataProvider::bindValue(int place, int value)
@@ -410,4 +580,70 @@ void SqLiteDataProvider::bindValue(int place, int value)
     sqlite3_bind_int(mStmt, place, value);
 }
 
+void SqLiteDataProvider::bindValue(int place, int64_t value)
+{
+    sqlite3_bind_int64(mStmt, place, value);
+}
+
+void SqLiteDataProvider::bindValue(int place, double value)
+{
+    sqlite3_bind_double(mStmt, place, value);
+}
+
+bool SqLiteDataProvider::fetchRow()
+{
+    if (!mIsConnected)
+        throw std::runtime_error("not connected to database");
+
+    if (!mStmt)
+    {
+        LOG_ERROR("SqLiteDataProvider::fetchRow: "
+                  "No statement prepared before fetching.");
+        return false;
+    }
+
+    const int result = sqlite3_step(mStmt);
+    if (result == SQLITE_ROW)
+        return true;
+
+    sqlite3_reset(mStmt);
+
+    if (result != SQLITE_DONE)
+    {
+        std::string msg(sqlite3_errmsg(mDb));
+        LOG_ERROR("Error in SQL: " << sqlite3_sql(mStmt) << "\n" << msg);
+        throw DbSqlQueryExecFailure(msg);
+    }
+
+    return false;
+}
+
+bool SqLiteDataProvider::isNull(unsigned col) const
+{
+    return sqlite3_column_type(mStmt, col) == SQLITE_NULL;
+}
+
+int64_t SqLiteDataProvider::getInt(unsigned col) const
+{
+    return sqlite3_column_int64(mStmt, col);
+}
+
+double SqLiteDataProvider::getDouble(unsigned col) const
+{
+    return sqlite3_column_double(mStmt, col);
+}
+
+std::string SqLiteDataProvider::getString(unsigned col) const
+{
+    const unsigned char *txt = sqlite3_column_text(mStmt, col);
+    if (!txt)
+        return std::string();
+    return std::string((const char*) txt, sqlite3_column_bytes(mStmt, col));
+}
+
+void SqLiteDataProvider::freeStatement(void *statement)
+{
+    sqlite3_finalize(static_cast<sqlite3_stmt*>(statement));
+}
+
 } // namespace dal
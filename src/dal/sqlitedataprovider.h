@@ -151,14 +151,63 @@ class SqLiteDataProvider: public DataProvider
          */
         void bindValue(int place, int value);
 
+        /**
+         * Bind Value (64-bit Integer)
+         * @param place - which parameter to bind to
+         * @param value - the integer to bind
+         */
+        void bindValue(int place, int64_t value);
+
+        /**
+         * Bind Value (Double)
+         * @param place - which parameter to bind to
+         * @param value - the floating point number to bind
+         */
+        void bindValue(int place, double value);
+
+        /**
+         * Steps the prepared statement to its next result row.
+         *
+         * @return false when there are no more rows.
+         */
+        bool fetchRow();
+
+        /** Typed access to the current row, see DataProvider. */
+        bool isNull(unsigned col) const;
+        int64_t getInt(unsigned col) const;
+        double getDouble(unsigned col) const;
+        std::string getString(unsigned col) const;
+
+        /**
+         * Runs a passive WAL checkpoint, which does not wait for readers and
+         * writers. Only has an effect when checkpoints are scheduled, see
+         * sqlite_checkpointInterval.
+         */
+        void checkpoint();
+
+    protected:
+        /**
+         * Finalizes a prepared statement dropped from the statement cache.
+         */
+        void freeStatement(void *statement);
+
     private:
+        /**
+         * Applies the journal, synchronization and caching settings from
+         * the configuration to the new connection.
+         */
+        void configure();
+
         /** defines the name of the database config parameter */
         static const std::string CFGPARAM_SQLITE_DB;
         /** defines the default value of the CFGPARAM_SQLITE_DB parameter */
         static const std::string CFGPARAM_SQLITE_DB_DEF;
 
         sqlite3 *mDb; /**< the handle to the database connection */
-        sqlite3_stmt *mStmt; /**< the prepared statement to process */
+        sqlite3_stmt *mStmt; /**< the prepared statement to process, owned by
+                                  the statement cache */
+        bool mScheduledCheckpoints; /**< whether automatic checkpoints are
+                                         replaced by checkpoint() calls */
 };
 
 
@@ -36,6 +36,8 @@
 #include "utils/tokendispenser.h"
 #include "utils/tokencollector.h"
 
+#include <limits>
+
 /** Maximum size of sync buffer in bytes. */
 const unsigned SYNC_BUFFER_SIZE = 1024;
 
@@ -44,7 +46,8 @@ const int SYNC_BUFFER_LIMIT = 20;
 
 AccountConnection::AccountConnection():
     mSyncBuffer(0),
-    mSyncMessages(0)
+    mSyncMessages(0),
+    mPagedPost(false)
 {
 }
 
@@ -85,6 +88,13 @@ bool AccountConnection::start(int gameServerPort)
     const std::string password =
         Configuration::getValue("net_password", "changeMe");
 
+    // Doubles are sent as text until the account server tells it
+    // understands the binary form
+    MessageOut::setBinaryDoublesByDefault(false);
+    if (mSyncBuffer)
+        mSyncBuffer->setBinaryDoubles(false);
+    mPagedPost = false;
+
     // Register with the account server
     MessageOut msg(GAMSG_REGISTER);
     msg.writeString(gameServerName);
@@ -92,6 +102,8 @@ bool AccountConnection::start(int gameServerPort)
     msg.writeInt16(gameServerPort);
     msg.writeString(password);
     msg.writeInt32(itemManager->getDatabaseVersion());
+    msg.writeInt16(SERVER_CAPABILITY_BINARY_DOUBLE |
+                   SERVER_CAPABILITY_PAGED_POST);
     send(msg);
 
     // initialize sync buffer
@@ -103,9 +115,16 @@ bool AccountConnection::start(int gameServerPort)
 
 void AccountConnection::sendCharacterData(Entity *p)
 {
-    MessageOut msg(GAMSG_PLAYER_DATA);
     auto *characterComponent = p->getComponent<CharacterComponent>();
-    msg.writeInt32(characterComponent->getDatabaseID());
+    const int charId = characterComponent->getDatabaseID();
+
+    // The quest variables are asked for again wherever the character goes
+    // next, so their changes have to arrive first.
+    writeCharacterVars(charId, charId);
+    syncChanges(true);
+
+    MessageOut msg(GAMSG_PLAYER_DATA);
+    msg.writeInt32(charId);
     characterComponent->serialize(*p, msg);
     send(msg);
 }
@@ -116,6 +135,19 @@ void AccountConnection::processMessage(MessageIn &msg)
 
     switch (msg.getId())
     {
+        case AGMSG_CAPABILITIES:
+        {
+            // Doubles are only sent to the account server, so the binary
+            // form can be used for all messages once it is supported.
+            const int capabilities = msg.readInt16();
+            const bool binaryDoubles =
+                    capabilities & SERVER_CAPABILITY_BINARY_DOUBLE;
+            MessageOut::setBinaryDoublesByDefault(binaryDoubles);
+            mSyncBuffer->setBinaryDoubles(binaryDoubles);
+            mPagedPost = capabilities & SERVER_CAPABILITY_PAGED_POST;
+            LOG_DEBUG("Account server capabilities: " << capabilities);
+        } break;
+
         case AGMSG_REGISTER_RESPONSE:
         {
             if (msg.readInt16() != DATA_VERSION_OK)
@@ -252,8 +284,16 @@ void AccountConnection::processMessage(MessageIn &msg)
                 break;
             }
 
-            std::string sender = msg.readString();
-            std::string letter = msg.readString();
+            // only one letter is requested at a time
+            if (mPagedPost)
+                msg.readInt16(); // letters left
+            std::string sender;
+            std::string letter;
+            if (msg.getUnreadLength())
+            {
+                sender = msg.readString();
+                letter = msg.readString();
+            }
 
             postMan->gotPost(character, sender, letter);
 
@@ -300,15 +340,29 @@ void AccountConnection::requestCharacterVar(Entity *ch,
     send(msg);
 }
 
-void AccountConnection::updateCharacterVar(Entity *ch,
-                                           const std::string &name,
-                                           const std::string &value)
+void AccountConnection::updateCharacterVar(int charId, int varId,
+                                           const QuestVar &value)
 {
-    MessageOut msg(GAMSG_SET_VAR_CHR);
-    msg.writeInt32(ch->getComponent<CharacterComponent>()->getDatabaseID());
-    msg.writeString(name);
-    msg.writeString(value);
-    send(msg);
+    mCharacterVars[std::make_pair(charId, varId)] = value;
+}
+
+void AccountConnection::writeCharacterVars(int firstCharId, int lastCharId)
+{
+    auto it = mCharacterVars.lower_bound(std::make_pair(firstCharId, 0));
+    const auto it_end = mCharacterVars.lower_bound(
+                std::make_pair(lastCharId + 1, 0));
+    if (it == it_end)
+        return;
+
+    for (auto i = it; i != it_end; ++i)
+    {
+        ++mSyncMessages;
+        mSyncBuffer->writeInt8(SYNC_QUEST_VAR);
+        mSyncBuffer->writeInt32(i->first.first);
+        mSyncBuffer->writeString(getQuestVarName(i->first.second));
+        mSyncBuffer->writeString(i->second.toString());
+    }
+    mCharacterVars.erase(it, it_end);
 }
 
 void AccountConnection::updateMapVar(MapComposite *map,
@@ -397,8 +451,8 @@ void AccountConnection::sendPost(Entity *c, MessageIn &msg)
     while (msg.getUnreadLength()) // attachments
     {
         // write the item id and amount for each attachment
-        out.writeInt32(msg.readInt16());
-        out.writeInt32(msg.readInt16());
+        out.writeInt16(msg.readInt16());
+        out.writeInt16(msg.readInt16());
     }
     send(out);
 }
@@ -412,6 +466,8 @@ void AccountConnection::getPost(Entity *c)
     LOG_DEBUG("Sending GCMSG_REQUEST_POST");
     MessageOut out(GCMSG_REQUEST_POST);
     out.writeInt32(c->getComponent<CharacterComponent>()->getDatabaseID());
+    if (mPagedPost)
+        out.writeInt16(1); // the scripts get one letter at a time
     send(out);
 }
 
@@ -425,6 +481,9 @@ void AccountConnection::changeAccountLevel(Entity *c, int level)
 
 void AccountConnection::syncChanges(bool force)
 {
+    if (force)
+        writeCharacterVars(0, std::numeric_limits<int>::max() - 1);
+
     if (mSyncMessages == 0)
         return;
 
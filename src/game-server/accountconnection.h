@@ -21,9 +21,12 @@
 #ifndef ACCOUNTCONNECTION_H
 #define ACCOUNTCONNECTION_H
 
+#include "game-server/quest.h"
 #include "net/messageout.h"
 #include "net/connection.h"
 
+#include <map>
+
 class Entity;
 class MapComposite;
 
@@ -58,10 +61,10 @@ class AccountConnection : public Connection
         void requestCharacterVar(Entity *, const std::string &);
 
         /**
-         * Pushes a new character-bound value to the database.
+         * Queues a new character-bound value for the database. Only the last
+         * value of each variable is sent, by the next forced syncChanges().
          */
-        void updateCharacterVar(Entity *, const std::string &name,
-                                const std::string &value);
+        void updateCharacterVar(int charId, int varId, const QuestVar &value);
 
         /**
          * Pushes a new value of a map variable to the account server.
@@ -176,8 +179,18 @@ class AccountConnection : public Connection
         virtual void processMessage(MessageIn &);
 
     private:
+        /**
+         * Writes the queued quest variable changes of the characters with ids
+         * in [\a firstCharId, \a lastCharId] to the sync buffer.
+         */
+        void writeCharacterVars(int firstCharId, int lastCharId);
+
         MessageOut* mSyncBuffer;     /**< Message buffer to store sync data. */
         int mSyncMessages;           /**< Number of messages in the sync buffer. */
+        bool mPagedPost;             /**< The account server pages the post. */
+
+        /** Quest variable changes, by character id and variable id. */
+        std::map<std::pair<int, int>, QuestVar> mCharacterVars;
 };
 
 extern AccountConnection *accountHandler;
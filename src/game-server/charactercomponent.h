@@ -30,6 +30,7 @@
 #include "game-server/mapcomposite.h"
 #include "game-server/mapmanager.h"
 #include "game-server/abilitymanager.h"
+#include "game-server/quest.h"
 
 #include "scripting/script.h"
 
@@ -38,6 +39,7 @@
 #include <map>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 class BuySell;
@@ -202,9 +204,9 @@ class CharacterComponent : public Component
 
         /**
          * Associative array containing all the quest variables known by the
-         * server.
+         * server, by quest variable id.
          */
-        std::map< std::string, std::string > questCache;
+        std::unordered_map< int, QuestVar > questCache;
 
         /**
          * Used to serialize kill count.
@@ -37,7 +37,9 @@
 #include "game-server/settingsmanager.h"
 #include "net/bandwidth.h"
 #include "net/connectionhandler.h"
+#include "net/hostpoller.h"
 #include "net/messageout.h"
+#include "scripting/script.h"
 #include "scripting/scriptmanager.h"
 #include "utils/logger.h"
 #include "utils/processorutils.h"
@@ -124,11 +126,14 @@ static void initializeServer()
     // Initialize the slang's and double quotes filter.
     stringFilter = new utils::StringFilter;
 
+    const uint64_t startupTime = utils::getTimeInMicroseconds();
+
     ResourceManager::initialize();
     ScriptManager::initialize();   // Depends on ResourceManager
 
     // load game settings files
     settingsManager->initialize();
+    const uint64_t settingsTime = utils::getTimeInMicroseconds();
 
     PermissionManager::initialize(DEFAULT_PERMISSION_FILE);
 
@@ -136,6 +141,21 @@ static void initializeServer()
     std::string mainScript = Configuration::getValue("script_mainFile",
                                                      DEFAULT_MAIN_SCRIPT_FILE);
     ScriptManager::loadMainScript(mainScript);
+    const uint64_t scriptsTime = utils::getTimeInMicroseconds();
+
+    // Report where the startup time went
+    const Script::LoadStatistics &scriptLoads =
+            ScriptManager::currentState()->getLoadStatistics();
+    settingsManager->logLoadTimes();
+    LOG_INFO("Startup timing: settings loaded in "
+             << (settingsTime - startupTime) / 1000 << " ms");
+    LOG_INFO("Startup timing: main script executed in "
+             << (scriptsTime - settingsTime) / 1000 << " ms");
+    LOG_INFO("Startup timing: " << scriptLoads.chunks << " script chunks ("
+             << scriptLoads.cached << " precompiled) loaded in "
+             << scriptLoads.microseconds / 1000 << " ms");
+    LOG_INFO("Startup timing: total " << (scriptsTime - startupTime) / 1000
+             << " ms");
 
     // --- Initialize the global handlers
     // FIXME: Make the global handlers global vars or part of a bigger
@@ -341,6 +361,12 @@ int main(int argc, char *argv[])
     bool debugNetwork = Configuration::getBoolValue("net_debugMode", false);
     MessageOut::setDebugModeEnabled(debugNetwork);
 
+    // Waits for the packets of the clients and the account server between
+    // the world ticks
+    HostPoller hostPoller;
+    accountHandler->setPoller(&hostPoller);
+    gameHandler->setPoller(&hostPoller);
+
     // Make an initial attempt to connect to the account server
     // Try again after longer and longer intervals when connection fails.
     bool isConnected = false;
@@ -374,7 +400,11 @@ int main(int argc, char *argv[])
 
         if (elapsedTicks == 0)
         {
-            worldTimer.sleep();
+            // Handle the messages that arrive before the next tick
+            hostPoller.wait(worldTimer.getTimeUntilNextTick());
+            if (accountHandler->isConnected())
+                accountHandler->process();
+            gameHandler->process();
             continue;
         }
 
@@ -422,6 +452,9 @@ int main(int argc, char *argv[])
                 {
                     LOG_WARN("The connection to the account server was lost.");
                     accountServerLost = true;
+
+                    // Nobody reads its socket anymore until reconnecting
+                    accountHandler->stop();
                 }
 
                 // Try to reconnect every 200 ticks
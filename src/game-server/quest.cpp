@@ -22,17 +22,22 @@
 
 #include "game-server/accountconnection.h"
 #include "game-server/charactercomponent.h"
+#include "scripting/scriptmanager.h"
 #include "utils/logger.h"
+#include "utils/string.h"
 
 #include <cassert>
+#include <climits>
 #include <list>
 #include <map>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <sigc++/connection.h>
 
 typedef std::list< QuestCallback * > QuestCallbacks;
-typedef std::map< std::string, QuestCallbacks > PendingVariables;
+typedef std::map< int, QuestCallbacks > PendingVariables;
 
 struct PendingQuest
 {
@@ -46,41 +51,109 @@ typedef std::map< int, PendingQuest > PendingQuests;
 
 static PendingQuests pendingQuests;
 
-bool getQuestVar(Entity *ch, const std::string &name, std::string &value)
+/** Quest variable ids by name, and names by id. */
+static std::unordered_map< std::string, int > questVarIds;
+static std::vector< std::string > questVarNames;
+
+/**
+ * Reads \a text as an integer when it is written the way toString() writes
+ * integers: no sign other than a minus, no leading zeroes and within the
+ * range of an int.
+ */
+static bool parseInteger(const std::string &text, int &result)
 {
-    std::map< std::string, std::string >::iterator
-        i = ch->getComponent<CharacterComponent>()->questCache.find(name);
-    if (i == ch->getComponent<CharacterComponent>()->questCache.end())
+    const bool negative = !text.empty() && text[0] == '-';
+    size_t i = negative ? 1 : 0;
+    const size_t digits = text.size() - i;
+    if (digits == 0 || digits > 10)
+        return false;
+    if (text[i] == '0' && (digits > 1 || negative))
+        return false;
+
+    long long value = 0;
+    for (; i < text.size(); ++i)
+    {
+        if (text[i] < '0' || text[i] > '9')
+            return false;
+        value = value * 10 + (text[i] - '0');
+    }
+    if (negative)
+        value = -value;
+    if (value < INT_MIN || value > INT_MAX)
         return false;
-    value = i->second;
+
+    result = (int) value;
     return true;
 }
 
-void setQuestVar(Entity *ch, const std::string &name,
-                 const std::string &value)
+QuestVar::QuestVar(const std::string &value):
+    isInteger(false),
+    integer(0)
+{
+    if (parseInteger(value, integer))
+        isInteger = true;
+    else
+        text = value;
+}
+
+std::string QuestVar::toString() const
+{
+    return isInteger ? utils::toString(integer) : text;
+}
+
+int getQuestVarId(const std::string &name)
+{
+    auto result = questVarIds.insert(
+                std::make_pair(name, (int) questVarNames.size()));
+    if (result.second)
+        questVarNames.push_back(name);
+    return result.first->second;
+}
+
+const std::string &getQuestVarName(int id)
+{
+    assert(isQuestVarId(id));
+    return questVarNames[id];
+}
+
+bool isQuestVarId(int id)
+{
+    return id >= 0 && id < (int) questVarNames.size();
+}
+
+void pushQuestVar(Script *script, const QuestVar &value)
+{
+    script->push(value.toString());
+}
+
+const QuestVar *getQuestVar(Entity *ch, int id)
+{
+    auto &questCache = ch->getComponent<CharacterComponent>()->questCache;
+    auto i = questCache.find(id);
+    if (i == questCache.end())
+        return nullptr;
+    return &i->second;
+}
+
+void setQuestVar(Entity *ch, int id, const QuestVar &value)
 {
     auto *characterComponent =
             ch->getComponent<CharacterComponent>();
 
-    std::map< std::string, std::string >::iterator
-        i = characterComponent->questCache.lower_bound(name);
-    if (i == characterComponent->questCache.end() || i->first != name)
+    auto result = characterComponent->questCache.insert(
+                std::make_pair(id, value));
+    if (!result.second)
     {
-        characterComponent->questCache.insert(i, std::make_pair(name, value));
-    }
-    else if (i->second == value)
-    {
-        return;
+        if (result.first->second == value)
+            return;
+        result.first->second = value;
     }
-    else
-    {
-        i->second = value;
-    }
-    accountHandler->updateCharacterVar(ch, name, value);
+    accountHandler->updateCharacterVar(characterComponent->getDatabaseID(),
+                                       id, value);
 }
 
 void QuestRefCallback::triggerCallback(Entity *ch,
-                                       const std::string &value) const
+                                       const QuestVar &value) const
 {
     if (!mRef.isValid())
         return;
@@ -89,7 +162,7 @@ void QuestRefCallback::triggerCallback(Entity *ch,
     s->prepare(mRef);
     s->push(ch);
     s->push(mQuestName);
-    s->push(value);
+    pushQuestVar(s, value);
     s->execute(ch->getMap());
 }
 
@@ -120,17 +193,16 @@ static void fullRemove(Entity &ch)
     pendingQuests.erase(id);
 }
 
-void recoverQuestVar(Entity *ch, const std::string &name,
-                     QuestCallback *f)
+void recoverQuestVar(Entity *ch, int id, QuestCallback *f)
 {
     auto *characterComponent =
             ch->getComponent<CharacterComponent>();
 
-    assert(characterComponent->questCache.find(name) ==
+    assert(characterComponent->questCache.find(id) ==
            characterComponent->questCache.end());
-    int id = ch->getComponent<CharacterComponent>()->getDatabaseID();
-    PendingQuests::iterator i = pendingQuests.lower_bound(id);
-    if (i == pendingQuests.end() || i->first != id)
+    int charId = characterComponent->getDatabaseID();
+    PendingQuests::iterator i = pendingQuests.lower_bound(charId);
+    if (i == pendingQuests.end() || i->first != charId)
     {
         PendingQuest pendingQuest;
         pendingQuest.character = ch;
@@ -145,17 +217,17 @@ void recoverQuestVar(Entity *ch, const std::string &name,
                 characterComponent->signal_disconnected.connect(
                         sigc::ptr_fun(fullRemove));
 
-        i = pendingQuests.insert(i, std::make_pair(id, pendingQuest));
+        i = pendingQuests.insert(i, std::make_pair(charId, pendingQuest));
     }
-    i->second.variables[name].push_back(f);
-    accountHandler->requestCharacterVar(ch, name);
+    i->second.variables[id].push_back(f);
+    accountHandler->requestCharacterVar(ch, getQuestVarName(id));
 }
 
-void recoveredQuestVar(int id,
+void recoveredQuestVar(int charId,
                        const std::string &name,
                        const std::string &value)
 {
-    PendingQuests::iterator i = pendingQuests.find(id);
+    PendingQuests::iterator i = pendingQuests.find(charId);
     if (i == pendingQuests.end())
         return;
 
@@ -164,7 +236,7 @@ void recoveredQuestVar(int id,
     pendingQuest.disconnectedConnection.disconnect();
 
     PendingVariables &variables = pendingQuest.variables;
-    PendingVariables::iterator j = variables.find(name);
+    PendingVariables::iterator j = variables.find(getQuestVarId(name));
     if (j == variables.end())
     {
         LOG_ERROR("Account server recovered an unexpected quest variable.");
@@ -173,13 +245,16 @@ void recoveredQuestVar(int id,
 
     Entity *ch = pendingQuest.character;
     auto *characterComponent = ch->getComponent<CharacterComponent>();
-    characterComponent->questCache[name] = value;
+
+    // A value set while waiting for the account server is more recent
+    const QuestVar cached = characterComponent->questCache.insert(
+                std::make_pair(j->first, QuestVar(value))).first->second;
 
     // Call the registered callbacks.
     for (QuestCallbacks::const_iterator k = j->second.begin(),
          k_end = j->second.end(); k != k_end; ++k)
     {
-        (*k)->triggerCallback(ch, value);
+        (*k)->triggerCallback(ch, cached);
         delete (*k);
     }
 
@@ -23,12 +23,50 @@
 
 #include <string>
 
-#include "scripting/scriptmanager.h"
+#include "scripting/script.h"
 
 class Entity;
 class Script;
 
 
+/**
+ * The value of a quest variable. Values that are integers are kept as such,
+ * since quest variables are mostly used as counters and flags.
+ */
+struct QuestVar
+{
+    QuestVar():
+        isInteger(false),
+        integer(0)
+    {}
+
+    explicit QuestVar(int value):
+        isInteger(true),
+        integer(value)
+    {}
+
+    /**
+     * Keeps \a value as an integer when it is one written the way
+     * toString() would write it, so that it reads back the same.
+     */
+    explicit QuestVar(const std::string &value);
+
+    std::string toString() const;
+
+    bool operator==(const QuestVar &other) const
+    {
+        return isInteger == other.isInteger &&
+                (isInteger ? integer == other.integer : text == other.text);
+    }
+
+    bool operator!=(const QuestVar &other) const
+    { return !(*this == other); }
+
+    bool isInteger;
+    int integer;
+    std::string text;   /**< The value, when it is not an integer. */
+};
+
 class QuestCallback
 {
     public:
@@ -36,14 +74,14 @@ class QuestCallback
         { }
 
         virtual void triggerCallback(Entity *ch,
-                                     const std::string &value) const = 0;
+                                     const QuestVar &value) const = 0;
 };
 
 class QuestThreadCallback : public QuestCallback
 {
     public:
         typedef void (*Handler)(Entity *,
-                                const std::string &value,
+                                const QuestVar &value,
                                 Script *mScript);
 
         QuestThreadCallback(Handler handler,
@@ -52,7 +90,7 @@ class QuestThreadCallback : public QuestCallback
             mScript(script)
         { }
 
-        void triggerCallback(Entity *ch, const std::string &value) const
+        void triggerCallback(Entity *ch, const QuestVar &value) const
         { mHandler(ch, value, mScript); }
 
     private:
@@ -67,34 +105,58 @@ class QuestRefCallback : public QuestCallback
             mQuestName(questName)
         { script->assignCallback(mRef); }
 
-        void triggerCallback(Entity *ch, const std::string &value) const;
+        void triggerCallback(Entity *ch, const QuestVar &value) const;
 
     private:
         Script::Ref mRef;
         std::string mQuestName;
 };
 
+/**
+ * Returns the id of the quest variable called \a name. Ids are handed out
+ * the first time a name is seen and are only valid until the server stops,
+ * so scripts look them up when they are loaded.
+ */
+int getQuestVarId(const std::string &name);
+
+/**
+ * Returns the name of the quest variable with the given id.
+ */
+const std::string &getQuestVarName(int id);
+
+/**
+ * Returns whether \a id is the id of a quest variable.
+ */
+bool isQuestVarId(int id);
+
+/**
+ * Pushes the value of a quest variable. Scripts always get the value as a
+ * string, the way it is stored.
+ */
+void pushQuestVar(Script *script, const QuestVar &value);
+
 /**
  * Gets the value associated to a quest variable.
- * @return false if no value was in cache.
+ * @return nullptr if no value was in cache.
  */
-bool getQuestVar(Entity *, const std::string &name, std::string &value);
+const QuestVar *getQuestVar(Entity *, int id);
 
 /**
- * Sets the value associated to a quest variable.
+ * Sets the value associated to a quest variable. The change is sent to the
+ * account server with the next sync of the character changes.
  */
-void setQuestVar(Entity *, const std::string &name, const std::string &value);
+void setQuestVar(Entity *, int id, const QuestVar &value);
 
 /**
  * Starts the recovery of a variable and returns immediatly. The callback will
  * be called once the value has been recovered.
  */
-void recoverQuestVar(Entity *, const std::string &name, QuestCallback *);
+void recoverQuestVar(Entity *, int id, QuestCallback *);
 
 /**
  * Called by the handler of the account server when a value is received.
  */
-void recoveredQuestVar(int id, const std::string &name,
+void recoveredQuestVar(int charId, const std::string &name,
                        const std::string &value);
 
 #endif
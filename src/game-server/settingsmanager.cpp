@@ -21,6 +21,7 @@
 #include "game-server/settingsmanager.h"
 #include "common/defines.h"
 #include "utils/logger.h"
+#include "utils/timer.h"
 #include "utils/xml.h"
 
 #include "common/resourcemanager.h"
@@ -40,6 +41,9 @@
  */
 void SettingsManager::initialize()
 {
+    mLoadTimes.clear();
+    mFileLoadTimes.clear();
+
     // initialize all managers in correct order
     MapManager::initialize();
     attributeManager->initialize();
@@ -61,6 +65,9 @@ void SettingsManager::initialize()
  */
 void SettingsManager::reload()
 {
+    mLoadTimes.clear();
+    mFileLoadTimes.clear();
+
     MapManager::reload();
     attributeManager->reload();
     abilityManager->reload();
@@ -76,10 +83,13 @@ void SettingsManager::reload()
 /**
  * Load a configuration file.
  */
-void SettingsManager::loadFile(const std::string &filename)
+uint64_t SettingsManager::loadFile(const std::string &filename)
 {
     LOG_INFO("Loading game settings from " << filename);
 
+    const uint64_t fileStart = utils::getTimeInMicroseconds();
+    uint64_t includeTime = 0;
+
     XML::Document doc(filename);
     xmlNodePtr node = doc.rootNode();
 
@@ -100,6 +110,8 @@ void SettingsManager::loadFile(const std::string &filename)
         if (childNode->type != XML_ELEMENT_NODE)
             continue;
 
+        const uint64_t start = utils::getTimeInMicroseconds();
+
         if (xmlStrEqual(childNode->name, BAD_CAST "include"))
         {
             // include an other file
@@ -121,9 +133,12 @@ void SettingsManager::loadFile(const std::string &filename)
                 else
                 {
                     // include that file
-                    loadFile(realIncludeFile);
+                    includeTime += loadFile(realIncludeFile);
                 }
             }
+
+            // The settings of the included file are timed by their own type
+            continue;
         }
         else if (xmlStrEqual(childNode->name, BAD_CAST "map"))
         {
@@ -169,11 +184,34 @@ void SettingsManager::loadFile(const std::string &filename)
         {
             // since the client and server share settings, don't be too strict
 //            LOG_WARN("Unexpected tag <" << childNode->name << "> in " << filename);
+            continue;
         }
+
+        mLoadTimes[(const char *) childNode->name] +=
+                utils::getTimeInMicroseconds() - start;
     }
 
     // remove this file from include stack
     mIncludedFiles.erase(filename);
+
+    // Only the time spent in this file, without the files it includes
+    const uint64_t total = utils::getTimeInMicroseconds() - fileStart;
+    mFileLoadTimes[filename] += total - includeTime;
+    return total;
+}
+
+void SettingsManager::logLoadTimes() const
+{
+    for (auto &loadTime : mLoadTimes)
+    {
+        LOG_INFO("Startup timing: " << loadTime.first << " settings loaded in "
+                 << loadTime.second / 1000 << " ms");
+    }
+    for (auto &loadTime : mFileLoadTimes)
+    {
+        LOG_INFO("Startup timing: " << loadTime.first << " loaded in "
+                 << loadTime.second / 1000 << " ms, without its includes");
+    }
 }
 
 /**
@@ -23,8 +23,11 @@
 
 #include <string>
 #include <list>
+#include <map>
 #include <set>
 
+#include <stdint.h>
+
 class SettingsManager
 {
     public:
@@ -36,11 +39,26 @@ class SettingsManager
 
 		void reload();
 
+		/**
+		 * Logs how much time was spent loading each kind of setting.
+		 */
+		void logLoadTimes() const;
+
 	private:
 		std::string mSettingsFile;
 		std::set<std::string> mIncludedFiles;
 
-		void loadFile(const std::string &filename);
+		/** Microseconds spent per settings node type (map, item, ...) */
+		std::map<std::string, uint64_t> mLoadTimes;
+
+		/** Microseconds spent per settings file, without its includes */
+		std::map<std::string, uint64_t> mFileLoadTimes;
+
+		/**
+		 * Loads a settings file and the files it includes.
+		 * @return the time this took in microseconds, includes counted.
+		 */
+		uint64_t loadFile(const std::string &filename);
 
 		void checkStatus();
 };
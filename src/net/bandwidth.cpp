@@ -32,16 +32,19 @@ BandwidthMonitor::BandwidthMonitor():
 
 void BandwidthMonitor::increaseInterServerOutput(int size)
 {
+    std::lock_guard<std::mutex> lock(mMutex);
     mAmountServerOutput += size;
 }
 
 void BandwidthMonitor::increaseInterServerInput(int size)
 {
+    std::lock_guard<std::mutex> lock(mMutex);
     mAmountServerInput += size;
 }
 
 void BandwidthMonitor::increaseClientOutput(NetComputer *nc, int size)
 {
+    std::lock_guard<std::mutex> lock(mMutex);
     mAmountClientOutput += size;
     // look for an existing client stored
     ClientBandwidth::iterator itr = mClientBandwidth.find(nc);
@@ -58,8 +61,19 @@ void BandwidthMonitor::increaseClientOutput(NetComputer *nc, int size)
 
 }
 
+/**
+ * Broadcasts are only counted in the total, updating the output of every
+ * recipient would take as long as sending to them one by one.
+ */
+void BandwidthMonitor::increaseBroadcastOutput(int size, unsigned recipients)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mAmountClientOutput += size * recipients;
+}
+
 void BandwidthMonitor::increaseClientInput(NetComputer *nc, int size)
 {
+    std::lock_guard<std::mutex> lock(mMutex);
     mAmountClientInput += size;
 
     // look for an existing client stored
@@ -22,9 +22,14 @@
 #define BANDWIDTH_H
 
 #include <map>
+#include <mutex>
 
 class NetComputer;
 
+/**
+ * Counts the network traffic. The account server sends and receives from
+ * more than one thread, so the counters may be increased from any thread.
+ */
 class BandwidthMonitor
 {
 public:
@@ -32,6 +37,7 @@ public:
     void increaseInterServerOutput(int size);
     void increaseInterServerInput(int size);
     void increaseClientOutput(NetComputer *nc, int size);
+    void increaseBroadcastOutput(int size, unsigned recipients);
     void increaseClientInput(NetComputer *nc, int size);
     int totalInterServerOut() const { return mAmountServerOutput; }
     int totalInterServerIn() const { return mAmountServerInput; }
@@ -39,6 +45,7 @@ public:
     int totalClientIn() const { return mAmountClientInput; }
 
 private:
+    std::mutex mMutex;
     int mAmountServerOutput;
     int mAmountServerInput;
     int mAmountClientOutput;
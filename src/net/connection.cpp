@@ -20,6 +20,7 @@
 
 #include "net/connection.h"
 #include "net/bandwidth.h"
+#include "net/hostpoller.h"
 #include "net/messagein.h"
 #include "net/messageout.h"
 #include "utils/logger.h"
@@ -32,12 +33,17 @@
 
 Connection::Connection():
     mRemote(0),
-    mLocal(0)
+    mLocal(0),
+    mPoller(0)
 {
 }
 
 bool Connection::start(const std::string &address, int port)
 {
+    // Clean up after a lost connection
+    if (mLocal)
+        stop();
+
     ENetAddress enetAddress;
     enet_address_set_host(&enetAddress, address.c_str());
     enetAddress.port = port;
@@ -72,6 +78,9 @@ bool Connection::start(const std::string &address, int port)
         stop();
         return false;
     }
+
+    if (mPoller)
+        mPoller->add(mLocal);
     return mRemote;
 }
 
@@ -83,6 +92,8 @@ void Connection::stop()
         enet_host_flush(mLocal);
     if (mRemote)
         enet_peer_reset(mRemote);
+    if (mLocal && mPoller)
+        mPoller->remove(mLocal);
     if (mLocal)
         enet_host_destroy(mLocal);
 
@@ -115,8 +126,23 @@ void Connection::send(const MessageOut &msg, bool reliable, unsigned channel)
         LOG_ERROR("Failure to create packet!");
 }
 
+void Connection::setPoller(HostPoller *poller)
+{
+    if (mLocal && mPoller)
+        mPoller->remove(mLocal);
+    mPoller = poller;
+    if (mLocal && mPoller)
+        mPoller->add(mLocal);
+}
+
 void Connection::process()
 {
+    if (mPoller && !mPoller->isReady(mLocal))
+    {
+        enet_host_flush(mLocal);
+        return;
+    }
+
     ENetEvent event;
     // Process Enet events and do not block.
     while (enet_host_service(mLocal, &event, 0) > 0)
@@ -24,6 +24,7 @@
 #include <string>
 #include <enet/enet.h>
 
+class HostPoller;
 class MessageIn;
 class MessageOut;
 
@@ -60,7 +61,14 @@ class Connection
                   unsigned channel = 0);
 
         /**
-         * Dispatches received messages to processMessage.
+         * Lets \a poller wait for the messages of the remote host, also
+         * after reconnecting. Pass nullptr to stop it.
+         */
+        void setPoller(HostPoller *poller);
+
+        /**
+         * Dispatches received messages to processMessage. With a poller, the
+         * socket is only read when the poller found packets waiting on it.
          */
         void process();
 
@@ -73,6 +81,7 @@ class Connection
     private:
         ENetPeer *mRemote;
         ENetHost *mLocal;
+        HostPoller *mPoller;
 };
 
 #endif
@@ -24,6 +24,7 @@
 
 #include "common/configuration.h"
 #include "net/bandwidth.h"
+#include "net/hostpoller.h"
 #include "net/messagein.h"
 #include "net/messageout.h"
 #include "net/netcomputer.h"
@@ -35,6 +36,12 @@
 #define ENET_CUTOFF 0xFFFFFFFF
 #endif
 
+ConnectionHandler::ConnectionHandler():
+    host(nullptr),
+    mPoller(nullptr)
+{
+}
+
 bool ConnectionHandler::startListen(enet_uint16 port,
                                     const std::string &listenHost)
 {
@@ -61,6 +68,9 @@ bool ConnectionHandler::startListen(enet_uint16 port,
             0           /* assume any amount of outgoing bandwidth */);
 #endif
 
+    if (host && mPoller)
+        mPoller->add(host);
+
     return host != 0;
 }
 
@@ -82,10 +92,22 @@ void ConnectionHandler::stopListen()
             enet_peer_reset(currentPeer);
         }
     }
+    if (mPoller)
+        mPoller->remove(host);
     enet_host_destroy(host);
+    host = nullptr;
     // FIXME: memory leak on NetComputers
 }
 
+void ConnectionHandler::setPoller(HostPoller *poller)
+{
+    if (host && mPoller)
+        mPoller->remove(host);
+    mPoller = poller;
+    if (host && mPoller)
+        mPoller->add(host);
+}
+
 void ConnectionHandler::flush()
 {
     enet_host_flush(host);
@@ -93,6 +115,12 @@ void ConnectionHandler::flush()
 
 void ConnectionHandler::process(enet_uint32 timeout)
 {
+    if (mPoller && !mPoller->isReady(host))
+    {
+        enet_host_flush(host);
+        return;
+    }
+
     ENetEvent event;
     // Process Enet events and do not block.
     while (enet_host_service(host, &event, timeout) > 0) {
@@ -150,16 +178,16 @@ void ConnectionHandler::process(enet_uint32 timeout)
 
             default: break;
         }
+
+        // Only wait while there is nothing to do, the other handlers of the
+        // same loop are waiting for their turn
+        timeout = 0;
     }
 }
 
 void ConnectionHandler::sendToEveryone(const MessageOut &msg)
 {
-    for (NetComputers::iterator i = clients.begin(), i_end = clients.end();
-         i != i_end; ++i)
-    {
-        (*i)->send(msg);
-    }
+    NetComputer::broadcast(clients.begin(), clients.end(), msg);
 }
 
 unsigned ConnectionHandler::getClientCount() const
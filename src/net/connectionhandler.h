@@ -25,6 +25,7 @@
 #include <string>
 #include <enet/enet.h>
 
+class HostPoller;
 class MessageIn;
 class MessageOut;
 class NetComputer;
@@ -37,6 +38,8 @@ class NetComputer;
 class ConnectionHandler
 {
     public:
+        ConnectionHandler();
+
         virtual ~ConnectionHandler() {}
 
         /**
@@ -52,12 +55,26 @@ class ConnectionHandler
          */
         void stopListen();
 
+        /**
+         * Lets \a poller wait for the packets of this handler, together
+         * with those of other hosts. Pass nullptr to stop it.
+         */
+        void setPoller(HostPoller *poller);
+
+        HostPoller *getPoller() const
+        { return mPoller; }
+
         /**
          * Process outgoing messages and listen to the server socket for
          * incoming messages and new connections.
          *
+         * With a poller, the socket is only read when the poller found
+         * packets waiting on it, otherwise only the outgoing messages are
+         * sent.
+         *
          * @timeout an optional timeout in milliseconds to wait for something
-         *          to happen when there is nothing to do
+         *          to happen when there is nothing to do, not to be used
+         *          together with a poller
          */
         virtual void process(enet_uint32 timeout = 0);
 
@@ -84,6 +101,7 @@ class ConnectionHandler
     private:
         ENetAddress address;      /**< Includes the port to listen to. */
         ENetHost *host;           /**< The host that listen for connections. */
+        HostPoller *mPoller;
 
     protected:
         /**
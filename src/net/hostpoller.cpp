@@ -0,0 +1,197 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "net/hostpoller.h"
+
+#include "utils/logger.h"
+#include "utils/timer.h"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+/** Milliseconds between two regular services of all the hosts. */
+static const uint64_t SERVICE_INTERVAL = 100;
+
+/** The most events handled by one epoll_wait(). */
+static const int MAX_EVENTS = 16;
+
+static uint64_t getTimeInMilliseconds()
+{
+    return utils::getTimeInMicroseconds() / 1000;
+}
+
+HostPoller::HostPoller():
+    mServiceDue(true),
+    mLastService(getTimeInMilliseconds())
+{
+#ifdef __linux__
+    mEpoll = epoll_create1(EPOLL_CLOEXEC);
+    mWakeUp = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    epoll_event event = epoll_event();
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;   // Tells the eventfd apart from the hosts
+
+    if (mEpoll < 0 || mWakeUp < 0 ||
+        epoll_ctl(mEpoll, EPOLL_CTL_ADD, mWakeUp, &event) != 0)
+    {
+        LOG_ERROR("Could not set up epoll (" << strerror(errno)
+                  << "), falling back to select.");
+        if (mEpoll >= 0)
+            close(mEpoll);
+        if (mWakeUp >= 0)
+            close(mWakeUp);
+        mEpoll = -1;
+        mWakeUp = -1;
+    }
+#endif
+}
+
+HostPoller::~HostPoller()
+{
+#ifdef __linux__
+    if (mEpoll >= 0)
+        close(mEpoll);
+    if (mWakeUp >= 0)
+        close(mWakeUp);
+#endif
+}
+
+void HostPoller::add(ENetHost *host)
+{
+    if (std::find(mHosts.begin(), mHosts.end(), host) != mHosts.end())
+        return;
+
+    mHosts.push_back(host);
+
+#ifdef __linux__
+    if (mEpoll >= 0)
+    {
+        epoll_event event = epoll_event();
+        event.events = EPOLLIN;
+        event.data.ptr = host;
+        if (epoll_ctl(mEpoll, EPOLL_CTL_ADD, host->socket, &event) != 0)
+        {
+            // The host is still served at the regular interval
+            LOG_ERROR("Could not wait for packets on socket " << host->socket
+                      << ": " << strerror(errno));
+        }
+    }
+#endif
+}
+
+void HostPoller::remove(ENetHost *host)
+{
+    auto it = std::find(mHosts.begin(), mHosts.end(), host);
+    if (it == mHosts.end())
+        return;
+
+    mHosts.erase(it);
+    mReady.erase(std::remove(mReady.begin(), mReady.end(), host),
+                 mReady.end());
+
+#ifdef __linux__
+    if (mEpoll >= 0)
+        epoll_ctl(mEpoll, EPOLL_CTL_DEL, host->socket, nullptr);
+#endif
+}
+
+void HostPoller::wait(int timeout)
+{
+    mReady.clear();
+
+    // Never wait past the next regular service
+    const uint64_t sinceService = getTimeInMilliseconds() - mLastService;
+    const int untilService = sinceService < SERVICE_INTERVAL
+            ? (int) (SERVICE_INTERVAL - sinceService) : 0;
+    if (timeout < 0 || timeout > untilService)
+        timeout = untilService;
+
+#ifdef __linux__
+    if (mEpoll >= 0)
+    {
+        epoll_event events[MAX_EVENTS];
+        const int count = epoll_wait(mEpoll, events, MAX_EVENTS, timeout);
+        for (int i = 0; i < count; ++i)
+        {
+            if (ENetHost *host = static_cast<ENetHost *>(events[i].data.ptr))
+            {
+                mReady.push_back(host);
+            }
+            else
+            {
+                uint64_t wakeUps;
+                if (read(mWakeUp, &wakeUps, sizeof(wakeUps)) < 0)
+                    LOG_DEBUG("Spurious wake up of the host poller.");
+            }
+        }
+    }
+    else
+#endif
+    {
+        ENetSocketSet sockets;
+        ENetSocket maxSocket = 0;
+        ENET_SOCKETSET_EMPTY(sockets);
+        for (ENetHost *host : mHosts)
+        {
+            ENET_SOCKETSET_ADD(sockets, host->socket);
+            maxSocket = std::max(maxSocket, host->socket);
+        }
+
+        if (enet_socketset_select(maxSocket, &sockets, nullptr, timeout) > 0)
+        {
+            for (ENetHost *host : mHosts)
+            {
+                if (ENET_SOCKETSET_CHECK(sockets, host->socket))
+                    mReady.push_back(host);
+            }
+        }
+    }
+
+    const uint64_t now = getTimeInMilliseconds();
+    mServiceDue = now - mLastService >= SERVICE_INTERVAL;
+    if (mServiceDue)
+        mLastService = now;
+}
+
+bool HostPoller::isReady(const ENetHost *host) const
+{
+    return mServiceDue ||
+            std::find(mReady.begin(), mReady.end(), host) != mReady.end();
+}
+
+void HostPoller::wakeUp()
+{
+#ifdef __linux__
+    if (mWakeUp >= 0)
+    {
+        const uint64_t one = 1;
+        if (write(mWakeUp, &one, sizeof(one)) < 0)
+            LOG_DEBUG("Wake up of the host poller already pending.");
+    }
+#endif
+}
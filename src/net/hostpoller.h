@@ -0,0 +1,91 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HOSTPOLLER_H
+#define HOSTPOLLER_H
+
+#include <vector>
+
+#include <enet/enet.h>
+
+#include <stdint.h>
+
+/**
+ * Waits for packets on several ENet hosts at once, so that a loop serving
+ * more than one host neither spins nor sleeps while packets are waiting on
+ * one of them. Uses epoll on Linux and select elsewhere.
+ *
+ * Only hosts that have packets waiting need to be served after a wait. All
+ * hosts are still served at a regular interval, since ENet also needs this
+ * to resend lost packets and to notice peers that timed out.
+ *
+ * Except for wakeUp(), a poller is only to be used by a single thread.
+ */
+class HostPoller
+{
+    public:
+        HostPoller();
+
+        ~HostPoller();
+
+        /**
+         * Starts waiting for packets on \a host.
+         */
+        void add(ENetHost *host);
+
+        /**
+         * Stops waiting for packets on \a host. To be called before the host
+         * is destroyed.
+         */
+        void remove(ENetHost *host);
+
+        /**
+         * Waits until packets arrive for one of the hosts, wakeUp() is
+         * called, the hosts are due for their regular service or \a timeout
+         * milliseconds passed. A negative \a timeout waits for one of the
+         * others.
+         */
+        void wait(int timeout);
+
+        /**
+         * Returns whether \a host has to be served after the last wait().
+         */
+        bool isReady(const ENetHost *host) const;
+
+        /**
+         * Ends the current or next wait(). May be called from any thread.
+         * Not supported by the select fallback, where the wait only ends
+         * at the next regular service.
+         */
+        void wakeUp();
+
+    private:
+        std::vector<ENetHost *> mHosts;
+        std::vector<const ENetHost *> mReady;   /**< Since the last wait. */
+        bool mServiceDue;       /**< Whether all the hosts are to be served. */
+        uint64_t mLastService;  /**< Time of the last regular service, in ms. */
+
+#ifdef __linux__
+        int mEpoll;
+        int mWakeUp;            /**< An eventfd, also waited for. */
+#endif
+};
+
+#endif // HOSTPOLLER_H
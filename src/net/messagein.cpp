@@ -134,8 +134,71 @@ double MessageIn::readDouble()
     mPos += sizeof(double);
 #else
     int length = readInt8();
-    std::istringstream i (readString(length));
-    i >> value;
+    switch (length)
+    {
+        case ManaServ::DOUBLE_INT16:
+            ASSERT_IF (mPos + 2 <= mLength)
+            {
+                uint16_t t;
+                memcpy(&t, mData + mPos, 2);
+                value = (int16_t) ENET_NET_TO_HOST_16(t);
+            }
+            mPos += 2;
+            break;
+
+        case ManaServ::DOUBLE_INT32:
+            ASSERT_IF (mPos + 4 <= mLength)
+            {
+                uint32_t t;
+                memcpy(&t, mData + mPos, 4);
+                value = (int32_t) ENET_NET_TO_HOST_32(t);
+            }
+            mPos += 4;
+            break;
+
+        case ManaServ::DOUBLE_DECIMAL:
+            ASSERT_IF (mPos + 5 <= mLength)
+            {
+                static const double scales[] = { 1, 10, 100, 1000 };
+                const unsigned scale = (unsigned char) mData[mPos];
+                uint32_t t;
+                memcpy(&t, mData + mPos + 1, 4);
+                if (scale < 4)
+                    value = (int32_t) ENET_NET_TO_HOST_32(t) / scales[scale];
+            }
+            mPos += 5;
+            break;
+
+        case ManaServ::DOUBLE_FLOAT:
+            ASSERT_IF (mPos + 4 <= mLength)
+            {
+                uint32_t t;
+                memcpy(&t, mData + mPos, 4);
+                t = ENET_NET_TO_HOST_32(t);
+                float single;
+                memcpy(&single, &t, 4);
+                value = single;
+            }
+            mPos += 4;
+            break;
+
+        case ManaServ::DOUBLE_BINARY:
+            ASSERT_IF (mPos + 8 <= mLength)
+            {
+                uint64_t bits = 0;
+                for (int i = 0; i < 8; ++i)
+                    bits = (bits << 8) | (unsigned char) mData[mPos + i];
+                memcpy(&value, &bits, 8);
+            }
+            mPos += 8;
+            break;
+
+        default:
+        {
+            std::istringstream i (readString(length));
+            i >> value;
+        } break;
+    }
 #endif
     return value;
 }
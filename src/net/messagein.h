@@ -24,6 +24,7 @@
 #include "common/manaserv_protocol.h"
 
 #include <iosfwd>
+#include <string>
 
 /**
  * Used for parsing an incoming message.
@@ -71,6 +72,12 @@ class MessageIn
          */
         int getUnreadLength() const { return mLength - mPos; }
 
+        /**
+         * Returns a copy of the complete message, which can be parsed again
+         * once the original data is gone.
+         */
+        std::string copyData() const { return std::string(mData, mLength); }
+
     private:
         bool readValueType(ManaServ::ValueType type);
 
@@ -25,6 +25,7 @@
 #include <iomanip>
 #include <iostream>
 #ifndef USE_NATIVE_DOUBLE
+#include <cmath>
 #include <limits>
 #include <sstream>
 #endif
@@ -39,10 +40,12 @@ const unsigned INITIAL_DATA_CAPACITY = 16;
 const unsigned CAPACITY_GROW_FACTOR = 2;
 
 static bool debugModeEnabled = false;
+static bool binaryDoublesByDefault = false;
 
 MessageOut::MessageOut(int id):
     mPos(0),
-    mDebugMode(false)
+    mDebugMode(false),
+    mBinaryDoubles(binaryDoublesByDefault)
 {
     mData = (char*) malloc(INITIAL_DATA_CAPACITY);
     mDataSize = INITIAL_DATA_CAPACITY;
@@ -115,6 +118,54 @@ void MessageOut::writeDouble(double value)
     memcpy(mData + mPos, &value, sizeof(double));
     mPos += sizeof(double);
 #else
+    if (mBinaryDoubles)
+    {
+        // Integral values are common, they are sent as integers when they
+        // fit. Negative zero is not integral in this sense.
+        if (value >= -32768 && value <= 32767 && value == (int) value &&
+            (value != 0 || !std::signbit(value)))
+        {
+            writeInt8(ManaServ::DOUBLE_INT16);
+            expand(mPos + 2);
+            uint16_t t = ENET_HOST_TO_NET_16((int16_t) value);
+            memcpy(mData + mPos, &t, 2);
+            mPos += 2;
+        }
+        else if (value >= std::numeric_limits<int32_t>::min() &&
+                 value <= std::numeric_limits<int32_t>::max() &&
+                 value == (int32_t) value && value != 0)
+        {
+            writeInt8(ManaServ::DOUBLE_INT32);
+            expand(mPos + 4);
+            uint32_t t = ENET_HOST_TO_NET_32((int32_t) value);
+            memcpy(mData + mPos, &t, 4);
+            mPos += 4;
+        }
+        else if ((double) (float) value == value)
+        {
+            // Exactly representable in single precision
+            const float single = value;
+            uint32_t bits;
+            memcpy(&bits, &single, 4);
+            writeInt8(ManaServ::DOUBLE_FLOAT);
+            expand(mPos + 4);
+            uint32_t t = ENET_HOST_TO_NET_32(bits);
+            memcpy(mData + mPos, &t, 4);
+            mPos += 4;
+        }
+        else if (!writeDecimalDouble(value))
+        {
+            // The IEEE-754 bit pattern, most significant byte first
+            uint64_t bits;
+            memcpy(&bits, &value, 8);
+            writeInt8(ManaServ::DOUBLE_BINARY);
+            expand(mPos + 8);
+            for (int i = 7; i >= 0; --i)
+                mData[mPos++] = (char) (bits >> (i * 8));
+        }
+        return;
+    }
+
 // Rather inefficient, but I don't have a lot of time.
 // If anyone wants to implement a custom double you are more than welcome to.
     std::ostringstream o;
@@ -127,6 +178,35 @@ void MessageOut::writeDouble(double value)
 #endif
 }
 
+#ifndef USE_NATIVE_DOUBLE
+bool MessageOut::writeDecimalDouble(double value)
+{
+    // Values with a few decimals, like the ones from the data files, are
+    // sent as a scaled integer when dividing it again gives the exact value.
+    static const double scales[] = { 10, 100, 1000 };
+    for (int i = 0; i < 3; ++i)
+    {
+        const double scaled = value * scales[i];
+        if (!(scaled >= std::numeric_limits<int32_t>::min() &&
+              scaled <= std::numeric_limits<int32_t>::max()))
+            return false;
+
+        const int32_t integer = (int32_t) std::floor(scaled + 0.5);
+        if (integer / scales[i] == value)
+        {
+            writeInt8(ManaServ::DOUBLE_DECIMAL);
+            expand(mPos + 5);
+            mData[mPos++] = i + 1;
+            uint32_t t = ENET_HOST_TO_NET_32(integer);
+            memcpy(mData + mPos, &t, 4);
+            mPos += 4;
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
 void MessageOut::writeString(const std::string &string, int length)
 {
     if (mDebugMode)
@@ -187,3 +267,8 @@ void MessageOut::setDebugModeEnabled(bool enabled)
 {
     debugModeEnabled = enabled;
 }
+
+void MessageOut::setBinaryDoublesByDefault(bool enabled)
+{
+    binaryDoublesByDefault = enabled;
+}
@@ -58,9 +58,19 @@ class MessageOut
         /**
          * Writes a double. HACKY and should *not* be used for client
          * communication!
+         *
+         * Unless binary doubles are enabled, the double is written as text.
          */
         void writeDouble(double value);
 
+        /**
+         * Sets whether doubles are written in a portable binary form, which
+         * is smaller and faster to convert. Only to be enabled when the
+         * receiver announced it understands them.
+         */
+        void setBinaryDoubles(bool enabled)
+        { mBinaryDoubles = enabled; }
+
         /**
          * Writes a string. If a fixed length is not given (-1), it is stored
          * as a short at the start of the string.
@@ -86,6 +96,13 @@ class MessageOut
          */
         static void setDebugModeEnabled(bool enabled);
 
+        /**
+         * Sets whether new messages write doubles in binary by default.
+         *
+         * @see setBinaryDoubles
+         */
+        static void setBinaryDoublesByDefault(bool enabled);
+
     private:
         /**
          * Ensures the capacity of the data buffer is large enough to hold the
@@ -95,10 +112,17 @@ class MessageOut
 
         void writeValueType(ManaServ::ValueType type);
 
+        /**
+         * Writes \a value as an integer with a decimal scale, when this
+         * represents it exactly. Returns whether it was written.
+         */
+        bool writeDecimalDouble(double value);
+
         char *mData;                /**< Data building up. */
         unsigned mPos;              /**< Position in the data. */
         unsigned mDataSize;         /**< Allocated datasize. */
         bool mDebugMode;            /**< Include debugging information. */
+        bool mBinaryDoubles;        /**< Write doubles in binary. */
 
         /**
          * Streams message ID and length to the given output stream.
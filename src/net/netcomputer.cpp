@@ -63,19 +63,32 @@ void NetComputer::send(const MessageOut &msg, bool reliable,
 
     gBandwidth->increaseClientOutput(this, msg.getLength());
 
-    ENetPacket *packet;
-    packet = enet_packet_create(msg.getData(),
-                                msg.getLength(),
-                                reliable ? ENET_PACKET_FLAG_RELIABLE : 0);
-
-    if (packet)
-    {
+    if (ENetPacket *packet = createPacket(msg, reliable))
         enet_peer_send(mPeer, channel, packet);
-    }
-    else
-    {
+}
+
+ENetPacket *NetComputer::createPacket(const MessageOut &msg, bool reliable)
+{
+    ENetPacket *packet = enet_packet_create(msg.getData(),
+                                            msg.getLength(),
+                                            reliable ?
+                                                ENET_PACKET_FLAG_RELIABLE : 0);
+    if (!packet)
         LOG_ERROR("Failure to create packet!");
-    }
+
+    return packet;
+}
+
+void NetComputer::broadcastDone(const MessageOut &msg, ENetPacket *packet,
+                                unsigned recipients)
+{
+    LOG_DEBUG("Broadcasting message " << msg << " to " << recipients
+              << " computers");
+
+    gBandwidth->increaseBroadcastOutput(msg.getLength(), recipients);
+
+    if (packet->referenceCount == 0)
+        enet_packet_destroy(packet);
 }
 
 std::ostream &operator <<(std::ostream &os, const NetComputer &comp)
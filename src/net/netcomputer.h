@@ -70,12 +70,34 @@ class NetComputer
         void send(const MessageOut &msg, bool reliable = true,
                   unsigned channel = 0);
 
+        /**
+         * Queues a message for sending to all the computers in the range
+         * [begin, end), for example the users of a chat channel.
+         *
+         * Unlike calling send() for each of them, the message is copied into
+         * a single packet that is shared by all the recipients and released
+         * by ENet once the last of them has sent it.
+         */
+        template <class Iterator>
+        static void broadcast(Iterator begin, Iterator end,
+                              const MessageOut &msg, bool reliable = true,
+                              unsigned channel = 0);
+
         /**
          * Returns IP address of computer in 32bit int form
          */
         int getIP() const;
 
     private:
+        static ENetPacket *createPacket(const MessageOut &msg, bool reliable);
+
+        /**
+         * Accounts for a packet sent by broadcast() and frees it when it was
+         * not queued to any peer.
+         */
+        static void broadcastDone(const MessageOut &msg, ENetPacket *packet,
+                                  unsigned recipients);
+
         ENetPeer *mPeer;              /**< Client peer */
 
         /**
@@ -87,4 +109,27 @@ class NetComputer
                                          const NetComputer &comp);
 };
 
+template <class Iterator>
+void NetComputer::broadcast(Iterator begin, Iterator end,
+                            const MessageOut &msg, bool reliable,
+                            unsigned channel)
+{
+    if (begin == end)
+        return;
+
+    ENetPacket *packet = createPacket(msg, reliable);
+    if (!packet)
+        return;
+
+    unsigned recipients = 0;
+    for (; begin != end; ++begin)
+    {
+        // Each successful send takes a reference on the packet
+        if (enet_peer_send((*begin)->mPeer, channel, packet) == 0)
+            ++recipients;
+    }
+
+    broadcastDone(msg, packet, recipients);
+}
+
 #endif // NETCOMPUTER_H
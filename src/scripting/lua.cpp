@@ -46,12 +46,15 @@
 #include "game-server/statusmanager.h"
 #include "game-server/triggerareacomponent.h"
 #include "net/messageout.h"
+#include "scripting/luabytecodecache.h"
 #include "scripting/luautil.h"
 #include "scripting/luascript.h"
 #include "scripting/scriptmanager.h"
 #include "utils/logger.h"
 #include "utils/speedconv.h"
 
+#include <algorithm>
+#include <climits>
 #include <string.h>
 #include <math.h>
 
@@ -514,6 +517,32 @@ static int say(lua_State *s)
     return lua_yield(s, 0);
 }
 
+/** LUA delay (input)
+ * delay(number seconds)
+ **
+ * **Warning:** May only be called from a script thread, like an NPC talk
+ * function.
+ *
+ * Suspends the current thread for the given amount of `seconds`. The thread
+ * is resumed automatically afterwards. Can be used to add pauses to scripted
+ * sequences without the player needing to click. Delays longer than a day
+ * are shortened to a day.
+ */
+static int delay(lua_State *s)
+{
+    const double seconds = luaL_checknumber(s, 1);
+    luaL_argcheck(s, seconds >= 0, 1, "negative or invalid delay");
+
+    Script *script = getScript(s);
+    Script::Thread *thread = checkCurrentThread(s, script);
+
+    // Clamped before converting, since large values do not fit an int
+    const double ticks = std::min<double>(seconds * 1000 / WORLD_TICK_MS,
+                                          Script::MAX_SLEEP_TICKS);
+    script->sleep(thread, (int) ticks);
+    return lua_yield(s, 0);
+}
+
 /** LUA ask (input)
  * ask(item1, item2, ... itemN)
  **
@@ -1211,10 +1240,31 @@ static int entity_unequip_item(lua_State *s)
 /** LUA_CATEGORY Character and being interaction (being)
  */
 
+/** LUA get_quest_var_id (being)
+ * get_quest_var_id(string name)
+ **
+ * **Return value:** The id of the quest variable named `name`. The quest
+ * variable functions accept this id instead of the name, which saves looking
+ * up the name every time. The id is an opaque value, so it is never mistaken
+ * for a name, not even a numeric one. The ids are only valid until the server
+ * stops, so look them up when the script is loaded:
+ *
+ * {% highlight lua %}
+ * local KILLS = get_quest_var_id("kills")
+ * {% endhighlight %}
+ */
+static int get_quest_var_id(lua_State *s)
+{
+    pushQuestVarId(s, checkQuestVarId(s, 1));
+    return 1;
+}
+
 /** LUA chr_get_quest (being)
  * chr_get_quest(handle character, string name)
+ * chr_get_quest(handle character, QuestVarId id)
  **
- * **Return value:** The quest variable named `name` for the given character.
+ * **Return value:** The quest variable named `name` for the given character,
+ * as a string.
  *
  * **Warning:** May only be called from an NPC talk function.
  *
@@ -1222,21 +1272,18 @@ static int entity_unequip_item(lua_State *s)
 static int chr_get_quest(lua_State *s)
 {
     Entity *q = checkCharacter(s, 1);
-    const char *name = luaL_checkstring(s, 2);
-    luaL_argcheck(s, name[0] != 0, 2, "empty variable name");
+    const int id = checkQuestVarId(s, 2);
 
     Script::Thread *thread = checkCurrentThread(s);
 
-    std::string value;
-    bool res = getQuestVar(q, name, value);
-    if (res)
+    if (const QuestVar *value = getQuestVar(q, id))
     {
-        push(s, value);
+        push(s, *value);
         return 1;
     }
     QuestCallback *f = new QuestThreadCallback(&LuaScript::getQuestCallback,
                                                getScript(s));
-    recoverQuestVar(q, name, f);
+    recoverQuestVar(q, id, f);
 
     thread->mState = Script::ThreadExpectingString;
     return lua_yield(s, 0);
@@ -1244,18 +1291,29 @@ static int chr_get_quest(lua_State *s)
 
 /** LUA chr_set_quest (being)
  * chr_set_quest(handle character, string name, string value)
+ * chr_set_quest(handle character, QuestVarId id, string value)
+ * chr_set_quest(handle character, string name, int value)
+ * chr_set_quest(handle character, QuestVarId id, int value)
  **
  * Sets the quest variable named `name` for the given  character to the value
- * `value`.
+ * `value`. The change is stored with the next save of the character changes.
  */
 static int chr_set_quest(lua_State *s)
 {
     Entity *q = checkCharacter(s, 1);
-    const char *name = luaL_checkstring(s, 2);
-    const char *value = luaL_checkstring(s, 3);
-    luaL_argcheck(s, name[0] != 0, 2, "empty variable name");
+    const int id = checkQuestVarId(s, 2);
+
+    if (lua_type(s, 3) == LUA_TNUMBER)
+    {
+        const lua_Number number = lua_tonumber(s, 3);
+        if (number >= INT_MIN && number <= INT_MAX && (int) number == number)
+        {
+            setQuestVar(q, id, QuestVar((int) number));
+            return 0;
+        }
+    }
 
-    setQuestVar(q, name, value);
+    setQuestVar(q, id, QuestVar(std::string(luaL_checkstring(s, 3))));
     return 0;
 }
 
@@ -2087,6 +2145,7 @@ static int entity_get_mapid(lua_State *s)
 
 /** LUA chr_request_quest (being)
  * chr_request_quest(handle character, string questvariable, Ref function)
+ * chr_request_quest(handle character, QuestVarId id, Ref function)
  **
  * Requests the questvar from the account server. This will make it available in
  * the quest cache after some time. The passed function will be called back as
@@ -2095,13 +2154,10 @@ static int entity_get_mapid(lua_State *s)
 static int chr_request_quest(lua_State *s)
 {
     Entity *ch = checkCharacter(s, 1);
-    const char *name = luaL_checkstring(s, 2);
-    luaL_argcheck(s, name[0] != 0, 2, "empty variable name");
+    const int id = checkQuestVarId(s, 2);
     luaL_checktype(s, 3, LUA_TFUNCTION);
 
-    std::string value;
-    bool res = getQuestVar(ch, name, value);
-    if (res)
+    if (const QuestVar *value = getQuestVar(ch, id))
     {
         // Already cached, call passed callback immediately
         Script *script = getScript(s);
@@ -2110,21 +2166,22 @@ static int chr_request_quest(lua_State *s)
 
         script->prepare(callback);
         script->push(ch);
-        script->push(name);
-        script->push(value);
+        script->push(getQuestVarName(id));
+        pushQuestVar(script, *value);
         script->execute(ch->getMap());
 
         return 0;
     }
 
-    QuestCallback *f = new QuestRefCallback(getScript(s), name);
-    recoverQuestVar(ch, name, f);
+    QuestCallback *f = new QuestRefCallback(getScript(s), getQuestVarName(id));
+    recoverQuestVar(ch, id, f);
 
     return 0;
 }
 
 /** LUA chr_try_get_quest (being)
  * chr_try_get_quest(handle character, string questvariable)
+ * chr_try_get_quest(handle character, QuestVarId id)
  **
  * Callback for checking if a quest variable is available in cache.
  *
@@ -2134,13 +2191,10 @@ static int chr_request_quest(lua_State *s)
 static int chr_try_get_quest(lua_State *s)
 {
     Entity *q = checkCharacter(s, 1);
-    const char *name = luaL_checkstring(s, 2);
-    luaL_argcheck(s, name[0] != 0, 2, "empty variable name");
+    const int id = checkQuestVarId(s, 2);
 
-    std::string value;
-    bool res = getQuestVar(q, name, value);
-    if (res)
-        push(s, value);
+    if (const QuestVar *value = getQuestVar(q, id))
+        push(s, *value);
     else
         lua_pushnil(s);
     return 1;
@@ -3357,9 +3411,11 @@ static int require_loader(lua_State *s)
     std::string filename = file;
     filename.append(".lua");
 
-    const std::string path = ResourceManager::resolve(filename);
-    if (!path.empty())
-        luaL_loadfile(s, path.c_str());
+    if (ResourceManager::exists(filename))
+    {
+        LuaScript *script = static_cast<LuaScript *>(getScript(s));
+        script->loadChunkFile(s, filename);
+    }
     else
         lua_pushliteral(s, "File not found");
 
@@ -3374,6 +3430,8 @@ LuaScript::LuaScript():
     mCurrentState = mRootState;
     luaL_openlibs(mRootState);
 
+    LuaBytecodeCache::initialize();
+
     // Register package loader that goes through the resource manager
     // package.loaders[2] = require_loader
     lua_getglobal(mRootState, "package");
@@ -3408,6 +3466,7 @@ LuaScript::LuaScript():
         { "get_status_effect",              get_status_effect                 },
         { "npc_create",                     npc_create                        },
         { "say",                            say                               },
+        { "delay",                          delay                             },
         { "ask",                            ask                               },
         { "ask_number",                     ask_number                        },
         { "ask_string",                     ask_string                        },
@@ -3415,6 +3474,7 @@ LuaScript::LuaScript():
         { "npc_post",                       npc_post                          },
         { "npc_enable",                     npc_enable                        },
         { "npc_disable",                    npc_disable                       },
+        { "get_quest_var_id",               get_quest_var_id                  },
         { "chr_get_quest",                  chr_get_quest                     },
         { "chr_set_quest",                  chr_set_quest                     },
         { "chr_request_quest",              chr_request_quest                 },
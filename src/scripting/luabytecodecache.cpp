@@ -0,0 +1,269 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "scripting/luabytecodecache.h"
+
+#include "common/configuration.h"
+#include "common/resourcemanager.h"
+#include "utils/logger.h"
+
+extern "C" {
+#include <lauxlib.h>
+}
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define mkdir(path, mode) _mkdir(path)
+#endif
+
+#include <stdint.h>
+
+static const char cacheMagic[4] = { 'M', 'S', 'B', 'C' };
+
+static std::string cacheDirectory;
+
+/**
+ * 64-bit FNV-1a hash. Only used to name and validate cache entries, so it
+ * does not need to be cryptographically strong.
+ */
+static uint64_t hashChunk(const char *name, const char *prog, size_t length)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *c = name; *c; ++c)
+    {
+        hash ^= (unsigned char) *c;
+        hash *= 1099511628211ULL;
+    }
+    hash *= 1099511628211ULL; // Separates the name from the source
+    for (size_t i = 0; i < length; ++i)
+    {
+        hash ^= (unsigned char) prog[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static std::string cacheFileName(uint64_t hash)
+{
+    char buffer[17];
+    snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long) hash);
+    return cacheDirectory + "/" + buffer + ".luac";
+}
+
+template<typename T>
+static void appendValue(std::string &out, T value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template<typename T>
+static bool readValue(const std::string &in, size_t &pos, T &value)
+{
+    if (in.size() - pos < sizeof(T))
+        return false;
+    memcpy(&value, in.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+}
+
+static int bytecodeWriter(lua_State *, const void *p, size_t size, void *ud)
+{
+    static_cast<std::string *>(ud)->append(static_cast<const char *>(p),
+                                           size);
+    return 0;
+}
+
+/**
+ * Tries to load the cached version of the given chunk. Returns whether a
+ * valid cache entry was found and pushed onto the stack.
+ */
+static bool loadCached(lua_State *s, uint64_t hash, const char *name,
+                       size_t length)
+{
+    std::ifstream file(cacheFileName(hash).c_str(), std::ios::binary);
+    if (!file)
+        return false;
+
+    const std::string data((std::istreambuf_iterator<char>(file)),
+                           std::istreambuf_iterator<char>());
+
+    size_t pos = 0;
+    char magic[4];
+    uint32_t version, sourceLength, nameLength;
+    uint64_t storedHash;
+
+    if (data.size() < sizeof(magic))
+        return false;
+    memcpy(magic, data.data(), sizeof(magic));
+    pos += sizeof(magic);
+
+    if (memcmp(magic, cacheMagic, sizeof(magic)) != 0 ||
+        !readValue(data, pos, version) ||
+        !readValue(data, pos, storedHash) ||
+        !readValue(data, pos, sourceLength) ||
+        !readValue(data, pos, nameLength))
+        return false;
+
+    if (version != LUA_VERSION_NUM || storedHash != hash ||
+        sourceLength != length || data.size() - pos < nameLength ||
+        data.compare(pos, nameLength, name) != 0)
+        return false;
+    pos += nameLength;
+
+    if (luaL_loadbuffer(s, data.data() + pos, data.size() - pos, name))
+    {
+        LOG_WARN("Discarding invalid bytecode cache entry for " << name
+                 << ": " << lua_tostring(s, -1));
+        lua_pop(s, 1);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Dumps the function on top of the stack into a new cache entry.
+ */
+static void store(lua_State *s, uint64_t hash, const char *name,
+                  size_t length)
+{
+    std::string data(cacheMagic, sizeof(cacheMagic));
+    appendValue<uint32_t>(data, LUA_VERSION_NUM);
+    appendValue<uint64_t>(data, hash);
+    appendValue<uint32_t>(data, length);
+    appendValue<uint32_t>(data, strlen(name));
+    data.append(name);
+
+#if LUA_VERSION_NUM < 503
+    int res = lua_dump(s, bytecodeWriter, &data);
+#else
+    int res = lua_dump(s, bytecodeWriter, &data, 0);
+#endif
+    if (res)
+        return;
+
+    // Write to a temporary file first so that a partially written entry is
+    // never picked up by another server process.
+    const std::string fileName = cacheFileName(hash);
+    const std::string tmpFileName = fileName + ".tmp";
+    {
+        std::ofstream file(tmpFileName.c_str(),
+                           std::ios::binary | std::ios::trunc);
+        file.write(data.data(), data.size());
+        if (!file)
+        {
+            LOG_WARN("Could not write bytecode cache entry " << tmpFileName);
+            return;
+        }
+    }
+    std::remove(fileName.c_str());
+    if (std::rename(tmpFileName.c_str(), fileName.c_str()) != 0)
+        std::remove(tmpFileName.c_str());
+}
+
+void LuaBytecodeCache::initialize()
+{
+    cacheDirectory = Configuration::getValue("script_bytecodeCache",
+                                             std::string());
+
+    // Strip trailing slashes, the file names are appended with one
+    while (cacheDirectory.size() > 1 &&
+           (cacheDirectory[cacheDirectory.size() - 1] == '/' ||
+            cacheDirectory[cacheDirectory.size() - 1] == '\\'))
+        cacheDirectory.erase(cacheDirectory.size() - 1);
+
+    if (cacheDirectory.empty())
+        return;
+
+    struct stat info;
+    if (stat(cacheDirectory.c_str(), &info) != 0 &&
+        mkdir(cacheDirectory.c_str(), 0755) != 0)
+    {
+        LOG_WARN("Could not create the bytecode cache directory "
+                 << cacheDirectory << ", script caching is disabled.");
+        cacheDirectory.clear();
+        return;
+    }
+
+    LOG_INFO("Using Lua bytecode cache in " << cacheDirectory);
+}
+
+bool LuaBytecodeCache::isEnabled()
+{
+    return !cacheDirectory.empty();
+}
+
+int LuaBytecodeCache::load(lua_State *s, const char *prog, size_t length,
+                           const char *name, bool *cacheHit)
+{
+    if (cacheHit)
+        *cacheHit = false;
+
+    if (!isEnabled())
+        return luaL_loadbuffer(s, prog, length, name);
+
+    const uint64_t hash = hashChunk(name, prog, length);
+    if (loadCached(s, hash, name, length))
+    {
+        if (cacheHit)
+            *cacheHit = true;
+        return 0;
+    }
+
+    int res = luaL_loadbuffer(s, prog, length, name);
+    if (res == 0)
+        store(s, hash, name, length);
+    return res;
+}
+
+int LuaBytecodeCache::loadFile(lua_State *s, const std::string &fileName,
+                               bool *cacheHit)
+{
+    int size;
+    char *buffer = ResourceManager::loadFile(fileName, size);
+    if (!buffer)
+    {
+        if (cacheHit)
+            *cacheHit = false;
+        lua_pushfstring(s, "cannot read %s", fileName.c_str());
+        return LUA_ERRFILE;
+    }
+
+    // Skip the UTF-8 byte order mark, like luaL_loadfile does
+    const char *prog = buffer;
+    if (size >= 3 && strncmp(prog, "\xef\xbb\xbf", 3) == 0)
+    {
+        prog += 3;
+        size -= 3;
+    }
+
+    const std::string chunkName = "@" + fileName;
+    int res = load(s, prog, size, chunkName.c_str(), cacheHit);
+    free(buffer);
+    return res;
+}
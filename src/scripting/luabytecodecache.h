@@ -0,0 +1,75 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCRIPTING_LUABYTECODECACHE_H
+#define SCRIPTING_LUABYTECODECACHE_H
+
+extern "C" {
+#include <lua.h>
+}
+
+#include <cstddef>
+#include <string>
+
+/**
+ * Caches precompiled Lua chunks on disk so that scripts do not need to be
+ * parsed again at every server start.
+ *
+ * Cache entries are keyed by a hash of the chunk name and its source text,
+ * so a modified script simply misses the cache and gets compiled again.
+ * Entries are written to the directory set by the "script_bytecodeCache"
+ * option. When this option is empty, the cache is disabled and chunks are
+ * always compiled from source.
+ */
+namespace LuaBytecodeCache
+{
+    /**
+     * Reads the cache directory from the configuration and creates it when
+     * needed.
+     */
+    void initialize();
+
+    /**
+     * Returns whether compiled chunks are looked up and stored on disk.
+     */
+    bool isEnabled();
+
+    /**
+     * Loads a chunk of Lua source as a function onto the stack of \a s,
+     * using the precompiled version when a valid one exists and storing it
+     * otherwise.
+     *
+     * Behaves like luaL_loadbuffer: on failure an error message is pushed
+     * instead and the Lua error code is returned.
+     *
+     * @param cacheHit set to whether the chunk came from the cache
+     */
+    int load(lua_State *s, const char *prog, size_t length, const char *name,
+             bool *cacheHit = nullptr);
+
+    /**
+     * Loads a script file through the ResourceManager as a Lua chunk onto
+     * the stack of \a s. The chunk is named after the file.
+     */
+    int loadFile(lua_State *s, const std::string &fileName,
+                 bool *cacheHit = nullptr);
+}
+
+#endif // SCRIPTING_LUABYTECODECACHE_H
@@ -21,15 +21,22 @@
 
 #include "luascript.h"
 
+#include "scripting/luabytecodecache.h"
 #include "scripting/luautil.h"
 #include "scripting/scriptmanager.h"
 
 #include "game-server/charactercomponent.h"
 #include "utils/logger.h"
+#include "utils/timer.h"
 
 #include <cassert>
 #include <cstring>
 
+/**
+ * Maximum amount of finished coroutines kept around for reuse.
+ */
+static const size_t MAX_IDLE_THREAD_STATES = 128;
+
 Script::Ref LuaScript::mDeathNotificationCallback;
 Script::Ref LuaScript::mRemoveNotificationCallback;
 
@@ -226,7 +233,13 @@ void LuaScript::load(const char *prog, const char *name,
 {
     const Context *previousContext = mContext;
     mContext = &context;
-    int res = luaL_loadbuffer(mRootState, prog, std::strlen(prog), name);
+
+    const uint64_t start = utils::getTimeInMicroseconds();
+    bool cacheHit;
+    int res = LuaBytecodeCache::load(mRootState, prog, std::strlen(prog), name,
+                                     &cacheHit);
+    recordLoad(start, cacheHit);
+
     if (res)
     {
         switch (res) {
@@ -250,6 +263,23 @@ void LuaScript::load(const char *prog, const char *name,
     mContext = previousContext;
 }
 
+int LuaScript::loadChunkFile(lua_State *s, const std::string &fileName)
+{
+    const uint64_t start = utils::getTimeInMicroseconds();
+    bool cacheHit;
+    int res = LuaBytecodeCache::loadFile(s, fileName, &cacheHit);
+    recordLoad(start, cacheHit);
+    return res;
+}
+
+void LuaScript::recordLoad(uint64_t start, bool cacheHit)
+{
+    ++mLoadStatistics.chunks;
+    if (cacheHit)
+        ++mLoadStatistics.cached;
+    mLoadStatistics.microseconds += utils::getTimeInMicroseconds() - start;
+}
+
 void LuaScript::processDeathEvent(Entity *entity)
 {
     if (mDeathNotificationCallback.isValid())
@@ -278,7 +308,7 @@ void LuaScript::processRemoveEvent(Entity *entity)
  * Called when the server has recovered the value of a quest variable.
  */
 void LuaScript::getQuestCallback(Entity *q,
-                                 const std::string &value,
+                                 const QuestVar &value,
                                  Script *script)
 {
     auto *characterComponent = q->getComponent<CharacterComponent>();
@@ -287,7 +317,7 @@ void LuaScript::getQuestCallback(Entity *q,
         return;
 
     script->prepareResume(thread);
-    script->push(value);
+    pushQuestVar(script, value);
     characterComponent->resumeNpcThread();
 }
 
@@ -311,15 +341,57 @@ void LuaScript::getPostCallback(Entity *q,
 }
 
 
+/**
+ * Keeps the coroutine of a finished thread around for reuse when possible,
+ * saving the creation of a new one and its registry reference.
+ */
+void LuaScript::releaseThreadState(lua_State *state, int ref)
+{
+#if LUA_VERSION_NUM >= 504
+    // Any coroutine can be reset, including ones that errored or were
+    // abandoned while suspended.
+# if LUA_VERSION_RELEASE_NUM >= 50406
+    lua_closethread(state, mRootState);
+# else
+    lua_resetthread(state);
+# endif
+    const bool reusable = true;
+#else
+    // Only coroutines that returned normally can be started again
+    const bool reusable = lua_status(state) == 0 && lua_gettop(state) == 0;
+#endif
+
+    if (reusable && mIdleThreadStates.size() < MAX_IDLE_THREAD_STATES)
+    {
+        lua_settop(state, 0);
+        IdleThreadState idle = { state, ref };
+        mIdleThreadStates.push_back(idle);
+    }
+    else
+    {
+        luaL_unref(mRootState, LUA_REGISTRYINDEX, ref);
+    }
+}
+
 LuaScript::LuaThread::LuaThread(LuaScript *script) :
     Thread(script)
 {
-    mState = lua_newthread(script->mRootState);
-    mRef = luaL_ref(script->mRootState, LUA_REGISTRYINDEX);
+    if (!script->mIdleThreadStates.empty())
+    {
+        const IdleThreadState &idle = script->mIdleThreadStates.back();
+        mState = idle.state;
+        mRef = idle.ref;
+        script->mIdleThreadStates.pop_back();
+    }
+    else
+    {
+        mState = lua_newthread(script->mRootState);
+        mRef = luaL_ref(script->mRootState, LUA_REGISTRYINDEX);
+    }
 }
 
 LuaScript::LuaThread::~LuaThread()
 {
     LuaScript *luaScript = static_cast<LuaScript*>(mScript);
-    luaL_unref(luaScript->mRootState, LUA_REGISTRYINDEX, mRef);
+    luaScript->releaseThreadState(mState, mRef);
 }
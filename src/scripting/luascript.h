@@ -29,6 +29,7 @@ extern "C" {
 #include "scripting/script.h"
 
 class CharacterComponent;
+struct QuestVar;
 
 /**
  * Implementation of the Script class for Lua.
@@ -47,6 +48,12 @@ class LuaScript : public Script
         void load(const char *prog, const char *name,
                   const Context &context = Context());
 
+        /**
+         * Loads a script file as a function onto the stack of \a s, without
+         * executing it. Used by the package loader for require().
+         */
+        int loadChunkFile(lua_State *s, const std::string &fileName);
+
         Thread *newThread();
 
         void prepare(Ref function);
@@ -68,7 +75,7 @@ class LuaScript : public Script
         void unref(Ref &ref);
 
         static void getQuestCallback(Entity *,
-                                     const std::string &value,
+                                     const QuestVar &value,
                                      Script *);
 
         static void getPostCallback(Entity *,
@@ -100,9 +107,24 @@ class LuaScript : public Script
                 int mRef;
         };
 
+        void recordLoad(uint64_t start, bool cacheHit);
+
+        void releaseThreadState(lua_State *state, int ref);
+
+        /**
+         * A Lua coroutine that finished executing and can be used again for
+         * a new script thread.
+         */
+        struct IdleThreadState
+        {
+            lua_State *state;
+            int ref;
+        };
+
         lua_State *mRootState;
         lua_State *mCurrentState;
         int nbArgs;
+        std::vector<IdleThreadState> mIdleThreadStates;
 
         static Ref mDeathNotificationCallback;
         static Ref mRemoveNotificationCallback;
@@ -21,6 +21,7 @@
 
 #include "luautil.h"
 
+#include <stdint.h>
 #include <string.h>
 
 #include "game-server/charactercomponent.h"
@@ -318,6 +319,31 @@ AttributeInfo *checkAttribute(lua_State *s, int p)
     return attributeInfo;
 }
 
+/*
+ * Quest variable ids are passed to scripts as light userdata holding the id
+ * plus one, so that they are never confused with names and never null.
+ */
+
+void pushQuestVarId(lua_State *s, int id)
+{
+    lua_pushlightuserdata(s, (void *) (intptr_t) (id + 1));
+}
+
+int checkQuestVarId(lua_State *s, int p)
+{
+    if (lua_type(s, p) == LUA_TLIGHTUSERDATA)
+    {
+        const int id = (int) (intptr_t) lua_touserdata(s, p) - 1;
+        luaL_argcheck(s, isQuestVarId(id), p, "invalid quest variable id");
+        return id;
+    }
+
+    // Numbers are names too
+    const char *name = luaL_checkstring(s, p);
+    luaL_argcheck(s, name[0] != 0, p, "empty variable name");
+    return getQuestVarId(name);
+}
+
 unsigned char checkWalkMask(lua_State *s, int p)
 {
     const char *stringMask = luaL_checkstring(s, p);
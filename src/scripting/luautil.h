@@ -39,6 +39,7 @@ extern "C" {
 
 #include "game-server/abilitymanager.h"
 #include "game-server/attributemanager.h"
+#include "game-server/quest.h"
 
 class CharacterComponent;
 class Entity;
@@ -211,6 +212,8 @@ MonsterClass *                         checkMonsterClass(lua_State *s, int p);
 Entity *                               checkNpc(lua_State *s, int p);
 AbilityManager::AbilityInfo *          checkAbility(lua_State *s, int p);
 AttributeInfo *      checkAttribute(lua_State *s, int p);
+int                                    checkQuestVarId(lua_State *s, int p);
+void                                   pushQuestVarId(lua_State *s, int id);
 unsigned char                          checkWalkMask(lua_State *s, int p);
 
 MapComposite *  checkCurrentMap(lua_State *s, Script *script = 0);
@@ -255,6 +258,11 @@ inline void push(lua_State *s, AttributeInfo *val)
     LuaAttributeInfo::push(s, val);
 }
 
+inline void push(lua_State *s, const QuestVar &val)
+{
+    push(s, val.toString());
+}
+
 
 /*  Pushes an STL LIST */
 template <typename T>
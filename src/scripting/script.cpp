@@ -23,8 +23,11 @@
 #include "common/configuration.h"
 #include "common/resourcemanager.h"
 #include "game-server/being.h"
+#include "game-server/charactercomponent.h"
+#include "game-server/state.h"
 #include "utils/logger.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 #include <map>
@@ -35,12 +38,23 @@ typedef std::map< std::string, Script::Factory > Engines;
 
 static Engines *engines = nullptr;
 
+/**
+ * Number of wake-up buckets for sleeping threads. Threads sleeping for
+ * longer than this amount of ticks stay in their bucket for several rounds.
+ */
+static const int SLEEP_BUCKETS = 256;
+
+/** Longest a thread can sleep, a day at the default tick length. */
+const int Script::MAX_SLEEP_TICKS = 24 * 60 * 60 * 10;
+
 Script::Ref Script::mCreateNpcDelayedCallback;
 Script::Ref Script::mUpdateCallback;
 
 Script::Script():
     mCurrentThread(0),
-    mContext(0)
+    mContext(0),
+    mSleepingThreads(SLEEP_BUCKETS),
+    mLastWakeTick(-1)
 {}
 
 Script::~Script()
@@ -78,6 +92,8 @@ Script *Script::create(const std::string &engine)
 
 void Script::update()
 {
+    wakeThreads(GameState::getCurrentTick());
+
     if (!mUpdateCallback.isValid())
     {
         LOG_ERROR("Could not find callback for update function!");
@@ -161,14 +177,104 @@ static void fastRemoveOne(std::vector<T> &vector, T value)
     }
 }
 
+void Script::sleep(Thread *thread, int ticks)
+{
+    unschedule(thread);
+
+    ticks = std::min(std::max(ticks, 1), MAX_SLEEP_TICKS);
+    const int tick = GameState::getCurrentTick() + ticks;
+    std::vector<Thread*> &bucket = mSleepingThreads[tick % SLEEP_BUCKETS];
+
+    thread->mState = ThreadSleeping;
+    thread->mWakeTick = tick;
+    thread->mSleepIndex = bucket.size();
+    bucket.push_back(thread);
+}
+
+void Script::unschedule(Thread *thread)
+{
+    if (thread->mSleepIndex == -1)
+        return;
+
+    std::vector<Thread*> &bucket =
+            mSleepingThreads[thread->mWakeTick % SLEEP_BUCKETS];
+
+    // Overwrite with the last thread of the bucket, which moves position
+    Thread *last = bucket.back();
+    bucket[thread->mSleepIndex] = last;
+    last->mSleepIndex = thread->mSleepIndex;
+    bucket.pop_back();
+
+    thread->mSleepIndex = -1;
+}
+
+void Script::wakeThreads(int tick)
+{
+    // Catch up with ticks that were skipped, but never more than one round
+    int from = mLastWakeTick + 1;
+    if (mLastWakeTick == -1 || tick - from >= SLEEP_BUCKETS)
+        from = tick - SLEEP_BUCKETS + 1;
+    mLastWakeTick = tick;
+
+    // The waking threads are kept in a member, so that threads that get
+    // deleted while resuming others are removed from it as well.
+    for (int t = std::max(from, 0); t <= tick; ++t)
+    {
+        std::vector<Thread*> &bucket = mSleepingThreads[t % SLEEP_BUCKETS];
+        for (size_t i = 0; i < bucket.size();)
+        {
+            Thread *thread = bucket[i];
+            if (thread->mWakeTick <= tick)
+            {
+                unschedule(thread);
+                mWakingThreads.push_back(thread);
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
+    // Resumed in the order they were collected
+    std::reverse(mWakingThreads.begin(), mWakingThreads.end());
+
+    while (!mWakingThreads.empty())
+    {
+        Thread *thread = mWakingThreads.back();
+        mWakingThreads.pop_back();
+
+        thread->mState = ThreadPending;
+        prepareResume(thread);
+
+        // NPC dialogs need to be resumed through their character, which
+        // takes care of closing the dialog once the thread is done.
+        Entity *character = thread->getContext().character;
+        CharacterComponent *characterComponent =
+                character ? character->getComponent<CharacterComponent>() : 0;
+
+        if (characterComponent && characterComponent->getNpcThread() == thread)
+            characterComponent->resumeNpcThread();
+        else
+            resume();
+    }
+}
+
 Script::Thread::Thread(Script *script) :
     mScript(script),
-    mState(ThreadPending)
+    mState(ThreadPending),
+    mWakeTick(0),
+    mSleepIndex(-1)
 {
     script->mThreads.push_back(this);
 }
 
 Script::Thread::~Thread()
 {
+    mScript->unschedule(this);
     fastRemoveOne(mScript->mThreads, this);
+
+    std::vector<Thread*> &waking = mScript->mWakingThreads;
+    waking.erase(std::remove(waking.begin(), waking.end(), this),
+                 waking.end());
 }
@@ -33,6 +33,8 @@
 
 #include <sigc++/trackable.h>
 
+#include <stdint.h>
+
 class MapComposite;
 class Entity;
 
@@ -89,7 +91,8 @@ class Script : public sigc::trackable
             ThreadPaused,
             ThreadExpectingNumber,
             ThreadExpectingString,
-            ThreadExpectingTwoStrings
+            ThreadExpectingTwoStrings,
+            ThreadSleeping
         };
 
         /**
@@ -108,6 +111,29 @@ class Script : public sigc::trackable
                 Script * const mScript;
                 ThreadState mState;
                 Context mContext;
+
+            private:
+                int mWakeTick;      /**< Tick at which a sleeping thread wakes */
+                int mSleepIndex;    /**< Position in its wake-up bucket */
+
+            friend class Script;
+        };
+
+        /**
+         * Keeps track of how much time was spent loading chunks into the
+         * script context.
+         */
+        struct LoadStatistics
+        {
+            unsigned chunks;            /**< Number of chunks loaded. */
+            unsigned cached;            /**< Chunks loaded precompiled. */
+            uint64_t microseconds;      /**< Total time spent loading. */
+
+            LoadStatistics()
+                : chunks(0)
+                , cached(0)
+                , microseconds(0)
+            {}
         };
 
         Script();
@@ -146,10 +172,20 @@ class Script : public sigc::trackable
 
         /**
          * Called every tick for the script to manage its data.
-         * Calls the "update" function of the script by default.
+         * Wakes up the threads that are done sleeping and calls the "update"
+         * function of the script by default.
          */
         virtual void update();
 
+        /**
+         * Suspends the given thread for the given amount of ticks, at most
+         * MAX_SLEEP_TICKS. The thread is expected to yield afterwards, it will
+         * be resumed by update().
+         */
+        void sleep(Thread *thread, int ticks);
+
+        static const int MAX_SLEEP_TICKS;
+
         /**
          * Creates a new script thread and makes it the current one. Script
          * threads do not execute in parallel, but they can suspend execution
@@ -245,6 +281,12 @@ class Script : public sigc::trackable
         const Context *getContext() const
         { return mContext; }
 
+        /**
+         * Returns statistics about the chunks loaded so far.
+         */
+        const LoadStatistics &getLoadStatistics() const
+        { return mLoadStatistics; }
+
         virtual void processDeathEvent(Entity *entity) = 0;
 
         virtual void processRemoveEvent(Entity *entity) = 0;
@@ -259,10 +301,25 @@ class Script : public sigc::trackable
         std::string mScriptFile;
         Thread *mCurrentThread;
         const Context *mContext;
+        LoadStatistics mLoadStatistics;
 
     private:
+        void unschedule(Thread *thread);
+        void wakeThreads(int tick);
+
         std::vector<Thread*> mThreads;
 
+        /**
+         * Sleeping threads, bucketed by wake-up tick modulo the number of
+         * buckets. This way scheduling and waking up a thread takes constant
+         * time and only the bucket of the current tick needs to be checked.
+         */
+        std::vector< std::vector<Thread*> > mSleepingThreads;
+        int mLastWakeTick;
+
+        /** Threads that woke up and were not resumed yet. */
+        std::vector<Thread*> mWakingThreads;
+
         static Ref mCreateNpcDelayedCallback;
         static Ref mUpdateCallback;
 
@@ -16,7 +16,8 @@ CREATE TABLE IF NOT EXISTS `mana_accounts` (
     --
     PRIMARY KEY  (`id`),
     UNIQUE KEY `username` (`username`),
-    UNIQUE KEY `email` (`email`)
+    UNIQUE KEY `email` (`email`),
+    KEY `ban` (`level`, `banned`)
 ) ENGINE=InnoDB
 DEFAULT CHARSET=utf8
 AUTO_INCREMENT=1 ;
@@ -319,6 +320,7 @@ CREATE TABLE IF NOT EXISTS `mana_post` (
         PRIMARY KEY (`letter_id`),
         INDEX `fk_letter_sender` (`sender_id` ASC) ,
         INDEX `fk_letter_receiver` (`receiver_id` ASC) ,
+        INDEX `letter_expiry` (`expiration_date` ASC) ,
         --
         FOREIGN KEY (`sender_id` )
                 REFERENCES `mana_characters` (`id`)
@@ -421,7 +423,7 @@ DEFAULT CHARSET=utf8 ;
 
 INSERT INTO mana_world_states VALUES('accountserver_startup',-1,'0', NOW());
 INSERT INTO mana_world_states VALUES('accountserver_version',-1,'0', NOW());
-INSERT INTO mana_world_states VALUES('database_version',     -1,'26', NOW());
+INSERT INTO mana_world_states VALUES('database_version',     -1,'29', NOW());
 
 -- all known transaction codes
 
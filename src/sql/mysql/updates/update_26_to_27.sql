@@ -0,0 +1,12 @@
+START TRANSACTION;
+
+-- Lets the server find the expired bans without scanning all accounts
+ALTER TABLE `mana_accounts` ADD INDEX `ban` (`level`, `banned`);
+
+-- Update database version.
+UPDATE mana_world_states
+    SET value = '27',
+        moddate = UNIX_TIMESTAMP()
+    WHERE state_name = 'database_version';
+
+COMMIT;
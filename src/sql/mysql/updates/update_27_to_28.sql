@@ -0,0 +1,12 @@
+START TRANSACTION;
+
+-- Lets the server find the expired letters without scanning all the post
+ALTER TABLE `mana_post` ADD INDEX `letter_expiry` (`expiration_date`);
+
+-- Update database version.
+UPDATE mana_world_states
+    SET value = '28',
+        moddate = UNIX_TIMESTAMP()
+    WHERE state_name = 'database_version';
+
+COMMIT;
@@ -0,0 +1,12 @@
+START TRANSACTION;
+
+-- The quest variables already have a primary key on the character and name,
+-- only the way the game servers send them changed.
+
+-- Update database version.
+UPDATE mana_world_states
+    SET value = '29',
+        moddate = UNIX_TIMESTAMP()
+    WHERE state_name = 'database_version';
+
+COMMIT;
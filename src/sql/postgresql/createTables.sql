@@ -31,6 +31,7 @@ CREATE TABLE mana_accounts
 );
 
 CREATE INDEX mana_accounts_username ON mana_accounts ( username );
+CREATE INDEX mana_accounts_ban ON mana_accounts ( level, banned );
 
 
 CREATE TABLE mana_characters
@@ -40,6 +40,7 @@ CREATE TABLE mana_accounts
 
 CREATE UNIQUE INDEX mana_accounts_username ON mana_accounts ( username );
 CREATE UNIQUE INDEX mana_accounts_email    ON mana_accounts ( email );
+CREATE INDEX mana_accounts_ban             ON mana_accounts ( level, banned );
 
 -----------------------------------------------------------------------------
 
@@ -222,6 +223,8 @@ CREATE TABLE mana_quests
    FOREIGN KEY (owner_id) REFERENCES mana_characters(id)
 );
 
+CREATE UNIQUE INDEX mana_quests_owner_name ON mana_quests ( owner_id, name );
+
 -----------------------------------------------------------------------------
 
 CREATE TABLE mana_world_states
@@ -292,6 +295,7 @@ CREATE TABLE mana_post
 
 CREATE INDEX mana_post_sender   ON mana_post ( sender_id );
 CREATE INDEX mana_post_receiver ON mana_post ( receiver_id );
+CREATE INDEX mana_post_expiry   ON mana_post ( expiration_date );
 
 -----------------------------------------------------------------------------
 
@@ -411,7 +415,7 @@ AS
 
 INSERT INTO mana_world_states VALUES('accountserver_startup',-1,'0', strftime('%s','now'));
 INSERT INTO mana_world_states VALUES('accountserver_version',-1,'0', strftime('%s','now'));
-INSERT INTO mana_world_states VALUES('database_version',     -1,'26', strftime('%s','now'));
+INSERT INTO mana_world_states VALUES('database_version',     -1,'29', strftime('%s','now'));
 
 -- all known transaction codes
 
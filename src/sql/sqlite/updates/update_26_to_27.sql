@@ -0,0 +1,12 @@
+BEGIN;
+
+-- Lets the server find the expired bans without scanning all accounts
+CREATE INDEX mana_accounts_ban ON mana_accounts ( level, banned );
+
+-- Update the database version, and set date of update
+UPDATE mana_world_states
+   SET value      = '27',
+       moddate    = strftime('%s','now')
+   WHERE state_name = 'database_version';
+
+END;
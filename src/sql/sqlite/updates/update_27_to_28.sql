@@ -0,0 +1,12 @@
+BEGIN;
+
+-- Lets the server find the expired letters without scanning all the post
+CREATE INDEX mana_post_expiry ON mana_post ( expiration_date );
+
+-- Update the database version, and set date of update
+UPDATE mana_world_states
+   SET value      = '28',
+       moddate    = strftime('%s','now')
+   WHERE state_name = 'database_version';
+
+END;
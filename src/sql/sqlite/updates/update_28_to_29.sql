@@ -0,0 +1,16 @@
+BEGIN;
+
+-- Quest variables are looked up and replaced by character and name. Only the
+-- most recent row of a variable is kept before the index is created.
+DELETE FROM mana_quests
+   WHERE rowid NOT IN (SELECT MAX(rowid) FROM mana_quests
+                          GROUP BY owner_id, name);
+CREATE UNIQUE INDEX mana_quests_owner_name ON mana_quests ( owner_id, name );
+
+-- Update the database version, and set date of update
+UPDATE mana_world_states
+   SET value      = '29',
+       moddate    = strftime('%s','now')
+   WHERE state_name = 'database_version';
+
+END;
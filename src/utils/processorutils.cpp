@@ -20,11 +20,54 @@
 
 #include "utils/processorutils.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#define HAVE_CPUID
+#endif
+
 bool utils::processor::isLittleEndian;
+bool utils::processor::hasShaExtensions;
+bool utils::processor::hasAvx2;
+
+#ifdef HAVE_CPUID
+/**
+ * Checks the CPU features used by the accelerated hash functions.
+ */
+static void detectFeatures()
+{
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return;
+
+    const bool ssse3 = ecx & (1 << 9);
+    const bool sse41 = ecx & (1 << 19);
+    const bool osxsave = ecx & (1 << 27);
+    const bool avx = ecx & (1 << 28);
+
+    // AVX state has to be saved by the operating system
+    bool avxEnabled = false;
+    if (osxsave && avx)
+    {
+        unsigned xcr0, xcr0High;
+        __asm__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0High) : "c" (0));
+        avxEnabled = (xcr0 & 6) == 6;
+    }
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return;
+
+    utils::processor::hasShaExtensions = (ebx & (1 << 29)) && ssse3 && sse41;
+    utils::processor::hasAvx2 = (ebx & (1 << 5)) && avxEnabled;
+}
+#endif
 
 void utils::processor::init()
 {
     utils::processor::isLittleEndian = utils::processor::littleEndianCheck();
+
+#ifdef HAVE_CPUID
+    detectFeatures();
+#endif
 }
 
 bool utils::processor::littleEndianCheck()
@@ -44,6 +44,16 @@ namespace utils
          */
         bool littleEndianCheck();
 
+        /**
+         * True if the processor supports the SHA extensions (SHA-NI).
+         */
+        extern bool hasShaExtensions;
+
+        /**
+         * True if the processor and the operating system support AVX2.
+         */
+        extern bool hasAvx2;
+
     } // namespace processor
 } // namespace utils
 
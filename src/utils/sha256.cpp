@@ -68,6 +68,7 @@
  */
 
 #include "sha256.h"
+#include "processorutils.h"
 #include <memory.h>
 
 #ifdef HAVE_CONFIG_H
@@ -81,8 +82,18 @@ typedef unsigned char uint8_t;
 typedef unsigned int uint32_t;
 #endif
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SHA256_X86
+#endif
+
 #define SHA256_BLOCK_SIZE  (512 / 8)
 
+/** Processes \a block_nb blocks of 64 bytes, updating the hash \a h. */
+typedef void (*SHA256TransformFunction)(uint32_t *h,
+                                        const unsigned char *message,
+                                        unsigned int block_nb);
+
 /** An sha 256 context, used by original m_opersha256 */
 class SHA256Context
 {
@@ -91,6 +102,7 @@ class SHA256Context
         unsigned int len;
         unsigned char block[2 * SHA256_BLOCK_SIZE];
         uint32_t h[8];
+        SHA256TransformFunction transform;
 };
 
 #define SHA256_DIGEST_SIZE (256 / 8)
@@ -156,21 +168,22 @@ uint32_t sha256_k[64] =
     0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
 };
 
-void SHA256Init(SHA256Context *ctx)
+void SHA256Init(SHA256Context *ctx, SHA256TransformFunction transform)
 {
     for (int i = 0; i < 8; i++)
         ctx->h[i] = sha256_h0[i];
     ctx->len = 0;
     ctx->tot_len = 0;
+    ctx->transform = transform;
 }
 
-void SHA256Transform(SHA256Context *ctx,
-                     unsigned char *message,
-                     unsigned int block_nb)
+static void SHA256TransformScalar(uint32_t *h,
+                                  const unsigned char *message,
+                                  unsigned int block_nb)
 {
     uint32_t w[64];
     uint32_t wv[8];
-    unsigned char *sub_block;
+    const unsigned char *sub_block;
     for (unsigned int i = 1; i <= block_nb; i++)
     {
         int j;
@@ -181,7 +194,7 @@ void SHA256Transform(SHA256Context *ctx,
         for (j = 16; j < 64; j++)
             SHA256_SCR(j);
         for (j = 0; j < 8; j++)
-            wv[j] = ctx->h[j];
+            wv[j] = h[j];
         for (j = 0; j < 64; j++)
         {
             uint32_t t1 = wv[7] + SHA256_F2(wv[4]) + CH(wv[4], wv[5], wv[6]) + sha256_k[j] + w[j];
@@ -196,8 +209,88 @@ void SHA256Transform(SHA256Context *ctx,
             wv[0] = t1 + t2;
         }
         for (j = 0; j < 8; j++)
-            ctx->h[j] += wv[j];
+            h[j] += wv[j];
+    }
+}
+
+#ifdef SHA256_X86
+/**
+ * Processes the blocks with the SHA extensions. The state is kept in the
+ * ABEF/CDGH layout the instructions work with, and each iteration of the
+ * round loop does four rounds while extending the message schedule.
+ */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void SHA256TransformShaNi(uint32_t *h,
+                                 const unsigned char *message,
+                                 unsigned int block_nb)
+{
+    const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                            0x0405060700010203ULL);
+
+    __m128i tmp = _mm_loadu_si128((const __m128i *) &h[0]);
+    __m128i state1 = _mm_loadu_si128((const __m128i *) &h[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);                 // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1B);           // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);   // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);        // CDGH
+
+    for (unsigned int i = 0; i < block_nb; i++, message += SHA256_BLOCK_SIZE)
+    {
+        const __m128i abefSave = state0;
+        const __m128i cdghSave = state1;
+        __m128i msgs[4];
+
+        for (int j = 0; j < 16; j++)
+        {
+            __m128i &current = msgs[j & 3];
+            if (j < 4)
+            {
+                current = _mm_loadu_si128(
+                            (const __m128i *) (message + (j << 4)));
+                current = _mm_shuffle_epi8(current, byteSwap);
+            }
+
+            __m128i msg = _mm_add_epi32(
+                        current,
+                        _mm_loadu_si128((const __m128i *) &sha256_k[j << 2]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+
+            if (j >= 3 && j <= 14)
+            {
+                __m128i &next = msgs[(j + 1) & 3];
+                tmp = _mm_alignr_epi8(current, msgs[(j - 1) & 3], 4);
+                next = _mm_add_epi32(next, tmp);
+                next = _mm_sha256msg2_epu32(next, current);
+            }
+
+            msg = _mm_shuffle_epi32(msg, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+            if (j >= 1 && j <= 12)
+            {
+                __m128i &previous = msgs[(j - 1) & 3];
+                previous = _mm_sha256msg1_epu32(previous, current);
+            }
+        }
+
+        state0 = _mm_add_epi32(state0, abefSave);
+        state1 = _mm_add_epi32(state1, cdghSave);
     }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);              // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);           // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);        // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);           // HGFE
+    _mm_storeu_si128((__m128i *) &h[0], state0);
+    _mm_storeu_si128((__m128i *) &h[4], state1);
+}
+#endif
+
+void SHA256Transform(SHA256Context *ctx,
+                     unsigned char *message,
+                     unsigned int block_nb)
+{
+    ctx->transform(ctx->h, message, block_nb);
 }
 
 void SHA256Update(SHA256Context *ctx,
@@ -253,17 +346,11 @@ void SHA256Final(SHA256Context *ctx, unsigned char *digest)
         UNPACK32(ctx->h[i], &digest[i << 2]);
 }
 
-std::string SHA256Hash(const char *src, int len)
+static std::string toHex(const unsigned char *bytehash)
 {
-    // Generate the hash
-    unsigned char bytehash[SHA256_DIGEST_SIZE];
-    SHA256Context ctx;
-    SHA256Init(&ctx);
-    SHA256Update(&ctx, (unsigned char *)src, (unsigned int)len);
-    SHA256Final(&ctx, bytehash);
-    // Convert it to hex
     const char* hxc = "0123456789abcdef";
     std::string hash;
+    hash.reserve(SHA256_HASH_LENGTH);
     for (int i = 0; i < SHA256_DIGEST_SIZE; i++)
     {
         hash += hxc[bytehash[i] / 16];
@@ -272,7 +359,317 @@ std::string SHA256Hash(const char *src, int len)
     return hash;
 }
 
+static std::string SHA256HashWith(SHA256TransformFunction transform,
+                                  const char *src, int len)
+{
+    // Generate the hash
+    unsigned char bytehash[SHA256_DIGEST_SIZE];
+    SHA256Context ctx;
+    SHA256Init(&ctx, transform);
+    SHA256Update(&ctx, (unsigned char *)src, (unsigned int)len);
+    SHA256Final(&ctx, bytehash);
+    // Convert it to hex
+    return toHex(bytehash);
+}
+
+/*
+ * Known answers from FIPS 180-2. The accelerated implementations are only
+ * used once they produce these, and agree with the scalar one on messages
+ * of all lengths up to a few blocks.
+ */
+struct SHA256TestVector
+{
+    const char *message;
+    const char *hash;
+};
+
+static const SHA256TestVector sha256_test_vectors[] =
+{
+    { "",
+      "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+    { "abc",
+      "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+    { "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+      "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+      "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1" }
+};
+
+static const int SHA256_TEST_LENGTH = 4 * SHA256_BLOCK_SIZE;
+
+static std::string testMessage(int length)
+{
+    std::string message(length, '\0');
+    for (int i = 0; i < length; i++)
+        message[i] = (char) (i * 7 + length);
+    return message;
+}
+
+static bool SHA256SelfTest(SHA256TransformFunction transform)
+{
+    for (const SHA256TestVector &vector : sha256_test_vectors)
+    {
+        if (SHA256HashWith(transform, vector.message,
+                           strlen(vector.message)) != vector.hash)
+            return false;
+    }
+    for (int length = 0; length <= SHA256_TEST_LENGTH; length++)
+    {
+        const std::string message = testMessage(length);
+        if (SHA256HashWith(transform, message.data(), length) !=
+            SHA256HashWith(SHA256TransformScalar, message.data(), length))
+            return false;
+    }
+    return true;
+}
+
+#ifdef SHA256_X86
+static bool useShaNi()
+{
+    if (!utils::processor::hasShaExtensions)
+        return false;
+    static const bool works = SHA256SelfTest(SHA256TransformShaNi);
+    return works;
+}
+#endif
+
+static SHA256TransformFunction SHA256SelectTransform()
+{
+#ifdef SHA256_X86
+    if (useShaNi())
+        return SHA256TransformShaNi;
+#endif
+    return SHA256TransformScalar;
+}
+
+std::string SHA256Hash(const char *src, int len)
+{
+    return SHA256HashWith(SHA256SelectTransform(), src, len);
+}
+
 std::string sha256(const std::string &string)
 {
     return SHA256Hash(string.c_str(), string.length());
 }
+
+#ifdef SHA256_X86
+/*
+ * Multi-buffer hashing with AVX2: eight independent messages are hashed at
+ * once, each one in a 32-bit lane of the vectors. Lanes whose message has
+ * no more blocks keep their state.
+ */
+
+static const int SHA256_LANES = 8;
+
+#define AVX2_ROTR(x, n) \
+    _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n))
+#define AVX2_SHFR(x, n) _mm256_srli_epi32(x, n)
+#define AVX2_XOR3(a, b, c) _mm256_xor_si256(_mm256_xor_si256(a, b), c)
+
+#define AVX2_F1(x) AVX2_XOR3(AVX2_ROTR(x,  2), AVX2_ROTR(x, 13), AVX2_ROTR(x, 22))
+#define AVX2_F2(x) AVX2_XOR3(AVX2_ROTR(x,  6), AVX2_ROTR(x, 11), AVX2_ROTR(x, 25))
+#define AVX2_F3(x) AVX2_XOR3(AVX2_ROTR(x,  7), AVX2_ROTR(x, 18), AVX2_SHFR(x,  3))
+#define AVX2_F4(x) AVX2_XOR3(AVX2_ROTR(x, 17), AVX2_ROTR(x, 19), AVX2_SHFR(x, 10))
+#define AVX2_CH(x, y, z) \
+    _mm256_xor_si256(_mm256_and_si256(x, y), _mm256_andnot_si256(x, z))
+#define AVX2_MAJ(x, y, z) AVX2_XOR3(_mm256_and_si256(x, y), \
+                                    _mm256_and_si256(x, z), \
+                                    _mm256_and_si256(y, z))
+
+/** Appends the SHA-256 padding to \a message. */
+static std::string SHA256Pad(const std::string &message)
+{
+    const uint64_t bits = (uint64_t) message.length() << 3;
+    std::string padded(message);
+    padded += (char) 0x80;
+    padded.append((SHA256_BLOCK_SIZE * 2 - 8 - padded.length()
+                   % SHA256_BLOCK_SIZE) % SHA256_BLOCK_SIZE, '\0');
+    for (int i = 7; i >= 0; i--)
+        padded += (char) (bits >> (i * 8));
+    return padded;
+}
+
+/**
+ * Hashes up to eight padded messages. Unused lanes have no blocks.
+ */
+__attribute__((target("avx2")))
+static void SHA256HashLanesAvx2(const std::string *padded[SHA256_LANES],
+                                unsigned char digests[][SHA256_DIGEST_SIZE])
+{
+    int blocks[SHA256_LANES];
+    int maxBlocks = 0;
+    for (int lane = 0; lane < SHA256_LANES; lane++)
+    {
+        blocks[lane] = padded[lane] ? padded[lane]->length() >> 6 : 0;
+        if (blocks[lane] > maxBlocks)
+            maxBlocks = blocks[lane];
+    }
+
+    const __m256i blockCounts =
+            _mm256_loadu_si256((const __m256i *) blocks);
+
+    __m256i state[8];
+    for (int i = 0; i < 8; i++)
+        state[i] = _mm256_set1_epi32(sha256_h0[i]);
+
+    uint32_t words[16][SHA256_LANES];
+    __m256i w[64];
+    __m256i wv[8];
+
+    for (int block = 0; block < maxBlocks; block++)
+    {
+        // Transpose the next block of each message into the lanes
+        for (int lane = 0; lane < SHA256_LANES; lane++)
+        {
+            if (block < blocks[lane])
+            {
+                const unsigned char *sub_block =
+                        (const unsigned char *) padded[lane]->data() +
+                        (block << 6);
+                for (int j = 0; j < 16; j++)
+                    PACK32(&sub_block[j << 2], &words[j][lane]);
+            }
+            else
+            {
+                for (int j = 0; j < 16; j++)
+                    words[j][lane] = 0;
+            }
+        }
+
+        for (int j = 0; j < 16; j++)
+            w[j] = _mm256_loadu_si256((const __m256i *) words[j]);
+        for (int j = 16; j < 64; j++)
+        {
+            w[j] = _mm256_add_epi32(
+                        _mm256_add_epi32(AVX2_F4(w[j - 2]), w[j - 7]),
+                        _mm256_add_epi32(AVX2_F3(w[j - 15]), w[j - 16]));
+        }
+
+        for (int j = 0; j < 8; j++)
+            wv[j] = state[j];
+        for (int j = 0; j < 64; j++)
+        {
+            __m256i t1 = _mm256_add_epi32(
+                        _mm256_add_epi32(wv[7], AVX2_F2(wv[4])),
+                        _mm256_add_epi32(AVX2_CH(wv[4], wv[5], wv[6]),
+                                         _mm256_add_epi32(
+                                             _mm256_set1_epi32(sha256_k[j]),
+                                             w[j])));
+            __m256i t2 = _mm256_add_epi32(AVX2_F1(wv[0]),
+                                          AVX2_MAJ(wv[0], wv[1], wv[2]));
+            wv[7] = wv[6];
+            wv[6] = wv[5];
+            wv[5] = wv[4];
+            wv[4] = _mm256_add_epi32(wv[3], t1);
+            wv[3] = wv[2];
+            wv[2] = wv[1];
+            wv[1] = wv[0];
+            wv[0] = _mm256_add_epi32(t1, t2);
+        }
+
+        // Only update the lanes that still had a block
+        const __m256i active =
+                _mm256_cmpgt_epi32(blockCounts, _mm256_set1_epi32(block));
+        for (int j = 0; j < 8; j++)
+        {
+            state[j] = _mm256_blendv_epi8(state[j],
+                                          _mm256_add_epi32(state[j], wv[j]),
+                                          active);
+        }
+    }
+
+    uint32_t h[8][SHA256_LANES];
+    for (int j = 0; j < 8; j++)
+        _mm256_storeu_si256((__m256i *) h[j], state[j]);
+
+    for (int lane = 0; lane < SHA256_LANES; lane++)
+        for (int j = 0; j < 8; j++)
+            UNPACK32(h[j][lane], &digests[lane][j << 2]);
+}
+
+static void SHA256HashBatchAvx2(const std::vector<std::string> &strings,
+                                std::vector<std::string> &hashes)
+{
+    std::string padded[SHA256_LANES];
+    const std::string *lanes[SHA256_LANES];
+    unsigned char digests[SHA256_LANES][SHA256_DIGEST_SIZE];
+
+    for (size_t first = 0; first < strings.size(); first += SHA256_LANES)
+    {
+        int count = 0;
+        for (int lane = 0; lane < SHA256_LANES; lane++)
+        {
+            lanes[lane] = nullptr;
+            if (first + lane < strings.size())
+            {
+                padded[lane] = SHA256Pad(strings[first + lane]);
+                lanes[lane] = &padded[lane];
+                count++;
+            }
+        }
+
+        SHA256HashLanesAvx2(lanes, digests);
+
+        for (int lane = 0; lane < count; lane++)
+            hashes.push_back(toHex(digests[lane]));
+    }
+}
+
+static bool useAvx2()
+{
+    if (!utils::processor::hasAvx2)
+        return false;
+
+    static const bool works = [] {
+        std::vector<std::string> messages;
+        for (const SHA256TestVector &vector : sha256_test_vectors)
+            messages.push_back(vector.message);
+        for (int length = 0; length <= SHA256_TEST_LENGTH; length++)
+            messages.push_back(testMessage(length));
+
+        std::vector<std::string> hashes;
+        SHA256HashBatchAvx2(messages, hashes);
+
+        for (size_t i = 0; i < messages.size(); i++)
+        {
+            if (hashes[i] != SHA256HashWith(SHA256TransformScalar,
+                                             messages[i].data(),
+                                             messages[i].length()))
+                return false;
+        }
+        return true;
+    }();
+    return works;
+}
+#endif
+
+std::vector<std::string> sha256(const std::vector<std::string> &strings)
+{
+    std::vector<std::string> hashes;
+    hashes.reserve(strings.size());
+
+#ifdef SHA256_X86
+    // The SHA extensions are faster than eight AVX2 lanes
+    if (!useShaNi() && useAvx2() && strings.size() > 1)
+    {
+        SHA256HashBatchAvx2(strings, hashes);
+        return hashes;
+    }
+#endif
+
+    for (const std::string &string : strings)
+        hashes.push_back(sha256(string));
+    return hashes;
+}
+
+const char *sha256Implementation()
+{
+#ifdef SHA256_X86
+    if (useShaNi())
+        return "SHA extensions";
+    if (useAvx2())
+        return "scalar, AVX2 for batches";
+#endif
+    return "scalar";
+}
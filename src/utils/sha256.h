@@ -22,6 +22,7 @@
 #define UTILS_SHA256_H
 
 #include <string>
+#include <vector>
 
 static const unsigned int SHA256_HASH_LENGTH = 64;
 
@@ -33,4 +34,18 @@ static const unsigned int SHA256_HASH_LENGTH = 64;
  */
 std::string sha256(const std::string &string);
 
+/**
+ * Returns the SHA-256 hashes for the given strings, in the same order. Faster
+ * than hashing them one by one when the processor supports AVX2 but not the
+ * SHA extensions.
+ */
+std::vector<std::string> sha256(const std::vector<std::string> &strings);
+
+/**
+ * Returns a description of the SHA-256 implementation used on this processor.
+ * The accelerated ones are only used after utils::processor::init() detected
+ * the required processor features.
+ */
+const char *sha256Implementation();
+
 #endif // UTILS_SHA256_H
@@ -19,6 +19,13 @@
  */
 
 #include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <queue>
+#include <sstream>
+#include <vector>
+
+#include <sys/stat.h>
 
 #include "utils/stringfilter.h"
 
@@ -28,8 +35,153 @@
 namespace utils
 {
 
+/**
+ * A deterministic Aho-Corasick automaton recognizing a set of slangs.
+ *
+ * Bytes are case folded and mapped to a small alphabet when the automaton is
+ * built, bytes that do not appear in any slang all share symbol 0. Scanning a
+ * text then costs one table lookup per byte, whatever the number of slangs.
+ */
+class SlangAutomaton
+{
+    public:
+        SlangAutomaton(const std::list<std::string> &slangs);
+
+        /**
+         * Calls \a matched with the end position and the length of the
+         * longest slang ending at each position of \a text where one ends.
+         * Stops when \a matched returns false.
+         */
+        template <class Callback>
+        void scan(const std::string &text, Callback matched) const;
+
+        size_t getStateCount() const
+        { return mMatchLength.size(); }
+
+    private:
+        unsigned char mSymbol[256];     /**< Alphabet symbol of each byte */
+        unsigned mAlphabetSize;
+
+        /** Transitions, mAlphabetSize per state. State 0 is the root. */
+        std::vector<unsigned> mNext;
+
+        /** Length of the longest slang recognized in each state, or 0. */
+        std::vector<unsigned> mMatchLength;
+};
+
+SlangAutomaton::SlangAutomaton(const std::list<std::string> &slangs):
+    mAlphabetSize(1)
+{
+    std::fill(mSymbol, mSymbol + 256, 0);
+    for (const std::string &slang : slangs)
+    {
+        for (unsigned char c : slang)
+        {
+            unsigned char &symbol = mSymbol[std::toupper(c)];
+            if (!symbol)
+                symbol = mAlphabetSize++;
+        }
+    }
+    for (int c = 0; c < 256; ++c)
+        mSymbol[c] = mSymbol[std::toupper(c)];
+
+    // Build the trie. A transition to the root means there is none yet,
+    // since no slang leads back to it.
+    mNext.assign(mAlphabetSize, 0);
+    mMatchLength.assign(1, 0);
+    for (const std::string &slang : slangs)
+    {
+        unsigned state = 0;
+        for (unsigned char c : slang)
+        {
+            const size_t transition = state * mAlphabetSize + mSymbol[c];
+            if (!mNext[transition])
+            {
+                mNext[transition] = mMatchLength.size();
+                mMatchLength.push_back(0);
+                mNext.resize(mNext.size() + mAlphabetSize, 0);
+            }
+            state = mNext[transition];
+        }
+        mMatchLength[state] = slang.length();
+    }
+
+    // Turn it into a complete automaton by following the failure links
+    // breadth first, so that the failure state of a state is always done.
+    std::vector<unsigned> failure(mMatchLength.size(), 0);
+    std::queue<unsigned> states;
+    for (unsigned symbol = 0; symbol < mAlphabetSize; ++symbol)
+        if (unsigned next = mNext[symbol])
+            states.push(next);
+
+    while (!states.empty())
+    {
+        const unsigned state = states.front();
+        states.pop();
+
+        const unsigned fail = failure[state];
+        mMatchLength[state] = std::max(mMatchLength[state],
+                                       mMatchLength[fail]);
+
+        for (unsigned symbol = 0; symbol < mAlphabetSize; ++symbol)
+        {
+            unsigned &next = mNext[state * mAlphabetSize + symbol];
+            const unsigned failNext = mNext[fail * mAlphabetSize + symbol];
+            if (next)
+            {
+                failure[next] = failNext;
+                states.push(next);
+            }
+            else
+            {
+                next = failNext;
+            }
+        }
+    }
+}
+
+template <class Callback>
+void SlangAutomaton::scan(const std::string &text, Callback matched) const
+{
+    unsigned state = 0;
+    for (size_t i = 0, length = text.length(); i < length; ++i)
+    {
+        const unsigned char c = text[i];
+        state = mNext[state * mAlphabetSize + mSymbol[c]];
+        if (mMatchLength[state] && !matched(i, mMatchLength[state]))
+            return;
+    }
+}
+
+
+/** Adds the non-empty entries of a separated list, trimming spaces. */
+static void addSlangs(std::list<std::string> &slangs, std::istream &is,
+                      char separator)
+{
+    std::string slang;
+    while (std::getline(is, slang, separator))
+    {
+        const size_t first = slang.find_first_not_of(" \t\r");
+        if (first == std::string::npos || slang[first] == '#')
+            continue;
+
+        const size_t last = slang.find_last_not_of(" \t\r");
+        slangs.push_back(slang.substr(first, last - first + 1));
+    }
+}
+
+/** Returns the modification time of a file, or 0 when it does not exist. */
+static time_t getModificationTime(const std::string &fileName)
+{
+    struct stat info;
+    if (stat(fileName.c_str(), &info) != 0)
+        return 0;
+    return info.st_mtime;
+}
+
 StringFilter::StringFilter():
-    mInitialized(false)
+    mMasking(false),
+    mSlangsFileTime(0)
 {
     loadSlangFilterList();
 }
@@ -41,19 +193,46 @@ StringFilter::~StringFilter()
 
 bool StringFilter::loadSlangFilterList()
 {
-    mInitialized = false;
+    mSlangs.clear();
+    mMasking = Configuration::getBoolValue("chat_maskSlangs", false);
 
-    const std::string slangsList = Configuration::getValue("SlangsList",
-                                                           std::string());
-    if (!slangsList.empty()) {
-        std::istringstream iss(slangsList);
-        std::string tmp;
-        while (getline(iss, tmp, ','))
-            mSlangs.push_back(tmp);
-        mInitialized = true;
+    std::istringstream iss(Configuration::getValue("SlangsList",
+                                                   std::string()));
+    addSlangs(mSlangs, iss, ',');
+
+    // The slangs file can be edited while the server is running
+    mSlangsFile = Configuration::getValue("chat_slangsFile", std::string());
+    if (!mSlangsFile.empty())
+    {
+        mSlangsFileTime = getModificationTime(mSlangsFile);
+        std::ifstream file(mSlangsFile.c_str());
+        if (file)
+            addSlangs(mSlangs, file, '\n');
+        else
+            LOG_WARN("Could not read the slangs file " << mSlangsFile);
+    }
+
+    std::shared_ptr<const SlangAutomaton> automaton;
+    if (!mSlangs.empty())
+    {
+        automaton = std::make_shared<SlangAutomaton>(mSlangs);
+        LOG_INFO("Loaded " << mSlangs.size() << " slangs ("
+                 << automaton->getStateCount() << " states).");
     }
 
-    return mInitialized;
+    std::lock_guard<std::mutex> lock(mAutomatonMutex);
+    mAutomaton = automaton;
+    return mAutomaton != nullptr;
+}
+
+void StringFilter::checkForChanges()
+{
+    if (!mSlangsFile.empty() &&
+        getModificationTime(mSlangsFile) != mSlangsFileTime)
+    {
+        LOG_INFO("The slangs file " << mSlangsFile << " changed, reloading.");
+        loadSlangFilterList();
+    }
 }
 
 void StringFilter::writeSlangFilterList()
@@ -69,31 +248,43 @@ void StringFilter::writeSlangFilterList()
     //mConfig->setValue("SlangsList", slangsList);
 }
 
+std::shared_ptr<const SlangAutomaton> StringFilter::getAutomaton() const
+{
+    std::lock_guard<std::mutex> lock(mAutomatonMutex);
+    return mAutomaton;
+}
+
 bool StringFilter::filterContent(const std::string &text) const
 {
-    if (!mInitialized) {
+    std::shared_ptr<const SlangAutomaton> automaton = getAutomaton();
+    if (!automaton) {
         LOG_DEBUG("Slangs List is not initialized.");
         return true;
     }
 
     bool isContentClean = true;
-    std::string upperCaseText = text;
+    automaton->scan(text, [&](size_t, unsigned) {
+        isContentClean = false;
+        return false;
+    });
+
+    return isContentClean;
+}
 
-    std::transform(text.begin(), text.end(), upperCaseText.begin(),
-            (int(*)(int))std::toupper);
+bool StringFilter::maskContent(std::string &text) const
+{
+    std::shared_ptr<const SlangAutomaton> automaton = getAutomaton();
+    if (!automaton)
+        return true;
 
-    for (Slangs::const_iterator i = mSlangs.begin(); i != mSlangs.end(); ++i)
-    {
-        // We look for slangs into the sentence.
-        std::string upperCaseSlang = *i;
-        std::transform(upperCaseSlang.begin(), upperCaseSlang.end(),
-                upperCaseSlang.begin(), (int(*)(int))std::toupper);
-
-        if (upperCaseText.compare(upperCaseSlang)) {
-            isContentClean = false;
-            break;
-        }
-    }
+    bool isContentClean = true;
+    automaton->scan(text, [&](size_t end, unsigned length) {
+        // Shorter slangs ending here are part of the longest one
+        std::fill(text.begin() + (end + 1 - length),
+                  text.begin() + (end + 1), '*');
+        isContentClean = false;
+        return true;
+    });
 
     return isContentClean;
 }
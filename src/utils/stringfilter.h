@@ -21,15 +21,24 @@
 #ifndef SLANGSFILTER_H
 #define SLANGSFILTER_H
 
+#include <atomic>
+#include <ctime>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <string>
 
 namespace utils
 {
 
+class SlangAutomaton;
+
 /**
  * Used to filter content containing bad words. Like username, character's
  * names, chat, ...
+ *
+ * The slangs are compiled into an Aho-Corasick automaton, so that a text is
+ * checked against all of them in a single pass, ignoring case.
  */
 class StringFilter
 {
@@ -39,12 +48,19 @@ class StringFilter
         ~StringFilter();
 
         /**
-         * Load slang list from the config file.
+         * Load slang list from the config file, and from the slangs file
+         * when one is configured.
          *
          * @return true is the config is loaded succesfully
          */
         bool loadSlangFilterList();
 
+        /**
+         * Reloads the slang list when the slangs file changed since it was
+         * last loaded.
+         */
+        void checkForChanges();
+
         /**
          * Write slang list to the config file.
          *
@@ -58,6 +74,19 @@ class StringFilter
         */
         bool filterContent(const std::string &text) const;
 
+        /**
+         * Replaces the slangs found in \a text with asterisks.
+         * @return true if the sentence was slangs clear.
+         */
+        bool maskContent(std::string &text) const;
+
+        /**
+         * Tells whether chat messages containing slangs should be masked
+         * rather than rejected.
+         */
+        bool isMaskingEnabled() const
+        { return mMasking; }
+
         /**
          * Tells if an email is valid
          */
@@ -71,10 +100,22 @@ class StringFilter
         bool findDoubleQuotes(const std::string &text) const;
 
     private:
+        std::shared_ptr<const SlangAutomaton> getAutomaton() const;
+
         typedef std::list<std::string> Slangs;
         typedef Slangs::iterator SlangIterator;
         Slangs mSlangs;    /**< the formatted Slangs list */
-        bool mInitialized;                 /**< Set if the list is loaded */
+        std::atomic<bool> mMasking;     /**< Read by the chat thread. */
+
+        std::string mSlangsFile;
+        time_t mSlangsFileTime;            /**< When it was last modified */
+
+        /**
+         * The compiled slangs, replaced as a whole on reload so that the
+         * filter can be used while the list is being reloaded.
+         */
+        std::shared_ptr<const SlangAutomaton> mAutomaton;
+        mutable std::mutex mAutomatonMutex;
 };
 
 } // ::utils
@@ -0,0 +1,50 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "utils/taskqueue.h"
+
+namespace utils
+{
+
+void TaskQueue::post(Task task)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mTasks.push_back(std::move(task));
+}
+
+void TaskQueue::process()
+{
+    std::vector<Task> tasks;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        tasks.swap(mTasks);
+    }
+
+    for (Task &task : tasks)
+        task();
+}
+
+size_t TaskQueue::getPendingCount() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mTasks.size();
+}
+
+} // namespace utils
@@ -0,0 +1,63 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TASKQUEUE_H
+#define TASKQUEUE_H
+
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace utils
+{
+
+/**
+ * Hands work over to another thread. The tasks are posted from any thread
+ * and called by the thread that owns the queue, whenever it calls process().
+ */
+class TaskQueue
+{
+    public:
+        typedef std::function<void()> Task;
+
+        /**
+         * Queues \a task, to be called by the next process().
+         */
+        void post(Task task);
+
+        /**
+         * Calls the tasks posted so far, in the order they were posted.
+         * Tasks posted by these tasks are left for the next call.
+         */
+        void process();
+
+        /**
+         * Returns the number of tasks waiting to be called.
+         */
+        size_t getPendingCount() const;
+
+    private:
+        mutable std::mutex mMutex;
+        std::vector<Task> mTasks;
+};
+
+} // namespace utils
+
+#endif // TASKQUEUE_H
@@ -43,6 +43,14 @@ static uint64_t getTimeInMillisec()
 namespace utils
 {
 
+uint64_t getTimeInMicroseconds()
+{
+    timeval time;
+
+    gettimeofday(&time, 0);
+    return (uint64_t)time.tv_sec * 1000 * 1000 + time.tv_usec;
+}
+
 Timer::Timer(unsigned ms)
 {
     active = false;
@@ -53,18 +61,25 @@ Timer::Timer(unsigned ms)
 void Timer::sleep()
 {
     if (!active) return;
-    uint64_t now = getTimeInMillisec();
-    if (now - lastpulse >= interval) return;
+    unsigned remaining = getTimeUntilNextTick();
+    if (remaining == 0) return;
 #ifndef _WIN32
     struct timespec req;
     req.tv_sec = 0;
-    req.tv_nsec = (interval - (now - lastpulse)) * (1000 * 1000);
+    req.tv_nsec = remaining * (1000 * 1000);
     nanosleep(&req, 0);
 #else
-    Sleep(interval - (now - lastpulse));
+    Sleep(remaining);
 #endif
 }
 
+unsigned Timer::getTimeUntilNextTick() const
+{
+    uint64_t now = getTimeInMillisec();
+    if (now - lastpulse >= interval) return 0;
+    return interval - (now - lastpulse);
+}
+
 int Timer::poll()
 {
     int elapsed = 0;
@@ -31,6 +31,12 @@
 namespace utils
 {
 
+/**
+ * Returns the current time in microseconds. Meant for measuring how long
+ * something took, the absolute value has no particular meaning.
+ */
+uint64_t getTimeInMicroseconds();
+
 /**
  * This class is for timing purpose as a replacement for SDL_TIMER
  */
@@ -54,6 +60,11 @@ class Timer
          */
         void sleep();
 
+        /**
+         * Returns the number of milliseconds till the next tick occurs.
+         */
+        unsigned getTimeUntilNextTick() const;
+
         /**
          * Activates the timer.
          */
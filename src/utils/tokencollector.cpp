@@ -20,72 +20,75 @@
 
 #include "utils/tokencollector.h"
 
-/* We are optimistic and we assume that clients connect as soon as possible.
-   It means that pending data are mainly outdated ones, except for the newer
-   ones. So we search the lists backward (from newer to older) for already
-   inserted data. On the contrary, data are removed when there was a network
-   failure, especially a timeout. So we search the lists forward when removing
-   data, in order to start from the older ones. */
+/* Both sides are indexed by token, so matching does not depend on the number
+   of pending items. The lists keep the items in the order they were added,
+   so outdated items are found at their front. */
+
+void TokenCollectorBase::add(PendingItems &pending, const std::string &token,
+                             intptr_t data, time_t timeStamp)
+{
+    Item item;
+    item.token = token;
+    item.data = data;
+    item.timeStamp = timeStamp;
+    Items::iterator it = pending.items.insert(pending.items.end(), item);
+
+    // Older items with the same token or data are only reachable through the
+    // list anymore, until they become outdated.
+    pending.byToken[token] = it;
+    pending.byData[data] = it;
+}
+
+void TokenCollectorBase::erase(PendingItems &pending, Items::iterator it)
+{
+    auto byToken = pending.byToken.find(it->token);
+    if (byToken != pending.byToken.end() && byToken->second == it)
+        pending.byToken.erase(byToken);
+
+    auto byData = pending.byData.find(it->data);
+    if (byData != pending.byData.end() && byData->second == it)
+        pending.byData.erase(byData);
+
+    pending.items.erase(it);
+}
 
 void TokenCollectorBase::insertClient(const std::string &token, intptr_t data)
 {
-    for (std::list<Item>::reverse_iterator it = mPendingConnects.rbegin(),
-         it_end = mPendingConnects.rend(); it != it_end; ++it)
+    auto match = mPendingConnects.byToken.find(token);
+    if (match != mPendingConnects.byToken.end())
     {
-        if (it->token == token)
-        {
-            foundMatch(data, it->data);
-            mPendingConnects.erase(--it.base());
-            return;
-        }
+        const intptr_t connect = match->second->data;
+        erase(mPendingConnects, match->second);
+        foundMatch(data, connect);
+        return;
     }
 
     time_t current = time(nullptr);
-
-    Item item;
-    item.token = token;
-    item.data = data;
-    item.timeStamp = current;
-    mPendingClients.push_back(item);
-
+    add(mPendingClients, token, data, current);
     removeOutdated(current);
 }
 
 void TokenCollectorBase::insertConnect(const std::string &token, intptr_t data)
 {
-    for (std::list<Item>::reverse_iterator it = mPendingClients.rbegin(),
-         it_end = mPendingClients.rend(); it != it_end; ++it)
+    auto match = mPendingClients.byToken.find(token);
+    if (match != mPendingClients.byToken.end())
     {
-        if (it->token == token)
-        {
-            foundMatch(it->data, data);
-            mPendingClients.erase(--it.base());
-            return;
-        }
+        const intptr_t client = match->second->data;
+        erase(mPendingClients, match->second);
+        foundMatch(client, data);
+        return;
     }
 
     time_t current = time(nullptr);
-
-    Item item;
-    item.token = token;
-    item.data = data;
-    item.timeStamp = current;
-    mPendingConnects.push_back(item);
-
+    add(mPendingConnects, token, data, current);
     removeOutdated(current);
 }
 
 void TokenCollectorBase::removeClient(intptr_t data)
 {
-    for (std::list<Item>::iterator it = mPendingClients.begin(),
-         it_end = mPendingClients.end(); it != it_end; ++it)
-    {
-        if (it->data == data)
-        {
-            mPendingClients.erase(it);
-            return;
-        }
-    }
+    auto it = mPendingClients.byData.find(data);
+    if (it != mPendingClients.byData.end())
+        erase(mPendingClients, it->second);
 }
 
 void TokenCollectorBase::removeOutdated(time_t current)
@@ -94,20 +97,22 @@ void TokenCollectorBase::removeOutdated(time_t current)
     time_t threshold = current - 30;
     if (threshold < mLastCheck) return;
 
-    std::list<Item>::iterator it;
-
-    it = mPendingConnects.begin();
-    while (it != mPendingConnects.end() && it->timeStamp < threshold)
+    // The items are erased before the handler is told, in case it modifies
+    // the collector.
+    while (!mPendingConnects.items.empty() &&
+           mPendingConnects.items.front().timeStamp < threshold)
     {
-        removedConnect(it->data);
-        it = mPendingConnects.erase(it);
+        const intptr_t data = mPendingConnects.items.front().data;
+        erase(mPendingConnects, mPendingConnects.items.begin());
+        removedConnect(data);
     }
 
-    it = mPendingClients.begin();
-    while (it != mPendingClients.end() && it->timeStamp < threshold)
+    while (!mPendingClients.items.empty() &&
+           mPendingClients.items.front().timeStamp < threshold)
     {
-        removedClient(it->data);
-        it = mPendingClients.erase(it);
+        const intptr_t data = mPendingClients.items.front().data;
+        erase(mPendingClients, mPendingClients.items.begin());
+        removedClient(data);
     }
 
     mLastCheck = current;
@@ -120,5 +125,5 @@ TokenCollectorBase::TokenCollectorBase():
 
 TokenCollectorBase::~TokenCollectorBase()
 {
-    // Not declared inline, as the list destructors are not trivial.
+    // Not declared inline, as the container destructors are not trivial.
 }
@@ -24,6 +24,7 @@
 #include <stdint.h>
 #include <string>
 #include <list>
+#include <unordered_map>
 #include <time.h>
 
 /**
@@ -38,23 +39,39 @@ class TokenCollectorBase
             time_t timeStamp;  /**< Creation time. */
         };
 
+        typedef std::list<Item> Items;
+
         /**
-         * List containing client already connected. Newer clients are at the
-         * back of the list.
+         * The pending items of one side. Newer items are at the back of the
+         * list, so that outdated ones can be removed from the front. The
+         * indexes refer to the newest item for each token and user data.
          */
-        std::list<Item> mPendingClients;
+        struct PendingItems
+        {
+            Items items;
+            std::unordered_map<std::string, Items::iterator> byToken;
+            std::unordered_map<intptr_t, Items::iterator> byData;
+        };
 
         /**
-         * List containing server data waiting for clients. Newer data are at
-         * the back of the list.
+         * Clients already connected.
          */
-        std::list<Item> mPendingConnects;
+        PendingItems mPendingClients;
+
+        /**
+         * Server data waiting for clients.
+         */
+        PendingItems mPendingConnects;
 
         /**
          * Time at which the TokenCollector performed its last check.
          */
         time_t mLastCheck;
 
+        static void add(PendingItems &, const std::string &, intptr_t,
+                        time_t);
+        static void erase(PendingItems &, Items::iterator);
+
     protected:
 
         virtual void removedClient(intptr_t) = 0;
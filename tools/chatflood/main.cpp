@@ -0,0 +1,473 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A benchmark for the effect of a busy chat on the logins. It runs the loop
+ * of the account server in process, with the real ConnectionHandlers and
+ * HostPoller, but with handlers that do no database work:
+ *
+ *  - the account handler answers each login seed request right away,
+ *  - the game server handler has no connections,
+ *  - the chat handler broadcasts every chat message to all its clients, as
+ *    in a channel that everyone is in.
+ *
+ * One client measures the round trip of the login seed requests while the
+ * flooders keep chatting:
+ *
+ *     manaserv-chatflood --flooders 50 --rate 4000
+ *     manaserv-chatflood --flooders 50 --rate 4000 --dedicated-thread
+ *
+ * Without --dedicated-thread the chat handler shares the main loop, like
+ * with chat_dedicatedThread disabled. With it, the chat handler runs on a
+ * thread with its own HostPoller, like ChatHandler::startThread().
+ */
+
+#include "common/configuration.h"
+#include "common/manaserv_protocol.h"
+#include "net/bandwidth.h"
+#include "net/connectionhandler.h"
+#include "net/hostpoller.h"
+#include "net/messagein.h"
+#include "net/messageout.h"
+#include "net/netcomputer.h"
+#include "utils/logger.h"
+#include "utils/processorutils.h"
+
+#include <enet/enet.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+using namespace ManaServ;
+
+BandwidthMonitor *gBandwidth;
+
+// The handlers only read their limits from the configuration
+int Configuration::getValue(const std::string &, int deflt)
+{ return deflt; }
+
+namespace utils {
+Logger::Level Logger::mVerbosity = Logger::Fatal;
+void Logger::output(const std::string &, Level) {}
+}
+
+struct Options
+{
+    int port = 19700;
+    int flooders = 50;
+    int rate = 1000;            /**< Chat messages per second, all flooders. */
+    int seconds = 5;
+    bool dedicatedThread = false;
+};
+
+static int64_t nowInMicroseconds()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(
+                steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Answers the login seed requests, standing in for the account handler.
+ */
+class LoginHandler : public ConnectionHandler
+{
+    protected:
+        NetComputer *computerConnected(ENetPeer *peer)
+        { return new NetComputer(peer); }
+
+        void computerDisconnected(NetComputer *computer)
+        { delete computer; }
+
+        void processMessage(NetComputer *computer, MessageIn &msg)
+        {
+            if (msg.getId() != PAMSG_LOGIN_RNDTRGR)
+                return;
+
+            MessageOut reply(APMSG_LOGIN_RNDTRGR_RESPONSE);
+            reply.writeString(msg.readString());
+            computer->send(reply);
+        }
+};
+
+/**
+ * A handler without connections, standing in for the game server handler.
+ */
+class IdleHandler : public ConnectionHandler
+{
+    protected:
+        NetComputer *computerConnected(ENetPeer *peer)
+        { return new NetComputer(peer); }
+
+        void computerDisconnected(NetComputer *computer)
+        { delete computer; }
+
+        void processMessage(NetComputer *, MessageIn &) {}
+};
+
+/**
+ * Broadcasts every chat message to all the clients, standing in for the chat
+ * handler with everyone in the same channel.
+ */
+class ChannelHandler : public ConnectionHandler
+{
+    public:
+        ChannelHandler(): mMessages(0) {}
+
+        unsigned getMessageCount() const
+        { return mMessages; }
+
+    protected:
+        NetComputer *computerConnected(ENetPeer *peer)
+        { return new NetComputer(peer); }
+
+        void computerDisconnected(NetComputer *computer)
+        { delete computer; }
+
+        void processMessage(NetComputer *, MessageIn &msg)
+        {
+            if (msg.getId() != PCMSG_CHAT)
+                return;
+
+            const std::string text = msg.readString();
+            const int channel = msg.readInt16();
+
+            MessageOut result(CPMSG_PUBMSG);
+            result.writeInt16(channel);
+            result.writeString("flooder");
+            result.writeString(text);
+            NetComputer::broadcast(clients.begin(), clients.end(), result);
+            ++mMessages;
+        }
+
+    private:
+        std::atomic<unsigned> mMessages;
+};
+
+/**
+ * Runs the handlers like the main loop of the account server, until
+ * \a running is cleared.
+ */
+static void runServer(LoginHandler &login, IdleHandler &game,
+                      ChannelHandler &chat, HostPoller &poller,
+                      const Options &options, const std::atomic<bool> &running)
+{
+    HostPoller chatPoller;
+    std::thread chatThread;
+
+    if (options.dedicatedThread)
+    {
+        chat.setPoller(&chatPoller);
+        chatThread = std::thread([&] {
+            while (running)
+            {
+                chatPoller.wait(-1);
+                chat.process();
+            }
+        });
+    }
+    else
+    {
+        chat.setPoller(&poller);
+    }
+
+    while (running)
+    {
+        poller.wait(-1);
+
+        login.process();
+        game.process();
+        if (!options.dedicatedThread)
+            chat.process();
+    }
+
+    if (chatThread.joinable())
+    {
+        chatPoller.wakeUp();
+        chatThread.join();
+    }
+    chat.setPoller(nullptr);
+}
+
+static ENetPeer *connect(ENetHost *host, int port)
+{
+    ENetAddress address;
+    enet_address_set_host(&address, "127.0.0.1");
+    address.port = port;
+    return enet_host_connect(host, &address, 1, 0);
+}
+
+static void send(ENetPeer *peer, const MessageOut &msg)
+{
+    enet_peer_send(peer, 0, enet_packet_create(msg.getData(), msg.getLength(),
+                                               ENET_PACKET_FLAG_RELIABLE));
+}
+
+/**
+ * Connects the flooders to the chat port, and sends their messages at the
+ * requested rate until \a running is cleared. The broadcasts are received
+ * and dropped.
+ */
+static void runFlooders(const Options &options,
+                        const std::atomic<bool> &running,
+                        std::atomic<bool> &connected,
+                        std::atomic<unsigned> &received)
+{
+    ENetHost *host = enet_host_create(nullptr, options.flooders, 1, 0, 0);
+    std::vector<ENetPeer *> peers;
+    for (int i = 0; i < options.flooders; ++i)
+        peers.push_back(connect(host, options.port + 2));
+
+    int connectedPeers = 0;
+    int64_t nextMessage = 0;
+    const int64_t interval = options.rate ? 1000000 / options.rate : 0;
+    unsigned sent = 0;
+    ENetEvent event;
+
+    while (running)
+    {
+        while (enet_host_service(host, &event, 1) > 0)
+        {
+            if (event.type == ENET_EVENT_TYPE_CONNECT &&
+                ++connectedPeers == options.flooders)
+            {
+                connected = true;
+                nextMessage = nowInMicroseconds();
+            }
+            else if (event.type == ENET_EVENT_TYPE_RECEIVE)
+            {
+                ++received;
+                enet_packet_destroy(event.packet);
+            }
+        }
+
+        if (!connected || !options.rate)
+            continue;
+
+        // Catch up on the messages that are due, without bursting after a
+        // stall
+        const int64_t now = nowInMicroseconds();
+        nextMessage = std::max(nextMessage, now - 100000);
+        while (nextMessage <= now)
+        {
+            MessageOut msg(PCMSG_CHAT);
+            msg.writeString("The quick brown fox jumps over the lazy dog");
+            msg.writeInt16(1);
+            send(peers[sent++ % peers.size()], msg);
+            nextMessage += interval;
+        }
+        enet_host_flush(host);
+    }
+
+    enet_host_destroy(host);
+}
+
+/**
+ * Sends login seed requests one after the other and records the round trips
+ * in microseconds, until \a running is cleared.
+ */
+static std::vector<int64_t> runProbe(const Options &options,
+                                     const std::atomic<bool> &running)
+{
+    ENetHost *host = enet_host_create(nullptr, 1, 1, 0, 0);
+    ENetPeer *peer = connect(host, options.port);
+
+    std::vector<int64_t> roundTrips;
+    int64_t sentAt = 0;
+    ENetEvent event;
+
+    while (running)
+    {
+        if (enet_host_service(host, &event, 1) <= 0)
+            continue;
+
+        if (event.type == ENET_EVENT_TYPE_RECEIVE)
+        {
+            MessageIn msg((const char *) event.packet->data,
+                          event.packet->dataLength);
+            if (msg.getId() == APMSG_LOGIN_RNDTRGR_RESPONSE)
+                roundTrips.push_back(nowInMicroseconds() - sentAt);
+            enet_packet_destroy(event.packet);
+
+            // Give the flooders time between the requests
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        else if (event.type != ENET_EVENT_TYPE_CONNECT)
+        {
+            continue;
+        }
+
+        MessageOut msg(PAMSG_LOGIN_RNDTRGR);
+        msg.writeString("probe");
+        send(peer, msg);
+        enet_host_flush(host);
+        sentAt = nowInMicroseconds();
+    }
+
+    enet_host_destroy(host);
+    return roundTrips;
+}
+
+static double percentile(std::vector<int64_t> &values, int p)
+{
+    if (values.empty())
+        return 0;
+    size_t index = std::min(values.size() - 1, values.size() * p / 100);
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index] / 1000.0;
+}
+
+static void printUsage()
+{
+    std::cout << "manaserv-chatflood" << std::endl << std::endl
+              << "Options: " << std::endl
+              << "     --port <n>         : First of the three ports"
+              << " (Default: 19700)" << std::endl
+              << "     --flooders <n>     : Number of chat clients"
+              << " (Default: 50)" << std::endl
+              << "     --rate <n>         : Chat messages per second"
+              << " (Default: 1000)" << std::endl
+              << "     --seconds <n>      : Duration of the flood"
+              << " (Default: 5)" << std::endl
+              << "     --dedicated-thread : Serve the chat on a thread of"
+              << " its own" << std::endl;
+}
+
+static bool parseOptions(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (arg == "--dedicated-thread")
+            options.dedicatedThread = true;
+        else if (arg == "--port" && hasValue)
+            options.port = atoi(argv[++i]);
+        else if (arg == "--flooders" && hasValue)
+            options.flooders = atoi(argv[++i]);
+        else if (arg == "--rate" && hasValue)
+            options.rate = atoi(argv[++i]);
+        else if (arg == "--seconds" && hasValue)
+            options.seconds = atoi(argv[++i]);
+        else
+            return false;
+    }
+    return options.flooders > 0 && options.rate >= 0 && options.seconds > 0;
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    utils::processor::init();
+
+    if (enet_initialize() != 0)
+    {
+        std::cerr << "Could not initialize ENet." << std::endl;
+        return 1;
+    }
+    atexit(enet_deinitialize);
+
+    gBandwidth = new BandwidthMonitor;
+
+    LoginHandler login;
+    IdleHandler game;
+    ChannelHandler chat;
+    HostPoller poller;
+
+    login.setPoller(&poller);
+    game.setPoller(&poller);
+    if (!login.startListen(options.port, "127.0.0.1") ||
+        !game.startListen(options.port + 1, "127.0.0.1") ||
+        !chat.startListen(options.port + 2, "127.0.0.1"))
+    {
+        std::cerr << "Could not listen on ports " << options.port << " to "
+                  << options.port + 2 << std::endl;
+        return 1;
+    }
+
+    std::atomic<bool> serverRunning(true);
+    std::thread server(runServer, std::ref(login), std::ref(game),
+                       std::ref(chat), std::ref(poller), std::cref(options),
+                       std::cref(serverRunning));
+
+    std::atomic<bool> clientsRunning(true);
+    std::atomic<bool> floodersConnected(false);
+    std::atomic<unsigned> broadcastsReceived(0);
+    std::thread flooders(runFlooders, std::cref(options),
+                         std::cref(clientsRunning),
+                         std::ref(floodersConnected),
+                         std::ref(broadcastsReceived));
+
+    while (!floodersConnected)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    std::vector<int64_t> roundTrips;
+    std::thread probe([&] {
+        roundTrips = runProbe(options, clientsRunning);
+    });
+
+    std::this_thread::sleep_for(std::chrono::seconds(options.seconds));
+    clientsRunning = false;
+    probe.join();
+    flooders.join();
+
+    serverRunning = false;
+    poller.wakeUp();
+    server.join();
+
+    std::cout << (options.dedicatedThread ? "Dedicated chat thread"
+                                          : "Shared main loop")
+              << ", " << options.flooders << " flooders at " << options.rate
+              << " messages/s" << std::endl
+              << "Chat messages broadcast: " << chat.getMessageCount()
+              << ", received: " << broadcastsReceived << std::endl
+              << "Login round trips: " << roundTrips.size();
+    if (roundTrips.empty())
+    {
+        std::cout << ", none answered" << std::endl;
+        return 1;
+    }
+
+    const double p50 = percentile(roundTrips, 50);
+    const double p99 = percentile(roundTrips, 99);
+    const double max = percentile(roundTrips, 100);
+    std::cout << ", p50 " << p50 << " ms, p99 " << p99 << " ms, max "
+              << max << " ms" << std::endl;
+
+    login.stopListen();
+    game.stopListen();
+    chat.stopListen();
+    return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A benchmark for the doubles sent between the game and account servers,
+ * comparing the text encoding with the binary one that is used once both
+ * servers announced the capability:
+ *
+ *     manaserv-doublebench --values 1000000
+ *
+ * The values are written with MessageOut and read back with MessageIn, in
+ * messages of --per-message values. Three kinds of values are tested:
+ * integral values like the attribute bases, values with three decimals
+ * like the modified attributes, and arbitrary fractions.
+ *
+ * The test fails when a value does not round-trip exactly in binary, or
+ * when it is off by more than the 15 significant digits of the text.
+ */
+
+#include "net/messagein.h"
+#include "net/messageout.h"
+#include "utils/logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace utils {
+Logger::Level Logger::mVerbosity = Logger::Fatal;
+void Logger::output(const std::string &, Level) {}
+}
+
+struct Options
+{
+    int values = 1000000;
+    int perMessage = 1000;
+};
+
+struct Result
+{
+    double valuesPerSecond;
+    double bytesPerValue;
+    double maxError;            /**< The largest relative error. */
+};
+
+static unsigned randomSeed = 1;
+
+static unsigned randomNumber()
+{
+    randomSeed = randomSeed * 1103515245 + 12345;
+    return randomSeed >> 8;
+}
+
+static std::vector<double> integralValues(int count)
+{
+    std::vector<double> values;
+    for (int i = 0; i < count; ++i)
+        values.push_back((int) (randomNumber() % 2000) - 1000);
+    return values;
+}
+
+static std::vector<double> decimalValues(int count)
+{
+    std::vector<double> values;
+    for (int i = 0; i < count; ++i)
+        values.push_back((randomNumber() % 1000000) / 1000.0);
+    return values;
+}
+
+static std::vector<double> fractionValues(int count)
+{
+    std::vector<double> values;
+    for (int i = 0; i < count; ++i)
+        values.push_back(randomNumber() % 1000 / (randomNumber() % 999 + 1.0));
+    return values;
+}
+
+/**
+ * Writes and reads back \a values, and checks the values read.
+ */
+static Result run(const std::vector<double> &values, bool binary,
+                  const Options &options)
+{
+    std::vector<double> read(values.size());
+    size_t bytes = 0;
+
+    using namespace std::chrono;
+    const auto start = steady_clock::now();
+
+    for (size_t first = 0; first < values.size();
+         first += options.perMessage)
+    {
+        const size_t last = std::min(values.size(),
+                                     first + options.perMessage);
+
+        MessageOut out(0);
+        out.setBinaryDoubles(binary);
+        for (size_t i = first; i < last; ++i)
+            out.writeDouble(values[i]);
+        bytes += out.getLength() - 2;
+
+        MessageIn in(out.getData(), out.getLength());
+        for (size_t i = first; i < last; ++i)
+            read[i] = in.readDouble();
+    }
+
+    const double elapsed = duration<double>(steady_clock::now() - start).count();
+
+    Result result;
+    result.valuesPerSecond = values.size() / elapsed;
+    result.bytesPerValue = (double) bytes / values.size();
+    result.maxError = 0;
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        if (read[i] == values[i])
+            continue;
+
+        const double error = values[i] ?
+                    std::fabs((read[i] - values[i]) / values[i]) : 1;
+        result.maxError = std::max(result.maxError, error);
+    }
+    return result;
+}
+
+static void printUsage()
+{
+    std::cout << "manaserv-doublebench" << std::endl << std::endl
+              << "Options: " << std::endl
+              << "     --values <n>      : Values of each kind"
+              << " (Default: 1000000)" << std::endl
+              << "     --per-message <n> : Values per message"
+              << " (Default: 1000)" << std::endl;
+}
+
+static bool parseOptions(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (arg == "--values" && hasValue)
+            options.values = atoi(argv[++i]);
+        else if (arg == "--per-message" && hasValue)
+            options.perMessage = atoi(argv[++i]);
+        else
+            return false;
+    }
+    // The text form takes up to 25 bytes, and messages have 16-bit lengths
+    return options.values > 0 && options.perMessage > 0 &&
+            options.perMessage <= 2500;
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    struct Kind
+    {
+        const char *name;
+        std::vector<double> values;
+    };
+
+    const Kind kinds[] = {
+        { "integral",            integralValues(options.values) },
+        { "3 decimals",          decimalValues(options.values) },
+        { "arbitrary fractions", fractionValues(options.values) },
+    };
+
+    bool ok = true;
+    for (const Kind &kind : kinds)
+    {
+        const Result text = run(kind.values, false, options);
+        const Result binary = run(kind.values, true, options);
+
+        std::cout << kind.name << ":" << std::endl
+                  << "  text:   " << text.valuesPerSecond / 1e6 << " M/s, "
+                  << text.bytesPerValue << " bytes, largest error "
+                  << text.maxError << std::endl
+                  << "  binary: " << binary.valuesPerSecond / 1e6 << " M/s, "
+                  << binary.bytesPerValue << " bytes, largest error "
+                  << binary.maxError << std::endl;
+
+        if (text.maxError > 1e-14 || binary.maxError != 0)
+        {
+            std::cout << "  FAILED" << std::endl;
+            ok = false;
+        }
+    }
+
+    std::cout << (ok ? "Passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
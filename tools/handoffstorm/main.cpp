@@ -0,0 +1,199 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A stress test for the TokenCollector, which matches the clients handed
+ * over between the servers with the data sent ahead by the other server.
+ * It simulates a large number of handoffs at once, like after a game server
+ * restart:
+ *
+ *     manaserv-handoffstorm --handoffs 50000
+ *
+ * Both orders are tested. First the data of every handoff is announced, then
+ * half of the clients connect with a matching token, in a random order, and
+ * the other half with unknown tokens, which stay pending until they
+ * disconnect. Then the same is done with the clients connecting first.
+ *
+ * Every match is checked, and the test fails when a client is matched with
+ * the wrong data, when a match is missing or when an item is dropped as
+ * outdated.
+ */
+
+#include "utils/tokencollector.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * Records what the collector reports. Clients and data are numbered, the
+ * data of handoff i is i + 1 and its client is -(i + 1).
+ */
+class Handler
+{
+    public:
+        Handler(): matched(0), mismatched(0), removed(0) {}
+
+        void deletePendingClient(int)
+        { ++removed; }
+
+        void deletePendingConnect(int)
+        { ++removed; }
+
+        void tokenMatched(int client, int data)
+        {
+            if (client == -data)
+                ++matched;
+            else
+                ++mismatched;
+        }
+
+        int matched;
+        int mismatched;
+        int removed;
+};
+
+typedef TokenCollector<Handler, int, int> Collector;
+
+struct Options
+{
+    int handoffs = 50000;
+};
+
+static std::string tokenOf(int handoff)
+{
+    char token[16];
+    snprintf(token, sizeof(token), "%08d", handoff);
+    return token;
+}
+
+static std::string unknownTokenOf(int handoff)
+{
+    return "x" + tokenOf(handoff);
+}
+
+/**
+ * Runs one round of handoffs. When \a clientsFirst is set, the clients
+ * connect before their data is announced.
+ */
+static bool runRound(const Options &options, bool clientsFirst)
+{
+    Handler handler;
+    Collector collector(&handler);
+
+    const int handoffs = options.handoffs;
+    const int matching = handoffs / 2;
+
+    // The clients do not arrive in the order they were handed over
+    std::vector<int> order(handoffs);
+    for (int i = 0; i < handoffs; ++i)
+        order[i] = i;
+    std::srand(1);
+    std::random_shuffle(order.begin(), order.end());
+
+    const auto start = std::chrono::steady_clock::now();
+
+    if (!clientsFirst)
+    {
+        for (int i = 0; i < handoffs; ++i)
+            collector.addPendingConnect(tokenOf(i), i + 1);
+    }
+
+    for (int i : order)
+    {
+        if (i < matching)
+            collector.addPendingClient(tokenOf(i), -(i + 1));
+        else if (!clientsFirst)
+            collector.addPendingClient(unknownTokenOf(i), -(i + 1));
+    }
+
+    if (clientsFirst)
+    {
+        for (int i = 0; i < handoffs; ++i)
+        {
+            if (i < matching)
+                collector.addPendingConnect(tokenOf(i), i + 1);
+            else
+                collector.addPendingConnect(unknownTokenOf(i), i + 1);
+        }
+    }
+
+    // The clients that were not matched disconnect
+    if (!clientsFirst)
+    {
+        for (int i = matching; i < handoffs; ++i)
+            collector.deletePendingClient(-(i + 1));
+    }
+
+    using namespace std::chrono;
+    const double elapsed = duration<double>(steady_clock::now() - start).count();
+
+    std::cout << (clientsFirst ? "Clients first: " : "Data first:    ")
+              << handler.matched << " of " << matching << " matched, "
+              << handler.mismatched << " mismatched, "
+              << handler.removed << " dropped as outdated, in "
+              << elapsed * 1000 << " ms" << std::endl;
+
+    return handler.matched == matching && handler.mismatched == 0 &&
+            handler.removed == 0;
+}
+
+static void printUsage()
+{
+    std::cout << "manaserv-handoffstorm" << std::endl << std::endl
+              << "Options: " << std::endl
+              << "     --handoffs <n>    : Number of handoffs"
+              << " (Default: 50000)" << std::endl;
+}
+
+static bool parseOptions(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (arg == "--handoffs" && hasValue)
+            options.handoffs = atoi(argv[++i]);
+        else
+            return false;
+    }
+    return options.handoffs > 0;
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    bool ok = runRound(options, false);
+    ok = runRound(options, true) && ok;
+
+    std::cout << (ok ? "Passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
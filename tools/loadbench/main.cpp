@@ -0,0 +1,481 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A benchmark of loading an account with its characters on login, on
+ * SQLite:
+ *
+ *     manaserv-loadbench --accounts 1000 --characters 3 --logins 5000
+ *
+ * A database is created from the SQLite schema in the given file, which is
+ * overwritten, and filled with accounts of --characters characters each.
+ *
+ * Random accounts are loaded once like the storage did before, with a
+ * query per table for every character, reproduced here on a data provider
+ * of its own. Then they are loaded with Storage::getAccount(), which loads
+ * all the characters of the account with a query per table. The slot fix
+ * of old accounts done by getAccount() is not done by the per-character
+ * loader.
+ *
+ * The test fails when the two loaders do not find the same rows.
+ */
+
+#include "account-server/account.h"
+#include "account-server/character.h"
+#include "account-server/storage.h"
+#include "chat-server/guildmanager.h"
+#include "common/configuration.h"
+#include "common/defines.h"
+#include "common/resourcemanager.h"
+#include "dal/dataproviderfactory.h"
+#include "utils/logger.h"
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// The storage reads its settings from the configuration
+static std::map<std::string, std::string> configuration;
+
+std::string Configuration::getValue(const std::string &key,
+                                    const std::string &deflt)
+{
+    std::map<std::string, std::string>::const_iterator i =
+            configuration.find(key);
+    return i != configuration.end() ? i->second : deflt;
+}
+
+int Configuration::getValue(const std::string &key, int deflt)
+{
+    std::map<std::string, std::string>::const_iterator i =
+            configuration.find(key);
+    return i != configuration.end() ? atoi(i->second.c_str()) : deflt;
+}
+
+bool Configuration::getBoolValue(const std::string &key, bool deflt)
+{ return getValue(key, deflt ? 1 : 0) != 0; }
+
+namespace utils {
+Logger::Level Logger::mVerbosity = Logger::Fatal;
+void Logger::output(const std::string &, Level) {}
+}
+
+// Without an item database, the storage skips synchronizing the items
+std::string ResourceManager::resolve(const std::string &)
+{ return std::string(); }
+
+// Guilds are not loaded by the benchmark
+GuildManager *guildManager;
+void GuildManager::setUserRights(Guild *, int, int) {}
+
+Storage *storage;
+
+struct Options
+{
+    int accounts = 1000;
+    int characters = 3;
+    int logins = 5000;
+    std::string database = "/tmp/manaserv-loadbench.db";
+};
+
+/**
+ * The number of rows found for the characters of an account, by table.
+ * The quest log is not compared, the characters do not expose it.
+ */
+struct LoadedRows
+{
+    int characters = 0;
+    int attributes = 0;
+    int statusEffects = 0;
+    int kills = 0;
+    int abilities = 0;
+    int items = 0;
+
+    bool operator==(const LoadedRows &other) const
+    {
+        return characters == other.characters &&
+                attributes == other.attributes &&
+                statusEffects == other.statusEffects &&
+                kills == other.kills && abilities == other.abilities &&
+                items == other.items;
+    }
+};
+
+struct Result
+{
+    double loadsPerSecond;
+    double averageMs;
+    double maxMs;
+};
+
+static unsigned randomSeed = 1;
+
+static unsigned randomNumber(unsigned range)
+{
+    randomSeed = randomSeed * 1103515245 + 12345;
+    return (randomSeed >> 16) % range;
+}
+
+static std::string accountName(int account)
+{
+    return "loadbench" + std::to_string(account);
+}
+
+static void removeDatabase(const std::string &database)
+{
+    std::remove(database.c_str());
+    std::remove((database + "-wal").c_str());
+    std::remove((database + "-shm").c_str());
+    std::remove((database + "-journal").c_str());
+    std::remove((database + ".characters").c_str());
+}
+
+/**
+ * Creates the tables of the SQLite schema in a new database.
+ */
+static bool createDatabase(const std::string &database)
+{
+    removeDatabase(database);
+
+    std::ifstream file(SCHEMA_FILE);
+    std::stringstream schema;
+    schema << file.rdbuf();
+
+    sqlite3 *db;
+    if (!file || sqlite3_open(database.c_str(), &db) != SQLITE_OK)
+    {
+        std::cerr << "Could not create " << database << " from "
+                  << SCHEMA_FILE << "." << std::endl;
+        return false;
+    }
+
+    char *error = nullptr;
+    if (sqlite3_exec(db, schema.str().c_str(), nullptr, nullptr, &error)
+        != SQLITE_OK)
+    {
+        std::cerr << "Could not create the tables: " << error << std::endl;
+        sqlite3_free(error);
+        sqlite3_close(db);
+        return false;
+    }
+    sqlite3_close(db);
+    return true;
+}
+
+/**
+ * Adds the accounts with their characters, saved once like a game server
+ * would so that they have rows in every table.
+ */
+static void addAccounts(const Options &options)
+{
+    for (int i = 0; i < options.accounts; ++i)
+    {
+        const std::string name = accountName(i);
+        Account account;
+        account.setName(name);
+        account.setPassword(name);
+        account.setEmail(name);
+        account.setLevel(AL_PLAYER);
+        account.setRegistrationDate(time(nullptr));
+        account.setLastLogin(time(nullptr));
+        storage->addAccount(&account);
+
+        for (int slot = 1; slot <= options.characters; ++slot)
+        {
+            CharacterData *character =
+                    new CharacterData(name + "-" + std::to_string(slot));
+            character->setCharacterSlot(slot);
+            character->setMapId(1);
+            for (int attr = 1; attr <= 20; ++attr)
+                character->setAttribute(attr, randomNumber(100));
+            for (int monster = 1; monster <= 10; ++monster)
+                character->setKillCount(monster, randomNumber(1000));
+            for (int ability = 1; ability <= 5; ++ability)
+                character->giveAbility(ability);
+            character->applyStatusEffect(1, 1000);
+
+            InventoryData inventory;
+            for (int itemSlot = 1; itemSlot <= 30; ++itemSlot)
+            {
+                InventoryItem &item = inventory[itemSlot];
+                item.slot = itemSlot;
+                item.itemId = 1 + randomNumber(500);
+                item.amount = 1 + randomNumber(20);
+            }
+            character->getPossessions().setInventory(inventory);
+
+            character->setAccount(&account);
+            account.addCharacter(character);
+        }
+        storage->flush(&account);
+
+        for (auto &it : account.getCharacters())
+            storage->updateCharacter(it.second);
+    }
+}
+
+/**
+ * Runs a query taking a single integer parameter and returns its rows.
+ */
+static int countRows(dal::DataProvider *db, const char *sql, int id)
+{
+    if (!db->prepareSql(sql))
+        throw std::runtime_error(std::string("Could not prepare ") + sql);
+    db->bindValue(1, id);
+    return db->processSql().rows();
+}
+
+/**
+ * Loads an account like the storage did before, a query per table for each
+ * of its characters.
+ */
+static LoadedRows loadPerCharacter(dal::DataProvider *db,
+                                   const std::string &name)
+{
+    LoadedRows rows;
+
+    if (!db->prepareSql("SELECT * FROM mana_accounts WHERE username = ?"))
+        throw std::runtime_error("Could not prepare the account query");
+    db->bindValue(1, name);
+    const dal::RecordSet &accountInfo = db->processSql();
+    if (accountInfo.isEmpty())
+        return rows;
+    const int accountId = atoi(accountInfo(0, 0).c_str());
+
+    if (!db->prepareSql("SELECT id FROM mana_characters WHERE user_id = ?"))
+        throw std::runtime_error("Could not prepare the character query");
+    db->bindValue(1, accountId);
+    const dal::RecordSet &charInfo = db->processSql();
+
+    std::vector<int> characterIds;
+    for (unsigned i = 0; i < charInfo.rows(); ++i)
+        characterIds.push_back(atoi(charInfo(i, 0).c_str()));
+
+    for (int id : characterIds)
+    {
+        rows.characters += countRows(
+                    db, "SELECT * FROM mana_characters WHERE id = ?", id);
+        rows.attributes += countRows(
+                    db, "SELECT attr_id, attr_base, attr_mod "
+                    "FROM mana_char_attr WHERE char_id = ?", id);
+        rows.statusEffects += countRows(
+                    db, "SELECT status_id, status_time "
+                    "FROM mana_char_status_effects WHERE char_id = ?", id);
+        rows.kills += countRows(
+                    db, "SELECT monster_id, kills "
+                    "FROM mana_char_kill_stats WHERE char_id = ?", id);
+        rows.abilities += countRows(
+                    db, "SELECT ability_id "
+                    "FROM mana_char_abilities WHERE char_id = ?", id);
+        countRows(db, "SELECT quest_id, quest_state, quest_title, "
+                  "quest_description FROM mana_questlog WHERE char_id = ?",
+                  id);
+        rows.items += countRows(
+                    db, "SELECT slot, class_id, amount, equipped "
+                    "FROM mana_inventories WHERE owner_id = ? "
+                    "ORDER BY slot ASC", id);
+    }
+    return rows;
+}
+
+/**
+ * Loads an account with Storage::getAccount().
+ */
+static LoadedRows loadWithStorage(const std::string &name)
+{
+    LoadedRows rows;
+    std::unique_ptr<Account> account(storage->getAccount(name));
+    if (!account)
+        return rows;
+
+    for (auto &it : account->getCharacters())
+    {
+        const CharacterData *character = it.second;
+        ++rows.characters;
+        rows.attributes += character->getAttributes().size();
+        rows.statusEffects += character->getStatusEffectSize();
+        rows.kills += character->getKillCountSize();
+        rows.abilities += character->getAbilities().size();
+        rows.items += character->getPossessions().getInventory().size();
+    }
+    return rows;
+}
+
+/**
+ * Loads random accounts with \a load, keeping what was loaded in \a loaded.
+ */
+template <typename Load>
+static Result run(const Options &options, std::vector<LoadedRows> &loaded,
+                  Load load)
+{
+    using namespace std::chrono;
+
+    Result result;
+    result.maxMs = 0;
+    double totalMs = 0;
+
+    randomSeed = 1;
+    for (int i = 0; i < options.logins; ++i)
+    {
+        const std::string name = accountName(randomNumber(options.accounts));
+
+        const auto start = steady_clock::now();
+        loaded.push_back(load(name));
+        const double ms =
+                duration<double, std::milli>(steady_clock::now() - start)
+                .count();
+
+        totalMs += ms;
+        result.maxMs = std::max(result.maxMs, ms);
+    }
+
+    result.averageMs = totalMs / options.logins;
+    result.loadsPerSecond = options.logins * 1000 / totalMs;
+    return result;
+}
+
+static void printResult(const char *name, const Result &result)
+{
+    std::cout << name << result.loadsPerSecond << " accounts/s, "
+              << result.averageMs << " ms on average, "
+              << result.maxMs << " ms at most" << std::endl;
+}
+
+static void printUsage()
+{
+    std::cout << "manaserv-loadbench" << std::endl << std::endl
+              << "Options: " << std::endl
+              << "     --accounts <n>    : Accounts in the database"
+              << " (Default: 1000)" << std::endl
+              << "     --characters <n>  : Characters of every account"
+              << " (Default: 3)" << std::endl
+              << "     --logins <n>      : Accounts loaded"
+              << " (Default: 5000)" << std::endl
+              << "     --database <file> : SQLite database file,"
+              << " overwritten" << std::endl
+              << "                         (Default:"
+              << " /tmp/manaserv-loadbench.db)" << std::endl;
+}
+
+static bool parseOptions(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (arg == "--accounts" && hasValue)
+            options.accounts = atoi(argv[++i]);
+        else if (arg == "--characters" && hasValue)
+            options.characters = atoi(argv[++i]);
+        else if (arg == "--logins" && hasValue)
+            options.logins = atoi(argv[++i]);
+        else if (arg == "--database" && hasValue)
+            options.database = argv[++i];
+        else
+            return false;
+    }
+    return options.accounts > 0 && options.characters > 0 &&
+            options.logins > 0;
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    if (!createDatabase(options.database))
+        return 1;
+
+    configuration["sqlite_database"] = options.database;
+    configuration["sql_characterJournal"] = options.database + ".characters";
+
+    bool ok = true;
+    try
+    {
+        Storage realStorage;
+        storage = &realStorage;
+        storage->open();
+        addAccounts(options);
+
+        std::unique_ptr<dal::DataProvider> db(
+                dal::DataProviderFactory::createDataProvider());
+        db->connect();
+
+        std::vector<LoadedRows> before;
+        const Result perCharacter = run(options, before,
+                                        [&db] (const std::string &name) {
+            return loadPerCharacter(db.get(), name);
+        });
+        db->disconnect();
+
+        std::vector<LoadedRows> after;
+        const Result setBased = run(options, after, loadWithStorage);
+
+        storage->close();
+        storage = nullptr;
+
+        std::cout << "Accounts of " << options.characters << " characters:"
+                  << std::endl;
+        printResult("  query per character: ", perCharacter);
+        printResult("  query per table:     ", setBased);
+
+        const int expected = options.logins * options.characters;
+        int characters = 0;
+        for (const LoadedRows &rows : after)
+            characters += rows.characters;
+
+        if (before != after || characters != expected)
+        {
+            std::cout << "  The loaders found different rows" << std::endl;
+            ok = false;
+        }
+    }
+    catch (const std::string &error)
+    {
+        std::cout << error << std::endl;
+        ok = false;
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << e.what() << std::endl;
+        ok = false;
+    }
+
+    removeDatabase(options.database);
+
+    std::cout << (ok ? "Passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,582 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A load test client for the account server. It simulates a large number of
+ * players logging in at the same time, like after a server restart.
+ *
+ * The test accounts are created first with --register, and logged in without
+ * it. Each client follows the login sequence of the real client and the
+ * results are summarized at the end:
+ *
+ *     manaserv-loginstorm --clients 5000 --register
+ *     manaserv-loginstorm --clients 5000 --addresses 250
+ *
+ * The account server allows one login per second and address, so the
+ * clients can be spread over several loopback addresses with --addresses
+ * when testing locally. The account server has to run with net_debugMode
+ * disabled.
+ */
+
+#include "common/configuration.h"
+#include "common/manaserv_protocol.h"
+#include "utils/processorutils.h"
+#include "utils/sha256.h"
+
+#include <enet/enet.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+using namespace ManaServ;
+
+/** The most peers a single ENet host is used for. */
+static const size_t PEERS_PER_HOST = 4000;
+
+static int64_t now()
+{
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(
+                steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * A message in the format of MessageOut, without debug mode.
+ */
+class Message
+{
+    public:
+        Message(int id)
+        { writeInt16(id); }
+
+        void writeInt8(int value)
+        { mData += (char) value; }
+
+        void writeInt16(int value)
+        {
+            uint16_t t = ENET_HOST_TO_NET_16(value);
+            mData.append((const char *) &t, 2);
+        }
+
+        void writeInt32(int value)
+        {
+            uint32_t t = ENET_HOST_TO_NET_32(value);
+            mData.append((const char *) &t, 4);
+        }
+
+        void writeString(const std::string &string)
+        {
+            writeInt16(string.length());
+            mData += string;
+        }
+
+        void send(ENetPeer *peer) const
+        {
+            ENetPacket *packet = enet_packet_create(mData.data(),
+                                                    mData.size(),
+                                                    ENET_PACKET_FLAG_RELIABLE);
+            enet_peer_send(peer, 0, packet);
+        }
+
+    private:
+        std::string mData;
+};
+
+/**
+ * Reads a received message in the format of MessageIn, without debug mode.
+ */
+class Reader
+{
+    public:
+        Reader(const ENetPacket *packet):
+            mData(packet->data),
+            mLength(packet->dataLength),
+            mPos(0)
+        {}
+
+        int readInt8()
+        {
+            if (mPos + 1 > mLength)
+                return -1;
+            return mData[mPos++];
+        }
+
+        int readInt16()
+        {
+            uint16_t t;
+            if (mPos + 2 > mLength)
+                return -1;
+            memcpy(&t, mData + mPos, 2);
+            mPos += 2;
+            return (int16_t) ENET_NET_TO_HOST_16(t);
+        }
+
+        int readInt32()
+        {
+            uint32_t t;
+            if (mPos + 4 > mLength)
+                return -1;
+            memcpy(&t, mData + mPos, 4);
+            mPos += 4;
+            return (int32_t) ENET_NET_TO_HOST_32(t);
+        }
+
+        std::string readString()
+        {
+            int length = readInt16();
+            if (length < 0 || mPos + length > mLength)
+                return std::string();
+            std::string s((const char *) mData + mPos, length);
+            mPos += length;
+            return s;
+        }
+
+    private:
+        const unsigned char *mData;
+        size_t mLength;
+        size_t mPos;
+};
+
+struct Options
+{
+    std::string host = "localhost";
+    int port = DEFAULT_SERVER_PORT;
+    int clients = 1000;
+    int rate = 0;                       /**< Connects per second, 0 for all. */
+    int addresses = 1;
+    int timeout = 300;
+    std::string prefix = "storm";
+    std::string password = "loginstorm";
+    bool registerAccounts = false;
+};
+
+enum ClientState
+{
+    CLIENT_IDLE,
+    CLIENT_CONNECTING,
+    CLIENT_REGISTERING,
+    CLIENT_WAITING_FOR_SEED,
+    CLIENT_LOGGING_IN,
+    CLIENT_DONE
+};
+
+struct Client
+{
+    ClientState state = CLIENT_IDLE;
+    ENetPeer *peer = nullptr;
+    std::string username;
+    std::string salt;
+    int64_t started = 0;        /**< When the connection was started. */
+    int64_t seeded = 0;         /**< When the random seed arrived. */
+    int64_t finished = 0;
+    int64_t retryAt = 0;        /**< When to send the login again, or 0. */
+    int queuePosition = 0;      /**< The first queue position received. */
+    int retries = 0;
+    int result = -1;            /**< Error code, -1 when disconnected. */
+};
+
+/**
+ * Returns the password as sent by the client when registering.
+ */
+static std::string registerPassword(const Client &client,
+                                    const Options &options)
+{
+    return sha256(client.username + options.password);
+}
+
+static void sendLogin(Client &client, const Options &options)
+{
+    Message msg(PAMSG_LOGIN);
+    msg.writeInt32(PROTOCOL_VERSION);
+    msg.writeString(client.username);
+    msg.writeString(sha256(sha256(registerPassword(client, options)) +
+                           client.salt));
+    msg.send(client.peer);
+    client.state = CLIENT_LOGGING_IN;
+}
+
+static void finish(Client &client, int result)
+{
+    client.state = CLIENT_DONE;
+    client.result = result;
+    client.finished = now();
+    enet_peer_disconnect_later(client.peer, 0);
+}
+
+static void connected(Client &client, const Options &options)
+{
+    if (options.registerAccounts)
+    {
+        Message msg(PAMSG_REGISTER);
+        msg.writeInt32(PROTOCOL_VERSION);
+        msg.writeString(client.username);
+        msg.writeString(registerPassword(client, options));
+        msg.writeString(client.username + "@loginstorm.example.com");
+        msg.writeString(std::string());
+        msg.send(client.peer);
+        client.state = CLIENT_REGISTERING;
+    }
+    else
+    {
+        Message msg(PAMSG_LOGIN_RNDTRGR);
+        msg.writeString(client.username);
+        msg.send(client.peer);
+        client.state = CLIENT_WAITING_FOR_SEED;
+    }
+}
+
+static void received(Client &client, const ENetPacket *packet,
+                     const Options &options)
+{
+    Reader msg(packet);
+    const int id = msg.readInt16();
+
+    if (id & XXMSG_DEBUG_FLAG)
+    {
+        std::cerr << "The server runs in debug mode, which is not supported."
+                  << std::endl;
+        exit(1);
+    }
+
+    switch (id)
+    {
+        case APMSG_REGISTER_RESPONSE:
+        {
+            // Existing accounts are fine, the test may be run repeatedly
+            const int error = msg.readInt8();
+            finish(client, error == REGISTER_EXISTS_USERNAME ? ERRMSG_OK
+                                                             : error);
+        } break;
+
+        case APMSG_LOGIN_QUEUE_POSITION:
+            if (!client.queuePosition)
+                client.queuePosition = msg.readInt32();
+            break;
+
+        case APMSG_LOGIN_RNDTRGR_RESPONSE:
+            client.salt = msg.readString();
+            client.seeded = now();
+            sendLogin(client, options);
+            break;
+
+        case APMSG_LOGIN_RESPONSE:
+        {
+            const int error = msg.readInt8();
+            if (error == LOGIN_INVALID_TIME)
+            {
+                // Another client logged in from the same address just now
+                client.retryAt = now() + 1000;
+                ++client.retries;
+            }
+            else
+            {
+                finish(client, error);
+            }
+        } break;
+    }
+}
+
+static int percentile(std::vector<int64_t> &values, int p)
+{
+    if (values.empty())
+        return 0;
+    size_t index = std::min(values.size() - 1, values.size() * p / 100);
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return (int) values[index];
+}
+
+static void printUsage()
+{
+    std::cout << "manaserv-loginstorm" << std::endl << std::endl
+              << "Options: " << std::endl
+              << "  -h --help            : Display this help" << std::endl
+              << "     --host <host>     : The account server host"
+              << " (Default: localhost)" << std::endl
+              << "     --port <n>        : The account server port"
+              << " (Default: " << DEFAULT_SERVER_PORT << ")" << std::endl
+              << "     --clients <n>     : Number of clients (Default: 1000)"
+              << std::endl
+              << "     --rate <n>        : Connections started per second,"
+              << " 0 for all at once" << std::endl
+              << "     --addresses <n>   : Spread the clients over 127.0.0.1"
+              << " to 127.0.0.<n>" << std::endl
+              << "     --timeout <n>     : Give up after n seconds"
+              << " (Default: 300)" << std::endl
+              << "     --prefix <name>   : Prefix of the account names"
+              << " (Default: storm)" << std::endl
+              << "     --password <pass> : Password of the accounts"
+              << std::endl
+              << "     --register        : Create the accounts instead of"
+              << " logging in" << std::endl;
+}
+
+static bool parseOptions(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (arg == "--register")
+            options.registerAccounts = true;
+        else if (arg == "--host" && hasValue)
+            options.host = argv[++i];
+        else if (arg == "--port" && hasValue)
+            options.port = atoi(argv[++i]);
+        else if (arg == "--clients" && hasValue)
+            options.clients = atoi(argv[++i]);
+        else if (arg == "--rate" && hasValue)
+            options.rate = atoi(argv[++i]);
+        else if (arg == "--addresses" && hasValue)
+            options.addresses = std::max(1, std::min(254, atoi(argv[++i])));
+        else if (arg == "--timeout" && hasValue)
+            options.timeout = atoi(argv[++i]);
+        else if (arg == "--prefix" && hasValue)
+            options.prefix = argv[++i];
+        else if (arg == "--password" && hasValue)
+            options.password = argv[++i];
+        else
+            return false;
+    }
+    return options.clients > 0;
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    utils::processor::init();
+
+    if (enet_initialize() != 0)
+    {
+        std::cerr << "Could not initialize ENet." << std::endl;
+        return 1;
+    }
+    atexit(enet_deinitialize);
+
+    ENetAddress serverAddress;
+    serverAddress.port = options.port;
+    if (enet_address_set_host(&serverAddress, options.host.c_str()) != 0)
+    {
+        std::cerr << "Unknown host " << options.host << std::endl;
+        return 1;
+    }
+
+    // Every address gets its own hosts, which hold a limited number of peers
+    const size_t clientsPerAddress =
+            (options.clients + options.addresses - 1) / options.addresses;
+    const size_t hostsPerAddress =
+            (clientsPerAddress + PEERS_PER_HOST - 1) / PEERS_PER_HOST;
+    std::vector<ENetHost *> hosts;
+    for (int a = 0; a < options.addresses; ++a)
+    {
+        for (size_t h = 0; h < hostsPerAddress; ++h)
+        {
+            ENetAddress bindAddress;
+            bindAddress.host = ENET_HOST_TO_NET_32(0x7F000001 + a);
+            bindAddress.port = 0;
+
+            ENetHost *host = enet_host_create(
+                        options.addresses > 1 ? &bindAddress : nullptr,
+                        PEERS_PER_HOST, 1, 0, 0);
+            if (!host)
+            {
+                std::cerr << "Could not create an ENet host." << std::endl;
+                return 1;
+            }
+            hosts.push_back(host);
+        }
+    }
+
+    std::vector<Client> clients(options.clients);
+    for (int i = 0; i < options.clients; ++i)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "%d", i);
+        clients[i].username = options.prefix + name;
+    }
+
+    std::cout << (options.registerAccounts ? "Registering " : "Logging in ")
+              << options.clients << " clients on " << options.host << ":"
+              << options.port << " from " << hosts.size() << " hosts"
+              << std::endl;
+
+    const int64_t start = now();
+    const int64_t deadline = start + options.timeout * 1000;
+    int started = 0;
+    int done = 0;
+
+    while (done < options.clients && now() < deadline)
+    {
+        // Start the connections that are due
+        const int64_t elapsed = now() - start;
+        const int due = options.rate > 0
+                ? std::min<int64_t>(options.clients,
+                                    elapsed * options.rate / 1000 + 1)
+                : options.clients;
+        for (; started < due; ++started)
+        {
+            Client &client = clients[started];
+            ENetHost *host = hosts[started % hosts.size()];
+            client.peer = enet_host_connect(host, &serverAddress, 1, 0);
+            if (!client.peer)
+            {
+                client.state = CLIENT_DONE;
+                ++done;
+                continue;
+            }
+            client.peer->data = &client;
+            client.state = CLIENT_CONNECTING;
+            client.started = now();
+        }
+
+        // Send the logins that were refused for being too fast
+        const int64_t time = now();
+        for (int i = 0; i < started; ++i)
+        {
+            Client &client = clients[i];
+            if (client.retryAt && client.retryAt <= time &&
+                client.state == CLIENT_LOGGING_IN)
+            {
+                client.retryAt = 0;
+                sendLogin(client, options);
+            }
+        }
+
+        bool idle = true;
+        for (ENetHost *host : hosts)
+        {
+            ENetEvent event;
+            while (enet_host_service(host, &event, 0) > 0)
+            {
+                idle = false;
+                Client &client = *static_cast<Client *>(event.peer->data);
+
+                switch (event.type)
+                {
+                    case ENET_EVENT_TYPE_CONNECT:
+                        connected(client, options);
+                        break;
+
+                    case ENET_EVENT_TYPE_RECEIVE:
+                        if (client.state != CLIENT_DONE)
+                        {
+                            received(client, event.packet, options);
+                            if (client.state == CLIENT_DONE)
+                                ++done;
+                        }
+                        enet_packet_destroy(event.packet);
+                        break;
+
+                    case ENET_EVENT_TYPE_DISCONNECT:
+                        if (client.state != CLIENT_DONE)
+                        {
+                            client.state = CLIENT_DONE;
+                            client.finished = now();
+                            ++done;
+                        }
+                        break;
+
+                    default:
+                        break;
+                }
+            }
+        }
+
+        if (idle)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // Let the disconnects go out
+    for (ENetHost *host : hosts)
+    {
+        enet_host_flush(host);
+        enet_host_destroy(host);
+    }
+
+    std::map<int, int> results;
+    std::vector<int64_t> latencies;
+    std::vector<int64_t> waits;
+    int queued = 0;
+    int maxQueuePosition = 0;
+    int retries = 0;
+
+    for (const Client &client : clients)
+    {
+        results[client.state == CLIENT_DONE ? client.result : -2]++;
+        if (client.state == CLIENT_DONE && client.result == ERRMSG_OK)
+        {
+            latencies.push_back(client.finished - client.started);
+            if (client.seeded)
+                waits.push_back(client.seeded - client.started);
+        }
+        if (client.queuePosition)
+        {
+            ++queued;
+            maxQueuePosition = std::max(maxQueuePosition,
+                                        client.queuePosition);
+        }
+        retries += client.retries;
+    }
+
+    std::cout << "Finished in " << (now() - start) << " ms" << std::endl;
+    for (auto &it : results)
+    {
+        if (it.first == -2)
+            std::cout << "  timed out: ";
+        else if (it.first == -1)
+            std::cout << "  disconnected: ";
+        else
+            std::cout << "  result " << it.first << ": ";
+        std::cout << it.second << std::endl;
+    }
+    std::cout << "Successful clients, total time in ms: p50 "
+              << percentile(latencies, 50) << ", p90 "
+              << percentile(latencies, 90) << ", p99 "
+              << percentile(latencies, 99) << ", max "
+              << percentile(latencies, 100) << std::endl;
+    if (!options.registerAccounts)
+    {
+        std::cout << "Time until the random seed in ms: p50 "
+                  << percentile(waits, 50) << ", p99 "
+                  << percentile(waits, 99) << std::endl
+                  << "Queued clients: " << queued
+                  << ", highest position: " << maxQueuePosition << std::endl
+                  << "Logins refused for being too fast: " << retries
+                  << std::endl;
+    }
+
+    return results[ERRMSG_OK] == options.clients ? 0 : 1;
+}
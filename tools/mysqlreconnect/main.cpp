@@ -0,0 +1,447 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A test of how the MySQL data provider handles a lost connection. It needs
+ * a local MySQL or MariaDB server and an account that may create databases,
+ * users and triggers:
+ *
+ *     manaserv-mysqlreconnect --user root --password secret
+ *
+ * The data provider connects as a test user, and its connection is killed
+ * from a second connection at the moments that matter:
+ *
+ *  - before a prepared SELECT and before a plain SELECT, which are run
+ *    again on a new connection,
+ *  - before an INSERT, which is done at most once,
+ *  - while an INSERT is running, after the server stored the row, which
+ *    must not be run again,
+ *  - within a transaction, which fails and is not retried,
+ *  - while the test user is dropped, so that the new connection fails and
+ *    the error is reported instead of crashing. The provider connects again
+ *    on the next query once the user is back.
+ *
+ * The database given with --database is created when needed, the tables and
+ * the test user are dropped at the end.
+ */
+
+#include "common/configuration.h"
+#include "dal/dalexcept.h"
+#include "dal/mysqldataprovider.h"
+#include "utils/logger.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+
+// The data provider reads its settings from the configuration
+static std::map<std::string, std::string> configuration;
+
+std::string Configuration::getValue(const std::string &key,
+                                    const std::string &deflt)
+{
+    std::map<std::string, std::string>::const_iterator i =
+            configuration.find(key);
+    return i != configuration.end() ? i->second : deflt;
+}
+
+int Configuration::getValue(const std::string &key, int deflt)
+{
+    std::map<std::string, std::string>::const_iterator i =
+            configuration.find(key);
+    return i != configuration.end() ? atoi(i->second.c_str()) : deflt;
+}
+
+namespace utils {
+Logger::Level Logger::mVerbosity = Logger::Fatal;
+void Logger::output(const std::string &, Level) {}
+}
+
+static const char *TEST_USER = "manaserv_reconnect";
+static const char *TEST_PASSWORD = "reconnect";
+
+struct Options
+{
+    std::string host = "localhost";
+    int port = 3306;
+    std::string user = "root";
+    std::string password;
+    std::string database = "manaserv_test";
+};
+
+/**
+ * A connection of its own, used to prepare the database and to kill the
+ * connection of the data provider.
+ */
+class Admin
+{
+    public:
+        Admin(): mDb(nullptr) {}
+
+        ~Admin()
+        {
+            if (mDb)
+                mysql_close(mDb);
+        }
+
+        bool connect(const Options &options)
+        {
+            mDb = mysql_init(nullptr);
+            if (!mysql_real_connect(mDb, options.host.c_str(),
+                                    options.user.c_str(),
+                                    options.password.c_str(), nullptr,
+                                    options.port, nullptr, 0))
+            {
+                std::cerr << "Could not connect: " << mysql_error(mDb)
+                          << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        bool exec(const std::string &sql)
+        {
+            if (mysql_query(mDb, sql.c_str()) != 0)
+            {
+                std::cerr << "Query failed: " << sql << ": "
+                          << mysql_error(mDb) << std::endl;
+                return false;
+            }
+            if (MYSQL_RES *res = mysql_store_result(mDb))
+                mysql_free_result(res);
+            return true;
+        }
+
+        /** Returns the first value of the result, or -1. */
+        int queryInt(const std::string &sql)
+        {
+            if (mysql_query(mDb, sql.c_str()) != 0)
+            {
+                std::cerr << "Query failed: " << sql << ": "
+                          << mysql_error(mDb) << std::endl;
+                return -1;
+            }
+
+            int value = -1;
+            if (MYSQL_RES *res = mysql_store_result(mDb))
+            {
+                if (MYSQL_ROW row = mysql_fetch_row(res))
+                    value = row[0] ? atoi(row[0]) : -1;
+                mysql_free_result(res);
+            }
+            return value;
+        }
+
+    private:
+        MYSQL *mDb;
+};
+
+static bool createTestUser(Admin &admin, const Options &options)
+{
+    for (const char *host : { "localhost", "%" })
+    {
+        std::ostringstream user;
+        user << "'" << TEST_USER << "'@'" << host << "'";
+        if (!admin.exec("CREATE USER " + user.str() + " IDENTIFIED BY '" +
+                        TEST_PASSWORD + "'") ||
+            !admin.exec("GRANT ALL ON " + options.database + ".* TO " +
+                        user.str()))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void dropTestUser(Admin &admin)
+{
+    for (const char *host : { "localhost", "%" })
+    {
+        std::ostringstream sql;
+        sql << "DROP USER IF EXISTS '" << TEST_USER << "'@'" << host << "'";
+        admin.exec(sql.str());
+    }
+}
+
+static int connectionId(dal::DataProvider &db)
+{
+    const dal::RecordSet &rs = db.execSql("SELECT CONNECTION_ID()", true);
+    return atoi(rs(0, 0).c_str());
+}
+
+/** Kills the connection \a id, after waiting \a delay milliseconds. */
+static void killConnection(Admin &admin, int id, int delay = 0)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+
+    std::ostringstream sql;
+    sql << "KILL " << id;
+    admin.exec(sql.str());
+
+    // Give the server time to close the socket
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+}
+
+static int countRows(Admin &admin, const char *table, int value)
+{
+    std::ostringstream sql;
+    sql << "SELECT COUNT(*) FROM " << table << " WHERE value = " << value;
+    return admin.queryInt(sql.str());
+}
+
+static void insert(dal::DataProvider &db, const char *table, int value)
+{
+    std::ostringstream sql;
+    sql << "INSERT INTO " << table << " (value) VALUES (?)";
+    if (db.prepareSql(sql.str()))
+    {
+        db.bindValue(1, value);
+        db.processSql();
+    }
+}
+
+static bool testPreparedSelect(dal::DataProvider &db, Admin &admin)
+{
+    // The statement gets compiled on the connection that is killed
+    const std::string sql = "SELECT COUNT(*) FROM reconnect_test";
+    if (!db.prepareSql(sql) || !db.fetchRow())
+        return false;
+    while (db.fetchRow()) {}
+
+    killConnection(admin, connectionId(db));
+
+    if (!db.prepareSql(sql) || !db.fetchRow())
+        return false;
+    while (db.fetchRow()) {}
+    return true;
+}
+
+static bool testPlainSelect(dal::DataProvider &db, Admin &admin)
+{
+    killConnection(admin, connectionId(db));
+    return db.execSql("SELECT 1", true)(0, 0) == "1";
+}
+
+static bool testInsertAfterKill(dal::DataProvider &db, Admin &admin)
+{
+    killConnection(admin, connectionId(db));
+
+    // May fail, but may not be done twice
+    insert(db, "reconnect_test", 3);
+    if (countRows(admin, "reconnect_test", 3) > 1)
+        return false;
+
+    // The next query gets a new connection
+    insert(db, "reconnect_test", 4);
+    return countRows(admin, "reconnect_test", 4) == 1;
+}
+
+static bool testInsertLostWhileRunning(dal::DataProvider &db, Admin &admin)
+{
+    // The trigger of the MyISAM table sleeps after the row is stored, which
+    // the kill does not undo
+    std::thread killer(killConnection, std::ref(admin), connectionId(db),
+                       500);
+    insert(db, "reconnect_slow", 5);
+    killer.join();
+
+    return countRows(admin, "reconnect_slow", 5) == 1 &&
+            db.execSql("SELECT 1", true)(0, 0) == "1";
+}
+
+static bool testTransaction(dal::DataProvider &db, Admin &admin)
+{
+    bool failed = false;
+    try
+    {
+        dal::PerformTransaction transaction(&db);
+        db.execSql("INSERT INTO reconnect_test (value) VALUES (6)", true);
+        killConnection(admin, connectionId(db));
+        db.execSql("INSERT INTO reconnect_test (value) VALUES (7)", true);
+        transaction.commit();
+    }
+    catch (const dal::DbSqlQueryExecFailure &)
+    {
+        failed = true;
+    }
+
+    return failed &&
+            countRows(admin, "reconnect_test", 6) == 0 &&
+            countRows(admin, "reconnect_test", 7) == 0 &&
+            db.execSql("SELECT 1", true)(0, 0) == "1";
+}
+
+static bool testFailedReconnect(dal::DataProvider &db, Admin &admin,
+                                const Options &options)
+{
+    const int id = connectionId(db);
+    dropTestUser(admin);
+    killConnection(admin, id);
+
+    bool failed = false;
+    try
+    {
+        db.execSql("SELECT 1", true);
+    }
+    catch (const dal::DbSqlQueryExecFailure &)
+    {
+        failed = true;
+    }
+
+    const bool preparedFailed = !db.prepareSql("SELECT 2");
+
+    if (!createTestUser(admin, options))
+        return false;
+
+    return failed && preparedFailed &&
+            db.execSql("SELECT 1", true)(0, 0) == "1";
+}
+
+static void printUsage()
+{
+    std::cout << "manaserv-mysqlreconnect" << std::endl << std::endl
+              << "Options: " << std::endl
+              << "     --host <host>     : The MySQL server"
+              << " (Default: localhost)" << std::endl
+              << "     --port <n>        : The MySQL port (Default: 3306)"
+              << std::endl
+              << "     --user <name>     : An account that may create users"
+              << " (Default: root)" << std::endl
+              << "     --password <pass> : Its password" << std::endl
+              << "     --database <name> : The database to test in"
+              << " (Default: manaserv_test)" << std::endl;
+}
+
+static bool parseOptions(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (arg == "--host" && hasValue)
+            options.host = argv[++i];
+        else if (arg == "--port" && hasValue)
+            options.port = atoi(argv[++i]);
+        else if (arg == "--user" && hasValue)
+            options.user = argv[++i];
+        else if (arg == "--password" && hasValue)
+            options.password = argv[++i];
+        else if (arg == "--database" && hasValue)
+            options.database = argv[++i];
+        else
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    Admin admin;
+    if (!admin.connect(options))
+        return 1;
+
+    dropTestUser(admin);
+    if (!admin.exec("CREATE DATABASE IF NOT EXISTS " + options.database) ||
+        !admin.exec("USE " + options.database) ||
+        !admin.exec("DROP TABLE IF EXISTS reconnect_test, reconnect_slow") ||
+        !admin.exec("CREATE TABLE reconnect_test (id INT AUTO_INCREMENT "
+                    "PRIMARY KEY, value INT) ENGINE=InnoDB") ||
+        !admin.exec("CREATE TABLE reconnect_slow (id INT AUTO_INCREMENT "
+                    "PRIMARY KEY, value INT) ENGINE=MyISAM") ||
+        !admin.exec("CREATE TRIGGER reconnect_slow_insert AFTER INSERT ON "
+                    "reconnect_slow FOR EACH ROW SET @slept = SLEEP(2)") ||
+        !createTestUser(admin, options))
+    {
+        return 1;
+    }
+
+    std::ostringstream port;
+    port << options.port;
+    configuration["mysql_hostname"] = options.host;
+    configuration["mysql_port"] = port.str();
+    configuration["mysql_database"] = options.database;
+    configuration["mysql_username"] = TEST_USER;
+    configuration["mysql_password"] = TEST_PASSWORD;
+    configuration["mysql_reconnectAttempts"] = "2";
+    configuration["mysql_reconnectDelay"] = "10";
+
+    dal::MySqlDataProvider db;
+    db.connect();
+
+    struct Test
+    {
+        const char *name;
+        std::function<bool()> run;
+    };
+
+    const Test tests[] = {
+        { "Prepared SELECT after a kill",
+          [&] { return testPreparedSelect(db, admin); } },
+        { "Plain SELECT after a kill",
+          [&] { return testPlainSelect(db, admin); } },
+        { "INSERT after a kill",
+          [&] { return testInsertAfterKill(db, admin); } },
+        { "INSERT killed after storing its row",
+          [&] { return testInsertLostWhileRunning(db, admin); } },
+        { "Kill within a transaction",
+          [&] { return testTransaction(db, admin); } },
+        { "Failed reconnect",
+          [&] { return testFailedReconnect(db, admin, options); } },
+    };
+
+    bool ok = true;
+    for (const Test &test : tests)
+    {
+        bool passed;
+        try
+        {
+            passed = test.run();
+        }
+        catch (const std::exception &e)
+        {
+            std::cout << test.name << ": " << e.what() << std::endl;
+            passed = false;
+        }
+
+        std::cout << test.name << ": " << (passed ? "passed" : "FAILED")
+                  << std::endl;
+        ok = ok && passed;
+    }
+
+    db.disconnect();
+    dropTestUser(admin);
+    admin.exec("DROP TABLE IF EXISTS reconnect_test, reconnect_slow");
+
+    std::cout << (ok ? "Passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
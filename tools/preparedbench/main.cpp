@@ -0,0 +1,420 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A benchmark of the prepared statement cache of the data providers, on
+ * SQLite:
+ *
+ *     manaserv-preparedbench --accounts 1000 --queries 20000 --logins 5000
+ *
+ * A database is created from the SQLite schema in the given file, which is
+ * overwritten, and filled with accounts of three characters each.
+ *
+ * First the account lookup by name is run through a data provider, once
+ * with the name concatenated into the SQL, so that every query is compiled
+ * like before the cache, and once as a bound parameter of a cached
+ * statement.
+ *
+ * Then a login storm runs the storage calls of a login, getAccount() and
+ * updateLastLogin(), through the real Storage. It is run once with
+ * sql_statementCacheSize at 1, so that the statements of a login compile
+ * each other out of the cache, and once with the default size.
+ *
+ * The test fails when the runs do not find the same accounts.
+ */
+
+#include "account-server/account.h"
+#include "account-server/character.h"
+#include "account-server/storage.h"
+#include "chat-server/guildmanager.h"
+#include "common/configuration.h"
+#include "common/defines.h"
+#include "common/resourcemanager.h"
+#include "dal/dataproviderfactory.h"
+#include "utils/logger.h"
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// The storage reads its settings from the configuration
+static std::map<std::string, std::string> configuration;
+
+std::string Configuration::getValue(const std::string &key,
+                                    const std::string &deflt)
+{
+    std::map<std::string, std::string>::const_iterator i =
+            configuration.find(key);
+    return i != configuration.end() ? i->second : deflt;
+}
+
+int Configuration::getValue(const std::string &key, int deflt)
+{
+    std::map<std::string, std::string>::const_iterator i =
+            configuration.find(key);
+    return i != configuration.end() ? atoi(i->second.c_str()) : deflt;
+}
+
+bool Configuration::getBoolValue(const std::string &key, bool deflt)
+{ return getValue(key, deflt ? 1 : 0) != 0; }
+
+namespace utils {
+Logger::Level Logger::mVerbosity = Logger::Fatal;
+void Logger::output(const std::string &, Level) {}
+}
+
+// Without an item database, the storage skips synchronizing the items
+std::string ResourceManager::resolve(const std::string &)
+{ return std::string(); }
+
+// Guilds are not loaded by the benchmark
+GuildManager *guildManager;
+void GuildManager::setUserRights(Guild *, int, int) {}
+
+Storage *storage;
+
+/** The characters of every account. */
+static const int CHARACTERS = 3;
+
+struct Options
+{
+    int accounts = 1000;
+    int queries = 20000;
+    int logins = 5000;
+    std::string database = "/tmp/manaserv-preparedbench.db";
+};
+
+static unsigned randomSeed = 1;
+
+static unsigned randomNumber(unsigned range)
+{
+    randomSeed = randomSeed * 1103515245 + 12345;
+    return (randomSeed >> 16) % range;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now() - start).count();
+}
+
+static std::string accountName(int account)
+{
+    return "preparedbench" + std::to_string(account);
+}
+
+static void removeDatabase(const std::string &database)
+{
+    std::remove(database.c_str());
+    std::remove((database + "-wal").c_str());
+    std::remove((database + "-shm").c_str());
+    std::remove((database + "-journal").c_str());
+    std::remove((database + ".characters").c_str());
+}
+
+/**
+ * Creates the tables of the SQLite schema in a new database.
+ */
+static bool createDatabase(const std::string &database)
+{
+    removeDatabase(database);
+
+    std::ifstream file(SCHEMA_FILE);
+    std::stringstream schema;
+    schema << file.rdbuf();
+
+    sqlite3 *db;
+    if (!file || sqlite3_open(database.c_str(), &db) != SQLITE_OK)
+    {
+        std::cerr << "Could not create " << database << " from "
+                  << SCHEMA_FILE << "." << std::endl;
+        return false;
+    }
+
+    char *error = nullptr;
+    if (sqlite3_exec(db, schema.str().c_str(), nullptr, nullptr, &error)
+        != SQLITE_OK)
+    {
+        std::cerr << "Could not create the tables: " << error << std::endl;
+        sqlite3_free(error);
+        sqlite3_close(db);
+        return false;
+    }
+    sqlite3_close(db);
+    return true;
+}
+
+/**
+ * Adds the accounts with their characters, saved once like a game server
+ * would so that they have rows in every table.
+ */
+static void addAccounts(int accounts)
+{
+    for (int i = 0; i < accounts; ++i)
+    {
+        const std::string name = accountName(i);
+        Account account;
+        account.setName(name);
+        account.setPassword(name);
+        account.setEmail(name);
+        account.setLevel(AL_PLAYER);
+        account.setRegistrationDate(time(nullptr));
+        account.setLastLogin(time(nullptr));
+        storage->addAccount(&account);
+
+        for (int slot = 1; slot <= CHARACTERS; ++slot)
+        {
+            CharacterData *character =
+                    new CharacterData(name + "-" + std::to_string(slot));
+            character->setCharacterSlot(slot);
+            character->setMapId(1);
+            for (int attr = 1; attr <= 20; ++attr)
+                character->setAttribute(attr, randomNumber(100));
+            for (int monster = 1; monster <= 10; ++monster)
+                character->setKillCount(monster, randomNumber(1000));
+
+            InventoryData inventory;
+            for (int itemSlot = 1; itemSlot <= 30; ++itemSlot)
+            {
+                InventoryItem &item = inventory[itemSlot];
+                item.slot = itemSlot;
+                item.itemId = 1 + randomNumber(500);
+                item.amount = 1 + randomNumber(20);
+            }
+            character->getPossessions().setInventory(inventory);
+
+            character->setAccount(&account);
+            account.addCharacter(character);
+        }
+        storage->flush(&account);
+
+        for (auto &it : account.getCharacters())
+            storage->updateCharacter(it.second);
+    }
+}
+
+/**
+ * Looks up random accounts by name through a data provider of its own.
+ * Returns the queries per second, and the ids found in \a ids.
+ */
+static double lookUpAccounts(bool prepared, const Options &options,
+                             std::vector<int> &ids)
+{
+    std::unique_ptr<dal::DataProvider> db(
+            dal::DataProviderFactory::createDataProvider());
+    db->connect();
+
+    randomSeed = 1;
+    const auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < options.queries; ++i)
+    {
+        const std::string name = accountName(randomNumber(options.accounts));
+
+        if (prepared)
+        {
+            db->prepareSql("SELECT id FROM mana_accounts WHERE username = ?");
+            db->bindValue(1, name);
+            const dal::RecordSet &result = db->processSql();
+            ids.push_back(result.isEmpty() ? 0 : atoi(result(0, 0).c_str()));
+        }
+        else
+        {
+            const dal::RecordSet &result = db->execSql(
+                        "SELECT id FROM mana_accounts WHERE username = '" +
+                        name + "'");
+            ids.push_back(result.isEmpty() ? 0 : atoi(result(0, 0).c_str()));
+        }
+    }
+
+    const double queriesPerSecond = options.queries / secondsSince(start);
+    db->disconnect();
+    return queriesPerSecond;
+}
+
+/**
+ * Runs the storage calls of the logins of random accounts, with the given
+ * statement cache size. Returns the logins per second, and the characters
+ * of the accounts logged in in \a characters.
+ */
+static double logIn(int cacheSize, const Options &options,
+                    std::vector<int> &characters)
+{
+    configuration["sql_statementCacheSize"] = std::to_string(cacheSize);
+
+    Storage runStorage;
+    storage = &runStorage;
+    storage->open();
+
+    randomSeed = 1;
+    const auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < options.logins; ++i)
+    {
+        const std::string name = accountName(randomNumber(options.accounts));
+        std::unique_ptr<Account> account(storage->getAccount(name));
+        if (!account)
+        {
+            characters.push_back(-1);
+            continue;
+        }
+
+        account->setLastLogin(time(nullptr));
+        storage->updateLastLogin(account.get());
+        characters.push_back(account->getCharacters().size());
+    }
+
+    const double loginsPerSecond = options.logins / secondsSince(start);
+    storage->close();
+    storage = nullptr;
+    return loginsPerSecond;
+}
+
+static void printUsage()
+{
+    std::cout << "manaserv-preparedbench" << std::endl << std::endl
+              << "Options: " << std::endl
+              << "     --accounts <n>    : Accounts in the database"
+              << " (Default: 1000)" << std::endl
+              << "     --queries <n>     : Account lookups"
+              << " (Default: 20000)" << std::endl
+              << "     --logins <n>      : Logins"
+              << " (Default: 5000)" << std::endl
+              << "     --database <file> : SQLite database file,"
+              << " overwritten" << std::endl
+              << "                         (Default:"
+              << " /tmp/manaserv-preparedbench.db)" << std::endl;
+}
+
+static bool parseOptions(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (arg == "--accounts" && hasValue)
+            options.accounts = atoi(argv[++i]);
+        else if (arg == "--queries" && hasValue)
+            options.queries = atoi(argv[++i]);
+        else if (arg == "--logins" && hasValue)
+            options.logins = atoi(argv[++i]);
+        else if (arg == "--database" && hasValue)
+            options.database = argv[++i];
+        else
+            return false;
+    }
+    return options.accounts > 0 && options.queries > 0 &&
+            options.logins > 0;
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    if (!createDatabase(options.database))
+        return 1;
+
+    configuration["sqlite_database"] = options.database;
+    configuration["sql_characterJournal"] = options.database + ".characters";
+
+    bool ok = true;
+    try
+    {
+        {
+            Storage setupStorage;
+            storage = &setupStorage;
+            storage->open();
+            addAccounts(options.accounts);
+            storage->close();
+            storage = nullptr;
+        }
+
+        std::vector<int> concatenatedIds;
+        std::vector<int> boundIds;
+        const double concatenated =
+                lookUpAccounts(false, options, concatenatedIds);
+        const double bound = lookUpAccounts(true, options, boundIds);
+
+        std::cout << "Account lookups:" << std::endl
+                  << "  concatenated SQL: " << concatenated << " queries/s"
+                  << std::endl
+                  << "  bound parameter:  " << bound << " queries/s"
+                  << std::endl;
+
+        if (concatenatedIds != boundIds ||
+            std::count(boundIds.begin(), boundIds.end(), 0))
+        {
+            std::cout << "  The lookups found different accounts"
+                      << std::endl;
+            ok = false;
+        }
+
+        std::vector<int> uncachedCharacters;
+        std::vector<int> cachedCharacters;
+        const double uncached = logIn(1, options, uncachedCharacters);
+        const double cached = logIn(64, options, cachedCharacters);
+
+        std::cout << "Logins:" << std::endl
+                  << "  1 cached statement:   " << uncached << " logins/s"
+                  << std::endl
+                  << "  64 cached statements: " << cached << " logins/s"
+                  << std::endl;
+
+        if (uncachedCharacters != cachedCharacters ||
+            std::count(cachedCharacters.begin(), cachedCharacters.end(),
+                       CHARACTERS) != options.logins)
+        {
+            std::cout << "  The logins found different characters"
+                      << std::endl;
+            ok = false;
+        }
+    }
+    catch (const std::string &error)
+    {
+        std::cout << error << std::endl;
+        ok = false;
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << e.what() << std::endl;
+        ok = false;
+    }
+
+    removeDatabase(options.database);
+
+    std::cout << (ok ? "Passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,524 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A throughput benchmark for quest variables, as used by quest-heavy
+ * scripts that increment counters all the time.
+ *
+ * The game server part runs a get, increment and set on random variables of
+ * random characters, once with a cache keyed by name that sends a
+ * GAMSG_SET_VAR_CHR message per change, and once with interned ids, integer
+ * values and changes coalesced into the periodic GAMSG_PLAYER_SYNC message.
+ * The messages are built with the real MessageOut:
+ *
+ *     manaserv-questbench --characters 500 --variables 16 --ops 10000000
+ *
+ * With --database, the account server part writes the same changes to an
+ * SQLite database in the given file, once as a DELETE and INSERT committed
+ * per change, and once coalesced and written in chunks in one transaction,
+ * like Storage::writeCharacterChanges() does. It also compares a lookup with
+ * and without the unique (owner_id, name) index. The file is overwritten.
+ */
+
+#include "common/manaserv_protocol.h"
+#include "net/messageout.h"
+#include "utils/logger.h"
+#include "utils/processorutils.h"
+#include "utils/string.h"
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace ManaServ;
+
+// The benchmark does not log anything
+namespace utils {
+Logger::Level Logger::mVerbosity = Logger::Fatal;
+void Logger::output(const std::string &, Level) {}
+}
+
+/** The number of ticks between two syncs, see AccountConnection. */
+static const int SYNC_TICKS = 100;
+
+/** The rows per statement, as in Storage::writeCharacterChanges(). */
+static const size_t ROWS_PER_STATEMENT = 32;
+
+struct Options
+{
+    int characters = 500;
+    int variables = 16;
+    int ops = 10000000;
+    int opsPerTick = 5000;
+    int changes = 20000;                /**< Database changes. */
+    std::string database;
+};
+
+struct Traffic
+{
+    size_t messages = 0;
+    size_t bytes = 0;
+
+    void send(const MessageOut &msg)
+    {
+        ++messages;
+        bytes += msg.getLength();
+    }
+};
+
+/**
+ * The value of a quest variable, kept as an integer when it is one. Mirrors
+ * the QuestVar of the game server, which needs the scripting headers.
+ */
+struct QuestVar
+{
+    QuestVar(): isInteger(false), integer(0) {}
+    explicit QuestVar(int value): isInteger(true), integer(value) {}
+
+    std::string toString() const
+    { return isInteger ? utils::toString(integer) : text; }
+
+    bool operator==(const QuestVar &other) const
+    {
+        return isInteger == other.isInteger &&
+                (isInteger ? integer == other.integer : text == other.text);
+    }
+
+    bool isInteger;
+    int integer;
+    std::string text;
+};
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now() - start).count();
+}
+
+static std::string variableName(int variable)
+{
+    return "quest_" + utils::toString(variable) + "_progress";
+}
+
+/** A simple deterministic random generator, the same for both runs. */
+class Random
+{
+    public:
+        Random(): mSeed(1) {}
+
+        unsigned next()
+        {
+            mSeed = mSeed * 1103515245 + 12345;
+            return mSeed >> 8;
+        }
+
+    private:
+        unsigned mSeed;
+};
+
+/**
+ * Quest variables kept by name, with a message for every change.
+ */
+static double runByName(const Options &options, Traffic &traffic)
+{
+    std::vector<std::map<std::string, std::string> > caches(options.characters);
+    Random random;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int op = 0; op < options.ops; ++op)
+    {
+        const unsigned r = random.next();
+        const int charId = r % options.characters;
+
+        // Scripts pass the name as a string every time
+        const std::string name = variableName(r / options.characters %
+                                              options.variables);
+
+        // tonumber(chr_get_quest(ch, name)) + 1
+        std::map<std::string, std::string> &cache = caches[charId];
+        auto it = cache.find(name);
+        const int count = it == cache.end() ? 0 : atoi(it->second.c_str());
+        const std::string value = utils::toString(count + 1);
+
+        // chr_set_quest(ch, name, value)
+        auto result = cache.insert(std::make_pair(name, value));
+        if (!result.second)
+        {
+            if (result.first->second == value)
+                continue;
+            result.first->second = value;
+        }
+
+        MessageOut msg(GAMSG_SET_VAR_CHR);
+        msg.writeInt32(charId + 1);
+        msg.writeString(name);
+        msg.writeString(value);
+        traffic.send(msg);
+    }
+    return secondsSince(start);
+}
+
+/**
+ * Quest variables kept by interned id, with the changes coalesced until the
+ * next sync.
+ */
+static double runById(const Options &options, Traffic &traffic)
+{
+    std::vector<std::unordered_map<int, QuestVar> > caches(options.characters);
+    std::map<std::pair<int, int>, QuestVar> pending;
+
+    // Looked up once, when the scripts are loaded
+    std::vector<std::string> names;
+    for (int v = 0; v < options.variables; ++v)
+        names.push_back(variableName(v));
+
+    Random random;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int op = 0; op < options.ops; ++op)
+    {
+        const unsigned r = random.next();
+        const int charId = r % options.characters;
+        const int id = r / options.characters % options.variables;
+
+        std::unordered_map<int, QuestVar> &cache = caches[charId];
+        auto it = cache.find(id);
+        const int count = it == cache.end() ? 0 : it->second.integer;
+        const QuestVar value(count + 1);
+
+        auto result = cache.insert(std::make_pair(id, value));
+        if (!result.second)
+        {
+            if (result.first->second == value)
+                continue;
+            result.first->second = value;
+        }
+        pending[std::make_pair(charId + 1, id)] = value;
+
+        if ((op + 1) % (options.opsPerTick * SYNC_TICKS) == 0 ||
+            op + 1 == options.ops)
+        {
+            MessageOut msg(GAMSG_PLAYER_SYNC);
+            for (auto &change : pending)
+            {
+                msg.writeInt8(SYNC_QUEST_VAR);
+                msg.writeInt32(change.first.first);
+                msg.writeString(names[change.first.second]);
+                msg.writeString(change.second.toString());
+            }
+            pending.clear();
+            traffic.send(msg);
+        }
+    }
+    return secondsSince(start);
+}
+
+static bool execute(sqlite3 *db, const std::string &sql)
+{
+    char *error = nullptr;
+    if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &error) != SQLITE_OK)
+    {
+        std::cerr << "SQL error: " << (error ? error : "?") << std::endl;
+        sqlite3_free(error);
+        return false;
+    }
+    return true;
+}
+
+static sqlite3 *createDatabase(const Options &options, bool index)
+{
+    std::remove(options.database.c_str());
+
+    sqlite3 *db = nullptr;
+    if (sqlite3_open(options.database.c_str(), &db) != SQLITE_OK)
+    {
+        std::cerr << "Could not open " << options.database << std::endl;
+        sqlite3_close(db);
+        return nullptr;
+    }
+
+    execute(db, "CREATE TABLE mana_quests (owner_id INTEGER NOT NULL, "
+                "name TEXT NOT NULL, value TEXT NOT NULL)");
+    if (index)
+    {
+        execute(db, "CREATE UNIQUE INDEX mana_quests_owner_name "
+                    "ON mana_quests ( owner_id, name )");
+    }
+
+    execute(db, "BEGIN");
+    sqlite3_stmt *insert;
+    sqlite3_prepare_v2(db, "INSERT INTO mana_quests VALUES (?, ?, '0')", -1,
+                       &insert, nullptr);
+    for (int c = 0; c < options.characters; ++c)
+    {
+        for (int v = 0; v < options.variables; ++v)
+        {
+            const std::string name = variableName(v);
+            sqlite3_bind_int(insert, 1, c + 1);
+            sqlite3_bind_text(insert, 2, name.c_str(), name.size(),
+                              SQLITE_TRANSIENT);
+            sqlite3_step(insert);
+            sqlite3_reset(insert);
+        }
+    }
+    sqlite3_finalize(insert);
+    execute(db, "COMMIT");
+    return db;
+}
+
+typedef std::pair<std::pair<int, std::string>, std::string> Change;
+
+static double writeByChange(sqlite3 *db, const std::vector<Change> &changes)
+{
+    sqlite3_stmt *remove;
+    sqlite3_stmt *insert;
+    sqlite3_prepare_v2(db, "DELETE FROM mana_quests "
+                       "WHERE owner_id = ? AND name = ?", -1, &remove, nullptr);
+    sqlite3_prepare_v2(db, "INSERT INTO mana_quests (owner_id, name, value) "
+                       "VALUES (?, ?, ?)", -1, &insert, nullptr);
+
+    const auto start = std::chrono::steady_clock::now();
+    for (const Change &change : changes)
+    {
+        const std::string &name = change.first.second;
+        sqlite3_bind_int(remove, 1, change.first.first);
+        sqlite3_bind_text(remove, 2, name.c_str(), name.size(),
+                          SQLITE_STATIC);
+        sqlite3_step(remove);
+        sqlite3_reset(remove);
+
+        sqlite3_bind_int(insert, 1, change.first.first);
+        sqlite3_bind_text(insert, 2, name.c_str(), name.size(),
+                          SQLITE_STATIC);
+        sqlite3_bind_text(insert, 3, change.second.c_str(),
+                          change.second.size(), SQLITE_STATIC);
+        sqlite3_step(insert);
+        sqlite3_reset(insert);
+    }
+    const double elapsed = secondsSince(start);
+
+    sqlite3_finalize(remove);
+    sqlite3_finalize(insert);
+    return elapsed;
+}
+
+static double writeBatch(sqlite3 *db, const std::vector<Change> &changes,
+                         size_t &rows)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    std::map<std::pair<int, std::string>, std::string> batch;
+    for (const Change &change : changes)
+        batch[change.first] = change.second;
+    rows = batch.size();
+
+    execute(db, "BEGIN");
+    auto it = batch.begin();
+    while (it != batch.end())
+    {
+        const size_t count = std::min<size_t>(ROWS_PER_STATEMENT,
+                                              std::distance(it, batch.end()));
+
+        std::string deleteSql = "DELETE FROM mana_quests WHERE ";
+        std::string insertSql =
+                "INSERT INTO mana_quests (owner_id, name, value) VALUES ";
+        for (size_t i = 0; i < count; ++i)
+        {
+            deleteSql += i ? " OR (owner_id = ? AND name = ?)"
+                           : "(owner_id = ? AND name = ?)";
+            insertSql += i ? ", (?, ?, ?)" : "(?, ?, ?)";
+        }
+
+        sqlite3_stmt *remove;
+        sqlite3_stmt *insert;
+        sqlite3_prepare_v2(db, deleteSql.c_str(), -1, &remove, nullptr);
+        sqlite3_prepare_v2(db, insertSql.c_str(), -1, &insert, nullptr);
+        for (size_t i = 0; i < count; ++i, ++it)
+        {
+            const std::string &name = it->first.second;
+            sqlite3_bind_int(remove, i * 2 + 1, it->first.first);
+            sqlite3_bind_text(remove, i * 2 + 2, name.c_str(), name.size(),
+                              SQLITE_STATIC);
+            sqlite3_bind_int(insert, i * 3 + 1, it->first.first);
+            sqlite3_bind_text(insert, i * 3 + 2, name.c_str(), name.size(),
+                              SQLITE_STATIC);
+            sqlite3_bind_text(insert, i * 3 + 3, it->second.c_str(),
+                              it->second.size(), SQLITE_STATIC);
+        }
+        sqlite3_step(remove);
+        sqlite3_step(insert);
+        sqlite3_finalize(remove);
+        sqlite3_finalize(insert);
+    }
+    execute(db, "COMMIT");
+
+    return secondsSince(start);
+}
+
+/** Returns the average time of a variable lookup in microseconds. */
+static double lookup(sqlite3 *db, const std::vector<Change> &changes)
+{
+    sqlite3_stmt *select;
+    sqlite3_prepare_v2(db, "SELECT value FROM mana_quests "
+                       "WHERE owner_id = ? AND name = ?", -1, &select, nullptr);
+
+    const size_t lookups = std::min<size_t>(changes.size(), 2000);
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < lookups; ++i)
+    {
+        const std::string &name = changes[i].first.second;
+        sqlite3_bind_int(select, 1, changes[i].first.first);
+        sqlite3_bind_text(select, 2, name.c_str(), name.size(), SQLITE_STATIC);
+        while (sqlite3_step(select) == SQLITE_ROW) {}
+        sqlite3_reset(select);
+    }
+    const double elapsed = secondsSince(start);
+
+    sqlite3_finalize(select);
+    return lookups ? elapsed / lookups * 1e6 : 0;
+}
+
+static bool runDatabase(const Options &options)
+{
+    std::vector<Change> changes;
+    Random random;
+    for (int i = 0; i < options.changes; ++i)
+    {
+        const unsigned r = random.next();
+        const int charId = r % options.characters + 1;
+        const int variable = r / options.characters % options.variables;
+        changes.push_back(Change(std::make_pair(charId,
+                                                variableName(variable)),
+                                 utils::toString(i)));
+    }
+
+    sqlite3 *db = createDatabase(options, false);
+    if (!db)
+        return false;
+    double elapsed = writeByChange(db, changes);
+    std::cout << "By change: " << changes.size() << " changes in "
+              << elapsed << " s, " << changes.size() / elapsed
+              << " changes/s" << std::endl;
+    const double unindexed = lookup(db, changes);
+    sqlite3_close(db);
+
+    db = createDatabase(options, true);
+    if (!db)
+        return false;
+    size_t rows;
+    elapsed = writeBatch(db, changes, rows);
+    std::cout << "Batched:   " << changes.size() << " changes, " << rows
+              << " rows after coalescing, in " << elapsed << " s, "
+              << changes.size() / elapsed << " changes/s" << std::endl;
+    const double indexed = lookup(db, changes);
+    sqlite3_close(db);
+
+    std::cout << "Lookup:    " << unindexed << " us without the index, "
+              << indexed << " us with it" << std::endl;
+    return true;
+}
+
+static void printUsage()
+{
+    std::cout << "manaserv-questbench" << std::endl << std::endl
+              << "Options: " << std::endl
+              << "  --characters <n>   : Number of characters"
+              << " (Default: 500)" << std::endl
+              << "  --variables <n>    : Quest variables per character"
+              << " (Default: 16)" << std::endl
+              << "  --ops <n>          : Get, increment and set operations"
+              << " (Default: 10000000)" << std::endl
+              << "  --ops-per-tick <n> : Operations per game tick"
+              << " (Default: 5000)" << std::endl
+              << "  --database <file>  : Also benchmark the database writes"
+              << " in this file" << std::endl
+              << "  --changes <n>      : Changes written to the database"
+              << " (Default: 20000)" << std::endl;
+}
+
+static bool parseOptions(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (arg == "--characters" && hasValue)
+            options.characters = atoi(argv[++i]);
+        else if (arg == "--variables" && hasValue)
+            options.variables = atoi(argv[++i]);
+        else if (arg == "--ops" && hasValue)
+            options.ops = atoi(argv[++i]);
+        else if (arg == "--ops-per-tick" && hasValue)
+            options.opsPerTick = atoi(argv[++i]);
+        else if (arg == "--database" && hasValue)
+            options.database = argv[++i];
+        else if (arg == "--changes" && hasValue)
+            options.changes = atoi(argv[++i]);
+        else
+            return false;
+    }
+    return options.characters > 0 && options.variables > 0 &&
+            options.ops > 0 && options.opsPerTick > 0 && options.changes >= 0;
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    utils::processor::init();
+
+    std::cout << options.ops << " operations on " << options.variables
+              << " variables of " << options.characters << " characters"
+              << std::endl;
+
+    Traffic byName;
+    double elapsed = runByName(options, byName);
+    std::cout << "By name: " << options.ops / elapsed / 1e6
+              << " M operations/s, " << byName.messages << " messages, "
+              << byName.bytes / 1e6 << " MB to the account server"
+              << std::endl;
+
+    Traffic byId;
+    elapsed = runById(options, byId);
+    std::cout << "By id:   " << options.ops / elapsed / 1e6
+              << " M operations/s, " << byId.messages << " messages, "
+              << byId.bytes / 1e6 << " MB to the account server"
+              << std::endl;
+
+    if (!options.database.empty() && !runDatabase(options))
+        return 1;
+
+    return 0;
+}
@@ -0,0 +1,439 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A benchmark of the character saves of the account server on SQLite, as
+ * done when a game server sends the data of a character:
+ *
+ *     manaserv-savebench --characters 200 --saves 5000
+ *
+ * The real Storage writes to a database created from the SQLite schema in
+ * the given file, which is overwritten. The saves are timed once with the
+ * settings SQLite used before the sqlite_* options, a rollback journal and
+ * synchronous=FULL, and once with the defaults of these options, a
+ * write-ahead log with synchronous=NORMAL. Like in the main loop of the
+ * account server, a checkpoint is requested every --checkpoint-interval
+ * seconds.
+ *
+ * Each save changes the position, an attribute, a kill count and an item of
+ * a random character. The test fails when the characters read back after
+ * reopening the database differ from the ones saved last.
+ */
+
+#include "account-server/account.h"
+#include "account-server/character.h"
+#include "account-server/storage.h"
+#include "chat-server/guildmanager.h"
+#include "common/configuration.h"
+#include "common/resourcemanager.h"
+#include "utils/logger.h"
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// The storage reads its settings from the configuration
+static std::map<std::string, std::string> configuration;
+
+std::string Configuration::getValue(const std::string &key,
+                                    const std::string &deflt)
+{
+    std::map<std::string, std::string>::const_iterator i =
+            configuration.find(key);
+    return i != configuration.end() ? i->second : deflt;
+}
+
+int Configuration::getValue(const std::string &key, int deflt)
+{
+    std::map<std::string, std::string>::const_iterator i =
+            configuration.find(key);
+    return i != configuration.end() ? atoi(i->second.c_str()) : deflt;
+}
+
+bool Configuration::getBoolValue(const std::string &key, bool deflt)
+{ return getValue(key, deflt ? 1 : 0) != 0; }
+
+namespace utils {
+Logger::Level Logger::mVerbosity = Logger::Fatal;
+void Logger::output(const std::string &, Level) {}
+}
+
+// Without an item database, the storage skips synchronizing the items
+std::string ResourceManager::resolve(const std::string &)
+{ return std::string(); }
+
+// Guilds are not loaded by the benchmark
+GuildManager *guildManager;
+void GuildManager::setUserRights(Guild *, int, int) {}
+
+Storage *storage;
+
+/** The attributes, kill counts and items of every character. */
+static const int ATTRIBUTES = 20;
+static const int MONSTERS = 10;
+static const int ITEMS = 30;
+
+struct Options
+{
+    int characters = 200;
+    int saves = 5000;
+    int checkpointInterval = 1;
+    std::string database = "/tmp/manaserv-savebench.db";
+};
+
+struct Mode
+{
+    const char *name;
+    const char *journalMode;    /**< Empty for the default options. */
+    const char *synchronous;
+};
+
+static unsigned randomSeed = 1;
+
+static unsigned randomNumber(unsigned range)
+{
+    randomSeed = randomSeed * 1103515245 + 12345;
+    return (randomSeed >> 16) % range;
+}
+
+static void removeDatabase(const std::string &database)
+{
+    std::remove(database.c_str());
+    std::remove((database + "-wal").c_str());
+    std::remove((database + "-shm").c_str());
+    std::remove((database + "-journal").c_str());
+    std::remove((database + ".characters").c_str());
+}
+
+/**
+ * Creates the tables of the SQLite schema in a new database.
+ */
+static bool createDatabase(const std::string &database)
+{
+    removeDatabase(database);
+
+    std::ifstream file(SCHEMA_FILE);
+    std::stringstream schema;
+    schema << file.rdbuf();
+
+    sqlite3 *db;
+    if (!file || sqlite3_open(database.c_str(), &db) != SQLITE_OK)
+    {
+        std::cerr << "Could not create " << database << " from "
+                  << SCHEMA_FILE << "." << std::endl;
+        return false;
+    }
+
+    char *error = nullptr;
+    if (sqlite3_exec(db, schema.str().c_str(), nullptr, nullptr, &error)
+        != SQLITE_OK)
+    {
+        std::cerr << "Could not create the tables: " << error << std::endl;
+        sqlite3_free(error);
+        sqlite3_close(db);
+        return false;
+    }
+    sqlite3_close(db);
+    return true;
+}
+
+/**
+ * Adds an account with a single character for each of the \a characters,
+ * and saves them once like a game server would.
+ */
+static void addCharacters(std::vector<std::unique_ptr<Account> > &accounts,
+                          int characters)
+{
+    for (int i = 0; i < characters; ++i)
+    {
+        const std::string name = "savebench" + std::to_string(i);
+        Account *account = new Account;
+        account->setName(name);
+        account->setPassword(name);
+        account->setEmail(name);
+        account->setRegistrationDate(time(nullptr));
+        account->setLastLogin(time(nullptr));
+        storage->addAccount(account);
+        accounts.push_back(std::unique_ptr<Account>(account));
+
+        CharacterData *character = new CharacterData(name);
+        character->setMapId(1);
+        character->setPosition(Point(randomNumber(4000), randomNumber(4000)));
+        for (int attr = 1; attr <= ATTRIBUTES; ++attr)
+        {
+            character->setAttribute(attr, randomNumber(100));
+            character->setModAttribute(attr, randomNumber(100));
+        }
+        for (int monster = 1; monster <= MONSTERS; ++monster)
+            character->setKillCount(monster, randomNumber(1000));
+        for (int ability = 1; ability <= 5; ++ability)
+            character->giveAbility(ability);
+        character->applyStatusEffect(1, 1000);
+
+        InventoryData inventory;
+        for (int slot = 1; slot <= ITEMS; ++slot)
+        {
+            InventoryItem &item = inventory[slot];
+            item.slot = slot;
+            item.itemId = 1 + randomNumber(500);
+            item.amount = 1 + randomNumber(20);
+        }
+        character->getPossessions().setInventory(inventory);
+
+        character->setAccount(account);
+        account->addCharacter(character);
+        storage->flush(account);
+
+        // The first save of a character writes all its rows
+        storage->updateCharacter(character);
+    }
+}
+
+/**
+ * Changes a few values of \a character, like playing a bit does.
+ */
+static void play(CharacterData *character)
+{
+    const Point &position = character->getPosition();
+    character->setPosition(Point(position.x + 1, position.y));
+
+    const unsigned attr = 1 + randomNumber(ATTRIBUTES);
+    character->setModAttribute(attr, randomNumber(100));
+
+    const int monster = 1 + randomNumber(MONSTERS);
+    character->setKillCount(monster, randomNumber(1000));
+
+    InventoryData inventory = character->getPossessions().getInventory();
+    inventory[1 + randomNumber(ITEMS)].amount = 1 + randomNumber(20);
+    character->getPossessions().setInventory(inventory);
+}
+
+static bool sameCharacter(const CharacterData *saved,
+                          const CharacterData *loaded)
+{
+    if (saved->getPosition() != loaded->getPosition() ||
+        saved->getAttributes().size() != loaded->getAttributes().size())
+        return false;
+
+    for (auto &it : saved->getAttributes())
+    {
+        auto loadedIt = loaded->getAttributes().find(it.first);
+        if (loadedIt == loaded->getAttributes().end() ||
+            loadedIt->second.base != it.second.base ||
+            loadedIt->second.modified != it.second.modified)
+            return false;
+    }
+
+    if (!std::equal(saved->getKillCountBegin(), saved->getKillCountEnd(),
+                    loaded->getKillCountBegin()) ||
+        saved->getKillCountSize() != loaded->getKillCountSize())
+        return false;
+
+    const InventoryData &inventory = saved->getPossessions().getInventory();
+    const InventoryData &loadedInventory =
+            loaded->getPossessions().getInventory();
+    if (inventory.size() != loadedInventory.size())
+        return false;
+    for (auto &it : inventory)
+    {
+        auto loadedIt = loadedInventory.find(it.first);
+        if (loadedIt == loadedInventory.end() ||
+            loadedIt->second.itemId != it.second.itemId ||
+            loadedIt->second.amount != it.second.amount)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Times the saves in the given mode, and checks the characters read back.
+ * Returns the saves per second, or 0 on failure.
+ */
+static double run(const Mode &mode, const Options &options)
+{
+    if (!createDatabase(options.database))
+        return 0;
+
+    configuration["sqlite_database"] = options.database;
+    configuration["sql_characterJournal"] = options.database + ".characters";
+    if (*mode.journalMode)
+    {
+        configuration["sqlite_journalMode"] = mode.journalMode;
+        configuration["sqlite_synchronous"] = mode.synchronous;
+    }
+    else
+    {
+        configuration.erase("sqlite_journalMode");
+        configuration.erase("sqlite_synchronous");
+    }
+
+    // A new storage, since it remembers the rows it saved
+    Storage runStorage;
+    storage = &runStorage;
+
+    std::vector<std::unique_ptr<Account> > accounts;
+    double savesPerSecond = 0;
+    bool ok = true;
+
+    try
+    {
+        storage->open();
+        addCharacters(accounts, options.characters);
+
+        using namespace std::chrono;
+        const auto start = steady_clock::now();
+        auto lastCheckpoint = start;
+
+        for (int i = 0; i < options.saves; ++i)
+        {
+            Account *account = accounts[randomNumber(accounts.size())].get();
+            CharacterData *character = account->getCharacters().begin()->second;
+            play(character);
+            storage->updateCharacter(character);
+
+            const auto now = steady_clock::now();
+            if (now - lastCheckpoint >= seconds(options.checkpointInterval))
+            {
+                storage->processCompletions();
+                storage->checkpoint();
+                lastCheckpoint = now;
+            }
+        }
+
+        savesPerSecond = options.saves /
+                duration<double>(steady_clock::now() - start).count();
+
+        storage->close();
+        storage->open();
+
+        int mismatches = 0;
+        for (auto &account : accounts)
+        {
+            CharacterData *character = account->getCharacters().begin()->second;
+            std::unique_ptr<CharacterData> loaded(
+                    storage->getCharacter(character->getDatabaseID(),
+                                          nullptr));
+            if (!loaded || !sameCharacter(character, loaded.get()))
+                ++mismatches;
+        }
+        storage->close();
+
+        if (mismatches)
+        {
+            std::cout << "  " << mismatches << " characters differ from"
+                      << " their last save" << std::endl;
+            ok = false;
+        }
+    }
+    catch (const std::string &error)
+    {
+        std::cout << "  " << error << std::endl;
+        ok = false;
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "  " << e.what() << std::endl;
+        ok = false;
+    }
+
+    removeDatabase(options.database);
+    storage = nullptr;
+    return ok ? savesPerSecond : 0;
+}
+
+static void printUsage()
+{
+    std::cout << "manaserv-savebench" << std::endl << std::endl
+              << "Options: " << std::endl
+              << "     --characters <n>          : Characters saved"
+              << " (Default: 200)" << std::endl
+              << "     --saves <n>               : Saves timed"
+              << " (Default: 5000)" << std::endl
+              << "     --checkpoint-interval <s> : Seconds between"
+              << " checkpoints (Default: 1)" << std::endl
+              << "     --database <file>         : SQLite database file,"
+              << " overwritten" << std::endl
+              << "                                 (Default:"
+              << " /tmp/manaserv-savebench.db)" << std::endl;
+}
+
+static bool parseOptions(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (arg == "--characters" && hasValue)
+            options.characters = atoi(argv[++i]);
+        else if (arg == "--saves" && hasValue)
+            options.saves = atoi(argv[++i]);
+        else if (arg == "--checkpoint-interval" && hasValue)
+            options.checkpointInterval = atoi(argv[++i]);
+        else if (arg == "--database" && hasValue)
+            options.database = argv[++i];
+        else
+            return false;
+    }
+    return options.characters > 0 && options.saves > 0 &&
+            options.checkpointInterval > 0;
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    configuration["sqlite_checkpointInterval"] =
+            std::to_string(options.checkpointInterval);
+
+    const Mode modes[] = {
+        { "rollback journal, synchronous=FULL", "DELETE", "FULL" },
+        { "write-ahead log, synchronous=NORMAL", "", "" },
+    };
+
+    bool ok = true;
+    for (const Mode &mode : modes)
+    {
+        std::cout << mode.name << ":" << std::endl;
+        const double savesPerSecond = run(mode, options);
+        if (savesPerSecond > 0)
+            std::cout << "  " << savesPerSecond << " saves/s" << std::endl;
+        else
+            ok = false;
+    }
+
+    std::cout << (ok ? "Passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,326 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A known-answer test and throughput benchmark for the SHA-256
+ * implementations in utils/sha256.cpp.
+ *
+ * Each implementation supported by the processor is tested in turn, by
+ * masking the processor features that utils::processor::init() detected:
+ *
+ *  - the scalar code,
+ *  - the SHA extensions,
+ *  - the AVX2 batch code.
+ *
+ * Each one has to reproduce the FIPS 180-2 test vectors, and to match the
+ * scalar code on messages of every length up to --max-length bytes. Then the
+ * hashes per second are measured on messages of --length bytes, which
+ * defaults to the size of a salted password hash:
+ *
+ *     manaserv-sha256bench --count 200000 --length 68
+ *
+ * The test fails when an implementation gives a wrong hash, or when the
+ * processor supports it but the SHA-256 code refused to use it.
+ */
+
+#include "utils/processorutils.h"
+#include "utils/sha256.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct Options
+{
+    int count = 200000;
+    int length = 68;
+    int maxLength = 1024;
+};
+
+struct KnownAnswer
+{
+    std::string message;
+    const char *hash;
+};
+
+/**
+ * An implementation to test, selected with the processor features it
+ * leaves enabled.
+ */
+struct Implementation
+{
+    const char *name;
+    bool shaExtensions;
+    bool avx2;
+    bool batch;                 /**< Whether to hash through the batch API. */
+    const char *expected;       /**< The expected sha256Implementation(). */
+};
+
+static std::vector<KnownAnswer> knownAnswers()
+{
+    std::vector<KnownAnswer> answers;
+    KnownAnswer answer;
+
+    answer.message = "";
+    answer.hash =
+        "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+    answers.push_back(answer);
+
+    answer.message = "abc";
+    answer.hash =
+        "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+    answers.push_back(answer);
+
+    answer.message =
+        "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    answer.hash =
+        "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1";
+    answers.push_back(answer);
+
+    answer.message =
+        "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+        "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu";
+    answer.hash =
+        "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1";
+    answers.push_back(answer);
+
+    answer.message = std::string(1000000, 'a');
+    answer.hash =
+        "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0";
+    answers.push_back(answer);
+
+    return answers;
+}
+
+/** Returns a message of the given length with varying bytes. */
+static std::string testMessage(int length, unsigned seed)
+{
+    std::string message(length, '\0');
+    for (int i = 0; i < length; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        message[i] = (char) (seed >> 16);
+    }
+    return message;
+}
+
+static std::vector<std::string> hash(const Implementation &implementation,
+                                     const std::vector<std::string> &messages)
+{
+    if (implementation.batch)
+        return sha256(messages);
+
+    std::vector<std::string> hashes;
+    hashes.reserve(messages.size());
+    for (const std::string &message : messages)
+        hashes.push_back(sha256(message));
+    return hashes;
+}
+
+static void selectImplementation(const Implementation &implementation,
+                                 bool hasShaExtensions, bool hasAvx2)
+{
+    utils::processor::hasShaExtensions =
+            hasShaExtensions && implementation.shaExtensions;
+    utils::processor::hasAvx2 = hasAvx2 && implementation.avx2;
+}
+
+/**
+ * Checks the known answers, and compares with \a reference, the hashes of
+ * the scalar code.
+ */
+static bool check(const Implementation &implementation,
+                  const std::vector<KnownAnswer> &answers,
+                  const std::vector<std::string> &messages,
+                  const std::vector<std::string> &reference)
+{
+    bool ok = true;
+
+    std::vector<std::string> answerMessages;
+    for (const KnownAnswer &answer : answers)
+        answerMessages.push_back(answer.message);
+    // The batch code is only used for more than one message
+    answerMessages.push_back(std::string());
+
+    const std::vector<std::string> answerHashes =
+            hash(implementation, answerMessages);
+    for (size_t i = 0; i < answers.size(); ++i)
+    {
+        if (answerHashes[i] != answers[i].hash)
+        {
+            std::cout << "  Wrong hash for the known answer " << i
+                      << ": " << answerHashes[i] << std::endl;
+            ok = false;
+        }
+    }
+
+    const std::vector<std::string> hashes = hash(implementation, messages);
+    int mismatches = 0;
+    for (size_t i = 0; i < messages.size(); ++i)
+    {
+        if (hashes[i] != reference[i])
+        {
+            if (mismatches++ < 10)
+            {
+                std::cout << "  Differs from the scalar code for a message "
+                          << "of " << messages[i].length() << " bytes"
+                          << std::endl;
+            }
+            ok = false;
+        }
+    }
+    if (mismatches > 10)
+        std::cout << "  ... " << mismatches << " mismatches" << std::endl;
+
+    return ok;
+}
+
+/** Returns the hashes per second. */
+static double benchmark(const Implementation &implementation,
+                        const Options &options)
+{
+    std::vector<std::string> messages;
+    for (int i = 0; i < options.count; ++i)
+        messages.push_back(testMessage(options.length, i));
+
+    // The account server hashes the login checks of an iteration at once
+    static const size_t BATCH_SIZE = 64;
+
+    using namespace std::chrono;
+    const auto start = steady_clock::now();
+    size_t hashed = 0;
+    for (size_t i = 0; i < messages.size(); i += BATCH_SIZE)
+    {
+        std::vector<std::string> batch(
+                    messages.begin() + i,
+                    messages.begin() + std::min(i + BATCH_SIZE,
+                                                messages.size()));
+        hashed += hash(implementation, batch).size();
+    }
+    const double elapsed = duration<double>(steady_clock::now() - start).count();
+    return hashed / elapsed;
+}
+
+static void printUsage()
+{
+    std::cout << "manaserv-sha256bench" << std::endl << std::endl
+              << "Options: " << std::endl
+              << "     --count <n>       : Hashes per benchmark"
+              << " (Default: 200000)" << std::endl
+              << "     --length <n>      : Length of the benchmark messages"
+              << " (Default: 68)" << std::endl
+              << "     --max-length <n>  : Longest message compared with the"
+              << " scalar code (Default: 1024)" << std::endl;
+}
+
+static bool parseOptions(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (arg == "--count" && hasValue)
+            options.count = atoi(argv[++i]);
+        else if (arg == "--length" && hasValue)
+            options.length = atoi(argv[++i]);
+        else if (arg == "--max-length" && hasValue)
+            options.maxLength = atoi(argv[++i]);
+        else
+            return false;
+    }
+    return options.count > 0 && options.length >= 0 && options.maxLength >= 0;
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    utils::processor::init();
+    const bool hasShaExtensions = utils::processor::hasShaExtensions;
+    const bool hasAvx2 = utils::processor::hasAvx2;
+
+    std::cout << "SHA extensions: " << (hasShaExtensions ? "yes" : "no")
+              << ", AVX2: " << (hasAvx2 ? "yes" : "no") << std::endl;
+
+    const Implementation implementations[] = {
+        { "scalar", false, false, false, "scalar" },
+        { "SHA extensions", true, false, false, "SHA extensions" },
+        { "AVX2 batch", false, true, true, "scalar, AVX2 for batches" },
+    };
+
+    const std::vector<KnownAnswer> answers = knownAnswers();
+
+    // Messages of every length, mixed so that batches have uneven lanes
+    std::vector<std::string> messages;
+    for (int length = 0; length <= options.maxLength; ++length)
+        messages.push_back(testMessage(length, length));
+    for (int length = options.maxLength; length >= 0; length -= 3)
+        messages.push_back(testMessage(length, ~length));
+
+    selectImplementation(implementations[0], hasShaExtensions, hasAvx2);
+    const std::vector<std::string> reference =
+            hash(implementations[0], messages);
+
+    bool ok = true;
+    for (const Implementation &implementation : implementations)
+    {
+        if ((implementation.shaExtensions && !hasShaExtensions) ||
+            (implementation.avx2 && !hasAvx2))
+        {
+            std::cout << implementation.name
+                      << ": not supported by the processor" << std::endl;
+            continue;
+        }
+
+        selectImplementation(implementation, hasShaExtensions, hasAvx2);
+
+        const std::string used = sha256Implementation();
+        if (used != implementation.expected)
+        {
+            std::cout << implementation.name << ": FAILED, the self-check "
+                      << "rejected it and " << used << " is used" << std::endl;
+            ok = false;
+            continue;
+        }
+
+        if (!check(implementation, answers, messages, reference))
+        {
+            std::cout << implementation.name << ": FAILED" << std::endl;
+            ok = false;
+            continue;
+        }
+
+        std::cout << implementation.name << ": "
+                  << benchmark(implementation, options) / 1e6
+                  << "M hashes/s" << std::endl;
+    }
+
+    std::cout << (ok ? "Passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,274 @@
+/*
+ *  The Mana Server
+ *  Copyright (C) 2013  The Mana Developers
+ *
+ *  This file is part of The Mana Server.
+ *
+ *  The Mana Server is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  any later version.
+ *
+ *  The Mana Server is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with The Mana Server.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A benchmark for the slang filter in utils/stringfilter.cpp, which matches
+ * all the slangs in a single pass. It is compared with a naive filter that
+ * searches the message for each slang in turn, like the filter did before:
+ *
+ *     manaserv-slangbench --slangs 10000 --messages 20000
+ *
+ * The slangs are random words, loaded through a slangs file like with the
+ * chat_slangsFile option, along with two in mixed case, one of them with a
+ * space. The messages are random text of 10 to 90 characters in mixed case,
+ * and a slang is inserted into a quarter of them.
+ *
+ * The test fails when the checks or the masked messages differ from those
+ * of the naive filter.
+ */
+
+#include "common/configuration.h"
+#include "utils/logger.h"
+#include "utils/stringfilter.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+// The filter reads its slangs from the configuration
+static std::map<std::string, std::string> configuration;
+
+std::string Configuration::getValue(const std::string &key,
+                                    const std::string &deflt)
+{
+    std::map<std::string, std::string>::const_iterator i =
+            configuration.find(key);
+    return i != configuration.end() ? i->second : deflt;
+}
+
+int Configuration::getValue(const std::string &, int deflt)
+{ return deflt; }
+
+bool Configuration::getBoolValue(const std::string &, bool deflt)
+{ return deflt; }
+
+namespace utils {
+Logger::Level Logger::mVerbosity = Logger::Fatal;
+void Logger::output(const std::string &, Level) {}
+}
+
+struct Options
+{
+    int slangs = 10000;
+    int messages = 20000;
+};
+
+static unsigned randomSeed = 1;
+
+static unsigned randomNumber(unsigned range)
+{
+    randomSeed = randomSeed * 1103515245 + 12345;
+    return (randomSeed >> 16) % range;
+}
+
+static std::string randomWord(int minLength, int maxLength)
+{
+    const int length = minLength + randomNumber(maxLength - minLength + 1);
+    std::string word(length, ' ');
+    for (char &c : word)
+        c = 'a' + randomNumber(26);
+    return word;
+}
+
+/**
+ * The filter as it was, uppercasing the message and searching it for every
+ * slang. Returns whether the message is clean and masks the slangs found.
+ */
+static bool naiveMask(std::string &text,
+                      const std::vector<std::string> &upperSlangs)
+{
+    std::string upperText = text;
+    std::transform(upperText.begin(), upperText.end(), upperText.begin(),
+                   (int(*)(int)) std::toupper);
+
+    bool isContentClean = true;
+    for (const std::string &slang : upperSlangs)
+    {
+        for (size_t pos = upperText.find(slang); pos != std::string::npos;
+             pos = upperText.find(slang, pos + 1))
+        {
+            std::fill(text.begin() + pos, text.begin() + pos + slang.length(),
+                      '*');
+            isContentClean = false;
+        }
+    }
+    return isContentClean;
+}
+
+static double elapsedSince(std::chrono::steady_clock::time_point start)
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now() - start).count();
+}
+
+static void printUsage()
+{
+    std::cout << "manaserv-slangbench" << std::endl << std::endl
+              << "Options: " << std::endl
+              << "     --slangs <n>      : Number of random slangs"
+              << " (Default: 10000)" << std::endl
+              << "     --messages <n>    : Number of messages"
+              << " (Default: 20000)" << std::endl;
+}
+
+static bool parseOptions(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (arg == "--slangs" && hasValue)
+            options.slangs = atoi(argv[++i]);
+        else if (arg == "--messages" && hasValue)
+            options.messages = atoi(argv[++i]);
+        else
+            return false;
+    }
+    return options.slangs > 0 && options.messages > 0;
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    std::vector<std::string> slangs;
+    slangs.push_back("Bad");
+    slangs.push_back("Evil Word");
+    for (int i = 0; i < options.slangs; ++i)
+        slangs.push_back(randomWord(4, 10));
+
+    char slangsFile[] = "/tmp/manaserv-slangbench-XXXXXX";
+    const int fd = mkstemp(slangsFile);
+    if (fd < 0)
+    {
+        std::cerr << "Could not create the slangs file." << std::endl;
+        return 1;
+    }
+    close(fd);
+    {
+        std::ofstream file(slangsFile);
+        for (const std::string &slang : slangs)
+            file << slang << std::endl;
+    }
+    configuration["chat_slangsFile"] = slangsFile;
+
+    std::vector<std::string> messages;
+    for (int i = 0; i < options.messages; ++i)
+    {
+        std::string message;
+        const size_t length = 10 + randomNumber(81);
+        while (message.length() < length)
+        {
+            if (!message.empty())
+                message += ' ';
+            message += randomWord(1, 8);
+        }
+        if (randomNumber(4) == 0)
+        {
+            message.insert(randomNumber(message.length()),
+                           slangs[randomNumber(slangs.size())]);
+        }
+        for (char &c : message)
+            if (randomNumber(3) == 0)
+                c = std::toupper(c);
+        messages.push_back(message);
+    }
+
+    std::vector<std::string> upperSlangs = slangs;
+    for (std::string &slang : upperSlangs)
+        std::transform(slang.begin(), slang.end(), slang.begin(),
+                       (int(*)(int)) std::toupper);
+
+    auto start = std::chrono::steady_clock::now();
+    utils::StringFilter filter;
+    const double loadTime = elapsedSince(start);
+    unlink(slangsFile);
+
+    std::vector<bool> naiveClean(messages.size());
+    std::vector<std::string> naiveMasked = messages;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < messages.size(); ++i)
+        naiveClean[i] = naiveMask(naiveMasked[i], upperSlangs);
+    const double naiveTime = elapsedSince(start);
+
+    std::vector<bool> clean(messages.size());
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < messages.size(); ++i)
+        clean[i] = filter.filterContent(messages[i]);
+    const double checkTime = elapsedSince(start);
+
+    std::vector<std::string> masked = messages;
+    std::vector<bool> maskedClean(messages.size());
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < messages.size(); ++i)
+        maskedClean[i] = filter.maskContent(masked[i]);
+    const double maskTime = elapsedSince(start);
+
+    int mismatches = 0;
+    int unclean = 0;
+    for (size_t i = 0; i < messages.size(); ++i)
+    {
+        if (!naiveClean[i])
+            ++unclean;
+
+        if (clean[i] != naiveClean[i] || maskedClean[i] != naiveClean[i] ||
+            masked[i] != naiveMasked[i])
+        {
+            if (mismatches++ < 10)
+            {
+                std::cout << "  Differs from the naive filter: \""
+                          << messages[i] << "\" masked as \"" << masked[i]
+                          << "\" instead of \"" << naiveMasked[i] << "\""
+                          << std::endl;
+            }
+        }
+    }
+
+    const double perMessage = 1e6 / messages.size();
+    std::cout << slangs.size() << " slangs loaded in " << loadTime * 1000
+              << " ms" << std::endl
+              << messages.size() << " messages, " << unclean
+              << " with slangs" << std::endl
+              << "Per-slang find:  " << naiveTime * perMessage
+              << " us per message" << std::endl
+              << "Automaton check: " << checkTime * perMessage
+              << " us per message" << std::endl
+              << "Automaton mask:  " << maskTime * perMessage
+              << " us per message" << std::endl;
+
+    const bool ok = mismatches == 0;
+    std::cout << (ok ? "Passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}